@@ -0,0 +1,197 @@
+// Include PluggableUSBHID.h explicitly to make sure we are using the Arduino-version of USBHID.
+#include <PluggableUSBHID.h>
+#include <USBJoystick.h>
+
+#include <mbed.h> // Include this for the DWT cycle counter.
+#include <rtos.h> // Include this for ThisThread::sleep_for
+
+/*
+  Measures the time spent in the joystick hot path on the board itself.
+
+  Upload, connect the board to a USB host (the joystick must be enumerated for the 'update' tests),
+  open the serial monitor at 57600 and compare the printed table before and after a change.
+  Times are in nanoseconds per call, measured with the cycle counter of the Cortex-M4 and with the
+  loop overhead subtracted. The numbers depend on the core clock and the compiler settings, so only
+  compare runs made on the same board and build.
+*/
+
+static const uint32_t ITERATIONS = 10000;
+static const uint32_t SEND_TEST_MS = 2000;   // Duration of the 'update' throughput test.
+
+USBJoystick joystick;
+JoystickForceFeedback forceFeedback(joystick);
+
+static constexpr JoystickCurve expoCurve = JoystickCurve::expo(0.5f);
+
+typedef void (*BenchmarkFunction)(uint32_t i);
+
+// Cycles of one empty iteration of 'measure', subtracted from the results.
+static uint32_t loopOverhead = 0;
+
+uint32_t measure(BenchmarkFunction function) {
+  uint32_t start = DWT->CYCCNT;
+  for (uint32_t i=0; i < ITERATIONS; i++) {
+    function(i);
+  }
+  uint32_t cycles = (DWT->CYCCNT - start) / ITERATIONS;
+  return (cycles > loopOverhead) ? cycles - loopOverhead : 0;
+}
+
+void report(const char *name, BenchmarkFunction function) {
+  uint32_t cycles = measure(function);
+  uint32_t nanoseconds = static_cast<uint64_t>(cycles) * 1000000000ULL / SystemCoreClock;
+
+  Serial.print(name);
+  for (size_t i = strlen(name); i < 28; i++) Serial.print(' ');
+  Serial.print(nanoseconds);
+  Serial.print(" ns/op  ");
+  Serial.print(cycles);
+  Serial.println(" cycles");
+}
+
+// The input changes on every call, otherwise the setters would only compare and return.
+static float floatValue(uint32_t i) { return static_cast<float>(static_cast<int32_t>(i % 1023) - 511); }
+static int32_t rawValue(uint32_t i) { return static_cast<int32_t>(i % 1023) - 511; }
+
+void benchmarkEmpty(uint32_t i) { }
+
+void benchmarkSetXAxis(uint32_t i) { joystick.setXAxis( floatValue(i) ); }
+void benchmarkSetYAxis(uint32_t i) { joystick.setYAxis( floatValue(i) ); }
+void benchmarkSetZAxis(uint32_t i) { joystick.setZAxis( floatValue(i) ); }
+void benchmarkSetRxAxis(uint32_t i) { joystick.setRxAxis( floatValue(i) ); }
+void benchmarkSetRyAxis(uint32_t i) { joystick.setRyAxis( floatValue(i) ); }
+void benchmarkSetRzAxis(uint32_t i) { joystick.setRzAxis( floatValue(i) ); }
+void benchmarkSetThrottleAxis(uint32_t i) { joystick.setThrottleAxis( floatValue(i) ); }
+void benchmarkSetRudderAxis(uint32_t i) { joystick.setRudderAxis( floatValue(i) ); }
+void benchmarkSetAxisRaw(uint32_t i) { joystick.setAxisRaw( X_AXIS, rawValue(i) ); }
+
+// The float 'map' the axis setters used before the scale was precomputed, for comparison with 'setAxisRaw'.
+static volatile int16_t mapSink = 0;
+void benchmarkMapfi(uint32_t i) { mapSink = JoystickCore::mapfi( floatValue(i), -511.0f, 511.0f, -2047, 2047 ); }
+
+void benchmarkSetAxes(uint32_t i) {
+  int16_t values[ AXIS_COUNT ];
+  for (uint8_t n=0; n < AXIS_COUNT; n++) values[n] = rawValue(i + n);
+  joystick.setAxes(values);
+}
+
+void benchmarkPressButton(uint32_t i) { joystick.pressButton( i % 64 ); }
+void benchmarkReleaseButton(uint32_t i) { joystick.releaseButton( i % 64 ); }
+void benchmarkToggleButton(uint32_t i) { joystick.toggleButton( i % 64 ); }
+void benchmarkSetButtons(uint32_t i) { joystick.setButtons( static_cast<uint64_t>(i) * 0x9E3779B97F4A7C15ULL ); }
+
+void benchmarkUpdateHIDreport(uint32_t i) { joystick.updateHIDreport(); }
+void benchmarkUpdateUnchanged(uint32_t i) { joystick.update(); }   // Nothing dirty, measures the skip path.
+
+void benchmarkForceTick(uint32_t i) { forceFeedback.tick(i); }
+
+// The same expo curve from the lookup table and computed directly. The results go to a volatile
+// so the compiler keeps the work.
+static volatile int32_t curveSink = 0;
+void benchmarkCurveTable(uint32_t i) { curveSink = expoCurve.evaluate(i & 0x7FFF); }
+void benchmarkCurveFloat(uint32_t i) {
+  float x = static_cast<float>(i & 0x7FFF) / 16384.0f - 1.0f;
+  curveSink = static_cast<int32_t>((0.5f * x + 0.5f * powf(x, 3.0f) + 1.0f) * 16384.0f);
+}
+void benchmarkSetAxisRawCurve(uint32_t i) { joystick.setAxisRaw( Y_AXIS, rawValue(i) ); }
+
+// Fill the effect pool with playing effects of every type, the worst case for 'tick'.
+void loadEffects(void) {
+  uint8_t control[] = { JoystickForceFeedback::REPORT_DEVICE_CONTROL, 4 };   // Reset.
+  forceFeedback.receiveReport(control, sizeof(control));
+
+  for (uint8_t n=0; n < JoystickForceFeedback::MAX_EFFECTS; n++) {
+    uint8_t type = 1 + n % (JoystickForceFeedback::EFFECT_TYPE_COUNT - 1);
+    uint8_t block = n + 1;
+    uint8_t create[] = { JoystickForceFeedback::REPORT_CREATE_EFFECT, type, 0, 0 };
+    uint8_t effect[] = { JoystickForceFeedback::REPORT_SET_EFFECT, block, type, 0xFF, 0xFF, 200, 0x07, static_cast<uint8_t>(n * 16) };
+    uint8_t periodic[] = { JoystickForceFeedback::REPORT_SET_PERIODIC, block, 0x10, 0x27, 0, 0, 0, 50, 0 };
+    uint8_t condition[] = { JoystickForceFeedback::REPORT_SET_CONDITION, block, 0, 0, 0, 0x10, 0x27, 0x10, 0x27, 0, 0 };
+    uint8_t start[] = { JoystickForceFeedback::REPORT_EFFECT_OPERATION, block, 1, 0xFF };
+    forceFeedback.receiveReport(create, sizeof(create));
+    forceFeedback.receiveReport(effect, sizeof(effect));
+    forceFeedback.receiveReport(periodic, sizeof(periodic));
+    forceFeedback.receiveReport(condition, sizeof(condition));
+    forceFeedback.receiveReport(start, sizeof(start));
+  }
+}
+
+
+void setup(void) {
+  Serial.begin(57600);
+  while (!Serial) { }
+
+  joystick.autoSend = false;   // The setters must not send, 'update' is measured separately.
+
+  // Enable the cycle counter.
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void loop(void) {
+  loopOverhead = 0;
+  loopOverhead = measure(benchmarkEmpty);
+
+  Serial.println();
+  Serial.print("Core clock ");
+  Serial.print(SystemCoreClock / 1000000);
+  Serial.print(" MHz, ");
+  Serial.print(ITERATIONS);
+  Serial.println(" iterations per test.");
+
+  report("setXAxis", benchmarkSetXAxis);
+  report("setYAxis", benchmarkSetYAxis);
+  report("setZAxis", benchmarkSetZAxis);
+  report("setRxAxis", benchmarkSetRxAxis);
+  report("setRyAxis", benchmarkSetRyAxis);
+  report("setRzAxis", benchmarkSetRzAxis);
+  report("setThrottleAxis", benchmarkSetThrottleAxis);
+  report("setRudderAxis", benchmarkSetRudderAxis);
+  report("setAxisRaw", benchmarkSetAxisRaw);
+  report("mapfi (float map)", benchmarkMapfi);
+  report("setAxes", benchmarkSetAxes);
+
+  report("curve (table)", benchmarkCurveTable);
+  report("curve (float)", benchmarkCurveFloat);
+  joystick.setAxisCurve(Y_AXIS, &expoCurve);
+  report("setAxisRaw (curve)", benchmarkSetAxisRawCurve);
+  joystick.setAxisCurve(Y_AXIS, nullptr);
+
+  report("pressButton", benchmarkPressButton);
+  report("releaseButton", benchmarkReleaseButton);
+  report("toggleButton", benchmarkToggleButton);
+  report("setButtons", benchmarkSetButtons);
+
+  report("updateHIDreport", benchmarkUpdateHIDreport);
+
+  joystick.update();   // Clear the dirty state left by the setters.
+  report("update (unchanged)", benchmarkUpdateUnchanged);
+
+  loadEffects();
+  report("force feedback tick (full)", benchmarkForceTick);
+
+  // Throughput of 'update' with a change every time, limited by the USB polling interval.
+  if (joystick.ready()) {
+    uint32_t sentBefore = joystick.reportsSent();
+    uint32_t start = millis();
+    uint32_t i = 0;
+    while (millis() - start < SEND_TEST_MS) {
+      joystick.setXAxis( floatValue(i++) );
+      joystick.update();
+    }
+    uint32_t reports = joystick.reportsSent() - sentBefore;
+    uint32_t bytesPerSecond = static_cast<uint64_t>(reports) * joystick.layout().reportLength * 1000 / SEND_TEST_MS;
+
+    Serial.print("update (changed)            ");
+    Serial.print(reports * 1000 / SEND_TEST_MS);
+    Serial.print(" reports/s  ");
+    Serial.print(bytesPerSecond);
+    Serial.println(" bytes/s");
+  }
+  else {
+    Serial.println("update (changed)            skipped, joystick not enumerated by the host");
+  }
+
+  rtos::ThisThread::sleep_for(5000);
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "HostPlatform.h"
+#include "USBJoystick.h"
+#include "USBJoystickEncoder.h"
+
+using namespace arduino;
+
+/*
+  Host version of 'examples/USBJoystickBenchmark': the same hot path measured on the build machine,
+  with the reports going to the stub 'USBHID' instead of a USB host.
+
+    USBJoystickHostBenchmark [iterations]
+
+  Times are nanoseconds per call, best of five runs, with the loop overhead subtracted. 'update (changed)' sends a
+  report on every call, its reports/s and bytes/s are the cost of building and handing over a
+  report with no bus in the way. Compare only runs of the same build on the same machine, see
+  README.md for the baseline.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+static uint32_t iterations = 1000000;
+
+static USBJoystick joystick;
+static JoystickForceFeedback forceFeedback(joystick);
+static JoystickEncoders encoders(joystick);
+
+static constexpr JoystickCurve expoCurve = JoystickCurve::expo(0.5f);
+
+typedef void (*BenchmarkFunction)(uint32_t i);
+
+static double loopOverhead = 0.0;   // Nanoseconds of one empty iteration.
+
+// Best of 'ROUNDS' runs, the other processes of the machine only ever make a run slower.
+static const uint8_t ROUNDS = 5;
+
+static double measure(BenchmarkFunction function, uint32_t count)
+{
+  double best = 0.0;
+  for (uint8_t round=0; round < ROUNDS; round++) {
+    Clock::time_point start = Clock::now();
+    for (uint32_t i=0; i < count; i++) {
+      function(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    if (round == 0 || elapsed.count() < best) best = elapsed.count();
+  }
+  double nanoseconds = best / count - loopOverhead;
+  return (nanoseconds > 0.0) ? nanoseconds : 0.0;
+}
+
+static void report(const char *name, BenchmarkFunction function)
+{
+  printf("%-28s %8.1f ns/op\n", name, measure(function, iterations));
+}
+
+// The input changes on every call, otherwise the setters would only compare and return.
+static float floatValue(uint32_t i) { return static_cast<float>(static_cast<int32_t>(i % 1023) - 511); }
+static int32_t rawValue(uint32_t i) { return static_cast<int32_t>(i % 1023) - 511; }
+
+static void benchmarkEmpty(uint32_t i) { __asm__ volatile("" : : "r"(i)); }
+
+static void benchmarkSetXAxis(uint32_t i) { joystick.setXAxis( floatValue(i) ); }
+static void benchmarkSetYAxis(uint32_t i) { joystick.setYAxis( floatValue(i) ); }
+static void benchmarkSetZAxis(uint32_t i) { joystick.setZAxis( floatValue(i) ); }
+static void benchmarkSetRxAxis(uint32_t i) { joystick.setRxAxis( floatValue(i) ); }
+static void benchmarkSetRyAxis(uint32_t i) { joystick.setRyAxis( floatValue(i) ); }
+static void benchmarkSetRzAxis(uint32_t i) { joystick.setRzAxis( floatValue(i) ); }
+static void benchmarkSetThrottleAxis(uint32_t i) { joystick.setThrottleAxis( floatValue(i) ); }
+static void benchmarkSetRudderAxis(uint32_t i) { joystick.setRudderAxis( floatValue(i) ); }
+static void benchmarkSetAxisRaw(uint32_t i) { joystick.setAxisRaw( X_AXIS, rawValue(i) ); }
+
+// The float 'map' the axis setters used before the scale was precomputed, for comparison with 'setAxisRaw'.
+static volatile int16_t mapSink = 0;
+static void benchmarkMapfi(uint32_t i) { mapSink = JoystickCore::mapfi( floatValue(i), -511.0f, 511.0f, -2047, 2047 ); }
+
+static void benchmarkSetAxes(uint32_t i) {
+  int16_t values[ AXIS_COUNT ];
+  for (uint8_t n=0; n < AXIS_COUNT; n++) values[n] = rawValue(i + n);
+  joystick.setAxes(values);
+}
+
+static void benchmarkPressButton(uint32_t i) { joystick.pressButton( i % 64 ); }
+static void benchmarkReleaseButton(uint32_t i) { joystick.releaseButton( i % 64 ); }
+static void benchmarkToggleButton(uint32_t i) { joystick.toggleButton( i % 64 ); }
+static void benchmarkSetButtons(uint32_t i) { joystick.setButtons( static_cast<uint64_t>(i) * 0x9E3779B97F4A7C15ULL ); }
+
+static void benchmarkUpdateHIDreport(uint32_t) { joystick.updateHIDreport(); }
+static void benchmarkUpdateUnchanged(uint32_t) { joystick.update(); }   // Nothing dirty, measures the skip path.
+static void benchmarkUpdateChanged(uint32_t i) {
+  joystick.setXAxis( floatValue(i) );
+  joystick.update();
+}
+
+static void benchmarkForceTick(uint32_t i) { forceFeedback.tick(i); }
+
+// One quadrature edge per call, counting up, as the pin interrupt would see a fast turn.
+static const bool waveA[4] = { false, false, true, true };
+static const bool waveB[4] = { false, true, true, false };
+static void benchmarkEncoderEdge(uint32_t i) { encoders.edge(0, waveA[i & 0x03], waveB[i & 0x03]); }
+
+static volatile int32_t curveSink = 0;
+static void benchmarkCurveTable(uint32_t i) { curveSink = expoCurve.evaluate(i & 0x7FFF); }
+static void benchmarkCurveFloat(uint32_t i) {
+  float x = static_cast<float>(i & 0x7FFF) / 16384.0f - 1.0f;
+  curveSink = static_cast<int32_t>((0.5f * x + 0.5f * powf(x, 3.0f) + 1.0f) * 16384.0f);
+}
+static void benchmarkSetAxisRawCurve(uint32_t i) { joystick.setAxisRaw( Y_AXIS, rawValue(i) ); }
+
+// Fill the effect pool with playing effects of every type, the worst case for 'tick'.
+static void loadEffects(void) {
+  uint8_t control[] = { JoystickForceFeedback::REPORT_DEVICE_CONTROL, 4 };   // Reset.
+  forceFeedback.receiveReport(control, sizeof(control));
+
+  for (uint8_t n=0; n < JoystickForceFeedback::MAX_EFFECTS; n++) {
+    uint8_t type = 1 + n % (JoystickForceFeedback::EFFECT_TYPE_COUNT - 1);
+    uint8_t block = n + 1;
+    uint8_t create[] = { JoystickForceFeedback::REPORT_CREATE_EFFECT, type, 0, 0 };
+    uint8_t effect[] = { JoystickForceFeedback::REPORT_SET_EFFECT, block, type, 0xFF, 0xFF, 200, 0x07, static_cast<uint8_t>(n * 16) };
+    uint8_t periodic[] = { JoystickForceFeedback::REPORT_SET_PERIODIC, block, 0x10, 0x27, 0, 0, 0, 50, 0 };
+    uint8_t condition[] = { JoystickForceFeedback::REPORT_SET_CONDITION, block, 0, 0, 0, 0x10, 0x27, 0x10, 0x27, 0, 0 };
+    uint8_t start[] = { JoystickForceFeedback::REPORT_EFFECT_OPERATION, block, 1, 0xFF };
+    forceFeedback.receiveReport(create, sizeof(create));
+    forceFeedback.receiveReport(effect, sizeof(effect));
+    forceFeedback.receiveReport(periodic, sizeof(periodic));
+    forceFeedback.receiveReport(condition, sizeof(condition));
+    forceFeedback.receiveReport(start, sizeof(start));
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  if (argc > 1) iterations = strtoul(argv[1], nullptr, 0);
+  if (iterations == 0) iterations = 1;
+
+  host::reset();
+  host::recordReports(false);   // Count the reports only, recording would measure the allocator.
+  joystick.autoSend = false;    // The setters must not send, 'update' is measured separately.
+
+  measure(benchmarkEmpty, iterations);   // Warm up.
+  loopOverhead = 0.0;
+  loopOverhead = measure(benchmarkEmpty, iterations);
+  printf("%u iterations per test, loop overhead %.2f ns subtracted.\n", iterations, loopOverhead);
+
+  report("setXAxis", benchmarkSetXAxis);
+  report("setYAxis", benchmarkSetYAxis);
+  report("setZAxis", benchmarkSetZAxis);
+  report("setRxAxis", benchmarkSetRxAxis);
+  report("setRyAxis", benchmarkSetRyAxis);
+  report("setRzAxis", benchmarkSetRzAxis);
+  report("setThrottleAxis", benchmarkSetThrottleAxis);
+  report("setRudderAxis", benchmarkSetRudderAxis);
+  report("setAxisRaw", benchmarkSetAxisRaw);
+  report("mapfi (float map)", benchmarkMapfi);
+  report("setAxes", benchmarkSetAxes);
+
+  report("curve (table)", benchmarkCurveTable);
+  report("curve (float)", benchmarkCurveFloat);
+  joystick.setAxisCurve(Y_AXIS, &expoCurve);
+  report("setAxisRaw (curve)", benchmarkSetAxisRawCurve);
+  joystick.setAxisCurve(Y_AXIS, nullptr);
+
+  report("pressButton", benchmarkPressButton);
+  report("releaseButton", benchmarkReleaseButton);
+  report("toggleButton", benchmarkToggleButton);
+  report("setButtons", benchmarkSetButtons);
+
+  report("updateHIDreport", benchmarkUpdateHIDreport);
+
+  joystick.update();   // Clear the dirty state left by the setters.
+  report("update (unchanged)", benchmarkUpdateUnchanged);
+
+  host::clearSentReports();
+  double changed = measure(benchmarkUpdateChanged, iterations);
+  double seconds = changed * iterations * ROUNDS / 1e9;   // The counters cover all the rounds.
+  printf("%-28s %8.1f ns/op  %.0f reports/s  %.0f bytes/s\n", "update (changed)", changed,
+         host::sentCount() / seconds, host::sentBytes() / seconds);
+
+  loadEffects();
+  report("force feedback tick (full)", benchmarkForceTick);
+
+  encoders.addButtons(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, 0, 1);
+  double edge = measure(benchmarkEncoderEdge, iterations);
+  printf("%-28s %8.1f ns/op  %.0f edges/s\n", "encoder edge", edge, (edge > 0.0) ? 1e9 / edge : 0.0);
+  return 0;
+}
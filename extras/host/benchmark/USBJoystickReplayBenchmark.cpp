@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "HostPlatform.h"
+#include "USBJoystick.h"
+#include "USBJoystickPlayer.h"
+#include "USBJoystickRecord.h"
+
+using namespace arduino;
+
+/*
+  Replays a recording made with 'JoystickRecorder' through a joystick on the stub 'USBHID', as fast as
+  the player goes: the decoding, the setters and the report building of a real session.
+
+    USBJoystickReplayBenchmark [recording]
+    USBJoystickReplayBenchmark --write recording [frames]
+
+  A recording is the 'data' of a recorder saved as is, from a board or from '--write', which records
+  'frames' reports of a synthetic session (a stick moving on two axes, buttons pressed now and then)
+  from the host joystick. Without a file the synthetic session is recorded in memory and replayed.
+  The time is the best of five replays, per frame; compare only runs on the same machine.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+static const uint8_t ROUNDS = 5;
+static const uint32_t SYNTHETIC_FRAMES = 100000;
+
+
+// Record 'frames' reports of a synthetic session, one every millisecond.
+static std::vector<uint8_t> recordSynthetic(uint32_t frames)
+{
+  std::vector<uint8_t> buffer( JoystickRecord::HEADER_LENGTH + frames * JoystickRecord::FRAME_MAX_LENGTH );
+  JoystickRecorder recorder(buffer.data(), buffer.size());
+  USBJoystick joystick;
+  joystick.autoSend = false;
+  joystick.keepAliveInterval = 0;
+  joystick.setRecorder(&recorder);
+
+  for (uint32_t i=0; i < frames; i++) {
+    host::setTime(i);
+    joystick.setAxisRaw(X_AXIS, static_cast<int32_t>(i % 1023) - 511);
+    joystick.setAxisRaw(Y_AXIS, static_cast<int32_t>((i * 7) % 1023) - 511);
+    if (i % 50 == 0) joystick.toggleButton( (i / 50) % 64 );
+    joystick.update();
+  }
+  joystick.setRecorder(nullptr);
+  buffer.resize(recorder.length());
+  return buffer;
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) return false;
+  uint8_t chunk[4096];
+  size_t got;
+  while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) data.insert(data.end(), chunk, chunk + got);
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+static bool writeFile(const char *path, const std::vector<uint8_t> &data)
+{
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr) return false;
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return (fclose(file) == 0) && ok;
+}
+
+
+int main(int argc, char **argv)
+{
+  host::reset();
+  host::recordReports(false);   // Count the reports only, recording would measure the allocator.
+
+  std::vector<uint8_t> recording;
+  if (argc > 2 && strcmp(argv[1], "--write") == 0) {
+    uint32_t frames = (argc > 3) ? strtoul(argv[3], nullptr, 0) : SYNTHETIC_FRAMES;
+    recording = recordSynthetic( (frames > 0) ? frames : 1 );
+    if (!writeFile(argv[2], recording)) {
+      perror(argv[2]);
+      return 1;
+    }
+    printf("%u frames, %zu bytes written to %s\n", frames, recording.size(), argv[2]);
+    return 0;
+  }
+  if (argc > 1) {
+    if (!readFile(argv[1], recording)) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+  else {
+    recording = recordSynthetic(SYNTHETIC_FRAMES);
+  }
+
+  JoystickRecordReader reader(recording.data(), recording.size());
+  if (!reader.valid()) {
+    fprintf(stderr, "not a recording of this format version\n");
+    return 1;
+  }
+  JoystickRecord::Frame frame;
+  reader.rewind(frame);
+  uint32_t frames = 0;
+  while (reader.next(frame)) frames++;
+  printf("%u frames, %zu bytes, %.3f s recorded\n", frames, recording.size(), frame.time / 1e6);
+
+  // A joystick with the button count of the recording.
+  USBJoystick joystick;
+  if (reader.buttonBytes() != joystick.layout().buttons / 8) {
+    fprintf(stderr, "recording has %u button bytes, the joystick %u\n", reader.buttonBytes(), joystick.layout().buttons / 8);
+    return 1;
+  }
+  joystick.keepAliveInterval = 0;
+
+  double best = 0.0;
+  uint32_t played = 0;
+  size_t reports = 0;
+  for (uint8_t round=0; round < ROUNDS; round++) {
+    JoystickPlayer player(joystick, recording.data(), recording.size());
+    player.speed = 0;   // One frame per 'poll'.
+    size_t before = host::sentCount();
+
+    Clock::time_point start = Clock::now();
+    player.start(0);
+    while (player.poll(0)) { }
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+    if (round == 0 || elapsed.count() < best) best = elapsed.count();
+    played = player.framesPlayed();
+    reports = host::sentCount() - before;
+  }
+
+  printf("%-28s %8.1f ns/frame  %.0f frames/s  %zu reports per replay\n", "replay", best / played,
+         played * 1e9 / best, reports);
+  return (played == frames) ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "HostPlatform.h"
+#include "USBJoystickTransport.h"
+
+using namespace arduino;
+
+/*
+  End to end through a 'JoystickPipeTransport': the default joystick sending over a pipe to a reader
+  thread that takes the frames apart, like a program on the other end of the link would.
+
+    USBJoystickTransportBenchmark [reports]
+
+  'throughput' sends 'reports' changed reports as fast as the reader takes them. 'latency' sends one
+  report at a time and measures from before the setter to the reader having the whole frame; the
+  median, 99th percentile and worst case of 'LATENCY_SAMPLES' round trips. Both depend on the scheduler
+  of the machine more than on the library, compare only runs on the same machine.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+static const uint32_t LATENCY_SAMPLES = 10000;
+
+static uint32_t reports = 1000000;
+
+static int pipeFds[2];
+static std::atomic<uint32_t> framesRead(0);
+static std::atomic<int64_t> lastArrival(0);   // Nanoseconds of 'Clock' when the last frame was complete.
+
+static bool readFully(int fd, uint8_t *buffer, size_t length)
+{
+  while (length > 0) {
+    ssize_t got = read(fd, buffer, length);
+    if (got <= 0) return false;
+    buffer += got;
+    length -= got;
+  }
+  return true;
+}
+
+// Reads frames until the pipe is closed.
+static void readerLoop(void)
+{
+  uint8_t frame[ 1 + 255 ];
+  while (readFully(pipeFds[0], frame, 1) && readFully(pipeFds[0], frame + 1, frame[0])) {
+    lastArrival.store(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count(),
+                      std::memory_order_relaxed);
+    framesRead.fetch_add(1, std::memory_order_release);
+  }
+}
+
+static float axisValue(uint32_t i) { return static_cast<float>(static_cast<int32_t>(i % 1023) - 511); }
+
+
+int main(int argc, char **argv)
+{
+  if (argc > 1) reports = strtoul(argv[1], nullptr, 0);
+  if (reports == 0) reports = 1;
+
+  host::reset();
+  if (pipe(pipeFds) != 0) {
+    perror("pipe");
+    return 1;
+  }
+
+  JoystickPipeTransport transport( pipeFds[1] );
+  JoystickDevice joystick( USBJoystickLayout<>::layout, transport );
+  joystick.autoSend = false;
+  joystick.sendBlocking = true;
+  if (!joystick.begin()) return 1;
+  std::thread reader(readerLoop);
+
+  // Throughput: the writer only waits when the pipe is full.
+  Clock::time_point start = Clock::now();
+  for (uint32_t i=0; i < reports; i++) {
+    joystick.setXAxis( axisValue(i) );
+    joystick.update();
+  }
+  while (framesRead.load(std::memory_order_acquire) < reports) std::this_thread::yield();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  double frameBytes = 1 + joystick.layout().reportLength;
+  printf("%-28s %8.1f ns/report  %.0f reports/s  %.0f bytes/s\n", "throughput", elapsed.count() * 1e9 / reports,
+         reports / elapsed.count(), reports * frameBytes / elapsed.count());
+
+  // Latency: one report in flight at a time.
+  std::vector<double> latency;
+  latency.reserve(LATENCY_SAMPLES);
+  for (uint32_t i=0; i < LATENCY_SAMPLES; i++) {
+    uint32_t before = framesRead.load(std::memory_order_acquire);
+    Clock::time_point sent = Clock::now();
+    joystick.setXAxis( axisValue(i + 1) );
+    joystick.update();
+    while (framesRead.load(std::memory_order_acquire) == before) std::this_thread::yield();
+    int64_t arrival = lastArrival.load(std::memory_order_relaxed);
+    latency.push_back((arrival - std::chrono::duration_cast<std::chrono::nanoseconds>(sent.time_since_epoch()).count()) / 1000.0);
+  }
+  std::sort(latency.begin(), latency.end());
+  printf("%-28s %8.1f us median  %.1f us p99  %.1f us max\n", "latency", latency[ LATENCY_SAMPLES / 2 ],
+         latency[ LATENCY_SAMPLES * 99 / 100 ], latency.back());
+
+  close(pipeFds[1]);
+  reader.join();
+  close(pipeFds[0]);
+  return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+  Host build shim: the part of the Arduino API the library uses. Time is virtual and only moves
+  when the test moves it, see 'HostPlatform.h'.
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define HIGH 0x1
+#define LOW 0x0
+
+typedef enum {
+  INPUT = 0x0,
+  OUTPUT = 0x1,
+  INPUT_PULLUP = 0x2,
+  INPUT_PULLDOWN = 0x3
+} PinMode;
+
+typedef int PinName;
+#define NC (-1)
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+
+template<class T, class L>
+auto min(const T &a, const L &b) -> decltype((b < a) ? b : a) { return (b < a) ? b : a; }
+
+template<class T, class L>
+auto max(const T &a, const L &b) -> decltype((b < a) ? b : a) { return (a < b) ? b : a; }
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+unsigned long millis(void);
+unsigned long micros(void);
+
+void pinMode(uint8_t pin, PinMode mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+PinName digitalPinToPinName(uint8_t pin);
+
+namespace arduino { }
+using namespace arduino;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+  Host build shim: 'mbed::DigitalIn' and 'mbed::DigitalInOut' on the simulated pins of the Arduino
+  shim, so the levels set with 'host::setPin' read back and the direction shows in 'host::pinModeOf'.
+  mbed calls the pull setting 'PinMode', that name is taken by the Arduino shim here.
+*/
+
+#ifndef HOST_DIGITALINOUT_H
+#define HOST_DIGITALINOUT_H
+
+#include "Arduino.h"
+
+typedef enum {
+  PIN_INPUT,
+  PIN_OUTPUT
+} PinDirection;
+
+typedef enum {
+  PullNone,
+  PullUp,
+  PullDown
+} PinPull;
+
+namespace mbed {
+
+class DigitalIn {
+public:
+  explicit DigitalIn(PinName pin, PinPull pull = PullNone) : _pin(pin) { this->mode(pull); }
+
+  int read(void) { return digitalRead(this->_pin); }
+  void mode(PinPull pull) { pinMode(this->_pin, (pull == PullUp) ? INPUT_PULLUP : (pull == PullDown) ? INPUT_PULLDOWN : INPUT); }
+
+private:
+  PinName _pin;
+} ;
+
+class DigitalInOut {
+public:
+  DigitalInOut(PinName pin, PinDirection direction, PinPull pull, int value) : _pin(pin), _pull(pull), _value(value) {
+    if (direction == PIN_OUTPUT) this->output();
+    else this->input();
+  }
+
+  void write(int value) {
+    this->_value = value;
+    if (this->_output) digitalWrite(this->_pin, value);
+  }
+  int read(void) { return this->_output ? this->_value : digitalRead(this->_pin); }
+
+  // The written level is latched while the pin is an input, like the output register of a port.
+  void output(void) {
+    this->_output = true;
+    pinMode(this->_pin, OUTPUT);
+    digitalWrite(this->_pin, this->_value);
+  }
+  void input(void) {
+    this->_output = false;
+    this->mode(this->_pull);
+  }
+  void mode(PinPull pull) {
+    this->_pull = pull;
+    if (!this->_output) pinMode(this->_pin, (pull == PullUp) ? INPUT_PULLUP : (pull == PullDown) ? INPUT_PULLDOWN : INPUT);
+  }
+
+private:
+  PinName _pin;
+  PinPull _pull;
+  int _value;
+  bool _output = false;
+} ;
+
+} // End of 'namespace mbed'.
+
+#endif // HOST_DIGITALINOUT_H
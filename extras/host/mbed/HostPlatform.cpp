@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "HostPlatform.h"
+#include "Arduino.h"
+#include "PluggableUSBHID.h"
+#include "mbed_atomic.h"
+#include "mbed_critical.h"
+#include "usb_phy_api.h"
+
+using namespace arduino;
+
+
+static const uint8_t PIN_COUNT = 64;
+
+static std::atomic<unsigned long> currentMillis(0);
+static std::atomic<unsigned long> currentMicros(0);
+
+static std::mutex reportMutex;   // The sends may come from the pump thread.
+static std::vector<host::Report> reports;
+static std::deque<host::Report> outputReports;
+static size_t reportCount = 0;
+static uint64_t reportBytes = 0;
+static bool recording = true;
+static std::atomic<bool> sendsFail(false);
+
+static host::ControlAnswer controlAnswer = { -1, { }, false, false };
+
+static int pinLevel[ PIN_COUNT ];
+static int pinWritten[ PIN_COUNT ];
+static int pinModes[ PIN_COUNT ];
+static int analogValue[ PIN_COUNT ];
+
+bool hostPreemptAtomics = false;
+static std::atomic<uint32_t> preemptionRate(0);
+static std::atomic<uint32_t> interleaving(0);   // Threads with an 'interleaveAfter' pending.
+static thread_local uint32_t interleaveCountdown = 0;
+static thread_local std::function<void(void)> interleaved;
+static thread_local bool interleavedRan = false;
+
+static std::recursive_mutex criticalSection;
+static thread_local uint32_t criticalDepth = 0;
+static thread_local bool inInterrupt = false;
+
+
+void host::reset(void)
+{
+  host::setTime(0);
+  host::clearSentReports();
+  host::recordReports(true);
+  host::failSends(false);
+  host::preemptAtomics(0);
+  host::interleaveAfter(0, nullptr);
+  {
+    std::lock_guard<std::mutex> lock(reportMutex);
+    outputReports.clear();
+  }
+  controlAnswer = { -1, { }, false, false };
+
+  for (uint8_t i=0; i < PIN_COUNT; i++) {
+    pinLevel[i] = HIGH;
+    pinWritten[i] = -1;
+    pinModes[i] = -1;
+    analogValue[i] = 0;
+  }
+}
+
+void host::setTime(unsigned long milliseconds)
+{
+  currentMillis = milliseconds;
+  currentMicros = milliseconds * 1000;
+}
+
+void host::advance(unsigned long milliseconds)
+{
+  currentMillis += milliseconds;
+  currentMicros += milliseconds * 1000;
+}
+
+void host::advanceMicros(unsigned long microseconds)
+{
+  currentMicros += microseconds;
+  currentMillis = currentMicros / 1000;
+}
+
+
+std::vector<host::Report> host::sentReports(void)
+{
+  std::lock_guard<std::mutex> lock(reportMutex);
+  return reports;
+}
+
+size_t host::sentCount(void)
+{
+  std::lock_guard<std::mutex> lock(reportMutex);
+  return reportCount;
+}
+
+uint64_t host::sentBytes(void)
+{
+  std::lock_guard<std::mutex> lock(reportMutex);
+  return reportBytes;
+}
+
+void host::clearSentReports(void)
+{
+  std::lock_guard<std::mutex> lock(reportMutex);
+  reports.clear();
+  reportCount = 0;
+  reportBytes = 0;
+}
+
+void host::recordReports(bool record)
+{
+  std::lock_guard<std::mutex> lock(reportMutex);
+  recording = record;
+}
+
+void host::failSends(bool fail)
+{
+  sendsFail = fail;
+}
+
+void host::queueOutputReport(const uint8_t *report, uint8_t length)
+{
+  std::lock_guard<std::mutex> lock(reportMutex);
+  outputReports.emplace_back(report, report + length);
+}
+
+host::ControlAnswer host::lastControlAnswer(void)
+{
+  return controlAnswer;
+}
+
+
+void host::setPin(uint8_t pin, int level)
+{
+  if (pin < PIN_COUNT) pinLevel[pin] = level;
+}
+
+void host::setAnalog(uint8_t pin, int value)
+{
+  if (pin < PIN_COUNT) analogValue[pin] = value;
+}
+
+int host::writtenLevel(uint8_t pin)
+{
+  return (pin < PIN_COUNT) ? pinWritten[pin] : -1;
+}
+
+int host::pinModeOf(uint8_t pin)
+{
+  return (pin < PIN_COUNT) ? pinModes[pin] : -1;
+}
+
+
+static void updatePreemptionPoints(void)
+{
+  __atomic_store_n(&hostPreemptAtomics, preemptionRate != 0 || interleaving != 0, __ATOMIC_SEQ_CST);
+}
+
+void host::preemptAtomics(uint32_t oneIn)
+{
+  preemptionRate = oneIn;
+  updatePreemptionPoints();
+}
+
+bool host::interleaveAfter(uint32_t operations, std::function<void(void)> function)
+{
+  bool ran = interleavedRan;
+  if (interleaveCountdown != 0) interleaving--;
+  interleaveCountdown = (function != nullptr) ? operations : 0;
+  interleaved = (interleaveCountdown != 0) ? function : nullptr;
+  interleavedRan = false;
+  if (interleaveCountdown != 0) interleaving++;
+  updatePreemptionPoints();
+  return ran;
+}
+
+void hostPreemptionPoint(void)
+{
+  if (interleaveCountdown != 0 && --interleaveCountdown == 0) {
+    // Disarmed first, the atomics of 'function' count for nothing.
+    std::function<void(void)> function;
+    function.swap(interleaved);
+    interleaving--;
+    updatePreemptionPoints();
+    interleavedRan = true;
+    function();
+  }
+
+  // Per-thread xorshift, so the threads don't switch in step.
+  static thread_local uint32_t random = 0x9E3779B9 ^ static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  random ^= random << 13;
+  random ^= random >> 17;
+  random ^= random << 5;
+
+  uint32_t rate = preemptionRate;
+  if (rate != 0 && random % rate == 0) std::this_thread::yield();
+}
+
+
+host::InterruptContext::InterruptContext(void)
+{
+  core_util_critical_section_enter();
+  inInterrupt = true;
+}
+
+host::InterruptContext::~InterruptContext(void)
+{
+  inInterrupt = false;
+  core_util_critical_section_exit();
+}
+
+
+
+unsigned long millis(void) { return currentMillis; }
+unsigned long micros(void) { return currentMicros; }
+
+long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+void pinMode(uint8_t pin, PinMode mode)
+{
+  if (pin < PIN_COUNT) pinModes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin < PIN_COUNT) pinWritten[pin] = value;
+}
+
+int digitalRead(uint8_t pin)
+{
+  return (pin < PIN_COUNT) ? pinLevel[pin] : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+  return (pin < PIN_COUNT) ? analogValue[pin] : 0;
+}
+
+PinName digitalPinToPinName(uint8_t pin)
+{
+  return pin;
+}
+
+
+bool core_util_is_isr_active(void)
+{
+  return inInterrupt;
+}
+
+bool core_util_in_critical_section(void)
+{
+  return criticalDepth > 0;
+}
+
+void core_util_critical_section_enter(void)
+{
+  criticalSection.lock();
+  criticalDepth++;
+}
+
+void core_util_critical_section_exit(void)
+{
+  criticalDepth--;
+  criticalSection.unlock();
+}
+
+
+
+void PluggableUSBDevice::complete_request(USBDevice::RequestResult result, uint8_t *data, uint32_t size)
+{
+  controlAnswer.result = result;
+  controlAnswer.data.assign(data, data + ((data != NULL) ? size : 0));
+  controlAnswer.completed = false;
+}
+
+void PluggableUSBDevice::complete_request_xfer_done(bool success)
+{
+  controlAnswer.completed = true;
+  controlAnswer.success = success;
+}
+
+PluggableUSBDevice &arduino::PluggableUSBD(void)
+{
+  static PluggableUSBDevice device;
+  return device;
+}
+
+USBPhy *get_usb_phy(void)
+{
+  static USBPhy phy;
+  return &phy;
+}
+
+
+USBHID::USBHID(USBPhy *, uint8_t, uint8_t, uint16_t, uint16_t, uint16_t)
+{
+
+}
+
+bool USBHID::send(const HID_REPORT *report)
+{
+  if (sendsFail) return false;
+  {
+    std::lock_guard<std::mutex> lock(reportMutex);
+    if (recording) reports.emplace_back(report->data, report->data + report->length);
+    reportCount++;
+    reportBytes += report->length;
+  }
+  this->report_tx();   // The transfer is done at once, there is no host polling the endpoint.
+  return true;
+}
+
+bool USBHID::send_nb(const HID_REPORT *report)
+{
+  return this->send(report);
+}
+
+bool USBHID::read_nb(HID_REPORT *report)
+{
+  std::lock_guard<std::mutex> lock(reportMutex);
+  if (outputReports.empty()) return false;
+
+  const host::Report &next = outputReports.front();
+  report->length = (next.size() < MAX_HID_REPORT_SIZE) ? next.size() : MAX_HID_REPORT_SIZE;
+  memcpy(report->data, next.data(), report->length);
+  outputReports.pop_front();
+  return true;
+}
+
+void USBHID::callback_request(const USBDevice::setup_packet_t *)
+{
+  PluggableUSBD().complete_request(USBDevice::PassThrough);
+}
+
+void USBHID::callback_request_xfer_done(const USBDevice::setup_packet_t *, bool aborted)
+{
+  PluggableUSBD().complete_request_xfer_done(!aborted);
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+  Control of the host build shims, for the tests and the benchmark.
+
+  - Time is virtual: 'millis' and 'micros' return what the test set, nothing moves by itself.
+  - Reports sent through 'USBHID' are recorded in order, and sending can be made to fail.
+  - Output reports queued here are returned by 'USBHID::read_nb'.
+  - Pin levels are set by the test and read by 'digitalRead' and 'analogRead'.
+  - The atomics can be made to switch threads, see 'preemptAtomics', or to run test code in between,
+    see 'interleaveAfter'.
+  - Code inside an 'InterruptContext' runs as an ISR: 'core_util_is_isr_active' is true and it holds
+    the critical section, so it is excluded from the critical sections of the threads like on the board.
+*/
+
+#ifndef HOST_PLATFORM_H
+#define HOST_PLATFORM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+namespace host {
+
+typedef std::vector<uint8_t> Report;
+
+/*
+  Put everything back to the start state: time 0, no recorded reports, sends succeed, pins high.
+*/
+void reset(void);
+
+/*
+  Virtual time. 'setTime' sets both clocks, the others move them forward.
+*/
+void setTime(unsigned long milliseconds);
+void advance(unsigned long milliseconds);
+void advanceMicros(unsigned long microseconds);
+
+/*
+  Input reports sent with 'USBHID::send' and 'send_nb', oldest first. With recording off only the
+  counters are kept, for measuring without allocating.
+*/
+std::vector<Report> sentReports(void);
+size_t sentCount(void);
+uint64_t sentBytes(void);
+void clearSentReports(void);
+void recordReports(bool record);
+
+/*
+  Make the sends fail, like a disconnected or busy endpoint.
+*/
+void failSends(bool fail);
+
+/*
+  Output report returned by the next 'USBHID::read_nb'.
+*/
+void queueOutputReport(const uint8_t *report, uint8_t length);
+
+/*
+  What the last control request was answered with through 'PluggableUSBD().complete_request'.
+*/
+struct ControlAnswer {
+  int result;                   // 'USBDevice::RequestResult', -1 if nothing was answered.
+  std::vector<uint8_t> data;    // Data of a 'Send' answer.
+  bool completed;               // 'complete_request_xfer_done' was called, with 'success'.
+  bool success;
+} ;
+ControlAnswer lastControlAnswer(void);
+
+/*
+  Level of pin 'pin' for 'digitalRead', and the value of 'analogRead'. Level of the last
+  'digitalWrite' and the last 'pinMode' of the pin.
+*/
+void setPin(uint8_t pin, int level);
+void setAnalog(uint8_t pin, int value);
+int writtenLevel(uint8_t pin);
+int pinModeOf(uint8_t pin);
+
+/*
+  Switch threads after one in 'oneIn' atomic operations of the library, picked at random, to bring
+  out the races of lock-free code. 0 turns it off. Only for the stress tests.
+*/
+void preemptAtomics(uint32_t oneIn);
+
+/*
+  Run 'function' once on the calling thread right after its next 'operations' atomic operations, as
+  if another thread had preempted it there. Stepping 'operations' through a setter puts the code of
+  'function' between every two atomic operations of it, for the interleaving tests. 0 cancels.
+
+  @returns true if the function of the previous call ran.
+*/
+bool interleaveAfter(uint32_t operations, std::function<void(void)> function);
+
+/*
+  Run the code of the scope as an interrupt handler.
+*/
+class InterruptContext {
+public:
+  InterruptContext(void);
+  ~InterruptContext(void);
+
+  InterruptContext(const InterruptContext &) = delete;
+  InterruptContext &operator=(const InterruptContext &) = delete;
+} ;
+
+} // End of 'namespace host'.
+
+#endif // HOST_PLATFORM_H
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HOST_PLATFORMMUTEX_H
+#define HOST_PLATFORMMUTEX_H
+
+#include <mutex>
+
+class PlatformMutex {
+public:
+  void lock(void) { this->_mutex.lock(); }
+  void unlock(void) { this->_mutex.unlock(); }
+  bool trylock(void) { return this->_mutex.try_lock(); }
+
+private:
+  std::recursive_mutex _mutex;
+} ;
+
+#endif // HOST_PLATFORMMUTEX_H
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+  Host build shim of the Arduino mbed 'USBHID'. There is no USB stack behind it: 'send' and
+  'send_nb' hand the report to the host platform, which records it, and 'read_nb' returns the
+  output reports a test queued with 'host::queueOutputReport'. See 'HostPlatform.h'.
+*/
+
+#ifndef HOST_PLUGGABLEUSBHID_H
+#define HOST_PLUGGABLEUSBHID_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "Arduino.h"
+
+#define MBED_STATIC_ASSERT(expression, message) static_assert(expression, message)
+
+#define MAX_HID_REPORT_SIZE (64)
+
+typedef struct {
+  uint32_t length;
+  uint8_t data[MAX_HID_REPORT_SIZE];
+} HID_REPORT;
+
+// Short items of the report descriptor, from USBHID_Types.h.
+#define USAGE_PAGE(size) (0x04 | size)
+#define LOGICAL_MINIMUM(size) (0x14 | size)
+#define LOGICAL_MAXIMUM(size) (0x24 | size)
+#define PHYSICAL_MINIMUM(size) (0x34 | size)
+#define PHYSICAL_MAXIMUM(size) (0x44 | size)
+#define UNIT_EXPONENT(size) (0x54 | size)
+#define UNIT(size) (0x64 | size)
+#define REPORT_SIZE(size) (0x74 | size)
+#define REPORT_ID(size) (0x84 | size)
+#define REPORT_COUNT(size) (0x94 | size)
+#define PUSH(size) (0xa4 | size)
+#define POP(size) (0xb4 | size)
+#define INPUT(size) (0x80 | size)
+#define OUTPUT(size) (0x90 | size)
+#define FEATURE(size) (0xb0 | size)
+#define COLLECTION(size) (0xa0 | size)
+#define END_COLLECTION(size) (0xc0 | size)
+#define USAGE(size) (0x08 | size)
+#define USAGE_MINIMUM(size) (0x18 | size)
+#define USAGE_MAXIMUM(size) (0x28 | size)
+#define DESIGNATOR_INDEX(size) (0x38 | size)
+#define DESIGNATOR_MINIMUM(size) (0x48 | size)
+#define DESIGNATOR_MAXIMUM(size) (0x58 | size)
+#define STRING_INDEX(size) (0x78 | size)
+#define STRING_MINIMUM(size) (0x88 | size)
+#define STRING_MAXIMUM(size) (0x98 | size)
+#define DELIMITER(size) (0xa8 | size)
+
+#define LSB(n) ((n) & 0xff)
+#define MSB(n) (((n) & 0xff00) >> 8)
+
+#define CONFIGURATION_DESCRIPTOR_LENGTH (0x09)
+#define INTERFACE_DESCRIPTOR_LENGTH (0x09)
+#define ENDPOINT_DESCRIPTOR_LENGTH (0x07)
+#define HID_DESCRIPTOR_LENGTH (0x09)
+
+#define CONFIGURATION_DESCRIPTOR (2)
+#define INTERFACE_DESCRIPTOR (4)
+#define ENDPOINT_DESCRIPTOR (5)
+#define HID_DESCRIPTOR (33)
+#define REPORT_DESCRIPTOR (34)
+
+#define C_RESERVED (1U << 7)
+#define C_SELF_POWERED (1U << 6)
+#define C_POWER(mA) ((mA) / 2)
+#define E_INTERRUPT (0x03)
+
+#define HID_CLASS (3)
+#define HID_SUBCLASS_NONE (0)
+#define HID_PROTOCOL_NONE (0)
+#define HID_VERSION_1_11 (0x0111)
+
+#define GET_REPORT (0x01)
+#define GET_IDLE (0x02)
+#define SET_REPORT (0x09)
+#define CLASS_TYPE (1)
+
+
+class USBPhy { } ;
+
+class USBDevice {
+public:
+  enum RequestResult { Receive = 0, Send = 1, Failure = 2, PassThrough = 3 };
+
+  struct setup_packet_t {
+    struct {
+      uint8_t dataTransferDirection;
+      uint8_t Type;
+      uint8_t Recipient;
+    } bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+  } ;
+
+  typedef uint8_t usb_ep_t;
+} ;
+
+
+namespace arduino {
+
+namespace internal {
+class PluggableUSBModule { } ;
+}
+
+/*
+  Records the answer to the control request in progress, see 'host::lastControlAnswer'.
+*/
+class PluggableUSBDevice {
+public:
+  void complete_request(USBDevice::RequestResult result, uint8_t *data = NULL, uint32_t size = 0);
+  void complete_request_xfer_done(bool success);
+} ;
+
+PluggableUSBDevice &PluggableUSBD(void);
+
+
+class USBHID : public internal::PluggableUSBModule {
+public:
+  USBHID(USBPhy *phy, uint8_t output_report_length, uint8_t input_report_length,
+         uint16_t vendor_id, uint16_t product_id, uint16_t product_release);
+  virtual ~USBHID(void) { }
+
+  void connect(void) { }
+  void disconnect(void) { }
+  bool configured(void) { return true; }
+  bool ready(void) { return true; }
+
+  bool send(const HID_REPORT *report);
+  bool send_nb(const HID_REPORT *report);
+  bool read(HID_REPORT *report) { return this->read_nb(report); }
+  bool read_nb(HID_REPORT *report);
+
+  virtual const uint8_t *report_desc(void) = 0;
+  virtual uint16_t report_desc_length(void) { this->report_desc(); return this->reportLength; }
+
+  virtual void report_rx(void) { }
+  virtual void report_tx(void) { }
+
+protected:
+  virtual const uint8_t *configuration_desc(uint8_t index) = 0;
+  virtual void callback_request(const USBDevice::setup_packet_t *setup);
+  virtual void callback_request_xfer_done(const USBDevice::setup_packet_t *setup, bool aborted);
+
+  uint16_t reportLength = 0;
+  USBDevice::usb_ep_t _int_in = 0x81;
+  USBDevice::usb_ep_t _int_out = 0x01;
+} ;
+
+} // End of 'namespace arduino'.
+
+#endif // HOST_PLUGGABLEUSBHID_H
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+  Host build shim of the mbed atomics, on top of the GCC builtins.
+*/
+
+#ifndef HOST_MBED_ATOMIC_H
+#define HOST_MBED_ATOMIC_H
+
+#include <stdint.h>
+
+// With 'host::preemptAtomics' the threads may be switched after any atomic operation, so the races
+// between two operations show up on a machine with a single core too.
+extern bool hostPreemptAtomics;
+void hostPreemptionPoint(void);
+
+#define HOST_PREEMPTION_POINT() (__builtin_expect(hostPreemptAtomics, 0) ? hostPreemptionPoint() : (void)0)
+
+#define HOST_ATOMIC_OPERATIONS(T, S) \
+  inline T core_util_atomic_load_##S(const volatile T *p) { \
+    T v = __atomic_load_n(p, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return v; \
+  } \
+  inline void core_util_atomic_store_##S(volatile T *p, T v) { __atomic_store_n(p, v, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); } \
+  inline T core_util_atomic_exchange_##S(volatile T *p, T v) { \
+    T r = __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return r; \
+  } \
+  inline bool core_util_atomic_cas_##S(volatile T *p, T *expected, T desired) { \
+    bool r = __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+    HOST_PREEMPTION_POINT(); return r; \
+  } \
+  inline T core_util_atomic_incr_##S(volatile T *p, T d) { T r = __atomic_add_fetch(p, d, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return r; } \
+  inline T core_util_atomic_decr_##S(volatile T *p, T d) { T r = __atomic_sub_fetch(p, d, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return r; } \
+  inline T core_util_atomic_fetch_add_##S(volatile T *p, T d) { T r = __atomic_fetch_add(p, d, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return r; } \
+  inline T core_util_atomic_fetch_sub_##S(volatile T *p, T d) { T r = __atomic_fetch_sub(p, d, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return r; } \
+  inline T core_util_atomic_fetch_and_##S(volatile T *p, T d) { T r = __atomic_fetch_and(p, d, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return r; } \
+  inline T core_util_atomic_fetch_or_##S(volatile T *p, T d) { T r = __atomic_fetch_or(p, d, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return r; } \
+  inline T core_util_atomic_fetch_xor_##S(volatile T *p, T d) { T r = __atomic_fetch_xor(p, d, __ATOMIC_SEQ_CST); HOST_PREEMPTION_POINT(); return r; }
+
+HOST_ATOMIC_OPERATIONS(uint8_t, u8)
+HOST_ATOMIC_OPERATIONS(uint16_t, u16)
+HOST_ATOMIC_OPERATIONS(uint32_t, u32)
+HOST_ATOMIC_OPERATIONS(uint64_t, u64)
+HOST_ATOMIC_OPERATIONS(int8_t, s8)
+HOST_ATOMIC_OPERATIONS(int16_t, s16)
+HOST_ATOMIC_OPERATIONS(int32_t, s32)
+HOST_ATOMIC_OPERATIONS(int64_t, s64)
+
+#undef HOST_ATOMIC_OPERATIONS
+
+inline bool core_util_atomic_flag_test_and_set(volatile bool *flag) { return __atomic_exchange_n(flag, true, __ATOMIC_SEQ_CST); }
+inline void core_util_atomic_flag_clear(volatile bool *flag) { __atomic_store_n(flag, false, __ATOMIC_SEQ_CST); }
+
+inline void *core_util_atomic_load_ptr(void *const volatile *p) { return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+inline void core_util_atomic_store_ptr(void *volatile *p, void *v) { __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+inline void *core_util_atomic_exchange_ptr(void *volatile *p, void *v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+
+template<typename T>
+inline T *core_util_atomic_load(T *const volatile *p) { return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+
+template<typename T>
+inline void core_util_atomic_store(T *volatile *p, T *v) { __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+
+#endif // HOST_MBED_ATOMIC_H
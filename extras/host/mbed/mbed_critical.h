@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+  Host build shim of the mbed critical sections. There are no interrupts on the host: the critical
+  section is one process-wide recursive lock, and the code of a test runs "in an ISR" inside a
+  'host::InterruptContext', see 'HostPlatform.h'.
+*/
+
+#ifndef HOST_MBED_CRITICAL_H
+#define HOST_MBED_CRITICAL_H
+
+bool core_util_is_isr_active(void);
+bool core_util_in_critical_section(void);
+void core_util_critical_section_enter(void);
+void core_util_critical_section_exit(void);
+
+#endif // HOST_MBED_CRITICAL_H
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+  Host build shim of the mbed OS callbacks, tickers and RTOS primitives the library uses.
+
+  Threads and event flags are real, on top of the C++ standard library, so the report pump runs as
+  on the board. Tickers only remember their callback; a test calls 'fire' instead of waiting for
+  the timer, which keeps the time in the tests virtual.
+*/
+
+#ifndef HOST_RTOS_H
+#define HOST_RTOS_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+typedef enum {
+  osPriorityIdle = 1,
+  osPriorityLow = 8,
+  osPriorityBelowNormal = 16,
+  osPriorityNormal = 24,
+  osPriorityAboveNormal = 32,
+  osPriorityHigh = 40,
+  osPriorityRealtime = 48
+} osPriority;
+
+typedef int32_t osStatus;
+
+#define osOK 0
+#define osWaitForever 0xFFFFFFFFU
+#define osFlagsError 0x80000000U
+#define osFlagsErrorTimeout 0xFFFFFFFEU
+#define OS_STACK_SIZE 4096
+
+
+namespace mbed {
+
+template<typename F>
+class Callback;
+
+template<typename R, typename... Arguments>
+class Callback<R(Arguments...)> {
+public:
+  Callback(void) { }
+  template<typename F>
+  Callback(F function): _function(function) { }
+
+  R operator()(Arguments... arguments) const { return this->_function(arguments...); }
+  explicit operator bool(void) const { return static_cast<bool>(this->_function); }
+
+private:
+  std::function<R(Arguments...)> _function;
+} ;
+
+template<typename T, typename R, typename... Arguments>
+Callback<R(Arguments...)> callback(T *object, R (T::*method)(Arguments...))
+{
+  return Callback<R(Arguments...)>( [object, method](Arguments... arguments) { return (object->*method)(arguments...); } );
+}
+
+template<typename R, typename... Arguments>
+Callback<R(Arguments...)> callback(R (*function)(Arguments...))
+{
+  return Callback<R(Arguments...)>(function);
+}
+
+
+class Ticker {
+public:
+  template<typename Rep, typename Period>
+  void attach(Callback<void()> function, std::chrono::duration<Rep, Period> interval) {
+    this->_function = function;
+    this->_interval = std::chrono::duration_cast<std::chrono::microseconds>(interval);
+  }
+  void detach(void) { this->_function = Callback<void()>(); }
+
+  // Host only: whether a callback is attached, its interval, and one expiry of the timer.
+  bool attached(void) const { return static_cast<bool>(this->_function); }
+  std::chrono::microseconds interval(void) const { return this->_interval; }
+  void fire(void) { if (this->_function) this->_function(); }
+
+private:
+  Callback<void()> _function;
+  std::chrono::microseconds _interval{0};
+} ;
+
+class Timeout : public Ticker { } ;
+
+} // End of 'namespace mbed'.
+
+
+namespace rtos {
+
+class EventFlags {
+public:
+  uint32_t set(uint32_t flags) {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_flags |= flags;
+    this->_changed.notify_all();
+    return this->_flags;
+  }
+
+  uint32_t clear(uint32_t flags = 0x7FFFFFFF) {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    uint32_t previous = this->_flags;
+    this->_flags &= ~flags;
+    return previous;
+  }
+
+  uint32_t get(void) const {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    return this->_flags;
+  }
+
+  uint32_t wait_any(uint32_t flags, uint32_t millisec = osWaitForever, bool clear = true) {
+    std::unique_lock<std::mutex> lock(this->_mutex);
+    auto raised = [this, flags] { return (this->_flags & flags) != 0; };
+    if (millisec == osWaitForever) {
+      this->_changed.wait(lock, raised);
+    }
+    else if (!this->_changed.wait_for(lock, std::chrono::milliseconds(millisec), raised)) {
+      return osFlagsErrorTimeout;
+    }
+    uint32_t result = this->_flags & flags;
+    if (clear) this->_flags &= ~flags;
+    return result;
+  }
+
+private:
+  mutable std::mutex _mutex;
+  std::condition_variable _changed;
+  uint32_t _flags = 0;
+} ;
+
+
+class Thread {
+public:
+  Thread(osPriority = osPriorityNormal, uint32_t = OS_STACK_SIZE, unsigned char * = nullptr, const char * = nullptr) { }
+  ~Thread(void) { this->join(); }
+
+  Thread(const Thread &) = delete;
+  Thread &operator=(const Thread &) = delete;
+
+  osStatus start(mbed::Callback<void()> task) {
+    this->_thread = std::thread( [task] { task(); } );
+    return osOK;
+  }
+  osStatus join(void) {
+    if (this->_thread.joinable()) this->_thread.join();
+    return osOK;
+  }
+  osStatus set_priority(osPriority) { return osOK; }
+
+private:
+  std::thread _thread;
+} ;
+
+
+namespace ThisThread {
+inline void sleep_for(uint32_t millisec) { std::this_thread::sleep_for(std::chrono::milliseconds(millisec)); }
+inline void yield(void) { std::this_thread::yield(); }
+}
+
+} // End of 'namespace rtos'.
+
+#endif // HOST_RTOS_H
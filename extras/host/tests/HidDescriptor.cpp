@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include "HidDescriptor.h"
+
+using namespace host;
+
+
+uint32_t HidField::usageOf(uint16_t index) const
+{
+  if (this->usages.empty()) return 0;
+  return (index < this->usages.size()) ? this->usages[index] : this->usages.back();
+}
+
+
+namespace {
+
+struct Globals {
+  uint16_t usagePage = 0;
+  int32_t logicalMinimum = 0;
+  int32_t logicalMaximum = 0;
+  uint32_t logicalMaximumUnsigned = 0;
+  uint8_t reportSize = 0;
+  uint16_t reportCount = 0;
+  uint8_t reportId = 0;
+} ;
+
+// Usage as it was written, the page of a 1 or 2 byte usage is the one in effect at the main item.
+struct LocalUsage {
+  uint32_t value;
+  bool extended;
+} ;
+
+} // End of anonymous namespace.
+
+
+HidDescriptor::HidDescriptor(const uint8_t *data, uint16_t length)
+{
+  this->parse(data, length);
+}
+
+void HidDescriptor::parse(const uint8_t *data, uint16_t length)
+{
+  Globals globals;
+  std::vector<Globals> stack;
+  std::vector<LocalUsage> usages;
+  bool hasMinimum = false, hasMaximum = false;
+  LocalUsage usageMinimum = { 0, false }, usageMaximum = { 0, false };
+  uint8_t depth = 0;
+  std::map<uint32_t, uint32_t> offsets;   // (type << 8 | report ID) -> bits so far.
+
+  uint16_t position = 0;
+  while (position < length && this->valid()) {
+    uint8_t prefix = data[position];
+    if (prefix == 0xFE) {   // Long item, skipped.
+      if (position + 2 >= length) return this->fail(position, "long item past the end");
+      position += 3 + data[position + 1];
+      continue;
+    }
+
+    uint8_t size = prefix & 0x03;
+    if (size == 3) size = 4;
+    uint8_t type = (prefix >> 2) & 0x03;
+    uint8_t tag = prefix >> 4;
+    if (position + 1 + size > length) return this->fail(position, "item past the end");
+
+    uint32_t value = 0;
+    for (uint8_t i=0; i < size; i++) value |= static_cast<uint32_t>(data[position + 1 + i]) << (8 * i);
+    int32_t signedValue = (size == 0 || size == 4) ? static_cast<int32_t>(value)
+                        : static_cast<int32_t>(value << (32 - 8 * size)) >> (32 - 8 * size);
+
+    if (type == 0) {   // Main
+      if (tag == 0x8 || tag == 0x9 || tag == 0xB) {
+        HidField field;
+        field.type = (tag == 0x8) ? HidField::INPUT : (tag == 0x9) ? HidField::OUTPUT : HidField::FEATURE;
+        field.reportId = globals.reportId;
+        field.size = globals.reportSize;
+        field.count = globals.reportCount;
+        field.flags = value;
+        field.logicalMinimum = globals.logicalMinimum;
+        // Both ends non-negative: the maximum is unsigned, 0xFF in one byte is 255.
+        field.logicalMaximum = (globals.logicalMinimum >= 0) ? static_cast<int32_t>(globals.logicalMaximumUnsigned)
+                                                             : globals.logicalMaximum;
+        field.collectionDepth = depth;
+
+        auto resolve = [&globals](const LocalUsage &u) { return u.extended ? u.value : usage(globals.usagePage, u.value); };
+        for (const LocalUsage &u : usages) field.usages.push_back(resolve(u));
+        if (hasMinimum != hasMaximum) return this->fail(position, "usage minimum without maximum");
+        if (hasMinimum) {
+          uint32_t first = resolve(usageMinimum), last = resolve(usageMaximum);
+          if (first > last || last - first > 0xFFFF) return this->fail(position, "bad usage range");
+          for (uint32_t u = first; u <= last; u++) field.usages.push_back(u);
+        }
+
+        if (field.size == 0 || field.size > 32) return this->fail(position, "report size 0 or over 32 bits");
+        if (field.count == 0) return this->fail(position, "report count 0");
+        if (this->_usesReportIds && field.reportId == 0) return this->fail(position, "field before the first report ID");
+        if (!field.constant()) {
+          if (field.usages.empty()) return this->fail(position, "data field without a usage");
+          if (field.logicalMinimum > field.logicalMaximum) return this->fail(position, "logical minimum above maximum");
+          // The logical range must fit the field.
+          int64_t low = (field.logicalMinimum < 0) ? -(static_cast<int64_t>(1) << (field.size - 1)) : 0;
+          int64_t high = (field.logicalMinimum < 0) ? (static_cast<int64_t>(1) << (field.size - 1)) - 1
+                                                    : (static_cast<int64_t>(1) << field.size) - 1;
+          if (field.logicalMinimum < low || field.logicalMaximum > high) return this->fail(position, "logical range does not fit the report size");
+        }
+
+        uint32_t &offset = offsets[ (static_cast<uint32_t>(field.type) << 8) | field.reportId ];
+        field.bitOffset = offset;
+        offset += static_cast<uint32_t>(field.size) * field.count;
+        this->_fields.push_back(field);
+      }
+      else if (tag == 0xA) {
+        depth++;
+      }
+      else if (tag == 0xC) {
+        if (depth == 0) return this->fail(position, "end collection without a collection");
+        depth--;
+      }
+      else {
+        return this->fail(position, "unknown main item");
+      }
+      usages.clear();
+      hasMinimum = hasMaximum = false;
+    }
+    else if (type == 1) {   // Global
+      switch (tag) {
+        case 0x0: globals.usagePage = value; break;
+        case 0x1: globals.logicalMinimum = signedValue; break;
+        case 0x2: globals.logicalMaximum = signedValue; globals.logicalMaximumUnsigned = value; break;
+        case 0x7: globals.reportSize = value; break;
+        case 0x8:
+          if (value == 0 || value > 0xFF) return this->fail(position, "report ID 0 or over 255");
+          if (!this->_usesReportIds && !this->_fields.empty()) return this->fail(position, "report ID after fields without one");
+          globals.reportId = value;
+          this->_usesReportIds = true;
+          break;
+        case 0x9: globals.reportCount = value; break;
+        case 0xA: stack.push_back(globals); break;
+        case 0xB:
+          if (stack.empty()) return this->fail(position, "pop without push");
+          globals = stack.back();
+          stack.pop_back();
+          break;
+        default: break;   // Physical range and units, not checked.
+      }
+    }
+    else if (type == 2) {   // Local
+      LocalUsage u = { value, size == 4 };
+      if (tag == 0x0) usages.push_back(u);
+      else if (tag == 0x1) { usageMinimum = u; hasMinimum = true; }
+      else if (tag == 0x2) { usageMaximum = u; hasMaximum = true; }
+    }
+    else {
+      return this->fail(position, "reserved item type");
+    }
+    position += 1 + size;
+  }
+
+  if (this->valid() && depth != 0) this->fail(length, "collection not closed");
+  if (this->valid() && !stack.empty()) this->fail(length, "push without pop");
+}
+
+void HidDescriptor::fail(uint16_t position, const char *message)
+{
+  char text[ 96 ];
+  snprintf(text, sizeof(text), "byte %u: %s", position, message);
+  this->_error = text;
+}
+
+
+std::vector<uint8_t> HidDescriptor::reportIds(uint8_t type) const
+{
+  std::vector<uint8_t> ids;
+  for (const HidField &field : this->_fields) {
+    if (field.type == type && std::find(ids.begin(), ids.end(), field.reportId) == ids.end()) ids.push_back(field.reportId);
+  }
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+uint32_t HidDescriptor::reportBits(uint8_t type, uint8_t reportId) const
+{
+  uint32_t bits = 0;
+  for (const HidField &field : this->_fields) {
+    if (field.type == type && field.reportId == reportId) bits += static_cast<uint32_t>(field.size) * field.count;
+  }
+  return bits;
+}
+
+const HidField *HidDescriptor::find(uint8_t type, uint32_t usage, uint16_t *index) const
+{
+  for (const HidField &field : this->_fields) {
+    if (field.type != type || field.constant() || !field.variable()) continue;
+    for (uint16_t i=0; i < field.count; i++) {
+      if (field.usageOf(i) != usage) continue;
+      if (index != nullptr) *index = i;
+      return &field;
+    }
+  }
+  return nullptr;
+}
+
+int32_t HidDescriptor::extract(const HidField &field, uint16_t index, const uint8_t *report) const
+{
+  const uint8_t *data = report + (this->_usesReportIds ? 1 : 0);
+  uint32_t bit = field.bitOffset + static_cast<uint32_t>(index) * field.size;
+
+  uint64_t value = 0;
+  for (uint8_t i=0; i < field.size; i++, bit++) {
+    value |= static_cast<uint64_t>((data[bit / 8] >> (bit % 8)) & 0x01) << i;
+  }
+  if (field.logicalMinimum < 0 && field.size < 64 && (value >> (field.size - 1)) & 0x01) {
+    value |= ~static_cast<uint64_t>(0) << field.size;   // Sign-extend.
+  }
+  return static_cast<int32_t>(static_cast<int64_t>(value));
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+  Independent parser of HID report descriptors for the tests, so the generated descriptors are
+  checked against the HID rules instead of against themselves: the fields of every input, output
+  and feature report with their report IDs, bit positions, sizes, logical ranges and usages, and
+  the errors a host would reject the descriptor for.
+
+    host::HidDescriptor descriptor( data, length );
+    CHECK( descriptor.valid() );
+    const host::HidField *x = descriptor.find( host::HidField::INPUT, host::usage(0x01, 0x30) );
+*/
+
+#ifndef HID_DESCRIPTOR_H
+#define HID_DESCRIPTOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace host {
+
+// Extended usage: usage page in the high 16 bits, usage ID in the low 16 bits.
+inline uint32_t usage(uint16_t page, uint16_t id) { return (static_cast<uint32_t>(page) << 16) | id; }
+
+/*
+  One main item: 'count' fields of 'size' bits starting at 'bitOffset' of the report data,
+  after the report ID byte.
+*/
+struct HidField {
+  enum { INPUT, OUTPUT, FEATURE } ;
+
+  uint8_t type;
+  uint8_t reportId;             // 0 when the descriptor uses no report IDs.
+  uint32_t bitOffset;
+  uint8_t size;
+  uint16_t count;
+  uint16_t flags;               // Data of the main item: bit 0 constant, bit 1 variable, bit 2 relative.
+  int32_t logicalMinimum;
+  int32_t logicalMaximum;
+  std::vector<uint32_t> usages;   // Extended usages; 'USAGE_MINIMUM' ... 'USAGE_MAXIMUM' expanded.
+  uint8_t collectionDepth;
+
+  bool constant(void) const { return (this->flags & 0x01) != 0; }
+  bool variable(void) const { return (this->flags & 0x02) != 0; }
+
+  // Usage of field 'index', the last usage repeats for the rest like the HID rules say.
+  uint32_t usageOf(uint16_t index) const;
+} ;
+
+
+class HidDescriptor {
+public:
+  HidDescriptor(const uint8_t *data, uint16_t length);
+
+  bool valid(void) const { return this->_error.empty(); }
+  const std::string &error(void) const { return this->_error; }
+
+  const std::vector<HidField> &fields(void) const { return this->_fields; }
+
+  /*
+    Report IDs used by reports of 'type', and the length of one report in bits without the ID byte.
+  */
+  std::vector<uint8_t> reportIds(uint8_t type) const;
+  uint32_t reportBits(uint8_t type, uint8_t reportId) const;
+
+  /*
+    The field carrying 'usage' in a report of 'type', and its position among the fields of the item.
+
+    @returns null if no variable field has the usage.
+  */
+  const HidField *find(uint8_t type, uint32_t usage, uint16_t *index = nullptr) const;
+
+  /*
+    Value of field 'index' of 'field' in 'report', which starts with the report ID byte if the
+    descriptor uses them. Sign-extended when the logical minimum is negative.
+  */
+  int32_t extract(const HidField &field, uint16_t index, const uint8_t *report) const;
+
+  bool usesReportIds(void) const { return this->_usesReportIds; }
+
+
+private:
+  std::vector<HidField> _fields;
+  std::string _error;
+  bool _usesReportIds = false;
+
+  void parse(const uint8_t *data, uint16_t length);
+  void fail(uint16_t position, const char *message);
+} ;
+
+} // End of 'namespace host'.
+
+#endif // HID_DESCRIPTOR_H
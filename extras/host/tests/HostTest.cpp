@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include "HostTest.h"
+
+
+static host::TestCase *firstCase = nullptr;
+static host::TestCase *lastCase = nullptr;
+static uint32_t failures = 0;
+
+
+host::TestCase::TestCase(const char *name, TestFunction function):
+  name(name),
+  function(function),
+  next(nullptr)
+{
+  // Kept in definition order, the tests of a file run top to bottom.
+  if (lastCase == nullptr) firstCase = this;
+  else lastCase->next = this;
+  lastCase = this;
+}
+
+bool host::check(bool passed, const char *expression, const char *file, int line)
+{
+  if (passed) return true;
+  if (expression != nullptr) printf("%s:%d: CHECK(%s) failed\n", file, line, expression);
+  failures++;
+  return false;
+}
+
+
+/*
+  Runs every test, or only the ones named on the command line.
+*/
+int main(int argc, char **argv)
+{
+  uint32_t run = 0;
+  uint32_t failed = 0;
+
+  for (host::TestCase *test = firstCase; test != nullptr; test = test->next) {
+    bool selected = (argc < 2);
+    for (int i=1; i < argc; i++) {
+      if (strcmp(argv[i], test->name) == 0) selected = true;
+    }
+    if (!selected) continue;
+
+    host::reset();
+    uint32_t before = failures;
+    test->function();
+    run++;
+
+    if (failures != before) failed++;
+    printf("%-48s %s\n", test->name, (failures != before) ? "FAILED" : "ok");
+  }
+
+  printf("%u tests, %u failed\n", run, failed);
+  return (failed == 0 && run > 0) ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+  Minimal test runner of the host tests. A test file defines its cases with 'TEST' and checks with
+  'CHECK' and 'CHECK_EQUAL'; 'HostTest.cpp' has the 'main' that runs them all, each one starting
+  from 'host::reset'. A failed check prints its location and the test goes on, the exit status
+  tells ctest whether anything failed.
+
+    TEST(pressSendsReport) {
+      USBJoystick joystick;
+      joystick.pressButton(3);
+      CHECK( joystick.update() );
+      CHECK_EQUAL( 1u, host::sentCount() );
+    }
+*/
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "HostPlatform.h"
+
+namespace host {
+
+typedef void (*TestFunction)(void);
+
+/*
+  Registered by 'TEST' before 'main' runs.
+*/
+class TestCase {
+public:
+  TestCase(const char *name, TestFunction function);
+
+  const char *name;
+  TestFunction function;
+  TestCase *next;
+} ;
+
+bool check(bool passed, const char *expression, const char *file, int line);
+
+template<typename Expected, typename Actual>
+bool checkEqual(const Expected &expected, const Actual &actual, const char *expression, const char *file, int line)
+{
+  if (expected == actual) return true;
+  printf("%s:%d: CHECK_EQUAL(%s) failed: expected %lld, got %lld\n", file, line, expression,
+         static_cast<long long>(expected), static_cast<long long>(actual));
+  return check(false, nullptr, file, line);
+}
+
+} // End of 'namespace host'.
+
+#define TEST(name) \
+  static void name(void); \
+  static host::TestCase name##_case(#name, name); \
+  static void name(void)
+
+#define CHECK(expression) host::check((expression), #expression, __FILE__, __LINE__)
+#define CHECK_EQUAL(expected, actual) host::checkEqual((expected), (actual), #expected ", " #actual, __FILE__, __LINE__)
+
+#endif // HOST_TEST_H
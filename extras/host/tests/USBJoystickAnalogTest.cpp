@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <atomic>
+#include <thread>
+#include "HostTest.h"
+#include "USBJoystickAnalog.h"
+
+using namespace arduino;
+
+
+/*
+  Background acquisition with a simulated ADC in place of the SAADC: the scans it schedules, the two
+  buffers it fills in turn, and the delivery of each scan to the joystick, from the interrupt or
+  from 'poll', including a scan completing while 'poll' copies.
+*/
+
+/*
+  Scans every input into the two buffers of 'JoystickAnalog' in turn, one scan per 'interval' of the
+  time given to 'run', each ending in 'scanComplete' as an interrupt. The sample of every input in a
+  scan is the number of the scan, so a scan mixed from two shows as axes that differ.
+*/
+class SimulatedADC : public JoystickAnalogHardware {
+public:
+  virtual bool start(JoystickAnalog &analog, const uint8_t *inputs, uint8_t count, uint32_t interval) {
+    if (this->analog != nullptr || interval == 0) return false;
+    this->analog = &analog;
+    memcpy(this->inputs, inputs, count);
+    this->count = count;
+    this->interval = interval;
+    this->elapsed = 0;
+    this->filling = 0;
+    this->written = 0;
+    return true;
+  }
+
+  virtual void stop(void) { this->analog = nullptr; }
+
+  // Let 'microseconds' pass, with a scan at the end of every interval.
+  void run(uint32_t microseconds) {
+    for (this->elapsed += microseconds; this->analog != nullptr && this->elapsed >= this->interval;
+         this->elapsed -= this->interval) {
+      this->finishScan();
+    }
+  }
+
+  // Write the first samples of the next scan, as the DMA does before the scan ends.
+  void writePart(uint8_t samples) {
+    int16_t *buffer = this->analog->buffer(this->filling);
+    for (; this->written < samples && this->written < this->count; this->written++) {
+      buffer[ this->written ] = sampleOf(this->scanNumber + 1);
+    }
+  }
+
+  void finishScan(void) {
+    this->writePart(this->count);
+    this->scanNumber++;
+    this->written = 0;
+    uint8_t completed = this->filling;
+    this->filling ^= 0x01;
+    this->buffers[completed]++;
+    host::InterruptContext interrupt;
+    this->analog->scanComplete(completed);
+  }
+
+  static int16_t sampleOf(uint32_t scan) { return static_cast<int16_t>(scan % 4096); }
+
+  JoystickAnalog *analog = nullptr;
+  uint8_t inputs[ JoystickAnalog::MAX_CHANNELS ];
+  uint8_t count = 0;
+  uint32_t interval = 0;
+  uint32_t elapsed = 0;
+  uint8_t filling = 0;
+  uint8_t written = 0;
+  uint32_t scanNumber = 0;
+  uint32_t buffers[2] = { 0, 0 };   // Scans completed into each buffer.
+} ;
+
+/*
+  Joystick with X, Y and Z on inputs 5, 2 and 7, all ranged like the 12-bit ADC.
+*/
+struct Rig {
+  JoystickCore joystick;
+  SimulatedADC adc;
+  JoystickAnalog analog;
+
+  Rig(void) : joystick(USBJoystickLayout<>::layout), analog(joystick, adc) {
+    joystick.setXAxisRange(0, 4095);
+    joystick.setYAxisRange(0, 4095);
+    joystick.setZAxisRange(0, 4095);
+    joystick.setRxAxisRange(0, 4095);
+    analog.addChannel(5, X_AXIS);
+    analog.addChannel(2, Y_AXIS);
+    analog.addChannel(7, Z_AXIS);
+  }
+
+  // The axes of one scan, 'scan' if given.
+  bool oneScan(int32_t scan = -1) {
+    int16_t x = this->joystick.axis.X;
+    if (this->joystick.axis.Y != x || this->joystick.axis.Z != x) return false;
+    if (scan < 0) return true;
+    this->joystick.setAxisRaw(RX_AXIS, SimulatedADC::sampleOf(scan));   // Not scanned, mapped like X.
+    return this->joystick.axis.Rx == x;
+  }
+} ;
+
+
+TEST(channelsAreCheckedAndPassedInOrder) {
+  Rig rig;
+  CHECK( !rig.analog.addChannel(1, X_AXIS) );        // One input per axis.
+  CHECK( !rig.analog.addChannel(1, AXIS_COUNT) );
+  CHECK( rig.analog.start(500) );
+  CHECK( !rig.analog.start(500) );
+  CHECK( !rig.analog.addChannel(1, RX_AXIS) );       // Not while scanning.
+
+  CHECK_EQUAL( 3, rig.adc.count );
+  CHECK_EQUAL( 5, rig.adc.inputs[0] );
+  CHECK_EQUAL( 2, rig.adc.inputs[1] );
+  CHECK_EQUAL( 7, rig.adc.inputs[2] );
+  CHECK_EQUAL( 500u, rig.adc.interval );
+
+  rig.analog.stop();
+  CHECK( rig.adc.analog == nullptr );
+  CHECK( rig.analog.start(1000) );
+
+  JoystickCore joystick;
+  SimulatedADC adc;
+  JoystickAnalog empty(joystick, adc);
+  CHECK( !empty.start() );
+}
+
+TEST(scansFollowTheIntervalIntoBothBuffers) {
+  Rig rig;
+  rig.analog.start(250);
+
+  rig.adc.run(200);
+  CHECK_EQUAL( 0u, rig.analog.scans() );
+  rig.adc.run(100);
+  CHECK_EQUAL( 1u, rig.analog.scans() );
+  rig.adc.run(10 * 1000 - 300);
+  CHECK_EQUAL( 40u, rig.analog.scans() );
+  CHECK_EQUAL( 20u, rig.adc.buffers[0] );
+  CHECK_EQUAL( 20u, rig.adc.buffers[1] );
+
+  // Stopped, the time goes by without scans.
+  rig.analog.stop();
+  rig.adc.run(10 * 1000);
+  CHECK_EQUAL( 40u, rig.analog.scans() );
+}
+
+TEST(interruptDeliversEveryScanWhole) {
+  Rig rig;
+  rig.analog.start(1000);
+  for (uint32_t scan=1; scan <= 50; scan++) {
+    rig.adc.run(1000);
+    if (!CHECK( rig.oneScan(scan) )) break;
+  }
+  CHECK_EQUAL( 0u, rig.analog.overruns() );
+  CHECK( !rig.analog.poll() );   // Nothing waits for the loop.
+}
+
+TEST(pollDeliversTheLatestScan) {
+  Rig rig;
+  rig.analog.deliverFromInterrupt = false;
+  rig.analog.start(1000);
+
+  int16_t before = rig.joystick.axis.X;
+  rig.adc.run(1000);
+  CHECK_EQUAL( before, rig.joystick.axis.X );   // Not delivered yet.
+  CHECK( rig.analog.poll() );
+  CHECK( rig.oneScan(1) );
+  CHECK( !rig.analog.poll() );
+
+  // Three scans before the next poll: two overruns, the newest one delivered.
+  rig.adc.run(3000);
+  CHECK_EQUAL( 2u, rig.analog.overruns() );
+  CHECK( rig.analog.poll() );
+  CHECK( rig.oneScan(4) );
+}
+
+TEST(scanCompletingDuringTheCopyIsNotTorn) {
+  // A scan ends after every atomic operation of 'poll' in turn, with the DMA already writing the
+  // first sample of the one after it into the buffer 'poll' may be copying.
+  for (uint32_t step=1; ; step++) {
+    Rig rig;
+    rig.analog.deliverFromInterrupt = false;
+    rig.analog.start(1000);
+    rig.adc.run(1000);
+
+    host::interleaveAfter(step, [&rig] {
+      rig.adc.finishScan();
+      rig.adc.writePart(1);
+    });
+    rig.analog.poll();
+    bool interleaved = host::interleaveAfter(0, nullptr);
+
+    if (!CHECK( rig.oneScan() )) {
+      printf("  with a scan after atomic operation %u of 'poll'\n", step);
+    }
+    if (!interleaved) return;
+  }
+}
+
+TEST(scansFromAnInterruptThreadAreNeverMixed) {
+  static const uint32_t SCANS = 20000;
+
+  Rig rig;
+  rig.analog.deliverFromInterrupt = false;
+  rig.analog.start(100);
+
+  // The ADC runs flat out; the loop polls meanwhile and checks every scan it gets.
+  std::atomic<bool> done(false);
+  std::thread adc([&] {
+    for (uint32_t i=0; i < SCANS; i++) {
+      rig.adc.writePart(1);
+      rig.adc.run(100);
+    }
+    done = true;
+  });
+
+  uint32_t mixed = 0;
+  while (!done.load()) {
+    if (rig.analog.poll() && !rig.oneScan()) mixed++;
+  }
+  adc.join();
+  rig.analog.poll();
+
+  CHECK_EQUAL( 0u, mixed );
+  CHECK_EQUAL( SCANS, rig.analog.scans() );
+  CHECK( rig.oneScan(SCANS) );
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include "HostTest.h"
+#include "USBJoystickCore.h"
+
+using namespace arduino;
+
+
+/*
+  Fixed-point axis mapping of 'setAxisRaw' and 'setAxes' against the float 'mapfi' the setters used
+  before: within 1 LSB for every input of the range, exact at the ends of the range.
+*/
+
+struct Range {
+  int16_t minimum;
+  int16_t maximum;
+} ;
+
+static const Range RANGES[] = {
+  { -511, 511 },      // The default.
+  { 0, 1023 },        // 10-bit ADC.
+  { 0, 4095 },        // 12-bit ADC.
+  { 100, 900 },       // Calibrated, off center.
+  { -5, 5 },          // Fewer input steps than output steps.
+  { -32768, 32767 },  // Full 16-bit input.
+};
+
+static const uint16_t MAX_STEPS = 5000;   // Wider ranges are sampled, with both ends.
+
+
+static int16_t floatReference(int32_t value, const Range &range, const JoystickLayout &layout)
+{
+  float clamped = constrain( value, range.minimum, range.maximum );
+  return JoystickCore::mapfi(clamped, range.minimum, range.maximum, layout.axisMinimum, layout.axisMaximum);
+}
+
+/*
+  Compare 'setAxisRaw', 'setAxes' and 'setXAxis' against 'mapfi' for every range.
+
+  @returns the largest difference seen.
+*/
+static int32_t compareWithFloat(const JoystickLayout &layout)
+{
+  JoystickCore joystick(layout);
+  int32_t worst = 0;
+
+  for (const Range &range : RANGES) {
+    joystick.setAllAxisRange(range.minimum, range.maximum);
+
+    int32_t span = static_cast<int32_t>(range.maximum) - range.minimum;
+    int32_t step = (span > MAX_STEPS) ? span / MAX_STEPS : 1;
+    // A little past both ends too, the setters clamp.
+    for (int32_t value = range.minimum - 2 * step; value <= range.maximum + 2 * step; value += step) {
+      int32_t input = constrain( value, INT16_MIN, INT16_MAX );
+      int16_t reference = floatReference(input, range, layout);
+
+      joystick.setAxisRaw(X_AXIS, input);
+      int32_t raw = joystick.axis.X;
+
+      int16_t values[ AXIS_COUNT ] = { };
+      values[Y_AXIS] = input;
+      joystick.setAxes(values, AXIS_Y);
+      int32_t bulk = joystick.axis.Y;
+
+      joystick.setXAxis(static_cast<float>(input));
+      int32_t floating = joystick.axis.X;
+
+      int32_t difference = abs(raw - reference);
+      if (abs(bulk - reference) > difference) difference = abs(bulk - reference);
+      if (abs(floating - reference) > difference) difference = abs(floating - reference);
+      if (difference > worst) worst = difference;
+      if (difference > 1) {
+        printf("  range %d...%d, input %d: float %d, setAxisRaw %d, setAxes %d, setXAxis %d\n",
+               range.minimum, range.maximum, input, reference, raw, bulk, floating);
+        return difference;
+      }
+    }
+
+    // The ends of the range are the ends of the layout, not one step short.
+    joystick.setAxisRaw(X_AXIS, range.minimum);
+    CHECK_EQUAL( layout.axisMinimum, joystick.axis.X );
+    joystick.setAxisRaw(X_AXIS, range.maximum);
+    CHECK_EQUAL( layout.axisMaximum, joystick.axis.X );
+  }
+  return worst;
+}
+
+
+TEST(fixedPointMatchesFloatWith8Bits) {
+  CHECK( compareWithFloat(USBJoystickLayout<8, AXIS_X | AXIS_Y, 8>::layout) <= 1 );
+}
+
+TEST(fixedPointMatchesFloatWith10Bits) {
+  CHECK( compareWithFloat(USBJoystickLayout<8, AXIS_X | AXIS_Y, 10>::layout) <= 1 );
+}
+
+TEST(fixedPointMatchesFloatWith12Bits) {
+  CHECK( compareWithFloat(USBJoystickLayout<8, AXIS_X | AXIS_Y, 12>::layout) <= 1 );
+}
+
+TEST(fixedPointMatchesFloatWith16Bits) {
+  CHECK( compareWithFloat(USBJoystickLayout<8, AXIS_X | AXIS_Y, 16>::layout) <= 1 );
+}
+
+TEST(emptyRangeGivesTheMinimum) {
+  JoystickCore joystick(USBJoystickLayout<>::layout);
+  joystick.setXAxisRange(100, 100);
+  joystick.setAxisRaw(X_AXIS, 100);
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMinimum, joystick.axis.X );
+  joystick.setAxisRaw(X_AXIS, 5000);
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMinimum, joystick.axis.X );
+}
+
+TEST(reversedRangeIsSorted) {
+  JoystickCore joystick(USBJoystickLayout<>::layout);
+  joystick.setXAxisRange(1023, 0);
+  CHECK_EQUAL( 0, joystick.axisMin.X );
+  CHECK_EQUAL( 1023, joystick.axisMax.X );
+  joystick.setAxisRaw(X_AXIS, 1023);
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMaximum, joystick.axis.X );
+}
+
+TEST(axisBytesOfEveryValue) {
+  JoystickCore joystick;
+  for (int32_t value = INT16_MIN; value <= INT16_MAX; value++) {
+    int16_t axis = static_cast<int16_t>(value);
+    uint8_t high = static_cast<uint8_t>(joystick.axis16bitToByte(axis, MSB));
+    uint8_t low = static_cast<uint8_t>(joystick.axis16bitToByte(axis, LSB));
+    if (static_cast<int16_t>((high << 8) | low) != axis) {
+      CHECK_EQUAL( value, static_cast<int16_t>((high << 8) | low) );
+      return;
+    }
+  }
+}
+
+/*
+  A thread keeps switching the range of X between two ranges while this one sets the same raw value.
+  The ranges differ in both ends and in width, so a value mapped with half of a range change, the new
+  minimum with the old maximum or scale, gives neither of the two results.
+*/
+TEST(rangeChangesNeverTearTheMapping) {
+  static const Range NARROW = { 0, 1000 };
+  static const Range WIDE = { 500, 4500 };
+  static const int32_t VALUE = 1000;
+  static const uint32_t SAMPLES = 200000;
+
+  JoystickCore joystick(USBJoystickLayout<>::layout);
+  joystick.setXAxisRange(NARROW.minimum, NARROW.maximum);
+  joystick.setAxisRaw(X_AXIS, VALUE);
+  int16_t narrow = joystick.axis.X;
+  joystick.setXAxisRange(WIDE.minimum, WIDE.maximum);
+  joystick.setAxisRaw(X_AXIS, VALUE);
+  int16_t wide = joystick.axis.X;
+  CHECK( narrow != wide );
+
+  std::atomic<bool> done(false);
+  std::thread changer([&] {
+    for (uint32_t i=0; !done.load(); i++) {
+      const Range &range = (i & 1) ? NARROW : WIDE;
+      joystick.setXAxisRange(range.minimum, range.maximum);
+    }
+  });
+
+  uint32_t torn = 0;
+  int16_t seen = 0;
+  for (uint32_t i=0; i < SAMPLES; i++) {
+    joystick.setAxisRaw(X_AXIS, VALUE);
+    int16_t value = joystick.axis.X;
+    if (value != narrow && value != wide) {
+      torn++;
+      seen = value;
+    }
+  }
+  done = true;
+  changer.join();
+
+  CHECK_EQUAL( 0u, torn );
+  if (torn != 0) CHECK_EQUAL( narrow, seen );
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include <vector>
+#include "HostTest.h"
+#include "USBJoystickCalibration.h"
+#include "USBJoystickCore.h"
+
+using namespace arduino;
+
+
+/*
+  Calibration records in a simulated flash of two sectors: learning, saving and loading back, the
+  switch between the two halves, and a power loss at every step of a series of saves.
+*/
+
+static const uint32_t SECTOR_SIZE = 1024;
+static const uint32_t PROGRAM_SIZE = 8;
+static const uint32_t SLOTS_PER_HALF = SECTOR_SIZE / 56;   // RECORD_LENGTH is a multiple of PROGRAM_SIZE.
+
+
+/*
+  Flash in RAM. Programming only clears bits, erasing works on whole sectors. After 'powerLossAfter'
+  more operations the next one is cut short: half of it is done and everything fails from then on,
+  until 'powerOn'.
+*/
+class SimulatedFlash : public JoystickCalibrationStorage {
+public:
+  SimulatedFlash(void) : data(2 * SECTOR_SIZE, 0xFF) { }
+
+  virtual uint32_t size(void) const { return this->data.size(); }
+  virtual uint32_t programSize(void) const { return PROGRAM_SIZE; }
+
+  virtual bool read(uint32_t offset, void *data, uint32_t length) {
+    if (this->off || offset + length > this->data.size()) return false;
+    memcpy(data, &this->data[offset], length);
+    return true;
+  }
+
+  virtual bool program(uint32_t offset, const void *data, uint32_t length) {
+    if (offset % PROGRAM_SIZE != 0 || length % PROGRAM_SIZE != 0 || offset + length > this->data.size()) return false;
+    uint32_t done = this->operation() ? length : length / 2;
+    if (this->off && done == length) return false;
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (uint32_t i=0; i < done; i++) this->data[offset + i] &= bytes[i];
+    this->programs++;
+    return !this->off;
+  }
+
+  virtual bool erase(uint32_t offset, uint32_t length) {
+    if (offset % SECTOR_SIZE != 0 || length % SECTOR_SIZE != 0 || offset + length > this->data.size()) return false;
+    uint32_t done = this->operation() ? length : length / 2;
+    if (this->off && done == length) return false;
+    memset(&this->data[offset], 0xFF, done);
+    this->erases++;
+    return !this->off;
+  }
+
+  void powerOn(void) {
+    this->off = false;
+    this->powerLossAfter = -1;
+  }
+
+  std::vector<uint8_t> data;
+  int32_t powerLossAfter = -1;   // -1 never.
+  bool off = false;
+  uint32_t programs = 0;
+  uint32_t erases = 0;
+
+private:
+  /*
+    @returns false if the power goes off during this operation.
+  */
+  bool operation(void) {
+    if (this->off) return true;
+    if (this->powerLossAfter < 0 || this->powerLossAfter-- > 0) return true;
+    this->off = true;
+    return false;
+  }
+} ;
+
+
+/*
+  Widen the range of X to -limit ... limit and save.
+*/
+static bool learnAndSave(JoystickCore &joystick, JoystickCalibration &calibration, int16_t limit)
+{
+  joystick.setAxisRaw(X_AXIS, -limit);
+  joystick.setAxisRaw(X_AXIS, limit);
+  return calibration.save();
+}
+
+static int16_t limitOf(uint32_t save) { return 100 + save; }
+
+
+TEST(learnedRangeIsAppliedAndLoadedBack) {
+  SimulatedFlash flash;
+  {
+    JoystickCore joystick;
+    JoystickCalibration calibration(joystick, flash);
+    CHECK( learnAndSave(joystick, calibration, 300) );
+    CHECK_EQUAL( -300, joystick.axisMin.X );
+    CHECK_EQUAL( 300, joystick.axisMax.X );
+    CHECK_EQUAL( 1u, calibration.saves() );
+  }
+
+  JoystickCore joystick;
+  JoystickCalibration calibration(joystick, flash);
+  CHECK( calibration.calibrated(X_AXIS) );
+  CHECK( !calibration.calibrated(Y_AXIS) );
+  CHECK_EQUAL( -300, joystick.axisMin.X );
+  CHECK_EQUAL( 300, joystick.axisMax.X );
+}
+
+TEST(unchangedValuesAreNotWritten) {
+  SimulatedFlash flash;
+  JoystickCore joystick;
+  JoystickCalibration calibration(joystick, flash);
+  CHECK( learnAndSave(joystick, calibration, 300) );
+  CHECK( learnAndSave(joystick, calibration, 300) );
+  CHECK_EQUAL( 1u, flash.programs );
+}
+
+TEST(fullHalfIsErasedAfterTheSwitch) {
+  SimulatedFlash flash;
+  JoystickCore joystick;
+  JoystickCalibration calibration(joystick, flash);
+
+  // Fill the first half, the next save goes to the second one and only then erases the first.
+  for (uint32_t i=0; i < SLOTS_PER_HALF; i++) CHECK( learnAndSave(joystick, calibration, limitOf(i)) );
+  CHECK_EQUAL( 0u, flash.erases );
+  CHECK( learnAndSave(joystick, calibration, limitOf(SLOTS_PER_HALF)) );
+  CHECK_EQUAL( 1u, flash.erases );
+  CHECK_EQUAL( 0xFF, flash.data[0] );
+  CHECK( flash.data[SECTOR_SIZE] != 0xFF );
+
+  // And back to the first half.
+  for (uint32_t i=1; i <= SLOTS_PER_HALF; i++) CHECK( learnAndSave(joystick, calibration, limitOf(SLOTS_PER_HALF + i)) );
+  CHECK_EQUAL( 2u, flash.erases );
+  CHECK_EQUAL( 0xFF, flash.data[SECTOR_SIZE] );
+
+  JoystickCore reloaded;
+  JoystickCalibration loaded(reloaded, flash);
+  CHECK_EQUAL( limitOf(2 * SLOTS_PER_HALF), reloaded.axisMax.X );
+}
+
+TEST(powerLossAtAnyStepKeepsARecord) {
+  // Enough saves for two switches between the halves.
+  static const uint32_t SAVES = 2 * SLOTS_PER_HALF + 4;
+
+  uint32_t operations;
+  {
+    SimulatedFlash flash;
+    JoystickCore joystick;
+    JoystickCalibration calibration(joystick, flash);
+    for (uint32_t i=0; i < SAVES; i++) learnAndSave(joystick, calibration, limitOf(i));
+    operations = flash.programs + flash.erases;
+  }
+
+  for (uint32_t cut=0; cut < operations; cut++) {
+    SimulatedFlash flash;
+    int32_t saved = -1;   // Last save that completed.
+    {
+      JoystickCore joystick;
+      JoystickCalibration calibration(joystick, flash);
+      flash.powerLossAfter = cut;
+      for (uint32_t i=0; i < SAVES && !flash.off; i++) {
+        if (learnAndSave(joystick, calibration, limitOf(i))) saved = i;
+      }
+    }
+    flash.powerOn();
+
+    // The record of the last completed save, or of the one cut short if it got through.
+    JoystickCore joystick;
+    JoystickCalibration calibration(joystick, flash);
+    if (saved < 0) {
+      if (calibration.calibrated(X_AXIS)) CHECK_EQUAL( limitOf(0), calibration.maximum(X_AXIS) );
+      continue;
+    }
+    int16_t maximum = calibration.maximum(X_AXIS);
+    if (!CHECK( maximum == limitOf(saved) || maximum == limitOf(saved + 1) )) {
+      printf("power lost at operation %u, last save %d, loaded %d\n", cut, saved, maximum);
+      return;
+    }
+
+    // Saving goes on where it stopped.
+    CHECK( learnAndSave(joystick, calibration, limitOf(SAVES)) );
+    JoystickCore reloaded;
+    JoystickCalibration loaded(reloaded, flash);
+    CHECK_EQUAL( limitOf(SAVES), loaded.maximum(X_AXIS) );
+  }
+}
+
+TEST(samplesFromAnInterruptWidenTheRange) {
+  SimulatedFlash flash;
+  JoystickCore joystick;
+  JoystickCalibration calibration(joystick, flash);
+  {
+    host::InterruptContext interrupt;
+    joystick.setAxisRaw(Y_AXIS, 1000);
+    joystick.setAxisRaw(Y_AXIS, 3000);
+    CHECK( !calibration.save() );
+  }
+  CHECK_EQUAL( 1000, joystick.axisMin.Y );
+  CHECK_EQUAL( 3000, joystick.axisMax.Y );
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMaximum, joystick.axis.Y );
+  CHECK( calibration.save() );
+}
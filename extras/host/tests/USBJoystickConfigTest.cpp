@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include "HostTest.h"
+#include "USBJoystick.h"
+
+using namespace arduino;
+
+
+/*
+  Configuration commands from the host, written as output reports and applied by 'update', and
+  the configuration report read back as the host would.
+*/
+
+static const uint8_t CURVES_OFFSET = 9 + AXIS_COUNT * 12;
+
+
+/*
+  Read the configuration report into 'config', JoystickDevice::FEATURE_REPORT_LENGTH bytes.
+*/
+static void readConfig(const USBJoystick &joystick, uint8_t *config)
+{
+  CHECK_EQUAL( JoystickConfig::CONFIG_REPORT_LENGTH, joystick.featureReport(JoystickConfig::CONFIG_REPORT_ID, config) );
+  CHECK_EQUAL( JoystickConfig::CONFIG_REPORT_ID, config[0] );
+  CHECK_EQUAL( JoystickConfig::VERSION, config[1] );
+}
+
+static int16_t readS16(const uint8_t *data) { return static_cast<int16_t>(data[0] | (data[1] << 8)); }
+
+static void writeS16(uint8_t *data, int16_t value)
+{
+  data[0] = static_cast<uint16_t>(value);
+  data[1] = static_cast<uint16_t>(value) >> 8;
+}
+
+/*
+  Block of axis 'axisNumber' in the configuration report.
+*/
+static const uint8_t *axisBlock(const uint8_t *config, uint8_t axisNumber) { return config + 9 + axisNumber * 12; }
+
+/*
+  Write command 'command' for joystick 'index' with 'arguments' from byte 3 on, and apply it.
+
+  @returns the status of the command from the configuration report.
+*/
+static uint8_t execute(USBJoystick &joystick, uint8_t command, const uint8_t *arguments, uint8_t length, uint8_t index = 0)
+{
+  uint8_t report[ JoystickConfig::COMMAND_LENGTH ] = { JoystickConfig::COMMAND_REPORT_ID, command, index };
+  if (length > 0) memcpy(report + 3, arguments, length);
+  CHECK( joystick.hostReport(report, sizeof(report)) );
+  joystick.update();
+
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  return config[7];
+}
+
+static uint8_t curveSlot(const USBJoystick &joystick, uint8_t axisNumber)
+{
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  joystick.featureReport(JoystickConfig::CONFIG_REPORT_ID, config);
+  return config[ CURVES_OFFSET + axisNumber ];
+}
+
+/*
+  Mapped value of 'raw' on X, range 0 ... 1000.
+*/
+static int16_t xAt(USBJoystick &joystick, int32_t raw)
+{
+  joystick.setAxisRaw(X_AXIS, raw);
+  return joystick.axis.X;
+}
+
+
+TEST(axesStartLinear) {
+  USBJoystick joystick;
+  for (uint8_t i=0; i < AXIS_COUNT; i++) CHECK_EQUAL( JoystickConfig::NO_CURVE, curveSlot(joystick, i) );
+}
+
+TEST(loadedExpoFlattensTheCenter) {
+  USBJoystick joystick;
+  joystick.setXAxisRange(0, 1000);
+  int16_t linear = xAt(joystick, 600);
+
+  const uint8_t load[] = { 1, JoystickConfig::CURVE_EXPO, 100 };
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::LOAD_CURVE, load, sizeof(load)) );
+  const uint8_t select[] = { X_AXIS, 1 };
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_CURVE, select, sizeof(select)) );
+  CHECK_EQUAL( 1, curveSlot(joystick, X_AXIS) );
+  CHECK_EQUAL( JoystickConfig::NO_CURVE, curveSlot(joystick, Y_AXIS) );
+
+  // x^3 at 0.2 from the center is 0.008, close to the center value.
+  int16_t center = xAt(joystick, 500);
+  int16_t curved = xAt(joystick, 600);
+  CHECK( curved < linear );
+  CHECK( curved - center <= 2 * (linear - center) / 10 );
+  // The ends stay where they were.
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMaximum, xAt(joystick, 1000) );
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMinimum, xAt(joystick, 0) );
+
+  const uint8_t linearAgain[] = { X_AXIS, JoystickConfig::NO_CURVE };
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_CURVE, linearAgain, sizeof(linearAgain)) );
+  CHECK_EQUAL( linear, xAt(joystick, 600) );
+}
+
+TEST(uploadedTableIsUsedAsAWhole) {
+  USBJoystick joystick;
+  joystick.setXAxisRange(0, 1000);
+
+  // Inverted line, 5 points per command.
+  for (uint8_t first=0; first < JoystickCurve::POINTS; first += 5) {
+    uint8_t count = (JoystickCurve::POINTS - first < 5) ? JoystickCurve::POINTS - first : 5;
+    uint8_t points[3 + 10] = { 2, first, count };
+    for (uint8_t i=0; i < count; i++) {
+      uint16_t output = JoystickCurve::ONE - (first + i) * (JoystickCurve::ONE / JoystickCurve::SEGMENTS);
+      points[3 + 2 * i] = output & 0xFF;
+      points[4 + 2 * i] = output >> 8;
+    }
+    CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_CURVE_POINTS, points, 3 + 2 * count) );
+  }
+
+  const uint8_t select[] = { 0xFF, 2 };
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_CURVE, select, sizeof(select)) );
+  for (uint8_t i=0; i < AXIS_COUNT; i++) CHECK_EQUAL( 2, curveSlot(joystick, i) );
+
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMinimum, xAt(joystick, 1000) );
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMaximum, xAt(joystick, 0) );
+}
+
+TEST(curveCommandsCheckTheirArguments) {
+  USBJoystick joystick;
+
+  const uint8_t badSlot[] = { JoystickConfig::CURVE_SLOTS, JoystickConfig::CURVE_EXPO, 50 };
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::LOAD_CURVE, badSlot, sizeof(badSlot)) );
+  const uint8_t badShape[] = { 0, 9, 50 };
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::LOAD_CURVE, badShape, sizeof(badShape)) );
+  const uint8_t badAmount[] = { 0, JoystickConfig::CURVE_S, 101 };
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::LOAD_CURVE, badAmount, sizeof(badAmount)) );
+
+  // Past the end of the table, and above ONE.
+  const uint8_t pastEnd[] = { 0, JoystickCurve::POINTS - 1, 2, 0x00, 0x00, 0x00, 0x00 };
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_CURVE_POINTS, pastEnd, sizeof(pastEnd)) );
+  const uint8_t aboveOne[] = { 0, 0, 1, 0x01, 0x80 };
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_CURVE_POINTS, aboveOne, sizeof(aboveOne)) );
+  const uint8_t noPoints[] = { 0, 0, 0 };
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_CURVE_POINTS, noPoints, sizeof(noPoints)) );
+
+  const uint8_t badSelect[] = { X_AXIS, JoystickConfig::CURVE_SLOTS };
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_CURVE, badSelect, sizeof(badSelect)) );
+  CHECK_EQUAL( JoystickConfig::NO_CURVE, curveSlot(joystick, X_AXIS) );
+}
+
+TEST(curveOfTheSketchIsReportedAsOther) {
+  static const JoystickCurve curve = JoystickCurve::sCurve(0.5f);
+  USBJoystick joystick;
+  joystick.setAxisCurve(Z_AXIS, &curve);
+  CHECK_EQUAL( JoystickConfig::OTHER_CURVE, curveSlot(joystick, Z_AXIS) );
+}
+
+
+TEST(axisRangeSetsOneAxisOrAll) {
+  USBJoystick joystick;
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  int16_t minimum = readS16(axisBlock(config, Y_AXIS));
+  int16_t maximum = readS16(axisBlock(config, Y_AXIS) + 2);
+
+  uint8_t range[5] = { X_AXIS };
+  writeS16(range + 1, -200);
+  writeS16(range + 3, 300);
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_AXIS_RANGE, range, sizeof(range)) );
+  readConfig(joystick, config);
+  CHECK_EQUAL( -200, readS16(axisBlock(config, X_AXIS)) );
+  CHECK_EQUAL( 300, readS16(axisBlock(config, X_AXIS) + 2) );
+  CHECK_EQUAL( minimum, readS16(axisBlock(config, Y_AXIS)) );
+  CHECK_EQUAL( maximum, readS16(axisBlock(config, Y_AXIS) + 2) );
+
+  range[0] = 0xFF;
+  writeS16(range + 1, 10);
+  writeS16(range + 3, 20);
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_AXIS_RANGE, range, sizeof(range)) );
+  readConfig(joystick, config);
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    CHECK_EQUAL( 10, readS16(axisBlock(config, i)) );
+    CHECK_EQUAL( 20, readS16(axisBlock(config, i) + 2) );
+  }
+}
+
+TEST(axisRangeChecksItsArguments) {
+  USBJoystick joystick;
+  joystick.setXAxisRange(0, 1000);
+
+  uint8_t range[5] = { X_AXIS };
+  writeS16(range + 1, 500);
+  writeS16(range + 3, 500);
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_AXIS_RANGE, range, sizeof(range)) );
+  writeS16(range + 3, -500);
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_AXIS_RANGE, range, sizeof(range)) );
+  range[0] = AXIS_COUNT;
+  writeS16(range + 3, 600);
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_AXIS_RANGE, range, sizeof(range)) );
+
+  // Nothing changed.
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  CHECK_EQUAL( 0, readS16(axisBlock(config, X_AXIS)) );
+  CHECK_EQUAL( 1000, readS16(axisBlock(config, X_AXIS) + 2) );
+}
+
+TEST(flagsChangeOnlyTheMaskedOnes) {
+  USBJoystick joystick;
+  joystick.sendBlocking = true;
+  joystick.autoSend = true;
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  CHECK_EQUAL( JoystickConfig::FLAG_SEND_BLOCKING | JoystickConfig::FLAG_AUTO_SEND, config[4] );
+
+  const uint8_t noAutoSend[] = { JoystickConfig::FLAG_AUTO_SEND, 0x00 };
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_FLAGS, noAutoSend, sizeof(noAutoSend)) );
+  CHECK( joystick.sendBlocking );
+  CHECK( !joystick.autoSend );
+  readConfig(joystick, config);
+  CHECK_EQUAL( JoystickConfig::FLAG_SEND_BLOCKING, config[4] );
+
+  const uint8_t swap[] = { JoystickConfig::FLAG_SEND_BLOCKING | JoystickConfig::FLAG_AUTO_SEND, JoystickConfig::FLAG_AUTO_SEND };
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_FLAGS, swap, sizeof(swap)) );
+  CHECK( !joystick.sendBlocking );
+  CHECK( joystick.autoSend );
+  readConfig(joystick, config);
+  CHECK_EQUAL( JoystickConfig::FLAG_AUTO_SEND, config[4] );
+}
+
+TEST(filterSettingsReadBack) {
+  USBJoystick joystick;
+  uint8_t filter[10] = { Z_AXIS };
+  writeS16(filter + 1, 300);
+  writeS16(filter + 3, -100);
+  writeS16(filter + 5, 20);
+  filter[7] = 4;
+  filter[8] = 8;
+  filter[9] = 1;
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_FILTER, filter, sizeof(filter)) );
+  CHECK_EQUAL( 8, joystick.axisFilter(Z_AXIS).oversampling() );
+  CHECK( joystick.axisFilter(Z_AXIS).decimating() );
+
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  const uint8_t *block = axisBlock(config, Z_AXIS);
+  CHECK_EQUAL( 300, readS16(block + 4) );
+  CHECK_EQUAL( -100, readS16(block + 6) );
+  CHECK_EQUAL( 20, readS16(block + 8) );
+  CHECK_EQUAL( 4, block[10] );
+  CHECK_EQUAL( 8, block[11] );
+  // The other axes keep no filter; 0 samples reads back as 1.
+  CHECK_EQUAL( 0, readS16(axisBlock(config, X_AXIS) + 4) );
+  CHECK_EQUAL( 1, axisBlock(config, X_AXIS)[11] );
+}
+
+TEST(filterChecksItsArguments) {
+  USBJoystick joystick;
+  uint8_t filter[10] = { X_AXIS };
+  writeS16(filter + 1, -1);
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_FILTER, filter, sizeof(filter)) );
+  writeS16(filter + 1, 0);
+  writeS16(filter + 5, -1);
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_FILTER, filter, sizeof(filter)) );
+  writeS16(filter + 5, 0);
+  filter[7] = 16;
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_FILTER, filter, sizeof(filter)) );
+  filter[7] = 0;
+  filter[8] = JoystickAxisFilter::OVERSAMPLE_MAX + 1;
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_FILTER, filter, sizeof(filter)) );
+  filter[8] = 0;
+  filter[0] = AXIS_COUNT;
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SET_FILTER, filter, sizeof(filter)) );
+
+  filter[0] = X_AXIS;
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_FILTER, filter, sizeof(filter)) );
+  CHECK( !joystick.axisFilter(X_AXIS).enabled() );
+}
+
+TEST(keepAliveReadsBackSaturated) {
+  USBJoystick joystick;
+  const uint8_t interval[] = { 0x34, 0x12 };
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_KEEP_ALIVE, interval, sizeof(interval)) );
+  CHECK_EQUAL( 0x1234u, joystick.keepAliveInterval );
+
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  CHECK_EQUAL( 0x34, config[5] );
+  CHECK_EQUAL( 0x12, config[6] );
+
+  // Set by the sketch beyond what the report holds.
+  joystick.keepAliveInterval = 100000;
+  readConfig(joystick, config);
+  CHECK_EQUAL( 0xFF, config[5] );
+  CHECK_EQUAL( 0xFF, config[6] );
+}
+
+TEST(selectPicksTheReportedJoystick) {
+  USBJoystick joystick;
+  JoystickCore second(USBJoystickLayout<8, AXIS_X | AXIS_Y, 8>::layout);
+  CHECK( joystick.addJoystick(second) );
+  joystick.keepAliveInterval = 10;
+  second.keepAliveInterval = 20;
+  second.sendBlocking = false;
+  second.autoSend = false;
+  second.setAxisRange(X_AXIS, -5, 5);
+
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  CHECK_EQUAL( 0, config[2] );
+  CHECK_EQUAL( 2, config[3] );
+  CHECK_EQUAL( 10, config[5] );
+
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SELECT, nullptr, 0, 1) );
+  readConfig(joystick, config);
+  CHECK_EQUAL( 1, config[2] );
+  CHECK_EQUAL( 2, config[3] );
+  CHECK_EQUAL( 0, config[4] );
+  CHECK_EQUAL( 20, config[5] );
+  CHECK_EQUAL( -5, readS16(axisBlock(config, X_AXIS)) );
+  CHECK_EQUAL( 5, readS16(axisBlock(config, X_AXIS) + 2) );
+
+  // A command for a joystick selects it too; one past the last is refused and keeps the selection.
+  const uint8_t interval[] = { 30, 0 };
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SET_KEEP_ALIVE, interval, sizeof(interval), 0) );
+  readConfig(joystick, config);
+  CHECK_EQUAL( 0, config[2] );
+  CHECK_EQUAL( 30, config[5] );
+  CHECK_EQUAL( 20u, second.keepAliveInterval );
+  CHECK_EQUAL( JoystickConfig::STATUS_BAD_ARGUMENT, execute(joystick, JoystickConfig::SELECT, nullptr, 0, 2) );
+  readConfig(joystick, config);
+  CHECK_EQUAL( 0, config[2] );
+}
+
+TEST(statusAndCountFollowTheCommands) {
+  USBJoystick joystick;
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, config[7] );
+  uint8_t applied = config[8];
+
+  CHECK_EQUAL( JoystickConfig::STATUS_UNKNOWN_COMMAND, execute(joystick, 0x7F, nullptr, 0) );
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, execute(joystick, JoystickConfig::SELECT, nullptr, 0) );
+  readConfig(joystick, config);
+  CHECK_EQUAL( uint8_t(applied + 2), config[8] );
+
+  // Only command reports are taken.
+  uint8_t other[ JoystickConfig::COMMAND_LENGTH ] = { JoystickConfig::CONFIG_REPORT_ID, JoystickConfig::SELECT };
+  CHECK( !joystick.hostReport(other, sizeof(other)) );
+  joystick.update();
+  readConfig(joystick, config);
+  CHECK_EQUAL( uint8_t(applied + 2), config[8] );
+}
+
+TEST(fullQueueDropsTheCommandAndReportsOverflow) {
+  USBJoystick joystick;
+  joystick.autoSend = false;
+  uint8_t config[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  readConfig(joystick, config);
+  uint8_t applied = config[8];
+
+  // Nothing applies them until 'update', the queue holds QUEUE_LENGTH commands.
+  uint8_t report[ JoystickConfig::COMMAND_LENGTH ] = { JoystickConfig::COMMAND_REPORT_ID, JoystickConfig::SET_KEEP_ALIVE, 0 };
+  for (uint8_t i=0; i < JoystickConfig::QUEUE_LENGTH; i++) {
+    report[3] = 100 + i;
+    CHECK( joystick.hostReport(report, sizeof(report)) );
+  }
+  report[3] = 200;
+  CHECK( !joystick.hostReport(report, sizeof(report)) );
+  readConfig(joystick, config);
+  CHECK_EQUAL( JoystickConfig::STATUS_OVERFLOW, config[7] );
+  CHECK_EQUAL( applied, config[8] );
+
+  // The queued ones apply in order, the dropped one never does.
+  joystick.update();
+  readConfig(joystick, config);
+  CHECK_EQUAL( JoystickConfig::STATUS_OK, config[7] );
+  CHECK_EQUAL( uint8_t(applied + JoystickConfig::QUEUE_LENGTH), config[8] );
+  CHECK_EQUAL( 100u + JoystickConfig::QUEUE_LENGTH - 1, joystick.keepAliveInterval );
+
+  // Room again.
+  CHECK( joystick.hostReport(report, sizeof(report)) );
+  joystick.update();
+  CHECK_EQUAL( 200u, joystick.keepAliveInterval );
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <vector>
+#include "HostTest.h"
+#include "USBJoystick.h"
+#include "USBJoystickTransport.h"
+
+using namespace arduino;
+
+
+/*
+  Several logical joysticks in one device: which reports one 'update' sends and in which order, by
+  priority and in turns, each joystick with its own changes and keep-alive.
+*/
+
+/*
+  The first joystick of the device and two more, nothing sent automatically and nothing unsent.
+*/
+struct Device {
+  USBJoystick first;
+  JoystickCore second;
+  JoystickCore third;
+
+  Device(void) : second(USBJoystickLayout<8, AXIS_X | AXIS_Y, 8>::layout), third(USBJoystickLayout<16, AXIS_X, 8>::layout) {
+    CHECK( first.addJoystick(second) );
+    CHECK( first.addJoystick(third) );
+    for (JoystickCore *joystick : { static_cast<JoystickCore *>(&first), &second, &third }) {
+      joystick->autoSend = false;
+      joystick->keepAliveInterval = 0;
+    }
+    first.update();
+    host::clearSentReports();
+  }
+
+  // Report IDs sent by one 'update', in order.
+  std::vector<uint8_t> update(void) {
+    host::clearSentReports();
+    CHECK( this->first.update() );
+    std::vector<uint8_t> ids;
+    for (const host::Report &report : host::sentReports()) ids.push_back(report[0]);
+    return ids;
+  }
+
+  void changeAll(void) {
+    this->first.toggleButton(0);
+    this->second.toggleButton(0);
+    this->third.toggleButton(0);
+  }
+} ;
+
+static std::vector<uint8_t> ids(std::initializer_list<uint8_t> list) { return std::vector<uint8_t>(list); }
+
+
+TEST(eachJoystickSendsItsOwnReport) {
+  Device device;
+  CHECK_EQUAL( 3, device.first.joystickCount() );
+  CHECK_EQUAL( device.first.reportId() + 1, device.second.reportId() );
+  CHECK_EQUAL( device.first.reportId() + 2, device.third.reportId() );
+
+  device.second.pressButton(3);
+  CHECK( device.update() == ids({ device.second.reportId() }) );
+  CHECK_EQUAL( 0x08, host::sentReports()[0][1] );
+
+  device.third.setAxisRaw(X_AXIS, 10);
+  device.first.pressButton(1);
+  std::vector<uint8_t> sent = device.update();
+  CHECK_EQUAL( 2u, sent.size() );
+  CHECK( sent == ids({ device.first.reportId(), device.third.reportId() }) ||
+         sent == ids({ device.third.reportId(), device.first.reportId() }) );
+
+  // Nothing left, and 'update' of any of them sends for the whole device.
+  CHECK( device.update().empty() );
+  device.first.pressButton(2);
+  host::clearSentReports();
+  device.third.update();
+  CHECK_EQUAL( 1u, host::sentCount() );
+  CHECK_EQUAL( device.first.reportId(), host::sentReports()[0][0] );
+}
+
+TEST(higherPriorityGoesFirst) {
+  Device device;
+  device.first.priority = 0;
+  device.second.priority = 5;
+  device.third.priority = 2;
+  for (uint8_t i=0; i < 3; i++) {   // Whatever joystick the turn starts from.
+    device.changeAll();
+    CHECK( device.update() == ids({ device.second.reportId(), device.third.reportId(), device.first.reportId() }) );
+  }
+}
+
+TEST(equalPrioritiesTakeTurns) {
+  Device device;
+  const std::vector<uint8_t> all = ids({ device.first.reportId(), device.second.reportId(), device.third.reportId() });
+
+  // Every update that sends starts one joystick further along.
+  device.changeAll();
+  std::vector<uint8_t> sent = device.update();
+  if (!CHECK_EQUAL( 3u, sent.size() )) return;
+  uint8_t start = sent[0] - all[0];
+  for (uint8_t round=0; round < 6; round++) {
+    for (uint8_t k=0; k < 3; k++) CHECK_EQUAL( all[ (start + k) % 3 ], sent[k] );
+    device.changeAll();
+    sent = device.update();
+    start = (start + 1) % 3;
+  }
+
+  // Equal among themselves, behind a higher one.
+  device.third.priority = 1;
+  for (uint8_t round=0; round < 2; round++) {
+    device.changeAll();
+    sent = device.update();
+    start = (start + 1) % 3;
+    CHECK_EQUAL( all[2], sent[0] );
+    CHECK_EQUAL( (start == 1) ? all[1] : all[0], sent[1] );
+  }
+}
+
+TEST(failedSendKeepsTheRestForTheNextUpdate) {
+  Device device;
+  device.second.priority = 1;
+  device.changeAll();
+
+  host::failSends(true);
+  host::clearSentReports();
+  CHECK( !device.first.update() );
+  host::failSends(false);
+
+  // All three are still due.
+  std::vector<uint8_t> sent = device.update();
+  CHECK_EQUAL( 3u, sent.size() );
+  CHECK_EQUAL( device.second.reportId(), sent[0] );
+  CHECK( device.update().empty() );
+}
+
+/*
+  Endpoint that takes 'accept' reports per 'update' and is busy after that.
+*/
+class BusyTransport : public JoystickTransport {
+public:
+  uint8_t accept = 1;
+  uint8_t taken = 0;
+  std::vector<uint8_t> ids;
+
+  virtual bool sendReport(const uint8_t *report, uint8_t, bool) {
+    if (this->taken >= this->accept) return false;
+    this->taken++;
+    this->ids.push_back(report[0]);
+    return true;
+  }
+} ;
+
+TEST(busyEndpointServesEqualPrioritiesInTurn) {
+  BusyTransport transport;
+  JoystickDevice first(USBJoystickLayout<>::layout, transport);
+  JoystickCore second(USBJoystickLayout<8, AXIS_X, 8>::layout);
+  JoystickCore third(USBJoystickLayout<8, AXIS_X, 8>::layout);
+  first.addJoystick(second);
+  first.addJoystick(third);
+  for (JoystickCore *joystick : { static_cast<JoystickCore *>(&first), &second, &third }) {
+    joystick->autoSend = false;
+    joystick->keepAliveInterval = 0;
+  }
+
+  // One report per update while all three keep changing: each gets every third report, none starves.
+  uint32_t counts[3] = { 0, 0, 0 };
+  for (uint8_t round=0; round < 30; round++) {
+    first.toggleButton(0);
+    second.toggleButton(0);
+    third.toggleButton(0);
+    transport.taken = 0;
+    first.update();
+  }
+  CHECK_EQUAL( 30u, transport.ids.size() );
+  for (uint8_t id : transport.ids) counts[ id - first.reportId() ]++;
+  for (uint32_t count : counts) CHECK_EQUAL( 10u, count );
+
+  // The two not sent in the last round stay dirty: once the changes stop, they go out once each.
+  uint8_t last = transport.ids.back();
+  transport.ids.clear();
+  for (uint8_t round=0; round < 4; round++) {
+    transport.taken = 0;
+    first.update();
+  }
+  if (!CHECK_EQUAL( 2u, transport.ids.size() )) return;
+  CHECK( transport.ids[0] != last && transport.ids[1] != last && transport.ids[0] != transport.ids[1] );
+}
+
+TEST(keepAliveIsPerJoystick) {
+  Device device;
+  device.second.keepAliveInterval = 10;
+  device.third.keepAliveInterval = 25;
+
+  host::setTime(0);
+  device.changeAll();
+  device.update();
+
+  std::vector<uint8_t> sent;
+  for (uint32_t now=1; now <= 50; now++) {
+    host::setTime(now);
+    std::vector<uint8_t> step = device.update();
+    sent.insert(sent.end(), step.begin(), step.end());
+  }
+  uint32_t first = 0, second = 0, third = 0;
+  for (uint8_t id : sent) {
+    if (id == device.first.reportId()) first++;
+    if (id == device.second.reportId()) second++;
+    if (id == device.third.reportId()) third++;
+  }
+  CHECK_EQUAL( 0u, first );
+  CHECK_EQUAL( 5u, second );
+  CHECK_EQUAL( 2u, third );
+
+  // A change sends only the joystick that changed, and restarts its own keep-alive.
+  host::setTime(55);
+  device.third.toggleButton(1);
+  CHECK( device.update() == ids({ device.third.reportId() }) );
+  host::setTime(75);
+  CHECK( device.update() == ids({ device.second.reportId() }) );
+  host::setTime(80);
+  CHECK( device.update() == ids({ device.third.reportId() }) );
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include "HostTest.h"
+#include "USBJoystickEncoder.h"
+
+using namespace arduino;
+
+
+/*
+  Encoders fed with simulated quadrature waveforms through 'edge': the decoding, the starting state
+  of NO_PIN encoders, missed edges, the axis and button output, and a waveform from an interrupt
+  thread running as fast as the host goes while the loop polls.
+*/
+
+// A B of each quarter step, counting up.
+static const bool WAVE_A[4] = { false, false, true, true };
+static const bool WAVE_B[4] = { false, true, true, false };
+
+/*
+  Quadrature waveform of one encoder, one edge per call.
+*/
+class Waveform {
+public:
+  Waveform(JoystickEncoders &encoders, uint8_t encoder) : _encoders(encoders), _encoder(encoder) { }
+
+  void start(void) { this->_encoders.edge(this->_encoder, WAVE_A[this->_phase], WAVE_B[this->_phase]); }
+
+  void step(int8_t direction) {
+    this->_phase = (this->_phase + direction) & 0x03;
+    this->_encoders.edge(this->_encoder, WAVE_A[this->_phase], WAVE_B[this->_phase]);
+  }
+
+  void steps(int32_t count) {
+    for (int32_t i=0; i < abs(count); i++) this->step((count > 0) ? 1 : -1);
+  }
+
+  void phase(uint8_t phase) { this->_phase = phase & 0x03; }
+
+private:
+  JoystickEncoders &_encoders;
+  uint8_t _encoder;
+  uint8_t _phase = 0;
+} ;
+
+
+TEST(quarterStepsMakeDetents) {
+  JoystickCore joystick;
+  joystick.setXAxisRange(-1000, 1000);
+  JoystickEncoders encoders(joystick);
+  uint8_t encoder = encoders.addAxis(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, X_AXIS, 10);
+  Waveform wave(encoders, encoder);
+  wave.start();
+
+  wave.steps(3);
+  encoders.poll();
+  CHECK_EQUAL( 0, encoders.position(encoder) );   // Short of a detent, kept for the next poll.
+  wave.steps(5);
+  encoders.poll();
+  CHECK_EQUAL( 20, encoders.position(encoder) );
+  wave.steps(-9);
+  encoders.poll();
+  CHECK_EQUAL( 0, encoders.position(encoder) );
+  CHECK_EQUAL( 0u, encoders.errors(encoder) );
+}
+
+TEST(firstEdgeOfANoPinEncoderIsItsStart) {
+  JoystickCore joystick;
+  joystick.setXAxisRange(-1000, 1000);
+  JoystickEncoders encoders(joystick);
+  uint8_t encoder = encoders.addAxis(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, X_AXIS, 1, 0, 1);
+
+  // Resting at A high, B low: neither a step from 00 nor a missed edge.
+  Waveform wave(encoders, encoder);
+  wave.phase(3);
+  wave.start();
+  encoders.poll();
+  CHECK_EQUAL( 0, encoders.position(encoder) );
+  CHECK_EQUAL( 0u, encoders.errors(encoder) );
+
+  wave.steps(2);
+  encoders.poll();
+  CHECK_EQUAL( 2, encoders.position(encoder) );
+
+  // Starting from 11 is not a missed edge either.
+  uint8_t other = encoders.addAxis(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, Y_AXIS, 1, 0, 1);
+  encoders.edge(other, true, true);
+  CHECK_EQUAL( 0u, encoders.errors(other) );
+}
+
+TEST(bothPinsChangingIsAMissedEdge) {
+  JoystickCore joystick;
+  JoystickEncoders encoders(joystick);
+  uint8_t encoder = encoders.addAxis(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, X_AXIS, 1, 0, 1);
+  encoders.edge(encoder, false, false);
+  encoders.edge(encoder, true, true);
+  encoders.edge(encoder, false, false);
+  encoders.poll();
+  CHECK_EQUAL( 2u, encoders.errors(encoder) );
+  CHECK_EQUAL( 0, encoders.position(encoder) );
+}
+
+TEST(axisPositionIsClampedToTheRange) {
+  JoystickCore joystick(USBJoystickLayout<>::layout);
+  joystick.setXAxisRange(0, 100);
+  JoystickEncoders encoders(joystick);
+  uint8_t encoder = encoders.addAxis(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, X_AXIS, 30, 50);
+  Waveform wave(encoders, encoder);
+  wave.start();
+
+  wave.steps(3 * 4);
+  encoders.poll();
+  CHECK_EQUAL( 100, encoders.position(encoder) );
+  CHECK_EQUAL( USBJoystickLayout<>::layout.axisMaximum, joystick.axis.X );
+
+  // Back from the end right away, the detents past it are not stored.
+  wave.steps(-4);
+  encoders.poll();
+  CHECK_EQUAL( 70, encoders.position(encoder) );
+}
+
+TEST(buttonEncoderPulsesEveryDetent) {
+  JoystickCore joystick;
+  JoystickEncoders encoders(joystick);
+  encoders.pulseLength = 20;
+  uint8_t encoder = encoders.addButtons(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, 4, 5);
+  Waveform wave(encoders, encoder);
+  wave.start();
+
+  wave.steps(3 * 4);
+  uint32_t presses = 0;
+  bool pressed = false;
+  for (uint32_t now=0; now < 200; now++) {
+    encoders.poll(now);
+    bool up = joystick.buttonState[0] & 0x10;
+    if (up && !pressed) presses++;
+    pressed = up;
+    CHECK( !(joystick.buttonState[0] & 0x20) );
+  }
+  CHECK_EQUAL( 3u, presses );
+  CHECK_EQUAL( 0, encoders.pendingPulses(encoder) );
+
+  // Turning back cancels the detents still waiting.
+  wave.steps(2 * 4);
+  encoders.poll(200);
+  wave.steps(-3 * 4);
+  encoders.poll(201);
+  CHECK_EQUAL( -2, encoders.pendingPulses(encoder) );
+}
+
+TEST(fastWaveformFromAnInterruptLosesNoSteps) {
+  static const int32_t QUARTER_STEPS = 100000;
+
+  JoystickCore joystick;
+  joystick.setXAxisRange(-30000, 30000);
+  JoystickEncoders encoders(joystick);
+  uint8_t axis = encoders.addAxis(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, X_AXIS, 1);
+  uint8_t buttons = encoders.addButtons(JoystickEncoders::NO_PIN, JoystickEncoders::NO_PIN, 0, 1);
+
+  // Forward, back a little and forward again, each edge its own interrupt, with no pause between
+  // them: the loop polls while the counters are being added to.
+  std::atomic<bool> done(false);
+  std::thread interrupts([&] {
+    Waveform axisWave(encoders, axis);
+    Waveform buttonWave(encoders, buttons);
+    {
+      host::InterruptContext interrupt;
+      axisWave.start();
+      buttonWave.start();
+    }
+    const int32_t legs[] = { QUARTER_STEPS / 2, -QUARTER_STEPS / 8, QUARTER_STEPS / 4 };
+    for (int32_t leg : legs) {
+      for (int32_t i=0; i < abs(leg); i++) {
+        host::InterruptContext interrupt;
+        axisWave.step((leg > 0) ? 1 : -1);
+        buttonWave.step((leg > 0) ? 1 : -1);
+      }
+    }
+    done = true;
+  });
+
+  // Up presses less down presses, seen after every poll; a press lasts at least one poll.
+  int32_t presses = 0;
+  uint8_t held = 0;
+  auto poll = [&](uint32_t now) {
+    encoders.poll(now);
+    uint8_t buttonsNow = joystick.buttonState[0] & 0x03;
+    if ((buttonsNow & ~held) & 0x01) presses++;
+    if ((buttonsNow & ~held) & 0x02) presses--;
+    held = buttonsNow;
+  };
+
+  uint32_t now = 0;
+  for (; !done.load(); now++) poll(now);
+  interrupts.join();
+  poll(now);
+
+  const int32_t detents = (QUARTER_STEPS / 2 - QUARTER_STEPS / 8 + QUARTER_STEPS / 4) / 4;
+  CHECK_EQUAL( detents, encoders.position(axis) );
+  CHECK_EQUAL( 0u, encoders.errors(axis) );
+  CHECK_EQUAL( 0u, encoders.errors(buttons) );
+
+  // Every detent still waiting is pulsed in turn, none was dropped.
+  while (encoders.pendingPulses(buttons) != 0 || held != 0) poll(now += encoders.pulseLength);
+  CHECK_EQUAL( detents, presses );
+}
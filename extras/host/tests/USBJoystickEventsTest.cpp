@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include "HostTest.h"
+#include "USBJoystickTransport.h"
+
+using namespace arduino;
+
+
+/*
+  The event queue between the setters and the reports: every press reaches the host as a report with
+  the button down, also when it is released before the next report and when the setters run
+  in the middle of an 'update', see 'host::interleaveAfter'.
+*/
+
+typedef USBJoystickLayout<8, AXIS_X, 8> EventLayout;
+
+static const uint8_t BUTTON_OFFSET = 1;
+
+
+
+/*
+  Counts the presses the host sees: reports where a button is down after a report where it was up.
+*/
+class PressCountingTransport : public JoystickTransport {
+public:
+  uint32_t presses[ 8 ] = { };
+  uint32_t reports = 0;
+
+  virtual bool sendReport(const uint8_t *report, uint8_t, bool) {
+    uint8_t pressed = report[BUTTON_OFFSET] & ~this->_previous;
+    for (uint8_t i=0; i < 8; i++) {
+      if (pressed & (0x01 << i)) this->presses[i]++;
+    }
+    this->_previous = report[BUTTON_OFFSET];
+    this->reports++;
+    return true;
+  }
+
+private:
+  uint8_t _previous = 0;
+} ;
+
+
+TEST(pressAndReleaseBetweenReportsAreBothSent) {
+  PressCountingTransport transport;
+  JoystickDevice joystick(EventLayout::layout, transport);
+  JoystickEventQueue events;
+  joystick.setEventQueue(&events);
+  joystick.autoSend = false;
+  joystick.update();
+
+  joystick.pressButton(2);
+  joystick.toggleButton(3);
+  joystick.releaseButton(2);
+  joystick.toggleButton(3);
+
+  // Both down in one report, both up in the next.
+  CHECK( joystick.update() );
+  CHECK_EQUAL( 1u, transport.presses[2] );
+  CHECK_EQUAL( 1u, transport.presses[3] );
+  CHECK( joystick.update() );
+  CHECK( events.empty() );
+  CHECK_EQUAL( 3u, transport.reports );
+  joystick.update();
+  CHECK_EQUAL( 3u, transport.reports );
+}
+
+/*
+  Run 'change' once for every atomic operation in it, with the sender's 'update' run right after that
+  operation, as if the report pump had preempted the setter there. Every run must show the host
+  'presses' presses of 'button'.
+*/
+template<typename Change>
+static void checkEveryInterleaving(Change change, uint8_t button, uint32_t presses)
+{
+  for (uint32_t step=1; ; step++) {
+    PressCountingTransport transport;
+    JoystickDevice joystick(EventLayout::layout, transport);
+    JoystickEventQueue events;
+    joystick.setEventQueue(&events);
+    joystick.autoSend = false;
+    joystick.update();
+
+    host::interleaveAfter(step, [&joystick] { joystick.update(); });
+    change(joystick);
+    bool interleaved = host::interleaveAfter(0, nullptr);
+
+    // Each report takes at least one event, then one more for the latest state.
+    for (uint32_t i=0; i <= JoystickEventQueue::CAPACITY; i++) joystick.update();
+
+    if (!CHECK_EQUAL( presses, transport.presses[button] )) {
+      printf("  with 'update' after atomic operation %u of the setters\n", step);
+    }
+    CHECK( events.empty() );
+    if (!interleaved) return;   // 'step' is past the last operation.
+  }
+}
+
+TEST(pressAndReleaseSurviveEveryInterleaving) {
+  checkEveryInterleaving( [](JoystickDevice &joystick) {
+    joystick.pressButton(1);
+    joystick.releaseButton(1);
+  }, 1, 1 );
+
+  checkEveryInterleaving( [](JoystickDevice &joystick) {
+    joystick.pressButton(1);
+    joystick.releaseButton(1);
+    joystick.pressButton(1);
+    joystick.releaseButton(1);
+  }, 1, 2 );
+}
+
+TEST(togglesSurviveEveryInterleaving) {
+  checkEveryInterleaving( [](JoystickDevice &joystick) {
+    joystick.toggleButton(4);
+    joystick.toggleButton(4);
+  }, 4, 1 );
+}
+
+TEST(buttonWordsSurviveEveryInterleaving) {
+  checkEveryInterleaving( [](JoystickDevice &joystick) {
+    joystick.setButtons(0x80);
+    joystick.setButtons(0x00);
+  }, 7, 1 );
+
+  checkEveryInterleaving( [](JoystickDevice &joystick) {
+    uint8_t pressed = 0x20;
+    uint8_t released = 0x00;
+    joystick.setButtonBytes(0, &pressed, 1);
+    joystick.setButtonBytes(0, &released, 1);
+  }, 5, 1 );
+}
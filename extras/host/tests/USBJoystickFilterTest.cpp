@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <math.h>
+#include <stdlib.h>
+#include "HostTest.h"
+#include "USBJoystickFilter.h"
+
+using namespace arduino;
+
+
+/*
+  The stages of 'JoystickAxisFilter' one at a time, on the logical range of the default layout,
+  with negative values as much as positive ones.
+*/
+
+static const int16_t RANGE_MIN = -2047;
+static const int16_t RANGE_MAX = 2047;
+
+
+static JoystickAxisFilter rangedFilter(void)
+{
+  JoystickAxisFilter filter;
+  filter.setRange(RANGE_MIN, RANGE_MAX);
+  return filter;
+}
+
+/*
+  @returns the output of 'input', or 'absorbed' if there was none.
+*/
+static int32_t run(JoystickAxisFilter &filter, int16_t input, int32_t absorbed = INT32_MIN)
+{
+  int16_t output;
+  return filter.process(input, output) ? output : absorbed;
+}
+
+
+TEST(disabledFilterPassesEverything) {
+  JoystickAxisFilter filter = rangedFilter();
+  CHECK( !filter.enabled() );
+  for (int32_t value = RANGE_MIN; value <= RANGE_MAX; value += 7) CHECK_EQUAL( value, run(filter, value) );
+}
+
+TEST(decimatedOversamplingOutputsEveryNthAverage) {
+  JoystickAxisFilter filter = rangedFilter();
+  filter.setOversampling(4, true);
+
+  const int16_t inputs[] = { -100, -200, -300, -403, 10, 20, 30, 40 };
+  const int32_t outputs[] = { INT32_MIN, INT32_MIN, INT32_MIN, -250, INT32_MIN, INT32_MIN, INT32_MIN, 25 };
+  for (uint8_t i=0; i < 8; i++) CHECK_EQUAL( outputs[i], run(filter, inputs[i]) );
+}
+
+TEST(movingOversamplingOutputsEveryAverage) {
+  JoystickAxisFilter filter = rangedFilter();
+  filter.setOversampling(3, false);
+
+  // Averages of the samples so far, then of the latest three, rounded towards zero.
+  CHECK_EQUAL( -300, run(filter, -300) );
+  CHECK_EQUAL( -150, run(filter, 0) );
+  CHECK_EQUAL( -100, run(filter, 0) );
+  CHECK_EQUAL( 100, run(filter, 300) );
+  CHECK_EQUAL( 200, run(filter, 300) );
+}
+
+TEST(smoothingFollowsFloatOnBothSides) {
+  for (uint8_t shift = 1; shift <= 8; shift++) {
+    JoystickAxisFilter filter = rangedFilter();
+    filter.setSmoothing(shift);
+    float reference = 0.0f;
+    bool primed = false;
+
+    // Steps between the ends of the range, and a slow sweep through zero.
+    srand(shift);
+    for (uint16_t i=0; i < 2000; i++) {
+      int16_t input = (i < 1000) ? ((i / 100) % 2 ? RANGE_MAX : RANGE_MIN) : -1000 + (i - 1000) * 2;
+      if (i % 3 == 0) input += rand() % 21 - 10;
+      if (input < RANGE_MIN) input = RANGE_MIN;   // The output is clamped to the range.
+      if (input > RANGE_MAX) input = RANGE_MAX;
+
+      reference = primed ? reference + (input - reference) / (1 << shift) : input;
+      primed = true;
+      int32_t output = run(filter, input);
+      // The fractional bits of the state round down, that drifts by up to 2^shift / 256 LSB.
+      if (fabsf(output - reference) > 1.5f) {
+        CHECK_EQUAL( lroundf(reference), output );
+        return;
+      }
+    }
+  }
+}
+
+TEST(smoothingIsSymmetricAroundZero) {
+  JoystickAxisFilter positive = rangedFilter();
+  JoystickAxisFilter negative = rangedFilter();
+  positive.setSmoothing(4);
+  negative.setSmoothing(4);
+
+  for (int16_t value = 0; value <= RANGE_MAX; value += 13) {
+    int32_t up = run(positive, value);
+    int32_t down = run(negative, -value);
+    if (abs(up + down) > 1) {
+      CHECK_EQUAL( up, -down );
+      return;
+    }
+  }
+}
+
+TEST(firstSmoothedSampleIsTaken) {
+  JoystickAxisFilter filter = rangedFilter();
+  filter.setSmoothing(4);
+  CHECK_EQUAL( RANGE_MIN, run(filter, RANGE_MIN) );
+  filter.reset();
+  CHECK_EQUAL( -1, run(filter, -1) );
+}
+
+TEST(deadzoneHoldsTheCenterAndKeepsTheEnds) {
+  const int16_t centers[] = { 0, -300, 500 };
+  for (int16_t center : centers) {
+    JoystickAxisFilter filter = rangedFilter();
+    filter.setDeadzone(100, center);
+
+    CHECK_EQUAL( center, run(filter, center - 100) );
+    CHECK_EQUAL( center, run(filter, center + 100) );
+    CHECK_EQUAL( RANGE_MIN, run(filter, RANGE_MIN) );
+    CHECK_EQUAL( RANGE_MAX, run(filter, RANGE_MAX) );
+
+    // Monotonic over the whole range, no jump at the edge of the deadzone.
+    int32_t previous = RANGE_MIN;
+    for (int32_t value = RANGE_MIN; value <= RANGE_MAX; value++) {
+      int32_t output = run(filter, value);
+      if (output < previous || output - previous > 2) {
+        CHECK_EQUAL( previous, output );
+        return;
+      }
+      previous = output;
+    }
+  }
+}
+
+TEST(hysteresisHoldsSmallChangesButNotTheEnds) {
+  JoystickAxisFilter filter = rangedFilter();
+  filter.setHysteresis(10);
+
+  CHECK_EQUAL( -500, run(filter, -500) );
+  CHECK_EQUAL( INT32_MIN, run(filter, -509) );
+  CHECK_EQUAL( INT32_MIN, run(filter, -491) );
+  CHECK_EQUAL( -510, run(filter, -510) );
+  CHECK_EQUAL( RANGE_MIN, run(filter, RANGE_MIN) );
+  CHECK_EQUAL( INT32_MIN, run(filter, RANGE_MIN + 5) );
+  CHECK_EQUAL( RANGE_MAX, run(filter, RANGE_MAX) );
+}
+
+TEST(stagesRunInOrder) {
+  // Oversampling feeds the average to the deadzone: samples around the center average into it.
+  JoystickAxisFilter filter = rangedFilter();
+  filter.setOversampling(2, true);
+  filter.setDeadzone(50);
+
+  CHECK_EQUAL( INT32_MIN, run(filter, -90) );
+  CHECK_EQUAL( 0, run(filter, 80) );
+  CHECK_EQUAL( INT32_MIN, run(filter, RANGE_MIN) );
+  CHECK_EQUAL( RANGE_MIN, run(filter, RANGE_MIN) );
+}
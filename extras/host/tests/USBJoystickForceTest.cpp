@@ -0,0 +1,501 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include "HidDescriptor.h"
+#include "HostTest.h"
+#include "USBJoystick.h"
+#include "USBJoystickForce.h"
+
+using namespace arduino;
+
+
+/*
+  Force feedback as the host drives it: the PID descriptor read back with the independent parser,
+  every report built from the fields the parser found instead of from the offsets the parser of the
+  device uses, and the forces the effects give over time.
+*/
+
+static const uint16_t PAGE_GENERIC_DESKTOP = 0x01;
+static const uint16_t PAGE_PID = 0x0F;
+static const uint16_t PAGE_ORDINAL = 0x0A;
+
+static uint32_t pid(uint16_t id) { return host::usage(PAGE_PID, id); }
+
+static const uint32_t EFFECT_BLOCK_INDEX = pid(0x22);
+static const uint32_t PARAMETER_BLOCK_OFFSET = pid(0x23);
+static const uint32_t DURATION = pid(0x50);
+static const uint32_t GAIN = pid(0x52);
+static const uint32_t DIRECTION_ENABLE = pid(0x56);
+static const uint32_t CP_OFFSET = pid(0x60);
+static const uint32_t POSITIVE_COEFFICIENT = pid(0x61);
+static const uint32_t NEGATIVE_COEFFICIENT = pid(0x62);
+static const uint32_t DEAD_BAND = pid(0x65);
+static const uint32_t OFFSET = pid(0x6F);
+static const uint32_t MAGNITUDE = pid(0x70);
+static const uint32_t PHASE = pid(0x71);
+static const uint32_t PERIOD = pid(0x72);
+static const uint32_t LOOP_COUNT = pid(0x7C);
+static const uint32_t DEVICE_GAIN = pid(0x7E);
+static const uint32_t RAM_POOL_SIZE = pid(0x80);
+static const uint32_t SIMULTANEOUS_EFFECTS_MAX = pid(0x83);
+static const uint32_t RAM_POOL_AVAILABLE = pid(0xAC);
+static const uint32_t BYTE_COUNT = host::usage(PAGE_GENERIC_DESKTOP, 0x3B);
+static const uint32_t USAGE_X = host::usage(PAGE_GENERIC_DESKTOP, 0x30);
+static const uint32_t USAGE_Y = host::usage(PAGE_GENERIC_DESKTOP, 0x31);
+static const uint32_t DIRECTION = host::usage(PAGE_ORDINAL, 0x01);
+
+// Array selectors.
+static const uint32_t ET_CONSTANT = pid(0x26);
+static const uint32_t ET_SQUARE = pid(0x30);
+static const uint32_t ET_SINE = pid(0x31);
+static const uint32_t ET_TRIANGLE = pid(0x32);
+static const uint32_t ET_SAWTOOTH_UP = pid(0x33);
+static const uint32_t ET_SAWTOOTH_DOWN = pid(0x34);
+static const uint32_t ET_SPRING = pid(0x40);
+static const uint32_t ET_DAMPER = pid(0x41);
+static const uint32_t OP_START = pid(0x79);
+static const uint32_t OP_START_SOLO = pid(0x7A);
+static const uint32_t OP_STOP = pid(0x7B);
+static const uint32_t DC_ENABLE = pid(0x97);
+static const uint32_t DC_DISABLE = pid(0x98);
+static const uint32_t DC_STOP_ALL = pid(0x99);
+static const uint32_t DC_PAUSE = pid(0x9B);
+static const uint32_t DC_CONTINUE = pid(0x9C);
+static const uint32_t BLOCK_LOAD_SUCCESS = pid(0x8C);
+static const uint32_t BLOCK_LOAD_FULL = pid(0x8D);
+
+
+static const host::HidDescriptor &pidDescriptor(void)
+{
+  static const host::HidDescriptor descriptor(JoystickForceFeedback::DESCRIPTOR, JoystickForceFeedback::DESCRIPTOR_LENGTH);
+  return descriptor;
+}
+
+/*
+  Field of report 'reportId' of 'type' with 'usage', a variable one or an array selecting it.
+*/
+static const host::HidField *findField(uint8_t type, uint8_t reportId, uint32_t usage, uint16_t &index)
+{
+  for (const host::HidField &field : pidDescriptor().fields()) {
+    if (field.type != type || field.reportId != reportId || field.constant()) continue;
+    for (uint16_t i=0; i < field.usages.size(); i++) {
+      if (field.usages[i] != usage) continue;
+      index = field.variable() ? i : 0;
+      return &field;
+    }
+  }
+  return nullptr;
+}
+
+/*
+  Output or feature report of the host, written field by field at the positions of the descriptor.
+*/
+class PidReport {
+public:
+  PidReport(uint8_t type, uint8_t reportId) : _type(type) {
+    memset(this->data, 0, sizeof(this->data));
+    this->data[0] = reportId;
+    this->length = 1 + (pidDescriptor().reportBits(type, reportId) + 7) / 8;
+  }
+
+  // Value of the variable field with 'usage'.
+  PidReport &set(uint32_t usage, int32_t value) {
+    uint16_t index;
+    const host::HidField *field = findField(this->_type, this->data[0], usage, index);
+    if (!CHECK( field != nullptr && field->variable() )) return *this;
+    CHECK( value >= field->logicalMinimum && value <= field->logicalMaximum );
+    this->write(field->bitOffset + index * field->size, field->size, value);
+    return *this;
+  }
+
+  // Array field selecting 'usage': its index among the usages, from the logical minimum.
+  PidReport &select(uint32_t usage) {
+    uint16_t index;
+    const host::HidField *field = findField(this->_type, this->data[0], usage, index);
+    if (!CHECK( field != nullptr && !field->variable() )) return *this;
+    for (uint16_t i=0; i < field->usages.size(); i++) {
+      if (field->usages[i] == usage) this->write(field->bitOffset, field->size, field->logicalMinimum + i);
+    }
+    return *this;
+  }
+
+  uint8_t data[ JoystickForceFeedback::REPORT_MAX_LENGTH ];
+  uint8_t length;
+
+private:
+  uint8_t _type;
+
+  void write(uint32_t bit, uint8_t size, int32_t value) {
+    for (uint8_t i=0; i < size; i++, bit++) {
+      uint8_t mask = 0x01 << (bit % 8);
+      if ((value >> i) & 0x01) this->data[1 + bit / 8] |= mask;
+      else this->data[1 + bit / 8] &= ~mask;
+    }
+  }
+} ;
+
+/*
+  Field 'usage' of feature report 'report' read back by the host; an array field gives the usage it selects.
+*/
+static uint32_t readFeature(const uint8_t *report, uint32_t usage)
+{
+  uint16_t index;
+  const host::HidField *field = findField(host::HidField::FEATURE, report[0], usage, index);
+  if (!CHECK( field != nullptr )) return 0;
+  int32_t value = pidDescriptor().extract(*field, index, report);
+  if (field->variable()) return value;
+  int32_t selected = value - field->logicalMinimum;
+  return (selected >= 0 && selected < static_cast<int32_t>(field->usages.size())) ? field->usages[selected] : 0;
+}
+
+
+/*
+  A joystick with force feedback, driven through the reports of the host.
+*/
+struct Rig {
+  USBJoystick joystick;
+  JoystickForceFeedback force;
+
+  Rig(void) : force(joystick) { }
+
+  bool send(const PidReport &report) { return this->joystick.hostReport(report.data, report.length); }
+
+  /*
+    Create an effect of type 'effectType' with the Create New Effect feature report.
+
+    @returns the block index from the Block Load report, 0 if the load failed.
+  */
+  uint8_t create(uint32_t effectType) {
+    PidReport create(host::HidField::FEATURE, JoystickForceFeedback::REPORT_CREATE_EFFECT);
+    create.select(effectType).set(BYTE_COUNT, 0);
+    CHECK( this->send(create) );
+
+    uint8_t load[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+    CHECK_EQUAL( 5, this->joystick.featureReport(JoystickForceFeedback::REPORT_BLOCK_LOAD, load) );
+    return (this->loadStatus(load) == BLOCK_LOAD_SUCCESS) ? readFeature(load, EFFECT_BLOCK_INDEX) : 0;
+  }
+
+  uint32_t loadStatus(const uint8_t *load) { return readFeature(load, BLOCK_LOAD_SUCCESS); }
+
+  // Set Effect with the axes in 'axes' (bit 0 X, bit 1 Y) or along 'direction' if 'directional'.
+  void setEffect(uint8_t block, uint32_t type, uint16_t duration, uint8_t gain, uint8_t axes,
+                 bool directional = false, uint8_t direction = 0) {
+    PidReport report(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_SET_EFFECT);
+    report.set(EFFECT_BLOCK_INDEX, block).select(type).set(DURATION, duration).set(GAIN, gain)
+          .set(USAGE_X, axes & 0x01).set(USAGE_Y, (axes >> 1) & 0x01)
+          .set(DIRECTION_ENABLE, directional ? 1 : 0).set(DIRECTION, direction);
+    CHECK( this->send(report) );
+  }
+
+  void operate(uint8_t block, uint32_t operation, uint8_t loops = 1) {
+    PidReport report(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_EFFECT_OPERATION);
+    report.set(EFFECT_BLOCK_INDEX, block).select(operation).set(LOOP_COUNT, loops);
+    CHECK( this->send(report) );
+  }
+
+  void control(uint32_t command) {
+    PidReport report(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_DEVICE_CONTROL);
+    report.select(command);
+    CHECK( this->send(report) );
+  }
+
+  // Constant force on X, started.
+  uint8_t constant(int16_t magnitude, uint8_t axes = 0x01) {
+    uint8_t block = this->create(ET_CONSTANT);
+    this->setEffect(block, ET_CONSTANT, 0xFFFF, 255, axes);
+    PidReport report(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_SET_CONSTANT_FORCE);
+    report.set(EFFECT_BLOCK_INDEX, block).set(MAGNITUDE, magnitude);
+    CHECK( this->send(report) );
+    this->operate(block, OP_START);
+    return block;
+  }
+
+  // Periodic effect of 'type' on X, started at the current time.
+  uint8_t periodic(uint32_t type, int16_t magnitude, uint16_t period, uint8_t phase = 0, int16_t offset = 0) {
+    uint8_t block = this->create(type);
+    this->setEffect(block, type, 0xFFFF, 255, 0x01);
+    PidReport report(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_SET_PERIODIC);
+    report.set(EFFECT_BLOCK_INDEX, block).set(MAGNITUDE, magnitude).set(OFFSET, offset)
+          .set(PHASE, phase).set(PERIOD, period);
+    CHECK( this->send(report) );
+    this->operate(block, OP_START);
+    return block;
+  }
+
+  // Condition of 'type' on X, started.
+  uint8_t condition(uint32_t type, int16_t offset, int16_t positive, int16_t negative, uint16_t deadBand) {
+    uint8_t block = this->create(type);
+    this->setEffect(block, type, 0xFFFF, 255, 0x01);
+    PidReport report(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_SET_CONDITION);
+    report.set(EFFECT_BLOCK_INDEX, block).set(PARAMETER_BLOCK_OFFSET, 0).set(CP_OFFSET, offset)
+          .set(POSITIVE_COEFFICIENT, positive).set(NEGATIVE_COEFFICIENT, negative).set(DEAD_BAND, deadBand);
+    CHECK( this->send(report) );
+    this->operate(block, OP_START);
+    return block;
+  }
+
+  // Forces after a tick at 'now'.
+  int16_t x(uint32_t now) {
+    host::setTime(now);
+    this->force.tick(now);
+    return this->force.forces()[0];
+  }
+  int16_t y(void) const { return this->force.forces()[1]; }
+} ;
+
+
+TEST(pidDescriptorParses) {
+  const host::HidDescriptor &descriptor = pidDescriptor();
+  if (!CHECK( descriptor.valid() )) {
+    printf("  %s\n", descriptor.error().c_str());
+    return;
+  }
+  CHECK_EQUAL( 528, JoystickForceFeedback::DESCRIPTOR_LENGTH );
+
+  // Every report ID the device parses, no other, each fitting REPORT_MAX_LENGTH.
+  std::vector<uint8_t> outputs = descriptor.reportIds(host::HidField::OUTPUT);
+  std::vector<uint8_t> features = descriptor.reportIds(host::HidField::FEATURE);
+  CHECK_EQUAL( 8u, outputs.size() );
+  CHECK_EQUAL( 3u, features.size() );
+  for (uint8_t id = JoystickForceFeedback::REPORT_SET_EFFECT; id <= JoystickForceFeedback::REPORT_DEVICE_GAIN; id++) {
+    uint32_t bits = descriptor.reportBits(host::HidField::OUTPUT, id);
+    CHECK( bits > 0 && bits % 8 == 0 && 1 + bits / 8 <= JoystickForceFeedback::REPORT_MAX_LENGTH );
+  }
+  for (uint8_t id = JoystickForceFeedback::REPORT_CREATE_EFFECT; id <= JoystickForceFeedback::REPORT_POOL; id++) {
+    uint32_t bits = descriptor.reportBits(host::HidField::FEATURE, id);
+    CHECK( bits > 0 && bits % 8 == 0 && 1 + bits / 8 <= JoystickForceFeedback::REPORT_MAX_LENGTH );
+  }
+  CHECK( descriptor.reportIds(host::HidField::INPUT).empty() );
+
+  // The Effect Type arrays select the types in EFFECT_* order.
+  uint16_t index;
+  const host::HidField *types = findField(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_SET_EFFECT, ET_CONSTANT, index);
+  if (CHECK( types != nullptr )) {
+    CHECK_EQUAL( JoystickForceFeedback::EFFECT_CONSTANT, types->logicalMinimum );
+    CHECK_EQUAL( JoystickForceFeedback::EFFECT_TYPE_COUNT - 1, types->logicalMaximum );
+    CHECK( types->usages[ JoystickForceFeedback::EFFECT_DAMPER - 1 ] == ET_DAMPER );
+    CHECK( types->usages[ JoystickForceFeedback::EFFECT_SAWTOOTH_DOWN - 1 ] == ET_SAWTOOTH_DOWN );
+  }
+}
+
+TEST(deviceDescriptorWithForceFeedbackParses) {
+  Rig rig;
+  host::HidDescriptor descriptor(rig.joystick.usb().report_desc(), rig.joystick.usb().report_desc_length());
+  if (!CHECK( descriptor.valid() )) {
+    printf("  %s\n", descriptor.error().c_str());
+    return;
+  }
+  // The PID reports keep their IDs next to the joystick report.
+  CHECK( descriptor.reportBits(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_SET_EFFECT) > 0 );
+  CHECK( descriptor.reportBits(host::HidField::FEATURE, JoystickForceFeedback::REPORT_POOL) > 0 );
+  CHECK( descriptor.reportBits(host::HidField::INPUT, rig.joystick.layout().reportId) > 0 );
+}
+
+TEST(poolAndBlockLoadReportsReadBack) {
+  Rig rig;
+  uint8_t pool[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  CHECK_EQUAL( 5, rig.joystick.featureReport(JoystickForceFeedback::REPORT_POOL, pool) );
+  CHECK_EQUAL( JoystickForceFeedback::MAX_EFFECTS, readFeature(pool, SIMULTANEOUS_EFFECTS_MAX) );
+  CHECK( readFeature(pool, RAM_POOL_SIZE) > 0 );
+
+  // Blocks are handed out from 1 until the pool is full.
+  for (uint8_t i=1; i <= JoystickForceFeedback::MAX_EFFECTS; i++) CHECK_EQUAL( i, rig.create(ET_SINE) );
+  CHECK_EQUAL( 0, rig.create(ET_SINE) );
+  uint8_t load[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  rig.joystick.featureReport(JoystickForceFeedback::REPORT_BLOCK_LOAD, load);
+  CHECK( readFeature(load, BLOCK_LOAD_SUCCESS) == BLOCK_LOAD_FULL );
+  CHECK_EQUAL( 0u, readFeature(load, RAM_POOL_AVAILABLE) );
+
+  // A freed block is reused.
+  PidReport free(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_BLOCK_FREE);
+  free.set(EFFECT_BLOCK_INDEX, 5);
+  CHECK( rig.send(free) );
+  CHECK_EQUAL( 5, rig.create(ET_CONSTANT) );
+}
+
+TEST(constantForceFollowsGainsAndDirection) {
+  Rig rig;
+  uint8_t block = rig.constant(6000);
+  CHECK_EQUAL( 6000, rig.x(10) );
+  CHECK_EQUAL( 0, rig.y() );
+
+  // Effect gain and device gain both scale by n / 255.
+  rig.setEffect(block, ET_CONSTANT, 0xFFFF, 128, 0x01);
+  CHECK_EQUAL( 6000 * 128 / 255, rig.x(20) );
+  PidReport gain(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_DEVICE_GAIN);
+  gain.set(DEVICE_GAIN, 51);
+  CHECK( rig.send(gain) );
+  CHECK_EQUAL( (6000 * 128 / 255) * 51 / 255, rig.x(30) );
+
+  // Along a direction, 64 = 90 degrees points to +X, 0 to +Y.
+  rig.setEffect(block, ET_CONSTANT, 0xFFFF, 255, 0x00, true, 64);
+  gain.set(DEVICE_GAIN, 255);
+  rig.send(gain);
+  CHECK_EQUAL( 6000, rig.x(40) );
+  CHECK_EQUAL( 0, rig.y() );
+  rig.setEffect(block, ET_CONSTANT, 0xFFFF, 255, 0x00, true, 0);
+  CHECK_EQUAL( 0, rig.x(50) );
+  CHECK_EQUAL( 6000, rig.y() );
+
+  // Y only.
+  rig.setEffect(block, ET_CONSTANT, 0xFFFF, 255, 0x02);
+  CHECK_EQUAL( 0, rig.x(60) );
+  CHECK_EQUAL( 6000, rig.y() );
+}
+
+TEST(periodicEffectsFollowTheirWaves) {
+  struct Point {
+    uint32_t type;
+    uint16_t elapsed;   // Of a 1000 ms period.
+    int16_t force;
+  } ;
+  // Magnitude 8000: quarter points of each wave, and a phase shift.
+  const Point points[] = {
+    { ET_SINE, 0, 0 }, { ET_SINE, 250, 8000 }, { ET_SINE, 500, 0 }, { ET_SINE, 750, -8000 },
+    { ET_SQUARE, 100, 8000 }, { ET_SQUARE, 600, -8000 },
+    { ET_TRIANGLE, 125, 4000 }, { ET_TRIANGLE, 250, 8000 }, { ET_TRIANGLE, 750, -8000 },
+    { ET_SAWTOOTH_UP, 0, -8000 }, { ET_SAWTOOTH_DOWN, 0, 8000 },
+  };
+
+  for (const Point &point : points) {
+    Rig rig;
+    host::setTime(1000);
+    rig.periodic(point.type, 8000, 1000);
+    int16_t force = rig.x(1000 + point.elapsed);
+    // The phase is 1/256 of the period, so allow the change over 4 ms.
+    if (abs(force - point.force) > 150) {
+      printf("  type 0x%02X at %u ms\n", point.type & 0xFF, point.elapsed);
+      CHECK_EQUAL( point.force, force );
+    }
+  }
+
+  // Phase 64 starts the sine at its peak, the offset moves the whole wave.
+  Rig rig;
+  host::setTime(0);
+  rig.periodic(ET_SINE, 5000, 400, 64, -2000);
+  CHECK_EQUAL( 3000, rig.x(0) );
+  CHECK_EQUAL( -7000, rig.x(200) );
+}
+
+TEST(effectStopsAfterItsLoops) {
+  Rig rig;
+  host::setTime(0);
+  uint8_t block = rig.create(ET_CONSTANT);
+  rig.setEffect(block, ET_CONSTANT, 100, 255, 0x01);
+  PidReport constant(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_SET_CONSTANT_FORCE);
+  constant.set(EFFECT_BLOCK_INDEX, block).set(MAGNITUDE, 1000);
+  rig.send(constant);
+  rig.operate(block, OP_START, 3);
+
+  CHECK_EQUAL( 1000, rig.x(299) );
+  CHECK_EQUAL( 1, rig.force.playingEffects() );
+  CHECK_EQUAL( 0, rig.x(300) );
+  CHECK_EQUAL( 0, rig.force.playingEffects() );
+
+  // Restarted, then stopped by the host.
+  rig.operate(block, OP_START);
+  CHECK_EQUAL( 1000, rig.x(310) );
+  rig.operate(block, OP_STOP);
+  CHECK_EQUAL( 0, rig.x(320) );
+}
+
+TEST(startSoloStopsTheOthers) {
+  Rig rig;
+  rig.constant(1000);
+  uint8_t second = rig.constant(2000);
+  CHECK_EQUAL( 3000, rig.x(10) );
+  rig.operate(second, OP_START_SOLO);
+  CHECK_EQUAL( 2000, rig.x(20) );
+  CHECK_EQUAL( 1, rig.force.playingEffects() );
+}
+
+TEST(sumIsClamped) {
+  Rig rig;
+  rig.constant(8000);
+  rig.constant(8000);
+  CHECK_EQUAL( JoystickForceFeedback::FORCE_MAX, rig.x(10) );
+}
+
+TEST(springPullsTowardsItsCenter) {
+  Rig rig;
+  rig.joystick.setXAxisRange(-1000, 1000);
+  rig.condition(ET_SPRING, 0, 10000, 5000, 1000);
+
+  // The position is the axis in -FORCE_MAX ... FORCE_MAX.
+  rig.joystick.setAxisRaw(X_AXIS, 0);
+  CHECK_EQUAL( 0, rig.x(10) );
+  rig.joystick.setAxisRaw(X_AXIS, 50);   // Inside the dead band.
+  CHECK_EQUAL( 0, rig.x(20) );
+  rig.joystick.setAxisRaw(X_AXIS, 1000);
+  int16_t positive = rig.x(30);
+  CHECK( abs(positive - -9000) <= 10 );
+  rig.joystick.setAxisRaw(X_AXIS, -1000);
+  int16_t negative = rig.x(40);
+  CHECK( abs(negative - 4500) <= 10 );
+}
+
+TEST(damperResistsTheMovement) {
+  Rig rig;
+  rig.joystick.setXAxisRange(-1000, 1000);
+  rig.condition(ET_DAMPER, 0, 10000, 10000, 0);
+
+  rig.joystick.setAxisRaw(X_AXIS, 0);
+  rig.x(100);
+  CHECK_EQUAL( 0, rig.x(200) );
+
+  // A tenth of the range in 100 ms is FORCE_MAX per second.
+  rig.joystick.setAxisRaw(X_AXIS, 100);
+  int16_t force = rig.x(300);
+  CHECK( force < -9000 && force >= -JoystickForceFeedback::FORCE_MAX );
+  CHECK_EQUAL( 0, rig.x(400) );
+}
+
+TEST(deviceControlPausesAndDisables) {
+  Rig rig;
+  host::setTime(0);
+  rig.periodic(ET_SAWTOOTH_UP, 10000, 1000);
+  int16_t before = rig.x(250);
+
+  // Paused for 500 ms, the wave goes on where it stopped.
+  rig.control(DC_PAUSE);
+  CHECK_EQUAL( 0, rig.x(300) );
+  CHECK( !rig.force.actuatorsEnabled() );
+  host::setTime(750);
+  rig.control(DC_CONTINUE);
+  CHECK_EQUAL( before, rig.x(750) );
+
+  rig.control(DC_DISABLE);
+  CHECK_EQUAL( 0, rig.x(760) );
+  rig.control(DC_ENABLE);
+  CHECK( rig.x(770) != 0 );
+
+  rig.control(DC_STOP_ALL);
+  CHECK_EQUAL( 0, rig.x(780) );
+  CHECK_EQUAL( 0, rig.force.playingEffects() );
+}
+
+TEST(reportsForFreeBlocksAreIgnored) {
+  Rig rig;
+  PidReport constant(host::HidField::OUTPUT, JoystickForceFeedback::REPORT_SET_CONSTANT_FORCE);
+  constant.set(EFFECT_BLOCK_INDEX, 3).set(MAGNITUDE, 5000);
+  CHECK( rig.send(constant) );
+  rig.operate(3, OP_START);
+  CHECK_EQUAL( 0, rig.x(10) );
+  CHECK_EQUAL( 0, rig.force.playingEffects() );
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+#include "HidDescriptor.h"
+#include "HostTest.h"
+#include "USBJoystick.h"
+#include "USBJoystickTransport.h"
+
+using namespace arduino;
+
+
+/*
+  The generated layouts read back with an independent descriptor parser: every axis resolution,
+  with and without the simulation axes and split reports. The descriptor must be valid, describe
+  reports of exactly the length 'writeReport' writes, and put each button and axis where
+  'writeReport' puts it, with the logical range of the layout.
+*/
+
+static const uint16_t PAGE_GENERIC_DESKTOP = 0x01;
+static const uint16_t PAGE_SIMULATION = 0x02;
+static const uint16_t PAGE_BUTTON = 0x09;
+
+static uint32_t axisUsage(uint8_t axis)
+{
+  if (axis == THROTTLE_AXIS) return host::usage(PAGE_SIMULATION, 0xBB);
+  if (axis == RUDDER_AXIS) return host::usage(PAGE_SIMULATION, 0xBA);
+  return host::usage(PAGE_GENERIC_DESKTOP, 0x30 + axis);
+}
+
+// Axis values that touch every bit of a field: both ends, around zero and a pattern per axis.
+static void axisValues(const JoystickLayout &layout, uint8_t pattern, int16_t *axes)
+{
+  const int16_t values[] = { layout.axisMinimum, layout.axisMaximum, -1, 0, 1,
+                             static_cast<int16_t>(layout.axisMaximum / 3), static_cast<int16_t>(-layout.axisMaximum / 5) };
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    axes[i] = values[ (i + pattern) % (sizeof(values) / sizeof(values[0])) ];
+  }
+}
+
+static void checkLayout(const JoystickLayout &layout)
+{
+  host::HidDescriptor descriptor(layout.descriptor, layout.descriptorLength);
+  if (!CHECK( descriptor.valid() )) {
+    printf("  %s\n", descriptor.error().c_str());
+    return;
+  }
+
+  // One input report per report ID of the layout, each as long as the one 'writeReport' writes.
+  std::vector<uint8_t> ids = descriptor.reportIds(host::HidField::INPUT);
+  CHECK_EQUAL( layout.reportCount, ids.size() );
+  uint8_t buttons[ 32 ];
+  int16_t axes[ AXIS_COUNT ];
+  uint8_t report[ MAX_HID_REPORT_SIZE ];
+
+  for (uint8_t pattern=0; pattern < 8; pattern++) {
+    for (uint8_t i=0; i < sizeof(buttons); i++) buttons[i] = static_cast<uint8_t>(0x5A * (i + 1) + pattern * 0x33);
+    axisValues(layout, pattern, axes);
+
+    for (uint8_t index=0; index < layout.reportCount; index++) {
+      uint8_t length = layout.writeReport(report, index, buttons, axes);
+      uint8_t id = report[0];
+      CHECK_EQUAL( layout.reportId + index, id );
+      CHECK_EQUAL( (length - 1) * 8u, descriptor.reportBits(host::HidField::INPUT, id) );
+      CHECK( length <= layout.reportLength );
+
+      for (const host::HidField &field : descriptor.fields()) {
+        if (field.reportId != id || field.constant()) continue;
+        for (uint16_t n=0; n < field.count; n++) {
+          uint32_t usage = field.usageOf(n);
+          int32_t value = descriptor.extract(field, n, report);
+          if ((usage >> 16) == PAGE_BUTTON) {
+            uint16_t button = (usage & 0xFFFF) - 1;
+            CHECK_EQUAL( 1, field.size );
+            CHECK_EQUAL( (buttons[button / 8] >> (button % 8)) & 0x01, value );
+            continue;
+          }
+          uint8_t axis = 0;
+          while (axis < AXIS_COUNT && axisUsage(axis) != usage) axis++;
+          if (!CHECK( axis < AXIS_COUNT && (layout.axisMask & (0x01 << axis)) )) continue;
+          CHECK_EQUAL( layout.axisBits, field.size );
+          CHECK_EQUAL( layout.axisMinimum, field.logicalMinimum );
+          CHECK_EQUAL( layout.axisMaximum, field.logicalMaximum );
+          CHECK_EQUAL( axes[axis], value );
+        }
+      }
+    }
+  }
+
+  // Every button and axis of the layout is somewhere.
+  for (uint16_t button=0; button < layout.buttons; button++) {
+    CHECK( descriptor.find(host::HidField::INPUT, host::usage(PAGE_BUTTON, button + 1)) != nullptr );
+  }
+  for (uint8_t axis=0; axis < AXIS_COUNT; axis++) {
+    bool described = descriptor.find(host::HidField::INPUT, axisUsage(axis)) != nullptr;
+    CHECK_EQUAL( (layout.axisMask & (0x01 << axis)) != 0, described );
+  }
+}
+
+
+TEST(layoutsWith8BitAxesParse) {
+  checkLayout( USBJoystickLayout<64, AXIS_XYZ_ROTATIONS, 8>::layout );
+  checkLayout( USBJoystickLayout<8, AXIS_X | AXIS_Y, 8>::layout );
+  checkLayout( USBJoystickLayout<0, AXIS_ALL, 8>::layout );
+}
+
+TEST(layoutsWith10BitAxesParse) {
+  checkLayout( USBJoystickLayout<64, AXIS_XYZ_ROTATIONS, 10>::layout );   // 60 bits and 4 bits of padding.
+  checkLayout( USBJoystickLayout<32, AXIS_X | AXIS_THROTTLE, 10>::layout );
+  checkLayout( USBJoystickLayout<128, AXIS_ALL, 10, 64>::layout );
+}
+
+TEST(layoutsWith12BitAxesParse) {
+  checkLayout( USBJoystickLayout<>::layout );
+  checkLayout( USBJoystickLayout<16, AXIS_X | AXIS_Y | AXIS_Z, 12>::layout );   // 36 bits and 4 bits of padding.
+  checkLayout( USBJoystickLayout<256, AXIS_ALL, 12, 32>::layout );
+}
+
+TEST(layoutsWith16BitAxesParse) {
+  checkLayout( USBJoystickLayout<64, AXIS_XYZ_ROTATIONS, 16>::layout );
+  checkLayout( USBJoystickLayout<8, AXIS_RUDDER, 16>::layout );
+  checkLayout( USBJoystickLayout<64, AXIS_ALL, 16, 24>::layout );
+}
+
+TEST(defaultReportIs18Bytes) {
+  // 64 buttons in 8 bytes and six 12-bit axes in 9 bytes after the report ID, see CHANGELOG.
+  CHECK_EQUAL( 18, USBJoystickLayout<>::layout.reportLength );
+  CHECK_EQUAL( 12, USBJoystickLayout<>::layout.axisBits );
+  CHECK_EQUAL( 2047, USBJoystickLayout<>::layout.axisMaximum );
+}
+
+TEST(deviceDescriptorParses) {
+  // The whole device: the joystick with the telemetry and configuration collections appended.
+  USBJoystick joystick;
+  JoystickCore second( USBJoystickLayout<8, AXIS_X | AXIS_Y, 10>::layout );
+  joystick.addJoystick(second);
+  const uint8_t *data = joystick.usb().report_desc();
+  host::HidDescriptor descriptor(data, joystick.usb().report_desc_length());
+  if (!CHECK( descriptor.valid() )) {
+    printf("  %s\n", descriptor.error().c_str());
+    return;
+  }
+  CHECK_EQUAL( (joystick.layout().reportLength - 1) * 8u, descriptor.reportBits(host::HidField::INPUT, joystick.layout().reportId) );
+  CHECK_EQUAL( (second.layout().reportLength - 1) * 8u, descriptor.reportBits(host::HidField::INPUT, joystick.layout().reportId + 1) );
+}
+
+
+/*
+  A split layout sends only the reports whose contents changed, and a report the host did not take
+  goes out again on the next update, without resending the reports that did get through.
+*/
+
+class SplitTransport : public JoystickTransport {
+public:
+  uint8_t accept = 255;
+  std::vector<uint8_t> ids;
+
+  virtual bool sendReport(const uint8_t *report, uint8_t, bool) {
+    if (this->accept == 0) return false;
+    this->accept--;
+    this->ids.push_back(report[0]);
+    return true;
+  }
+} ;
+
+static std::vector<uint8_t> splitUpdate(JoystickDevice &joystick, SplitTransport &transport, bool sent = true)
+{
+  transport.ids.clear();
+  CHECK_EQUAL( sent, joystick.update() );
+  return transport.ids;
+}
+
+TEST(splitLayoutSendsOnlyTheChangedReport) {
+  SplitTransport transport;
+  JoystickDevice joystick(USBJoystickLayout<128, AXIS_ALL, 10, 64>::layout, transport);
+  joystick.autoSend = false;
+  joystick.keepAliveInterval = 0;
+  const uint8_t id = joystick.reportId();
+  CHECK( splitUpdate(joystick, transport) == std::vector<uint8_t>({ id, uint8_t(id + 1), uint8_t(id + 2) }) );
+  CHECK( splitUpdate(joystick, transport).empty() );
+
+  joystick.setAxisRaw(Y_AXIS, 100);
+  CHECK( splitUpdate(joystick, transport) == std::vector<uint8_t>({ uint8_t(id + 2) }) );
+
+  joystick.pressButton(70);
+  CHECK( splitUpdate(joystick, transport) == std::vector<uint8_t>({ uint8_t(id + 1) }) );
+
+  joystick.pressButton(3);
+  joystick.setAxisRaw(X_AXIS, -100);
+  CHECK( splitUpdate(joystick, transport) == std::vector<uint8_t>({ id, uint8_t(id + 2) }) );
+  CHECK( splitUpdate(joystick, transport).empty() );
+}
+
+TEST(splitLayoutResendsTheReportThatFailed) {
+  SplitTransport transport;
+  JoystickDevice joystick(USBJoystickLayout<128, AXIS_ALL, 10, 64>::layout, transport);
+  joystick.autoSend = false;
+  joystick.keepAliveInterval = 0;
+  const uint8_t id = joystick.reportId();
+  splitUpdate(joystick, transport);
+
+  // Nothing taken: the one changed report stays pending until the host takes it.
+  transport.accept = 0;
+  joystick.setAxisRaw(Z_AXIS, 200);
+  CHECK( splitUpdate(joystick, transport, false).empty() );
+  transport.accept = 255;
+  CHECK( splitUpdate(joystick, transport) == std::vector<uint8_t>({ uint8_t(id + 2) }) );
+  CHECK( splitUpdate(joystick, transport).empty() );
+
+  // The first of two changed reports taken: only the second goes out again.
+  transport.accept = 1;
+  joystick.pressButton(100);
+  joystick.setAxisRaw(Z_AXIS, -200);
+  CHECK( splitUpdate(joystick, transport, false) == std::vector<uint8_t>({ uint8_t(id + 1) }) );
+  transport.accept = 255;
+  CHECK( splitUpdate(joystick, transport) == std::vector<uint8_t>({ uint8_t(id + 2) }) );
+  CHECK( splitUpdate(joystick, transport).empty() );
+}
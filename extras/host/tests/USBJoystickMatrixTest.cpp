@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "HostTest.h"
+#include "USBJoystickMatrix.h"
+
+using namespace arduino;
+
+
+/*
+  Button matrix scanner on a simulated matrix: debouncing, where the buttons land in the joystick,
+  the rejected 'firstButton' and the span clipped at the end of the button array. And the GPIO
+  pins on the simulated pins of the host.
+*/
+
+class SimulatedMatrix : public JoystickMatrixPins {
+public:
+  virtual void selectRow(uint8_t row) { this->selected = row; }
+  virtual void releaseRow(uint8_t /* row */) { this->selected = -1; }
+  virtual uint32_t readColumns(void) { return (this->selected >= 0) ? this->closed[this->selected] : 0; }
+
+  uint32_t closed[ MAX_ROWS ] = { };
+  int selected = -1;
+} ;
+
+static bool button(const JoystickCore &joystick, uint16_t number)
+{
+  return (joystick.buttonState[number / 8] >> (number % 8)) & 0x01;
+}
+
+/*
+  Scan until the debounced state settles, a few passes more than the debouncing needs.
+*/
+static void settle(JoystickButtonMatrix &matrix)
+{
+  for (uint8_t i=0; i < 6; i++) matrix.scan();
+}
+
+
+TEST(switchIsAcceptedAfterFourPasses) {
+  JoystickCore joystick;
+  SimulatedMatrix pins;
+  JoystickButtonMatrix matrix(joystick, pins, 2, 3);
+  matrix.scan();   // Selects the first row, reads nothing yet.
+
+  pins.closed[1] = 0x04;
+  for (uint8_t pass=0; pass < 3; pass++) {
+    matrix.scan();
+    CHECK( !matrix.pressed(1, 2) );
+  }
+  matrix.scan();
+  CHECK( matrix.pressed(1, 2) );
+  CHECK( button(joystick, 1 * 3 + 2) );
+
+  // A bounce shorter than four passes is ignored.
+  pins.closed[1] = 0;
+  matrix.scan();
+  pins.closed[1] = 0x04;
+  settle(matrix);
+  CHECK( button(joystick, 5) );
+}
+
+TEST(buttonsStartAtFirstButtonAndKeepTheirNeighbours) {
+  JoystickCore joystick;
+  joystick.pressButton(23);   // Same byte as the last button of the matrix, not one of its buttons.
+  SimulatedMatrix pins;
+  JoystickButtonMatrix matrix(joystick, pins, 3, 3, 8);
+  CHECK( matrix.valid() );
+
+  pins.closed[0] = 0x01;
+  pins.closed[2] = 0x04;
+  settle(matrix);
+  CHECK( button(joystick, 8) );
+  CHECK( button(joystick, 8 + 8) );
+  CHECK( !button(joystick, 9) );
+  CHECK( button(joystick, 23) );
+  CHECK( !button(joystick, 0) );
+}
+
+TEST(unalignedFirstButtonIsRejected) {
+  JoystickCore joystick;
+  SimulatedMatrix pins;
+  JoystickButtonMatrix matrix(joystick, pins, 2, 2, 3);
+  CHECK( !matrix.valid() );
+
+  pins.closed[0] = 0x03;
+  settle(matrix);
+  CHECK_EQUAL( 0u, matrix.passes() );
+  CHECK_EQUAL( -1, pins.selected );
+  for (uint8_t i=0; i < sizeof(joystick.buttonState); i++) CHECK_EQUAL( 0, joystick.buttonState[i] );
+}
+
+TEST(spanPastTheArrayKeepsTheWholeLastByte) {
+  JoystickCore joystick;
+  SimulatedMatrix pins;
+  // 4 x 5 = 20 buttons from 248, only 248 ... 255 fit. The partial byte would have been the third.
+  JoystickButtonMatrix matrix(joystick, pins, 4, 5, 248);
+
+  pins.closed[1] = 0x04;   // Button 248 + 7.
+  pins.closed[3] = 0x01;   // Button 248 + 15, dropped.
+  settle(matrix);
+  CHECK( matrix.pressed(1, 2) );
+  CHECK( button(joystick, 255) );
+  CHECK_EQUAL( 0x80, joystick.buttonState[31] );
+}
+
+TEST(gpioDrivesOnlyTheSelectedRow) {
+  const uint8_t rows[] = { 2, 3 };
+  const uint8_t columns[] = { 4, 5, 6 };
+  JoystickMatrixGPIO gpio(rows, 2, columns, 3);
+  gpio.begin();
+
+  CHECK_EQUAL( INPUT, host::pinModeOf(2) );
+  CHECK_EQUAL( INPUT, host::pinModeOf(3) );
+  for (uint8_t pin : columns) CHECK_EQUAL( INPUT_PULLUP, host::pinModeOf(pin) );
+
+  {
+    host::InterruptContext interrupt;
+    gpio.selectRow(1);
+    CHECK_EQUAL( OUTPUT, host::pinModeOf(3) );
+    CHECK_EQUAL( LOW, host::writtenLevel(3) );
+    CHECK_EQUAL( INPUT, host::pinModeOf(2) );
+    gpio.releaseRow(1);
+    CHECK_EQUAL( INPUT, host::pinModeOf(3) );
+  }
+
+  host::setPin(6, LOW);
+  CHECK_EQUAL( 0x04u, gpio.readColumns() );
+}
+
+TEST(gpioMatrixScansFromAnInterrupt) {
+  const uint8_t rows[] = { 2, 3 };
+  const uint8_t columns[] = { 4, 5 };
+  JoystickMatrixGPIO gpio(rows, 2, columns, 2);
+  gpio.begin();
+  JoystickCore joystick;
+  JoystickButtonMatrix matrix(joystick, gpio, 2, 2);
+
+  // Every row reads the same columns on the host, row 1 column 0 is button 2.
+  host::setPin(4, LOW);
+  for (uint8_t i=0; i < 12; i++) {
+    host::InterruptContext interrupt;
+    matrix.scanRow();
+  }
+  CHECK( button(joystick, 0) );
+  CHECK( button(joystick, 2) );
+  CHECK( !button(joystick, 1) );
+}
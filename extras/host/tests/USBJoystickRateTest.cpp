@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <vector>
+#include "HostTest.h"
+#include "USBJoystick.h"
+#include "USBJoystickRate.h"
+
+using namespace arduino;
+
+
+/*
+  Rate governor on its own and driving the keep-alives of a joystick: the back-off while idle, the
+  learned hold time, and the return to the active interval on the first change.
+*/
+
+TEST(intervalDoublesEveryHoldTimeWhileIdle) {
+  JoystickRateGovernor governor;   // Active 1 ms, hold 50 ms, idle 1000 ms.
+  CHECK_EQUAL( 1000u, governor.interval(0) );   // Nothing seen yet.
+
+  governor.activity(10000);
+  CHECK( governor.active(10000) );
+  CHECK_EQUAL( 1u, governor.interval(10000) );
+  CHECK_EQUAL( 1u, governor.interval(10049) );
+  CHECK( !governor.active(10050) );
+  CHECK_EQUAL( 2u, governor.interval(10050) );
+  CHECK_EQUAL( 4u, governor.interval(10100) );
+  CHECK_EQUAL( 512u, governor.interval(10450) );
+  CHECK_EQUAL( 1000u, governor.interval(10500) );
+  CHECK_EQUAL( 1000u, governor.interval(10000 + 3600000) );
+
+  // Back to active on the first change.
+  governor.activity(20000);
+  CHECK_EQUAL( 1u, governor.interval(20000) );
+}
+
+TEST(zeroHoldTimeIsIdleRightAway) {
+  JoystickRateGovernor governor;
+  governor.holdTime = 0;
+  governor.activity(10000);
+  CHECK_EQUAL( 0u, governor.hold() );
+  CHECK( !governor.active(10000) );
+  CHECK_EQUAL( 1000u, governor.interval(10000) );
+  CHECK_EQUAL( 1000u, governor.interval(10000 + 3600000) );
+}
+
+TEST(holdTimeFollowsTheGapsBetweenChanges) {
+  JoystickRateGovernor governor;
+  governor.activity(0);
+  CHECK_EQUAL( 50u, governor.hold() );
+
+  // A knob turned every 40 ms: the hold grows to twice the gap, 80 ms.
+  uint32_t now = 0;
+  for (uint8_t i=0; i < 60; i++) governor.activity(now += 40);
+  CHECK( governor.hold() >= 78 && governor.hold() <= 80 );
+  CHECK_EQUAL( 1u, governor.interval(now + 70) );   // Still between two steps of the knob.
+
+  // An idle period is not a gap of the activity.
+  governor.activity(now += 60000);
+  CHECK( governor.hold() >= 78 && governor.hold() <= 80 );
+
+  // Fast changes bring it back down to 'holdTime'.
+  for (uint8_t i=0; i < 60; i++) governor.activity(now += 1);
+  CHECK_EQUAL( 50u, governor.hold() );
+}
+
+/*
+  Run the loop of a sketch calling 'update' every millisecond from 'from' to 'to', 'to' excluded.
+
+  @returns the times a report was sent.
+*/
+static std::vector<uint32_t> runLoop(USBJoystick &joystick, uint32_t from, uint32_t to)
+{
+  std::vector<uint32_t> sent;
+  for (uint32_t now=from; now < to; now++) {
+    host::setTime(now);
+    size_t before = host::sentCount();
+    joystick.update();
+    if (host::sentCount() != before) sent.push_back(now);
+  }
+  return sent;
+}
+
+TEST(keepAlivesBackOffWhileIdleAndRecoverOnChange) {
+  USBJoystick joystick;
+  JoystickRateGovernor governor;
+  joystick.setRateGovernor(&governor);
+
+  host::setTime(1000);
+  joystick.pressButton(0);
+  joystick.update();
+  host::clearSentReports();
+
+  // Every millisecond for the hold time. Then each keep-alive goes out as soon as the interval of
+  // the governor has passed since the previous one: the gaps only grow, up to 'idleInterval'.
+  std::vector<uint32_t> sent = runLoop(joystick, 1001, 1000 + 8000);
+  uint32_t previous = 1000;
+  uint32_t previousGap = 1;
+  for (uint32_t time : sent) {
+    uint32_t gap = time - previous;
+    bool onTime = (gap >= governor.interval(time)) && (gap - 1 < governor.interval(time - 1));
+    if (!CHECK( onTime && gap >= previousGap && gap <= governor.idleInterval )) {
+      printf("  keep-alive at %u ms, %u ms after the previous one\n", time, gap);
+      break;
+    }
+    if (time - 1000 < governor.hold()) CHECK_EQUAL( 1u, gap );
+    previous = time;
+    previousGap = gap;
+  }
+  CHECK_EQUAL( governor.idleInterval, previousGap );
+
+  // Idle, one keep-alive a second.
+  size_t count = sent.size();
+  CHECK( count > 2 && sent[count - 1] - sent[count - 2] == 1000 && sent[count - 2] - sent[count - 3] == 1000 );
+
+  // The first change goes out at once, and the keep-alives are every millisecond again.
+  host::setTime(9000);
+  joystick.releaseButton(0);
+  host::clearSentReports();
+  joystick.update();
+  CHECK_EQUAL( 1u, host::sentCount() );
+  CHECK_EQUAL( 1u, governor.interval(9000) );
+  CHECK_EQUAL( 10u, runLoop(joystick, 9001, 9011).size() );
+}
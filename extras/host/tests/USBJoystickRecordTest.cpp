@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include <vector>
+#include "HostTest.h"
+#include "USBJoystick.h"
+#include "USBJoystickPlayer.h"
+#include "USBJoystickRecord.h"
+
+using namespace arduino;
+
+
+/*
+  Recordings end to end: a joystick records the reports it sends, the reader decodes them back into
+  the same states and times, and the player sends the same report bytes again at the same times.
+*/
+
+struct Sent {
+  uint32_t time;      // Microseconds.
+  host::Report report;
+} ;
+
+/*
+  A short session: button and axis changes at uneven times, and a keep-alive with nothing changed.
+*/
+static std::vector<Sent> recordSession(USBJoystick &joystick)
+{
+  std::vector<Sent> sent;
+  auto send = [&](uint32_t time) {
+    host::setTime(time / 1000);
+    host::advanceMicros(time % 1000);
+    size_t before = host::sentCount();
+    joystick.update();
+    if (CHECK_EQUAL( before + 1, host::sentCount() )) sent.push_back({ time, host::sentReports().back() });
+  };
+
+  joystick.autoSend = false;
+  joystick.keepAliveInterval = 0;
+  joystick.setXAxisRange(-1000, 1000);
+  send(1000);                                   // The initial state.
+  joystick.pressButton(0);
+  joystick.setAxisRaw(X_AXIS, 500);
+  send(3500);
+  joystick.pressButton(63);
+  joystick.setAxisRaw(X_AXIS, -1000);
+  joystick.setAxisRaw(RZ_AXIS, 1000);
+  send(4250);
+  joystick.releaseButton(0);
+  send(20000);
+  joystick.keepAliveInterval = 1;               // A keep-alive, the same state again.
+  send(21000);
+  joystick.keepAliveInterval = 0;
+  joystick.setButtons(0x5A5A5A5A5A5A5A5AULL);
+  joystick.setAxisRaw(RZ_AXIS, 0);
+  send(100000);
+  return sent;
+}
+
+
+TEST(recordingDecodesToTheSentStates) {
+  USBJoystick joystick;
+  uint8_t buffer[1024];
+  JoystickRecorder recorder(buffer, sizeof(buffer));
+  joystick.setRecorder(&recorder);
+  std::vector<Sent> sent = recordSession(joystick);
+  CHECK_EQUAL( sent.size(), recorder.frames() );
+  CHECK_EQUAL( 0u, recorder.overflows() );
+
+  JoystickRecordReader reader(recorder.data(), recorder.length());
+  CHECK( reader.valid() );
+  CHECK_EQUAL( 8, reader.buttonBytes() );
+
+  JoystickRecord::Frame frame;
+  reader.rewind(frame);
+  USBJoystick decoded;   // Sends the report of each decoded frame, to compare with the recorded one.
+  decoded.autoSend = false;
+  decoded.keepAliveInterval = 0;
+  for (const Sent &expected : sent) {
+    if (!CHECK( reader.next(frame) )) return;
+    CHECK_EQUAL( expected.time - sent[0].time, frame.time );
+
+    decoded.setButtonBytes(0, frame.buttons, reader.buttonBytes());
+    decoded.setAxesMapped(frame.axes);
+    decoded.update();   // Sends nothing for an unchanged frame, the previous report stands.
+    CHECK( host::sentReports().back() == expected.report );
+  }
+  CHECK( !reader.next(frame) );
+
+  // The keep-alive frame is three bytes of nothing changed.
+  reader.rewind(frame);
+  for (uint8_t i=0; i < 5; i++) reader.next(frame);
+  CHECK_EQUAL( 0, frame.axisMask );
+  CHECK_EQUAL( 0u, frame.changedButtons );
+  CHECK_EQUAL( 1000u, frame.delta );
+}
+
+TEST(truncatedRecordingEndsAtTheLastWholeFrame) {
+  USBJoystick joystick;
+  uint8_t buffer[1024];
+  JoystickRecorder recorder(buffer, sizeof(buffer));
+  joystick.setRecorder(&recorder);
+  recordSession(joystick);
+
+  JoystickRecord::Frame frame;
+  JoystickRecordReader whole(recorder.data(), recorder.length());
+  whole.rewind(frame);
+  uint32_t frames = 0;
+  uint32_t lastWhole = 0;
+  for (uint32_t length = JoystickRecord::HEADER_LENGTH; length < recorder.length(); length++) {
+    JoystickRecordReader reader(recorder.data(), length);
+    JoystickRecord::Frame cut;
+    reader.rewind(cut);
+    uint32_t count = 0;
+    while (reader.next(cut)) count++;
+    CHECK( count >= lastWhole && count < recorder.frames() );
+    lastWhole = count;
+  }
+  while (whole.next(frame)) frames++;
+  CHECK_EQUAL( recorder.frames(), frames );
+
+  uint8_t header[ JoystickRecord::HEADER_LENGTH ];
+  memcpy(header, recorder.data(), sizeof(header));
+  header[4] = JoystickRecord::VERSION + 1;
+  CHECK( !JoystickRecordReader(header, sizeof(header)).valid() );
+}
+
+TEST(fullBufferKeepsTheFirstFrames) {
+  USBJoystick joystick;
+  uint8_t buffer[ JoystickRecord::HEADER_LENGTH + 24 ];
+  JoystickRecorder recorder(buffer, sizeof(buffer));
+  joystick.setRecorder(&recorder);
+  std::vector<Sent> sent = recordSession(joystick);
+
+  CHECK( recorder.full() );
+  CHECK( recorder.frames() > 0 );
+  CHECK_EQUAL( sent.size(), recorder.frames() + recorder.overflows() );
+
+  JoystickRecordReader reader(recorder.data(), recorder.length());
+  JoystickRecord::Frame frame;
+  reader.rewind(frame);
+  uint32_t frames = 0;
+  while (reader.next(frame)) frames++;
+  CHECK_EQUAL( recorder.frames(), frames );
+}
+
+TEST(replaySendsTheSameReportsAtTheSameTimes) {
+  std::vector<uint8_t> recording;
+  std::vector<Sent> sent;
+  {
+    USBJoystick joystick;
+    uint8_t buffer[1024];
+    JoystickRecorder recorder(buffer, sizeof(buffer));
+    joystick.setRecorder(&recorder);
+    sent = recordSession(joystick);
+    recording.assign(recorder.data(), recorder.data() + recorder.length());
+  }
+
+  for (uint16_t speed : { 100, 200 }) {
+    host::reset();
+    USBJoystick joystick;
+    joystick.update();   // The start state, not part of the replay.
+    host::clearSentReports();
+
+    JoystickPlayer player(joystick, recording.data(), recording.size());
+    player.speed = speed;
+    CHECK( player.start(5000) );
+
+    // Poll every 250 us: each frame goes out on the first poll at or after its time.
+    std::vector<uint32_t> times;
+    for (uint32_t now = 5000; player.playing() && now < 5000 + 200000; now += 250) {
+      size_t before = host::sentCount();
+      player.poll(now);
+      if (host::sentCount() != before) times.push_back(now);
+    }
+    CHECK( !player.playing() );
+    CHECK_EQUAL( sent.size(), player.framesPlayed() );
+
+    // The first frame is the start state and the keep-alive repeats a state: no change for the
+    // joystick, so nothing is sent for them.
+    std::vector<host::Report> replayed = host::sentReports();
+    if (!CHECK_EQUAL( sent.size() - 2, replayed.size() )) continue;
+    for (size_t i=0, j=0; i < sent.size(); i++) {
+      if (i == 0 || i == 4) continue;
+      CHECK( replayed[j] == sent[i].report );
+      uint32_t due = 5000 + (sent[i].time - sent[0].time) * 100 / speed;
+      CHECK( times[j] >= due && times[j] < due + 250 );
+      j++;
+    }
+  }
+}
+
+TEST(replayRefusesAnotherButtonCount) {
+  USBJoystick recorded;
+  uint8_t buffer[256];
+  JoystickRecorder recorder(buffer, sizeof(buffer));
+  recorded.setRecorder(&recorder);
+  recorded.update();
+
+  JoystickCore small(USBJoystickLayout<16, AXIS_X | AXIS_Y, 8>::layout);
+  JoystickPlayer player(small, recorder.data(), recorder.length());
+  CHECK( !player.start(0) );
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "HostTest.h"
+#include "USBJoystick.h"
+#include "USBJoystickSequencer.h"
+
+using namespace arduino;
+
+
+/*
+  Sequencer ticked directly and polled: the steps and their durations, the report a poll sends for
+  all the ticks it caught up on, and the buttons no two playing sequences may share.
+*/
+
+static uint8_t buttons(const JoystickCore &joystick) { return joystick.buttonState[0]; }
+
+
+TEST(stepsHoldForTheirDurations) {
+  USBJoystick joystick;
+  JoystickSequencer sequencer(joystick);
+  const JoystickStep steps[] = {
+    { 0x01, JoystickStep::NO_AXIS, 0, 2 },
+    { 0x03, JoystickStep::NO_AXIS, 0, 1 },
+    { 0x00, JoystickStep::NO_AXIS, 0, 1 },
+  };
+  uint16_t handle = sequencer.play(steps, 3);
+  CHECK( handle != JoystickSequencer::NONE );
+
+  const uint8_t expected[] = { 0x01, 0x01, 0x03, 0x00, 0x00 };
+  for (uint8_t state : expected) {
+    sequencer.tick();
+    CHECK_EQUAL( state, buttons(joystick) );
+  }
+  CHECK( !sequencer.playing(handle) );
+  CHECK_EQUAL( 0, sequencer.playingCount() );
+}
+
+TEST(pollSendsTheTicksItCatchesUpOnAsOneReport) {
+  USBJoystick joystick;
+  joystick.update();
+  JoystickSequencer sequencer(joystick);
+  const JoystickStep steps[] = {
+    { 0x01, JoystickStep::NO_AXIS, 0, 1 },
+    { 0x02, JoystickStep::NO_AXIS, 0, 1 },
+    { 0x04, JoystickStep::NO_AXIS, 0, 10 },
+  };
+  sequencer.poll(100);
+  sequencer.play(steps, 3);
+  host::clearSentReports();
+
+  sequencer.poll(105);   // Five ticks, three step changes.
+  CHECK_EQUAL( 1u, host::sentCount() );
+  CHECK_EQUAL( 0x04, buttons(joystick) );
+
+  sequencer.poll(105);
+  sequencer.poll(106);   // Within the last step, nothing changes.
+  CHECK_EQUAL( 1u, host::sentCount() );
+}
+
+TEST(overlappingButtonsAreRefused) {
+  JoystickCore joystick;
+  JoystickSequencer sequencer(joystick);
+  const JoystickStep first[] = { { 0x03, JoystickStep::NO_AXIS, 0, 5 } };
+  const JoystickStep second[] = { { 0x06, JoystickStep::NO_AXIS, 0, 5 } };
+
+  uint16_t handle = sequencer.play(first, 1);
+  CHECK( handle != JoystickSequencer::NONE );
+  CHECK_EQUAL( JoystickSequencer::NONE, sequencer.play(second, 1) );
+  CHECK_EQUAL( JoystickSequencer::NONE, sequencer.autofire(1, 2, 2) );
+
+  // The same bits in another bank are other buttons.
+  CHECK( sequencer.play(second, 1, 1, 1) != JoystickSequencer::NONE );
+  CHECK( sequencer.autofire(2, 2, 2) != JoystickSequencer::NONE );
+
+  sequencer.cancel(handle);
+  CHECK( sequencer.play(second, 1) == JoystickSequencer::NONE );   // Button 2 is the autofire's.
+  const JoystickStep third[] = { { 0x01, JoystickStep::NO_AXIS, 0, 5 } };
+  CHECK( sequencer.play(third, 1) != JoystickSequencer::NONE );
+}
+
+TEST(cancelledButtonsAreReleasedBeforeTheNewSequencePressesThem) {
+  JoystickCore joystick;
+  JoystickSequencer sequencer(joystick);
+  const JoystickStep other[] = { { 0x10, JoystickStep::NO_AXIS, 0, 50 } };
+  const JoystickStep hold[] = { { 0x01, JoystickStep::NO_AXIS, 0, 50 } };
+  uint16_t otherHandle = sequencer.play(other, 1);
+  uint16_t holdHandle = sequencer.play(hold, 1);
+  sequencer.tick();
+  CHECK_EQUAL( 0x11, buttons(joystick) );
+
+  // Both cancelled and the button taken over in the same tick. Removing the first sequence moves the
+  // new one ahead of the old owner of the button.
+  sequencer.cancel(otherHandle);
+  sequencer.cancel(holdHandle);
+  uint16_t handle = sequencer.play(hold, 1);
+  CHECK( handle != JoystickSequencer::NONE );
+  sequencer.tick();
+  CHECK_EQUAL( 0x01, buttons(joystick) );
+  CHECK( sequencer.playing(handle) );
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "HostTest.h"
+#include "USBJoystickTransport.h"
+
+using namespace arduino;
+
+
+/*
+  Stress test of the sequence lock around the joystick state: writer threads keep changing their own
+  fields while other threads build and send reports, and every sent report is checked for a frame
+  that mixes two writes of one writer. Each writer owns two axes and one button byte and writes
+  them together, axis 2k = v, axis 2k+1 = -v and button byte k = v & 0xFF, so a torn snapshot shows
+  up as fields that disagree. The atomics switch threads at random, see 'host::preemptAtomics'.
+*/
+
+typedef USBJoystickLayout<64, AXIS_ALL, 16> StressLayout;   // 16 bits, the values go out unchanged.
+
+static const uint8_t WRITERS = 4;
+static const uint8_t SENDERS = 2;
+// Each test sends this many reports while the writers are writing, or as many as it can in
+// 'STRESS_SECONDS' when batches keep the senders out.
+static const uint32_t REPORTS_CHECKED = 5000;
+static const uint32_t STRESS_SECONDS = 2;
+
+// Switch threads after one in this many atomic operations. Often enough that the snapshots overlap
+// the writes, rarely enough that the senders still find gaps between them.
+static const uint32_t PREEMPTION_RATE = 32;
+static const int16_t VALUE_LIMIT = 30000;
+
+static const uint8_t BUTTON_OFFSET = 1;
+static const uint8_t AXIS_OFFSET = 1 + 64 / 8;
+
+
+/*
+  Checks every report on the way out.
+*/
+class CheckingTransport : public JoystickTransport {
+public:
+  explicit CheckingTransport(bool checkButtons): _checkButtons(checkButtons) { }
+
+  std::atomic<uint32_t> reports{0};
+  std::atomic<uint32_t> torn{0};
+
+  virtual bool sendReport(const uint8_t *report, uint8_t length, bool) {
+    if (length != StressLayout::layout.reportLength) {
+      this->torn++;
+      return true;
+    }
+    for (uint8_t k=0; k < WRITERS; k++) {
+      int16_t first = readAxis(report, 2 * k);
+      int16_t second = readAxis(report, 2 * k + 1);
+      uint8_t buttons = report[BUTTON_OFFSET + k];
+      if (second != -first || (this->_checkButtons && buttons != static_cast<uint8_t>(first))) this->torn++;
+    }
+    this->reports++;
+    return true;
+  }
+
+private:
+  bool _checkButtons;
+
+  static int16_t readAxis(const uint8_t *report, uint8_t axis) {
+    const uint8_t *field = report + AXIS_OFFSET + 2 * axis;
+    return static_cast<int16_t>(field[0] | (field[1] << 8));
+  }
+} ;
+
+static int16_t writerValue(uint32_t i) { return static_cast<int16_t>(1 + i % VALUE_LIMIT); }
+
+
+/*
+  Run the writers with 'write' and the senders calling 'update' until 'REPORTS_CHECKED' reports have
+  been sent or the time is up. The senders start once every writer is writing.
+*/
+template<typename WriteFunction>
+static void runStress(JoystickDevice &joystick, CheckingTransport &transport, WriteFunction write)
+{
+  std::atomic<bool> writing{true};
+  std::atomic<uint8_t> started{0};
+  host::preemptAtomics(PREEMPTION_RATE);
+  std::vector<std::thread> writers;
+
+  for (uint8_t k=0; k < WRITERS; k++) {
+    writers.emplace_back( [&joystick, &writing, &started, write, k] {
+      started++;
+      for (uint32_t i=0; writing; i++) {
+        write(joystick, k, writerValue(i + k));
+        std::this_thread::yield();   // Let the others in between two writes too.
+      }
+    } );
+  }
+  while (started < WRITERS) std::this_thread::yield();
+
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(STRESS_SECONDS);
+  std::vector<std::thread> senders;
+  for (uint8_t s=0; s < SENDERS; s++) {
+    senders.emplace_back( [&joystick, &transport, end] {
+      while (transport.reports < REPORTS_CHECKED && std::chrono::steady_clock::now() < end) {
+        joystick.markDirty();   // Send every time, the point is to snapshot as often as possible.
+        joystick.update();
+      }
+    } );
+  }
+  for (std::thread &sender : senders) sender.join();
+
+  writing = false;
+  for (std::thread &writer : writers) writer.join();
+  host::preemptAtomics(0);
+}
+
+
+TEST(axesOfOneWriteAreNeverTorn) {
+  CheckingTransport transport(false);
+  JoystickDevice joystick(StressLayout::layout, transport);
+
+  // One 'setAxesMapped' per write: a single write section without a batch, the senders never wait.
+  runStress(joystick, transport, [](JoystickDevice &joystick, uint8_t k, int16_t value) {
+    int16_t values[ AXIS_COUNT ] = { };
+    values[2 * k] = value;
+    values[2 * k + 1] = -value;
+    joystick.setAxesMapped(values, 0x03 << (2 * k));
+  } );
+
+  CHECK( transport.reports >= REPORTS_CHECKED );
+  CHECK_EQUAL( 0u, transport.torn.load() );
+}
+
+TEST(batchIsPublishedWhole) {
+  CheckingTransport transport(true);
+  JoystickDevice joystick(StressLayout::layout, transport);
+
+  // Axes and buttons go in different write sections, only the batch keeps them together.
+  runStress(joystick, transport, [](JoystickDevice &joystick, uint8_t k, int16_t value) {
+    int16_t values[ AXIS_COUNT ] = { };
+    values[2 * k] = value;
+    values[2 * k + 1] = -value;
+    uint8_t buttons = static_cast<uint8_t>(value);
+
+    JoystickCore::Batch batch(joystick);
+    joystick.setAxesMapped(values, 0x03 << (2 * k));
+    joystick.setButtonBytes(k, &buttons, 1);
+  } );
+
+  CHECK( transport.reports >= REPORTS_CHECKED );
+  CHECK_EQUAL( 0u, transport.torn.load() );
+}
+
+TEST(readerGivesUpInsteadOfTearing) {
+  CheckingTransport transport(true);
+  JoystickDevice joystick(StressLayout::layout, transport);
+  joystick.update();
+  uint32_t sent = transport.reports;
+
+  // A writer in the middle of a write: the snapshot fails after its retries, nothing is sent
+  // and the change stays pending for the next 'update'.
+  joystick.beginBatch();
+  int16_t values[ AXIS_COUNT ] = { 5, -5 };
+  joystick.setAxesMapped(values, 0x01);
+  joystick.markDirty();
+  CHECK( !joystick.updateHIDreport() );
+  CHECK_EQUAL( sent, transport.reports.load() );
+
+  joystick.setAxesMapped(values, 0x02);
+  uint8_t buttons = 5;
+  joystick.setButtonBytes(0, &buttons, 1);
+  CHECK( joystick.commitBatch() );
+  CHECK_EQUAL( sent + 1, transport.reports.load() );
+  CHECK_EQUAL( 0u, transport.torn.load() );
+}
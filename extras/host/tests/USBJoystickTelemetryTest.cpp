@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "HostTest.h"
+#include "USBJoystick.h"
+#include "USBJoystickTelemetry.h"
+
+using namespace arduino;
+
+
+/*
+  Telemetry as the host reads it, the 0xF0 feature report: its layout, the send counters, the latency
+  histogram and the report rate, down to 0 once the joystick stops sending. On the host the ticks
+  are microseconds.
+*/
+
+static uint32_t u16(const uint8_t *report, uint8_t offset) { return report[offset] | (report[offset + 1] << 8); }
+static uint32_t u32(const uint8_t *report, uint8_t offset) { return u16(report, offset) | (u16(report, offset + 2) << 16); }
+
+static uint32_t reportedRate(USBJoystick &joystick)
+{
+  uint8_t report[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  CHECK_EQUAL( JoystickTelemetry::REPORT_LENGTH, joystick.featureReport(JoystickTelemetry::REPORT_ID, report) );
+  return u16(report, 42);
+}
+
+// A changed report every 'step' milliseconds from 'from' up to and including 'to'.
+static void sendEvery(USBJoystick &joystick, uint32_t step, uint32_t from, uint32_t to)
+{
+  for (uint32_t now=from; now <= to; now += step) {
+    host::setTime(now);
+    joystick.toggleButton(0);
+    joystick.update();
+  }
+}
+
+
+TEST(reportCarriesTheCounters) {
+  USBJoystick joystick;
+  joystick.autoSend = false;
+  joystick.keepAliveInterval = 0;
+
+  joystick.update();        // The initial state.
+  joystick.update();        // Nothing changed, skipped.
+  joystick.update();
+  joystick.pressButton(1);
+  joystick.update();
+
+  host::failSends(true);
+  joystick.pressButton(2);
+  joystick.update();        // Blocking by default: failed.
+  joystick.sendBlocking = false;
+  joystick.update();        // Dropped, the endpoint is busy.
+  host::failSends(false);
+
+  uint8_t report[ JoystickDevice::FEATURE_REPORT_LENGTH ];
+  CHECK_EQUAL( JoystickTelemetry::REPORT_LENGTH, joystick.featureReport(JoystickTelemetry::REPORT_ID, report) );
+  CHECK_EQUAL( JoystickTelemetry::REPORT_ID, report[0] );
+  CHECK_EQUAL( JoystickTelemetry::VERSION, report[1] );
+  CHECK_EQUAL( 2u, u32(report, 2) );
+  CHECK_EQUAL( 1u, u32(report, 6) );
+  CHECK_EQUAL( 1u, u32(report, 10) );
+  CHECK_EQUAL( 2u, u32(report, 14) );
+  CHECK_EQUAL( 4u, u32(report, 18) );
+  CHECK_EQUAL( 1000000u, u32(report, 44) );
+
+  // The same numbers as the getters, and every timed update in the histogram.
+  const JoystickTelemetry &telemetry = joystick.telemetry();
+  CHECK_EQUAL( telemetry.reportsSent(), u32(report, 2) );
+  CHECK_EQUAL( telemetry.reportsFailed(), u32(report, 6) );
+  CHECK_EQUAL( telemetry.reportsDropped(), u32(report, 10) );
+  CHECK_EQUAL( telemetry.updatesSkipped(), u32(report, 14) );
+  uint32_t histogram = 0;
+  for (uint8_t i=0; i < JoystickTelemetry::HISTOGRAM_BUCKETS; i++) histogram += u16(report, 48 + 2 * i);
+  CHECK_EQUAL( 4u, histogram );
+}
+
+TEST(latencyLandsInPowerOfTwoBuckets) {
+  JoystickTelemetry telemetry;
+  const uint32_t latencies[] = { 0, 1, 2, 3, 4, 1000, 1023, 1024, 100000000 };
+  for (uint32_t latency : latencies) telemetry.recordUpdate(5000, 5000 + latency / 2, 5000 + latency);
+  telemetry.recordUpdate(0xFFFFFFF0, 0xFFFFFFF8, 0x10);   // Across the wrap-around, 32 ticks.
+
+  uint8_t report[ JoystickTelemetry::REPORT_LENGTH ];
+  telemetry.writeReport(report);
+  const uint16_t expected[ JoystickTelemetry::HISTOGRAM_BUCKETS ] = {
+    2, 2, 1, 0, 0, 1, 0, 0, 0, 2, 1, 0, 0, 0, 0, 1
+  };
+  for (uint8_t i=0; i < JoystickTelemetry::HISTOGRAM_BUCKETS; i++) {
+    if (!CHECK_EQUAL( expected[i], u16(report, 48 + 2 * i) )) printf("  bucket %u\n", i);
+  }
+
+  uint32_t total = 0;
+  for (uint32_t latency : latencies) total += latency;
+  CHECK_EQUAL( 10u, u32(report, 18) );
+  CHECK_EQUAL( 0u, u32(report, 22) );
+  CHECK_EQUAL( (total + 32) / 10, u32(report, 26) );
+  CHECK_EQUAL( 100000000u, u32(report, 30) );
+  CHECK_EQUAL( 100000000u / 2, u32(report, 38) );
+  CHECK( u32(report, 34) >= 100000000u / 2 );
+
+  // Bucket counts saturate at 0xFFFF.
+  for (uint32_t i=0; i < 70000; i++) telemetry.recordUpdate(0, 0, 0);
+  telemetry.writeReport(report);
+  CHECK_EQUAL( 0xFFFFu, u16(report, 48) );
+
+  telemetry.reset();
+  telemetry.writeReport(report);
+  CHECK_EQUAL( 0u, u32(report, 18) );
+  CHECK_EQUAL( 0u, u16(report, 48) );
+}
+
+TEST(rateGoesToZeroWhenIdle) {
+  USBJoystick joystick;
+  joystick.autoSend = false;
+  joystick.keepAliveInterval = 0;
+  CHECK_EQUAL( 0u, reportedRate(joystick) );
+
+  // 100 reports in the first second.
+  sendEvery(joystick, 10, 10, 1000);
+  CHECK_EQUAL( 100u, reportedRate(joystick) );
+
+  // 50 in the first half of the next second, then nothing: that second had 50, the one after none.
+  sendEvery(joystick, 10, 1010, 1500);
+  CHECK_EQUAL( 100u, reportedRate(joystick) );
+  host::setTime(2000);
+  CHECK_EQUAL( 50u, reportedRate(joystick) );
+  host::setTime(2999);
+  CHECK_EQUAL( 50u, reportedRate(joystick) );
+  host::setTime(3000);
+  CHECK_EQUAL( 0u, reportedRate(joystick) );
+  host::setTime(100000);
+  CHECK_EQUAL( 0u, joystick.telemetry().reportRate() );
+
+  // Sending again measures from there.
+  sendEvery(joystick, 5, 100005, 101005);
+  CHECK_EQUAL( 200u, reportedRate(joystick) );
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "HostTest.h"
+#include "USBJoystick.h"
+
+using namespace arduino;
+
+
+/*
+  The joystick through the stub 'USBHID': what reaches the bus, and when.
+*/
+
+// Default layout: report ID, 64 buttons in 8 bytes, six 12-bit axes packed in 9 bytes.
+static const uint8_t DEFAULT_REPORT_LENGTH = 18;
+static const uint8_t AXIS_OFFSET = 9;
+
+static bool waitForReports(size_t count)
+{
+  for (uint32_t i=0; i < 1000 && host::sentCount() < count; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return host::sentCount() >= count;
+}
+
+
+TEST(reportCarriesButtonsAndPackedAxes) {
+  USBJoystick joystick;
+  joystick.pressButton(0);
+  joystick.pressButton(63);
+  joystick.setXAxis(511.0f);
+  joystick.setYAxis(-511.0f);
+
+  CHECK( joystick.update() );
+  std::vector<host::Report> sent = host::sentReports();
+  CHECK_EQUAL( 1u, sent.size() );
+  if (sent.size() != 1) return;
+
+  const host::Report &report = sent[0];
+  CHECK_EQUAL( DEFAULT_REPORT_LENGTH, report.size() );
+  CHECK_EQUAL( joystick.layout().reportId, report[0] );
+  CHECK_EQUAL( 0x01, report[1] );
+  CHECK_EQUAL( 0x80, report[8] );
+
+  // X = 2047 = 0x7FF, Y = -2047 = 0x801, both 12 bits from the lowest bit up.
+  CHECK_EQUAL( 0xFF, report[AXIS_OFFSET] );
+  CHECK_EQUAL( 0x17, report[AXIS_OFFSET + 1] );
+  CHECK_EQUAL( 0x80, report[AXIS_OFFSET + 2] );
+}
+
+TEST(unchangedStateIsNotSent) {
+  USBJoystick joystick;
+  CHECK( joystick.update() );   // Everything is unsent at start.
+  CHECK_EQUAL( 1u, host::sentCount() );
+
+  CHECK( joystick.update() );
+  CHECK( joystick.update() );
+  CHECK_EQUAL( 1u, host::sentCount() );
+  CHECK_EQUAL( 2u, joystick.reportsSkipped() );
+
+  joystick.pressButton(5);
+  joystick.pressButton(5);   // No change, already pressed.
+  CHECK( joystick.update() );
+  CHECK_EQUAL( 2u, host::sentCount() );
+}
+
+TEST(failedSendKeepsTheChange) {
+  USBJoystick joystick;
+  joystick.update();
+  host::clearSentReports();
+
+  host::failSends(true);
+  joystick.pressButton(2);
+  CHECK( !joystick.update() );
+  CHECK_EQUAL( 0u, host::sentCount() );
+
+  host::failSends(false);
+  CHECK( joystick.update() );
+  std::vector<host::Report> sent = host::sentReports();
+  CHECK_EQUAL( 1u, sent.size() );
+  if (sent.size() == 1) CHECK_EQUAL( 0x04, sent[0][1] );
+}
+
+TEST(batchSendsOneReport) {
+  USBJoystick joystick;
+  joystick.autoSend = true;
+  joystick.update();
+  host::clearSentReports();
+
+  {
+    JoystickCore::Batch batch(joystick);
+    joystick.pressButton(0);
+    joystick.pressButton(1);
+    joystick.setXAxis(100.0f);
+    CHECK_EQUAL( 0u, host::sentCount() );
+  }
+  CHECK_EQUAL( 1u, host::sentCount() );
+
+  joystick.pressButton(2);   // Outside a batch 'autoSend' sends every change.
+  joystick.pressButton(3);
+  CHECK_EQUAL( 3u, host::sentCount() );
+}
+
+TEST(maskedButtonsLeaveTheOthers) {
+  USBJoystick joystick;
+  joystick.setButtons(0xF0F0F0F0F0F0F0F0ull);
+  CHECK_EQUAL( 0xF0, joystick.buttonState[0] );
+  CHECK_EQUAL( 0xF0, joystick.buttonState[7] );
+
+  joystick.setButtonsMasked(0x000000FFFF0000FFull, 0x0000005A5A00000Full);
+  CHECK_EQUAL( 0x0F, joystick.buttonState[0] );
+  CHECK_EQUAL( 0xF0, joystick.buttonState[1] );
+  CHECK_EQUAL( 0xF0, joystick.buttonState[2] );
+  CHECK_EQUAL( 0x5A, joystick.buttonState[3] );
+  CHECK_EQUAL( 0x5A, joystick.buttonState[4] );
+  CHECK_EQUAL( 0xF0, joystick.buttonState[5] );
+
+  // The second bank leaves the first alone, and a bank past the array is ignored.
+  joystick.setButtons(0x8000000000000001ull, 1);
+  CHECK_EQUAL( 0x01, joystick.buttonState[8] );
+  CHECK_EQUAL( 0x80, joystick.buttonState[15] );
+  CHECK_EQUAL( 0x0F, joystick.buttonState[0] );
+  joystick.setButtons(0ull, 4);
+  CHECK_EQUAL( 0x01, joystick.buttonState[8] );
+  CHECK_EQUAL( 0x80, joystick.buttonState[15] );
+}
+
+/*
+  Report IDs sent by the split layout below, four reports of 32 buttons and the axis report.
+*/
+static std::vector<uint8_t> sentIds(void)
+{
+  std::vector<uint8_t> ids;
+  for (const host::Report &report : host::sentReports()) ids.push_back(report[0]);
+  host::clearSentReports();
+  return ids;
+}
+
+TEST(bulkButtonsSendOnlyTheTouchedGroups) {
+  USBJoystick joystick(USBJoystickLayout<128, AXIS_ALL, 12, 32>::layout);
+  joystick.keepAliveInterval = 0;
+  joystick.update();
+  host::clearSentReports();
+  const uint8_t id = joystick.reportId();
+
+  // Within one group of 32, with the rest of the bank masked off.
+  joystick.setButtonsMasked(0x0000000100000000ull, ~0ull);
+  CHECK( joystick.update() );
+  CHECK( sentIds() == std::vector<uint8_t>({ uint8_t(id + 1) }) );
+
+  // Across the boundary between the first two groups.
+  joystick.setButtonsMasked(0x0000000180000000ull, 0x0000000080000000ull);
+  CHECK( joystick.update() );
+  CHECK( sentIds() == std::vector<uint8_t>({ id, uint8_t(id + 1) }) );
+  CHECK_EQUAL( 0x80, joystick.buttonState[3] );
+  CHECK_EQUAL( 0x00, joystick.buttonState[4] );
+
+  // Unchanged bits mark nothing, and the second bank maps to the last two groups.
+  joystick.setButtons(0x0000000080000000ull);
+  CHECK( joystick.update() );
+  CHECK( sentIds().empty() );
+  joystick.setButtons(0x0000000100000000ull, 1);
+  CHECK( joystick.update() );
+  CHECK( sentIds() == std::vector<uint8_t>({ uint8_t(id + 3) }) );
+
+  // 'autoSend' sends the same reports from the setter itself.
+  joystick.autoSend = true;
+  joystick.setButtonsMasked(0x0000000180000000ull, 0x0000000080000000ull, 1);
+  CHECK( sentIds() == std::vector<uint8_t>({ uint8_t(id + 2), uint8_t(id + 3) }) );
+  joystick.setButtons(0x0000000080000000ull);
+  CHECK( sentIds().empty() );
+}
+
+TEST(autoSendWindowCoalesces) {
+  USBJoystick joystick;
+  joystick.autoSend = true;
+  joystick.autoSendWindow = 10;
+  joystick.update();
+  host::clearSentReports();
+
+  host::advance(20);
+  joystick.pressButton(0);   // Window passed, sent.
+  joystick.pressButton(1);   // Held back.
+  joystick.pressButton(2);
+  CHECK_EQUAL( 1u, host::sentCount() );
+
+  host::advance(10);
+  joystick.pressButton(3);   // Sends the held changes too.
+  std::vector<host::Report> sent = host::sentReports();
+  CHECK_EQUAL( 2u, sent.size() );
+  if (sent.size() == 2) CHECK_EQUAL( 0x0F, sent[1][1] );
+}
+
+TEST(pumpSendsInTheBackground) {
+  USBJoystick joystick;
+  CHECK( joystick.startPump() );
+  CHECK( joystick.pumpRunning() );
+  CHECK( waitForReports(1) );   // The initial state.
+
+  joystick.pressButton(7);
+  CHECK( waitForReports(2) );
+  joystick.stopPump();
+  CHECK( !joystick.pumpRunning() );
+
+  std::vector<host::Report> sent = host::sentReports();
+  CHECK( sent.size() >= 2 );
+  if (sent.size() >= 2) CHECK_EQUAL( 0x80, sent.back()[1] );
+}
+
+TEST(reportDescriptorIsBuilt) {
+  USBJoystick joystick;
+  const uint8_t *descriptor = joystick.usb().report_desc();
+  CHECK( joystick.usb().report_desc_length() > joystick.layout().descriptorLength );
+  CHECK_EQUAL( 0, memcmp(descriptor, joystick.layout().descriptor, joystick.layout().descriptorLength - 1) );
+}
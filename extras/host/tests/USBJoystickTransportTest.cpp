@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "HostTest.h"
+#include "USBJoystick.h"
+
+using namespace arduino;
+
+
+/*
+  'JoystickPipeTransport' on a real pipe: the frames, and what a send does when the reader is behind.
+  'USBJoystick' going through 'JoystickUSBTransport' is covered by 'USBJoystickTest'.
+*/
+
+typedef USBJoystickLayout<8, AXIS_X | AXIS_Y, 8> PipeLayout;
+
+static const uint8_t FRAME_REPORT[] = { 0x10, 0xA5, 0x01, 0x02 };
+
+class Pipe {
+public:
+  Pipe(void) { if (pipe(this->fds) != 0) this->fds[0] = this->fds[1] = -1; }
+  ~Pipe(void) { close(this->fds[0]); close(this->fds[1]); }
+
+  int readEnd(void) const { return this->fds[0]; }
+  int writeEnd(void) const { return this->fds[1]; }
+
+  // Fill the pipe until a non-blocking write fails, returns the bytes written.
+  size_t fill(void)
+  {
+    fcntl(this->writeEnd(), F_SETFL, fcntl(this->writeEnd(), F_GETFL) | O_NONBLOCK);
+    uint8_t filler[ 256 ];
+    memset(filler, 0xEE, sizeof(filler));
+    size_t total = 0;
+    for (size_t chunk = sizeof(filler); chunk > 0; chunk /= 2) {
+      ssize_t written;
+      while ((written = write(this->writeEnd(), filler, chunk)) > 0) total += written;
+    }
+    return total;
+  }
+
+  // Everything readable right now.
+  std::vector<uint8_t> drain(void)
+  {
+    fcntl(this->readEnd(), F_SETFL, fcntl(this->readEnd(), F_GETFL) | O_NONBLOCK);
+    std::vector<uint8_t> data;
+    uint8_t buffer[ 4096 ];
+    ssize_t got;
+    while ((got = read(this->readEnd(), buffer, sizeof(buffer))) > 0) data.insert(data.end(), buffer, buffer + got);
+    return data;
+  }
+
+private:
+  int fds[2];
+} ;
+
+static bool endsWithFrame(const std::vector<uint8_t> &data, const uint8_t *report, uint8_t length)
+{
+  if (data.size() < 1u + length) return false;
+  size_t start = data.size() - 1 - length;
+  return data[start] == length && memcmp(&data[start + 1], report, length) == 0;
+}
+
+
+TEST(updateWritesOneFrame) {
+  Pipe pipe;
+  JoystickPipeTransport transport( pipe.writeEnd() );
+  JoystickDevice joystick( PipeLayout::layout, transport );
+  CHECK( joystick.begin() );
+
+  joystick.pressButton(1);
+  joystick.setXAxis(511.0f);
+  CHECK( joystick.update() );
+
+  const uint8_t length = joystick.layout().reportLength;
+  std::vector<uint8_t> data = pipe.drain();
+  CHECK_EQUAL( 1u + length, data.size() );
+  if (data.size() != 1u + length) return;
+  CHECK_EQUAL( length, data[0] );
+  CHECK_EQUAL( joystick.layout().reportId, data[1] );
+  CHECK_EQUAL( 0x02, data[2] );
+  CHECK_EQUAL( 127, static_cast<int8_t>(data[3]) );
+}
+
+TEST(nonBlockingSendFailsWholeOnAFullPipe) {
+  Pipe pipe;
+  JoystickPipeTransport transport( pipe.writeEnd() );
+  size_t filled = pipe.fill();
+  CHECK( filled > 0 );
+
+  CHECK( !transport.sendReport(FRAME_REPORT, sizeof(FRAME_REPORT), false) );
+
+  // Nothing of the frame went in, not even the length byte.
+  std::vector<uint8_t> data = pipe.drain();
+  CHECK_EQUAL( filled, data.size() );
+  CHECK( !endsWithFrame(data, FRAME_REPORT, sizeof(FRAME_REPORT)) );
+
+  CHECK( transport.sendReport(FRAME_REPORT, sizeof(FRAME_REPORT), false) );
+  CHECK( endsWithFrame(pipe.drain(), FRAME_REPORT, sizeof(FRAME_REPORT)) );
+}
+
+TEST(blockingSendWaitsForTheReader) {
+  Pipe pipe;
+  JoystickPipeTransport transport( pipe.writeEnd() );
+  size_t filled = pipe.fill();   // Also makes the descriptor O_NONBLOCK, the transport must wait by itself.
+
+  std::vector<uint8_t> data;
+  std::thread reader([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    while (data.size() < filled + 1 + sizeof(FRAME_REPORT)) {
+      std::vector<uint8_t> more = pipe.drain();
+      data.insert(data.end(), more.begin(), more.end());
+      std::this_thread::yield();
+    }
+  });
+  bool sent = transport.sendReport(FRAME_REPORT, sizeof(FRAME_REPORT), true);
+  reader.join();
+
+  CHECK( sent );
+  CHECK_EQUAL( filled + 1 + sizeof(FRAME_REPORT), data.size() );
+  CHECK( endsWithFrame(data, FRAME_REPORT, sizeof(FRAME_REPORT)) );
+}
+
+TEST(sendToAClosedPipeFails) {
+  signal(SIGPIPE, SIG_IGN);   // Then the write fails with EPIPE instead of ending the test.
+  int fds[2];
+  CHECK_EQUAL( 0, pipe(fds) );
+  close(fds[0]);
+  JoystickPipeTransport transport( fds[1] );
+
+  CHECK( !transport.sendReport(FRAME_REPORT, sizeof(FRAME_REPORT), true) );
+  close(fds[1]);
+}
+
+TEST(hostFramesArriveInPieces) {
+  Pipe output, input;
+  JoystickPipeTransport transport( output.writeEnd(), input.readEnd() );
+  JoystickDevice joystick( PipeLayout::layout, transport );
+  CHECK( joystick.begin() );
+
+  // SET_KEEP_ALIVE of 500 ms, split over two reads; the frame is only passed on whole.
+  uint8_t frame[ 1 + JoystickConfig::COMMAND_LENGTH ] = { JoystickConfig::COMMAND_LENGTH, JoystickConfig::COMMAND_REPORT_ID,
+                                                          JoystickConfig::SET_KEEP_ALIVE, 0, 0xF4, 0x01 };
+  CHECK_EQUAL( 4, write(input.writeEnd(), frame, 4) );
+  transport.poll();
+  joystick.update();
+  CHECK( joystick.keepAliveInterval != 500u );
+
+  CHECK_EQUAL( static_cast<ssize_t>(sizeof(frame) - 4), write(input.writeEnd(), frame + 4, sizeof(frame) - 4) );
+  transport.poll();
+  joystick.update();
+  CHECK_EQUAL( 500u, joystick.keepAliveInterval );
+}
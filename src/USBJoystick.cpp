@@ -20,82 +20,44 @@
 #include "usb_phy_api.h"
 
 
-USBJoystick::USBJoystick(bool connect, uint16_t vendor_id, uint16_t product_id, uint16_t product_release):
-  USBHID(get_usb_phy(), 0, 0, vendor_id, product_id, product_release)
+JoystickUSBTransport::JoystickUSBTransport(JoystickDevice &device, USBPhy *phy, uint16_t vendor_id, uint16_t product_id,
+                                           uint16_t product_release):
+  USBHID(phy, 0, 0, vendor_id, product_id, product_release),
+  _device(device)
 {
-
+  // User or owner must call connect or init. 
 }
 
-USBJoystick::USBJoystick(USBPhy *phy, uint16_t vendor_id, uint16_t product_id, uint16_t product_release):
-  USBHID(phy, 0, 0, vendor_id, product_id, product_release)
+bool JoystickUSBTransport::sendReport(const uint8_t *report, uint8_t length, bool blocking)
 {
-  // User or child must call connect or init when using this constructor. 
+  if (length > MAX_HID_REPORT_SIZE) return false;
+
+  HID_REPORT hidReport;
+  hidReport.length = length;
+  memcpy(hidReport.data, report, length);
+  return this->sendHidReport(&hidReport, blocking);
 }
 
-USBJoystick::~USBJoystick(void)
+bool JoystickUSBTransport::sendHidReport(HID_REPORT *report, bool blocking)
 {
+  if (blocking) {
+    return this->send( report );
+  }
+  return this->send_nb( report );
 }
 
 
-const uint8_t* USBJoystick::report_desc(void)
+const uint8_t* JoystickUSBTransport::report_desc(void)
 {
-  // TODO: Make a HID-descriptor which can handle different axis-counts and multiple joysticks.
-  static const uint8_t reportDescriptor[] = { 
-        USAGE_PAGE(1), 0x01,        // Generic Desktop
-        USAGE(1), 0x04,             // Joystick
-        COLLECTION(1), 0x01,        // Collection Application
-
-          // Report for buttons.
-          COLLECTION(1), 0x00,      // Collection Physical. 
-            //REPORT_ID(1), 0x01,         // ReportID = 01.
-            REPORT_ID(1), this->REPORT_ID,  
-            USAGE_PAGE(1), 0x09,        // Button page.
-            USAGE_MINIMUM(1), 0x01,     // Min allowed UsageID 
-            //USAGE_MAXIMUM(1), 0x20,     // Max allowed UsageID 
-            USAGE_MAXIMUM(1), this->BUTTONS_MAX_NUMBER,     // Max allowed UsageID 
-            LOGICAL_MINIMUM(1), 0x00,   // Min value 0 = button not pressed.
-            LOGICAL_MAXIMUM(1), 0x01,   // Max value 1 = button pressed.
-            //REPORT_COUNT(1), 0x20,      // 32 reports... (32 buttons)
-            REPORT_COUNT(1), this->BUTTONS_MAX_NUMBER,      
-            REPORT_SIZE(1), 0x01,       // ...of 1 bit of data per report.
-            INPUT(1), 0x02,             // Data, Variable, Absolute
-          END_COLLECTION(0),
-
-          USAGE_PAGE(1), 0x01,      // Generic Desktop
-          USAGE(1), 0x01,           // Pointer
-          COLLECTION(1), 0x00,      // Collection Physical
-            USAGE_PAGE(1), 0x01,        // Generic Desktop
-            USAGE(1), 0x30,             // X
-            USAGE(1), 0x31,             // Y
-            USAGE(1), 0x32,             // Z
-            USAGE(1), 0x33,             // Rx
-            USAGE(1), 0x34,             // Ry
-            USAGE(1), 0x35,             // Rz
-            //LOGICAL_MINIMUM(2), 0x01, 0xfe, // 0xfe01 = -511. 10-bit resolution. 
-            //LOGICAL_MAXIMUM(2), 0xff, 0x01, // 0x01ff = 511
-            LOGICAL_MINIMUM(2), static_cast<uint8_t>(this->HID_AXIS_MIN), static_cast<uint8_t>(this->HID_AXIS_MIN >> this->BYTE_LENGTH),
-            LOGICAL_MAXIMUM(2), static_cast<uint8_t>(this->HID_AXIS_MAX), static_cast<uint8_t>(this->HID_AXIS_MAX >> this->BYTE_LENGTH),
-            REPORT_COUNT(1), 0x06,      // 6 reports ...
-            REPORT_SIZE(1), 0x10,       // ...of 16 bits of data.
-            INPUT(1), 0x02,             // Data, variable, absolute.
-          END_COLLECTION(0),        // End collection Physical.
-
-        END_COLLECTION(0)           // End collection Application
-    };
-
-  this->reportLength = sizeof(reportDescriptor); // reportLength is inherited from USBHID.
-  return reportDescriptor;
+  // Rebuilt on every call, it only changes if joysticks were attached after the last one.
+  this->reportLength = this->_device.reportDescriptor(this->_reportDescriptor, sizeof(this->_reportDescriptor)); // reportLength is inherited from USBHID.
+  return this->_reportDescriptor;
 }
 
 
 #define DEFAULT_CONFIGURATION (1)
-#define TOTAL_DESCRIPTOR_LENGTH ((1 * CONFIGURATION_DESCRIPTOR_LENGTH) \
-                               + (1 * INTERFACE_DESCRIPTOR_LENGTH) \
-                               + (1 * HID_DESCRIPTOR_LENGTH) \
-                               + (1 * ENDPOINT_DESCRIPTOR_LENGTH))
-                               //+ (2 * ENDPOINT_DESCRIPTOR_LENGTH)) 
 
-const uint8_t* USBJoystick::configuration_desc(uint8_t index)
+const uint8_t* JoystickUSBTransport::configuration_desc(uint8_t index)
 {
   if (index != 0) { return NULL; } // Is 'index' the configuration number??
 
@@ -103,8 +65,8 @@ const uint8_t* USBJoystick::configuration_desc(uint8_t index)
   uint8_t configuration_descriptor_temp[] = {  
     CONFIGURATION_DESCRIPTOR_LENGTH,    // bLength
     CONFIGURATION_DESCRIPTOR,           // bDescriptorType
-    LSB(TOTAL_DESCRIPTOR_LENGTH),       // wTotalLength (LSB)
-    MSB(TOTAL_DESCRIPTOR_LENGTH),       // wTotalLength (MSB)
+    LSB(CONFIGURATION_DESCRIPTOR_TOTAL_LENGTH), // wTotalLength (LSB)
+    MSB(CONFIGURATION_DESCRIPTOR_TOTAL_LENGTH), // wTotalLength (MSB)
     0x01,                               // bNumInterfaces
     DEFAULT_CONFIGURATION,              // bConfigurationValue
     0x00,                               // iConfiguration
@@ -115,7 +77,7 @@ const uint8_t* USBJoystick::configuration_desc(uint8_t index)
     INTERFACE_DESCRIPTOR,               // bDescriptorType
     0x00,                               // bInterfaceNumber
     0x00,                               // bAlternateSetting
-    0x01,                               // bNumEndpoints
+    0x02,                               // bNumEndpoints
     HID_CLASS,                          // bInterfaceClass
     HID_SUBCLASS_NONE,                  // bInterfaceSubClass
     HID_PROTOCOL_NONE,                  // bInterfaceProtocol
@@ -137,19 +99,19 @@ const uint8_t* USBJoystick::configuration_desc(uint8_t index)
     E_INTERRUPT,                        // bmAttributes
     LSB(MAX_HID_REPORT_SIZE),           // wMaxPacketSize (LSB)
     MSB(MAX_HID_REPORT_SIZE),           // wMaxPacketSize (MSB)
-    1,                                  // bInterval (milliseconds)
-
-// OUT-endpoint is not necessary for regular joystick that only sends data to host.
-//    ENDPOINT_DESCRIPTOR_LENGTH,         // bLength
-//    ENDPOINT_DESCRIPTOR,                // bDescriptorType
-//    _int_out,                           // bEndpointAddress
-//    E_INTERRUPT,                        // bmAttributes
-//    LSB(MAX_HID_REPORT_SIZE),           // wMaxPacketSize (LSB)
-//    MSB(MAX_HID_REPORT_SIZE),           // wMaxPacketSize (MSB)
-//    1,                                  // bInterval (milliseconds)
+    this->pollInterval,                 // bInterval (milliseconds)
+
+    // OUT-endpoint for the configuration commands of the host.
+    ENDPOINT_DESCRIPTOR_LENGTH,         // bLength
+    ENDPOINT_DESCRIPTOR,                // bDescriptorType
+    _int_out,                           // bEndpointAddress
+    E_INTERRUPT,                        // bmAttributes
+    LSB(MAX_HID_REPORT_SIZE),           // wMaxPacketSize (LSB)
+    MSB(MAX_HID_REPORT_SIZE),           // wMaxPacketSize (MSB)
+    this->pollInterval,                 // bInterval (milliseconds)
   };
 
-  MBED_STATIC_ASSERT( sizeof(configuration_descriptor_temp) == sizeof(this->_configuration_descriptor), "Length of 'configuration_descriptor_temp' in 'USBJoystick::configuration_desc' must be identical to the length of array 'USBJoystick::_configuration_descriptor'." );
+  MBED_STATIC_ASSERT( sizeof(configuration_descriptor_temp) == sizeof(this->_configuration_descriptor), "Length of 'configuration_descriptor_temp' in 'JoystickUSBTransport::configuration_desc' must be identical to the length of array 'JoystickUSBTransport::_configuration_descriptor'." );
   memcpy( this->_configuration_descriptor, configuration_descriptor_temp, sizeof(this->_configuration_descriptor) );
   return this->_configuration_descriptor;
 }
@@ -157,224 +119,153 @@ const uint8_t* USBJoystick::configuration_desc(uint8_t index)
 
 
 
-void USBJoystick::updateHIDreport(void) {
-
-  // Buttons part of the HID-report.
-  uint8_t dataBytesAmount = this->BUTTONS_MAX_NUMBER / this->BYTE_LENGTH;
-
-  this->HIDreport.data[0] = this->REPORT_ID;
-  this->HIDreport.length = 1;
-
-  for (uint8_t i=0; i < dataBytesAmount; i++) {
-    this->HIDreport.data[i+1] = this->buttonState[i];
-    this->HIDreport.length++;
-  }
-
-  // Axis part of the report.
-  
-  // NOTE: The axis-values are 16-bit, assigning them to the 
-  // 8-bit array-elements chops away higher bits that don't fit the target variable.
-  // TODO: Should we write 'static_cast<uint8_t>()' to show this more explicitly?
-  // TODO: Or use the axis16bitToByte?
-
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.X;
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.X >> this->BYTE_LENGTH;
-
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Y;
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Y >> this->BYTE_LENGTH;
-
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Z;
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Z >> this->BYTE_LENGTH;
-
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Rx;
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Rx >> this->BYTE_LENGTH;
-
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Ry;
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Ry >> this->BYTE_LENGTH;
-
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Rz;
-  this->HIDreport.data[this->HIDreport.length++] = this->axis.Rz >> this->BYTE_LENGTH;
+#define HID_REPORT_TYPE_OUTPUT (2)
+#define HID_REPORT_TYPE_FEATURE (3)
 
+static bool isHostReportRequest(const USBDevice::setup_packet_t *setup)
+{
+  return setup->bmRequestType.Type == CLASS_TYPE && setup->bRequest == SET_REPORT &&
+         ((setup->wValue >> 8) == HID_REPORT_TYPE_OUTPUT || (setup->wValue >> 8) == HID_REPORT_TYPE_FEATURE);
 }
 
-
-
-bool USBJoystick::update(void)
+void JoystickUSBTransport::callback_request(const USBDevice::setup_packet_t *setup)
 {
-  this->updateHIDreport();
-
-  this->_mutex.lock();  // The underlying USB-system and -hardware is most probably shared
-                        // by all threads, so we need to acquire lock before using it.
-
-  bool sendSuccessful;
-  if (this->sendBlocking) {
-    sendSuccessful = this->send( &(this->HIDreport) );
+  // wValue has the report type in the high byte and the report ID in the low byte.
+  if (setup->bmRequestType.Type == CLASS_TYPE && setup->bRequest == GET_REPORT &&
+      (setup->wValue >> 8) == HID_REPORT_TYPE_FEATURE) {
+    uint8_t length = this->_device.featureReport(setup->wValue & 0xFF, this->_featureReport);
+    if (length > 0) {
+      if (length > setup->wLength) length = setup->wLength;
+      PluggableUSBD().complete_request(USBDevice::Send, this->_featureReport, length);
+      return;
+    }
   }
-  else {
-    sendSuccessful = this->send_nb( &(this->HIDreport) );
+  if (isHostReportRequest(setup)) {
+    uint16_t length = (setup->wLength < sizeof(this->_hostReport)) ? setup->wLength : sizeof(this->_hostReport);
+    PluggableUSBD().complete_request(USBDevice::Receive, this->_hostReport, length);
+    return;
   }
-
-  this->_mutex.unlock();
-  return sendSuccessful;
+  USBHID::callback_request(setup);
 }
 
-
-// TODO: Cut & paste of same code in 'pressButton', 'releaseButton' and ' toggleButton'.
-void USBJoystick::pressButton(uint8_t buttonNumber)
+void JoystickUSBTransport::callback_request_xfer_done(const USBDevice::setup_packet_t *setup, bool aborted)
 {
-  // buttonState is array of 8-bit integers where each bit represents current button state.
-  // buttonState[0] has buttons 0-7, buttonState[1] has buttons 8-15 etc. 
- 
-  // Get the array index and bit position for the button number 'buttonNumber'.
-  uint8_t index = buttonNumber / this->BYTE_LENGTH;
-  uint8_t position = buttonNumber % this->BYTE_LENGTH; 
-
-  bitSet( this->buttonState[index], position );
-  if (this->autoSend) this->update();
+  if (isHostReportRequest(setup)) {
+    if (!aborted) {
+      uint16_t length = (setup->wLength < sizeof(this->_hostReport)) ? setup->wLength : sizeof(this->_hostReport);
+      this->_device.hostReport(this->_hostReport, length);
+    }
+    PluggableUSBD().complete_request_xfer_done(!aborted);
+    return;
+  }
+  USBHID::callback_request_xfer_done(setup, aborted);
 }
 
-void USBJoystick::releaseButton(uint8_t buttonNumber)
+void JoystickUSBTransport::report_rx(void)
 {
-  // See 'USBJoystick::pressButton for explanation of 'index' and 'position'.
-  uint8_t index = buttonNumber / this->BYTE_LENGTH; 
-  uint8_t position = buttonNumber % this->BYTE_LENGTH;
-
-  bitClear( this->buttonState[index], position );
-  if (this->autoSend) this->update();
+  // Runs in the USB interrupt context, 'read_nb' only copies the received report.
+  HID_REPORT report;
+  if (this->read_nb(&report)) {
+    this->_device.hostReport(report.data, report.length);
+  }
 }
 
-void USBJoystick::toggleButton(uint8_t buttonNumber)
+void JoystickUSBTransport::report_tx(void)
 {
-  // See 'USBJoystick::pressButton for explanation of 'index' and 'position'.
-  uint8_t index = buttonNumber / this->BYTE_LENGTH; 
-  uint8_t position = buttonNumber % this->BYTE_LENGTH;
-
-  this->buttonState[index] ^= 0x01 << position; // XOR to toggle a bit.
-  if (this->autoSend) this->update();
+  // Runs in the USB interrupt context.
+  this->_device.transportReady();
 }
 
-void USBJoystick::setButton(uint8_t buttonNumber, uint8_t value)
+
+USBJoystick::USBJoystick(bool connect, uint16_t vendor_id, uint16_t product_id, uint16_t product_release):
+  USBJoystick(USBJoystickLayout<>::layout, connect, vendor_id, product_id, product_release)
 {
-  if (value == 0) this->releaseButton(buttonNumber);
-  else this->pressButton(buttonNumber);
+
 }
 
+USBJoystick::USBJoystick(const JoystickLayout &layout, bool /* connect */, uint16_t vendor_id, uint16_t product_id, uint16_t product_release):
+  USBJoystick(layout, get_usb_phy(), vendor_id, product_id, product_release)
+{
 
+}
 
-int8_t USBJoystick::axis16bitToByte(int16_t axisValue, bool MSB_OR_LSB) {
-  switch (MSB_OR_LSB) {
-    case MSB:
-      return static_cast<int8_t>( axisValue >> this->BYTE_LENGTH );
-    case LSB:
-      return static_cast<int8_t>( axisValue );
+USBJoystick::USBJoystick(const JoystickLayout &layout, JoystickCore *const *joysticks, uint8_t count,
+                         bool /* connect */, uint16_t vendor_id, uint16_t product_id, uint16_t product_release):
+  USBJoystick(layout, get_usb_phy(), vendor_id, product_id, product_release)
+{
+  // Before the USB-stack asks for the report descriptor.
+  for (uint8_t i=0; i < count; i++) {
+    this->addJoystick( *joysticks[i] );
   }
 }
 
+USBJoystick::USBJoystick(USBPhy *phy, uint16_t vendor_id, uint16_t product_id, uint16_t product_release):
+  USBJoystick(USBJoystickLayout<>::layout, phy, vendor_id, product_id, product_release)
+{
 
-// TODO: Too much cut & pasting. Can we just write one function which takes axis as input?
-void USBJoystick::setXAxis(float value) {
-  value = constrain( value, this->axisMin.X, this->axisMax.X );
-  this->axis.X = USBJoystick::mapfi(value, this->axisMin.X, this->axisMax.X, 
-                    this->HID_AXIS_MIN, this->HID_AXIS_MAX);
-
-  if (this->autoSend) this->update();
 }
 
-void USBJoystick::setYAxis(float value) {
-  value = constrain (value, this->axisMin.Y, this->axisMax.Y );
-  this->axis.Y = USBJoystick::mapfi(value, this->axisMin.Y, this->axisMax.Y,
-                    this->HID_AXIS_MIN, this->HID_AXIS_MAX);
- 
-  if (this->autoSend) this->update();
+USBJoystick::USBJoystick(const JoystickLayout &layout, USBPhy *phy, uint16_t vendor_id, uint16_t product_id, uint16_t product_release):
+  JoystickDevice(layout, this->_usb),   // Only the reference is taken, '_usb' is constructed next.
+  _usb(*this, phy, vendor_id, product_id, product_release),
+  pollInterval(this->_usb.pollInterval)
+{
+  // User or child must call connect or init when using this constructor. 
 }
 
-void USBJoystick::setZAxis(float value) {
-  value = constrain( value, this->axisMin.Z, this->axisMax.Z );
-  this->axis.Z = USBJoystick::mapfi(value, this->axisMin.Z, this->axisMax.Z,
-                    this->HID_AXIS_MIN, this->HID_AXIS_MAX);
- 
-  if (this->autoSend) this->update();
-}
-void USBJoystick::setRxAxis(float value) {
-  value = constrain( value, this->axisMin.Rx, this->axisMax.Rx );
-  this->axis.Rx = map(value, this->axisMin.Rx, this->axisMax.Rx, 
-                      this->HID_AXIS_MIN, this->HID_AXIS_MAX);
-  
-  if (this->autoSend) this->update();
-}
-void USBJoystick::setRyAxis(float value) {
-  value = constrain( value, this->axisMin.Ry, this->axisMax.Ry );
-  this->axis.Ry = map(value, this->axisMin.Ry, this->axisMax.Ry, 
-                      this->HID_AXIS_MIN, this->HID_AXIS_MAX);
-  
-  if (this->autoSend) this->update();
-}
-void USBJoystick::setRzAxis(float value) {
-  value = constrain( value, this->axisMin.Rz, this->axisMax.Rz );
-  this->axis.Rz = map(value, this->axisMin.Rz, this->axisMax.Rz, 
-                      this->HID_AXIS_MIN, this->HID_AXIS_MAX);
-  
-  if (this->autoSend) this->update();
+USBJoystick::~USBJoystick(void)
+{
+  this->stopPump();
 }
 
-void USBJoystick::setThrottleAxis(float value) {
-  value = constrain( value, this->axisMin.throttle, this->axisMax.throttle );
-  this->axis.throttle = map(value, this->axisMin.throttle, this->axisMax.throttle, 
-                          this->HID_AXIS_MIN, this->HID_AXIS_MAX);
-  
-  if (this->autoSend) this->update();
+void USBJoystick::stateChanged(void)
+{
+  if (this->_pumpThread != nullptr) this->_pumpFlags.set(PUMP_FLAG_CHANGED);  // Safe from ISRs too.
 }
 
-void USBJoystick::setRudderAxis(float value) {
-  value = constrain( value, this->axisMin.rudder, this->axisMax.rudder );
-  this->axis.rudder = map(value, this->axisMin.rudder, this->axisMax.rudder,
-                        this->HID_AXIS_MIN, this->HID_AXIS_MAX);
 
-  if (this->autoSend) this->update();
+bool USBJoystick::startPump(osPriority priority, uint32_t stackSize)
+{
+  if (this->_pumpThread != nullptr) return false;
+
+  this->_pumpFlags.clear(PUMP_FLAG_CHANGED | PUMP_FLAG_TX_READY | PUMP_FLAG_STOP);
+  this->_pumpThread = new rtos::Thread(priority, stackSize, nullptr, "USBJoystick");
+  this->_pumpThread->start( mbed::callback(this, &USBJoystick::pumpLoop) );
+  this->_pumpFlags.set(PUMP_FLAG_CHANGED);  // Send whatever is pending right away.
+  return true;
 }
 
+void USBJoystick::stopPump(void)
+{
+  if (this->_pumpThread == nullptr) return;
 
-// TODO: Too much cut & pasting, again...
-void USBJoystick::setXAxisRange(int16_t minimum, int16_t maximum) {
-  this->axisMin.X = min(minimum, maximum);
-  this->axisMax.X = max(minimum, maximum);
-}
-void USBJoystick::setYAxisRange(int16_t minimum, int16_t maximum) {
-  this->axisMin.Y = min(minimum, maximum);
-  this->axisMax.Y = max(minimum, maximum);
-}
-void USBJoystick::setZAxisRange(int16_t minimum, int16_t maximum) {
-  this->axisMin.Z = min(minimum, maximum);
-  this->axisMax.Z = max(minimum, maximum);
-}
-void USBJoystick::setRxAxisRange(int16_t minimum, int16_t maximum) {
-  this->axisMin.Rx = min(minimum, maximum);
-  this->axisMax.Rx = max(minimum, maximum);
-}
-void USBJoystick::setRyAxisRange(int16_t minimum, int16_t maximum) {
-  this->axisMin.Ry = min(minimum, maximum);
-  this->axisMax.Ry = max(minimum, maximum);
+  this->_pumpFlags.set(PUMP_FLAG_STOP);
+  this->_pumpThread->join();
+  delete this->_pumpThread;
+  this->_pumpThread = nullptr;
 }
-void USBJoystick::setRzAxisRange(int16_t minimum, int16_t maximum) {
-  this->axisMin.Rz = min(minimum, maximum);
-  this->axisMax.Rz = max(minimum, maximum);
-}
-void USBJoystick::setThrottleAxisRange(int16_t minimum, int16_t maximum) {
-  this->axisMin.throttle = min(minimum, maximum);
-  this->axisMax.throttle = max(minimum, maximum);
-}
-void USBJoystick::setRudderAxisRange(int16_t minimum, int16_t maximum) {
-  this->axisMin.rudder = min(minimum, maximum);
-  this->axisMax.rudder = max(minimum, maximum);
-}
-void USBJoystick::setAllAxisRange(int16_t minimum, int16_t maximum) {
-  this->setXAxisRange(minimum, maximum);
-  this->setYAxisRange(minimum, maximum);
-  this->setZAxisRange(minimum, maximum);
-  this->setRxAxisRange(minimum, maximum);
-  this->setRyAxisRange(minimum, maximum);
-  this->setRzAxisRange(minimum, maximum);
-  this->setThrottleAxisRange(minimum, maximum);
-  this->setRudderAxisRange(minimum, maximum);
+
+void USBJoystick::transportReady(void)
+{
+  // Runs in the USB interrupt context, only signal the pump.
+  if (this->_pumpThread != nullptr) this->_pumpFlags.set(PUMP_FLAG_TX_READY);
 }
 
+void USBJoystick::pumpLoop(void)
+{
+  while (true) {
+    uint32_t interval = this->keepAlive( millis() );   // Grows while idle when a rate governor is attached.
+    uint32_t timeout = (interval != 0) ? interval : osWaitForever;
+    uint32_t flags = this->_pumpFlags.wait_any(PUMP_FLAG_CHANGED | PUMP_FLAG_TX_READY | PUMP_FLAG_STOP, timeout);
+
+    if (flags & osFlagsError) {
+      this->update();  // Timed out, 'update' sends the keep-alive if it is due.
+      continue;
+    }
+    if (flags & PUMP_FLAG_STOP) return;
+
+    // TX_READY alone wakes us after every transfer; only send if something changed meanwhile
+    // or a non-blocking send failed earlier and left the state dirty.
+    if (this->pending()) this->update();
+  }
+}
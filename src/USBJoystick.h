@@ -20,88 +20,76 @@
 #define USBJOYSTICK_H
 
 #include "PluggableUSBHID.h"
-#include "PlatformMutex.h"
+#include "mbed_atomic.h"
+#include "rtos.h"
+#include "USBJoystickCore.h"
+#include "USBJoystickTransport.h"
 
 namespace arduino {
 
-enum {
-  MSB,
-  LSB
-} ;
 
-class USBJoystick: public USBHID { 
+/*
+  USB backend of a 'JoystickDevice': the USB descriptors, the interrupt endpoints and the control
+  requests of the HID interface. Reports go to 'USBHID::send' or 'send_nb' in the 'HID_REPORT'
+  the joystick built them in.
+
+  The USB stack asks for the report descriptor as soon as the device enumerates, which on the boards
+  may be before 'setup', so the transport knows its device from the start. 'USBJoystick' is the
+  ready-made pair, to send a 'JoystickDevice' over USB yourself
+
+    extern JoystickDevice joystick;
+    JoystickUSBTransport usb( joystick, get_usb_phy() );
+    JoystickDevice joystick( USBJoystickLayout<>::layout, usb );
+*/
+class JoystickUSBTransport: public USBHID, public JoystickTransport {
 private:
-  // TODO: Change BUTTONS_MAX_NUMBER to be set by user.
-  static const uint8_t BUTTON_ARRAY_MAX_SIZE = 32;  // Absolute maximum number of buttons 32*8 = 256.
-  static const uint8_t BUTTONS_MAX_NUMBER = 64;      // Actual max amount of buttons we are using.
-  static const uint8_t BYTE_LENGTH = 8;             // How many bits is in a single byte of data. 
-
+  static const uint16_t CONFIGURATION_DESCRIPTOR_TOTAL_LENGTH = CONFIGURATION_DESCRIPTOR_LENGTH
+                                                              + INTERFACE_DESCRIPTOR_LENGTH
+                                                              + HID_DESCRIPTOR_LENGTH
+                                                              + 2 * ENDPOINT_DESCRIPTOR_LENGTH;
 
-  // Axis data will be constrained to this range when sending it over the USB. Default 10-bit res.
-  // TODO: 16-bit resolution works on windows but not on linux. Maybe something wrong with the HID-report?
-  //static const int16_t HID_AXIS_MIN = -511;   // 10-bit
-  //static const int16_t HID_AXIS_MAX = 511;
-  //static const int16_t HID_AXIS_MIN = -1023;  // 11-bit
-  //static const int16_t HID_AXIS_MAX = 1023;
-  static const int16_t HID_AXIS_MIN = -2047;    // 12-bit
-  static const int16_t HID_AXIS_MAX = 2047;
+  // Room for the report descriptors of 'MAX_JOYSTICKS' joysticks and the force feedback reports.
+  static const uint16_t REPORT_DESCRIPTOR_MAX_LENGTH = 512 + JoystickForceFeedback::DESCRIPTOR_LENGTH;
 
+  // Longest output or feature report the host writes.
+  static const uint8_t HOST_REPORT_MAX_LENGTH = (JoystickConfig::COMMAND_LENGTH > JoystickForceFeedback::REPORT_MAX_LENGTH)
+                                              ? JoystickConfig::COMMAND_LENGTH : JoystickForceFeedback::REPORT_MAX_LENGTH;
 
-  // TODO:  Report IDs have to be declared static or otherwise the report-descriptor becomes corrupted and
-  //        the whole USB-device goes down.
-  static const uint8_t REPORT_ID = 0x10;
+  JoystickDevice &_device;
 
-  // Buttons amount must be byte-aligned because I don't want to deal with padding-data in the HID-report :)
-  MBED_STATIC_ASSERT( BUTTONS_MAX_NUMBER % BYTE_LENGTH == 0, 
-                      "BUTTONS_MAX_NUMBER does not align to byte-length" ); 
+  uint8_t _configuration_descriptor[ CONFIGURATION_DESCRIPTOR_TOTAL_LENGTH ];
+  uint8_t _reportDescriptor[ REPORT_DESCRIPTOR_MAX_LENGTH ];
+  uint8_t _featureReport[ JoystickDevice::FEATURE_REPORT_LENGTH ];   // Answer to the GET_REPORT in progress.
+  uint8_t _hostReport[ HOST_REPORT_MAX_LENGTH ];   // Data of the SET_REPORT in progress.
 
 
-  uint8_t _configuration_descriptor[34]; // 34 bytes. // TODO: Hardcoded magic number 
-  HID_REPORT HIDreport;
-  PlatformMutex _mutex;
-  
-
 public:
 
-  bool sendBlocking = true;
-  bool autoSend = false;
-
-  uint8_t buttonState[ BUTTON_ARRAY_MAX_SIZE ];   
-
-  struct _axis_ {
-    int16_t X;
-    int16_t Y;
-    int16_t Z;
-    int16_t Rx;
-    int16_t Ry;
-    int16_t Rz;
-    int16_t throttle;
-    int16_t rudder;
-  } ;
-
-  // TODO: Hardcoded magic default numbers.
-  _axis_ axis = {0, 0, 0, 0, 0, 0, 0, 0};
-  _axis_ axisMin = {-511, -511, -511, -511, -511, -511, -511, -511 };
-  _axis_ axisMax = {511, 511, 511, 511, 511, 511, 511, 511 };
-
+  // 'bInterval' of the interrupt-IN endpoint in milliseconds, how often the host polls for a report.
+  // The host reads it when it enumerates the device, so change it before that (before 'connect' when
+  // constructed with a 'USBPhy') or reconnect afterwards.
+  uint8_t pollInterval = 1;
 
   /*
-    Constuctors and destructors.
+    'device' only needs to be constructed by the time the USB stack asks for the descriptors.
   */
-  USBJoystick(bool connect_blocking=true, uint16_t vendor_id=0x1235, 
-              uint16_t product_id=0x0050, uint16_t product_release=0x0001);
-
-
+  JoystickUSBTransport(JoystickDevice &device, USBPhy *phy, uint16_t vendor_id=0x1235,
+                       uint16_t product_id=0x0050, uint16_t product_release=0x0001);
 
-  USBJoystick(USBPhy *phy, uint16_t vendor_id=0x1235, 
-              uint16_t product_id=0x0050, uint16_t product_release=0x0001);
-
-  virtual ~USBJoystick(void);
 
+  /*
+    'JoystickTransport' interface. 'begin' only checks that 'device' is the one given to the constructor,
+    the USB stack connects the device.
+  */
+  virtual bool begin(JoystickDevice &device) { return &device == &this->_device; }
+  virtual bool sendReport(const uint8_t *report, uint8_t length, bool blocking);
+  virtual bool sendHidReport(HID_REPORT *report, bool blocking);
+  virtual bool ready(void) const { return const_cast<JoystickUSBTransport *>(this)->USBHID::ready(); }  // Not const in USBHID.
 
 
   /*
-   Construct the HID-report descriptor.
+   Construct the HID-report descriptor. The descriptors are generated at compile time by the layouts,
+   here they are only put together for all the attached joysticks.
 
    @returns pointer to the report descriptor.
   */
@@ -111,130 +99,130 @@ public:
   virtual const uint8_t *report_desc(void);
 
 
-  // TODO: Do we need these? 'report_rx' is used only when Host sends HID-report to the Device.
-  // Do we need to use 'report_tx' or simply use 'send' periodically???
-  //virtual void report_rx(void); // Called when there is a hid report that can be read.
-  //virtual void report_tx(void); // Called when there is space to send a hid report (space in the USB-bus??)
-
-  
   /*
-    Send a USB HID-report to the host. 'send' for blocking and 'send_nb' for non-blocking.
-    These are inherited from the USBHID class.
+    Called by USBHID when the host has written an output report to the interrupt-OUT endpoint.
+    Passes configuration commands and force feedback reports on, see 'JoystickCore::receiveReport'.
   */
-  // bool send(HID_REPORT report);
-  // bool send_nb(HID_REPORT report);
+  virtual void report_rx(void);
 
   /*
-    Read a USB HID-report from the host. 'read' for blocking and 'read_nb' for non-blocking.
-    These are inherited from the USBHID class.
+    Called by USBHID when the interrupt-IN endpoint has finished sending the previous report.
+    Tells the device with 'JoystickDevice::transportReady'.
   */
-  // bool read(HID_REPORT report);
-  // bool read_nb(HID_REPORT report);
- 
+  virtual void report_tx(void);
+
 
+protected:
   /*
-    Send joystick state update to the host. 
+   Get configuration descriptor.
 
-    @returns true if there was no error, false otherwise. Return values passed through from 'USBHID::send'. 
+   @returns pointer to the configuration descriptor.
   */
-  bool update(void);
+  // TODO: Who calls this function? Something deep inside the USB-stack???
+  virtual const uint8_t *configuration_desc(uint8_t index);
 
   /*
-    Wrapper. For API-compliance with the MHeironimus-ArduinoJoystickLibrary.
+    Control requests of the interface. Answers GET_REPORT for the feature reports and takes
+    SET_REPORT for the output and feature reports, everything else is handled by USBHID.
   */
-  void sendState(void) { this->update(); }
+  virtual void callback_request(const USBDevice::setup_packet_t *setup);
+  virtual void callback_request_xfer_done(const USBDevice::setup_packet_t *setup, bool aborted);
 
-  /*
-    These don't really do much currently. For API-compliance with the MHeironimus-ArduinoJoystickLibrary.
-  */
-  void begin(bool autoSendState) { this->autoSend = autoSendState; }
-  void end(void) { }
 
-  /*
-    Update the HID-report with the current joystick-state (axis-values, button-states etc.).
-  */
-  void updateHIDreport(void);
+} ; // End of 'class JoystickUSBTransport'.
 
-  /*
-    Get the lower (LSB) or higher (MSB) 8-bits of 16-bit axis-value.
-    You have to call this twice with MSB and LSB to get the full axis value. 
-    Used to store the axis value in the HID-report which is made of 8-bit fields.
 
-    @returns 8-bit integer containing the least-significant or most significant byte. 
-  */
-  int8_t axis16bitToByte(int16_t axisValue, bool MSB_OR_LSB);
+/*
+  USB HID joystick: a 'JoystickDevice' with its own 'JoystickUSBTransport'. The joystick state and the
+  setters come from 'JoystickCore', this class adds the report pump. The 'USBHID' of the device,
+  for 'connect' or 'configured' for example, is 'usb()'.
+*/
+class USBJoystick: public JoystickDevice { 
+private:
+  // Events for the report pump thread.
+  static const uint32_t PUMP_FLAG_CHANGED = 0x01;   // State changed, send it.
+  static const uint32_t PUMP_FLAG_TX_READY = 0x02;  // Interrupt-IN endpoint finished the previous report.
+  static const uint32_t PUMP_FLAG_STOP = 0x04;
 
+  JoystickUSBTransport _usb;
+
+  rtos::Thread *_pumpThread = nullptr;  // Non-null while the pump is running.
+  rtos::EventFlags _pumpFlags;
 
   /*
-    Template implementation of Arduino map-function for arbitary input and output data-types.
+    Body of the pump thread. Sleeps until the state changes or the endpoint is free again,
+    then sends the latest state.
   */
-  //template<typename fromType, typename toType>
-  //static toType map(fromType x, fromType in_min, fromType in_max, toType out_min, toType out_max)
-  //{
-  //  return (x -in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
-  //}
+  void pumpLoop(void);
+
 
+public:
+
+  // 'bInterval' of the interrupt-IN endpoint, see 'JoystickUSBTransport::pollInterval'.
+  uint8_t &pollInterval;
 
   /*
-    Maps value in the range [in_min:in_max] to [out_min:out_max].
-    Local implementation of Arduino map-function for floating-point data input. 
-    Takes input as 'float' and output as 'int16_t'.
-    
-    @returns mapped value as 16-bit integer.
+    Constuctors and destructors.
+    Without 'layout' the joystick uses the default 'USBJoystickLayout<>' (64 buttons, X to Rz axes),
+    otherwise for example
+
+      USBJoystick joystick( USBJoystickLayout<8, AXIS_X | AXIS_Y, 8>::layout );
+
+    'joysticks' are 'count' more logical joysticks attached to the device with 'addJoystick',
+    see 'JoystickCore'. They must be constructed before this one.
   */
-  static inline int16_t mapfi(float x, float in_min, float in_max, int16_t out_min, int16_t out_max)
-  {
-    return (x-in_min) * (out_max-out_min) / (in_max-in_min) + out_min;
-  }
+  USBJoystick(bool connect_blocking=true, uint16_t vendor_id=0x1235, 
+              uint16_t product_id=0x0050, uint16_t product_release=0x0001);
+
+  USBJoystick(const JoystickLayout &layout, bool connect_blocking=true, uint16_t vendor_id=0x1235, 
+              uint16_t product_id=0x0050, uint16_t product_release=0x0001);
+
+  USBJoystick(const JoystickLayout &layout, JoystickCore *const *joysticks, uint8_t count,
+              bool connect_blocking=true, uint16_t vendor_id=0x1235, 
+              uint16_t product_id=0x0050, uint16_t product_release=0x0001);
+
+
+  USBJoystick(USBPhy *phy, uint16_t vendor_id=0x1235, 
+              uint16_t product_id=0x0050, uint16_t product_release=0x0001);
+
+  USBJoystick(const JoystickLayout &layout, USBPhy *phy, uint16_t vendor_id=0x1235, 
+              uint16_t product_id=0x0050, uint16_t product_release=0x0001);
+
+  virtual ~USBJoystick(void);
 
 
   /*
-    Set axis value to the given value.
+    The USB side of the device: 'connect', 'configured', the descriptors and the raw 'send' and 'read'
+    of 'USBHID'.
   */
-  void setXAxis(float value);
-  void setYAxis(float value);
-  void setZAxis(float value);
-  void setRxAxis(float value);
-  void setRyAxis(float value);
-  void setRzAxis(float value);
-  void setThrottleAxis(float value);
-  void setRudderAxis(float value);
+  JoystickUSBTransport &usb(void) { return this->_usb; }
 
 
   /*
-    Set the allowed minimum and maximum values. 
-  */
-  void setXAxisRange(int16_t min, int16_t max);
-  void setYAxisRange(int16_t min, int16_t max);
-  void setZAxisRange(int16_t min, int16_t max);
-  void setRxAxisRange(int16_t min, int16_t max);
-  void setRyAxisRange(int16_t min, int16_t max);
-  void setRzAxisRange(int16_t min, int16_t max);
-  void setThrottleAxisRange(int16_t min, int16_t max);
-  void setRudderAxisRange(int16_t min, int16_t max);
-  void setAllAxisRange(int16_t min, int16_t max);
+    Start or stop the report pump. While the pump is running a library-owned thread sends the
+    latest state as soon as it changes and the endpoint is free, so the setters never block and
+    neither 'autoSend' nor calling 'update' is needed. A change waits at most one 'bInterval' frame
+    for the transfer in progress. 'keepAliveInterval' and 'sendBlocking' still apply; with a rate governor
+    attached the pump sleeps for the governor's interval instead, see 'JoystickRateGovernor'.
 
+    @returns false if the pump was already running.
+  */
+  bool startPump(osPriority priority = osPriorityAboveNormal, uint32_t stackSize = 1024);
+  void stopPump(void);
+  bool pumpRunning(void) const { return this->_pumpThread != nullptr; }
 
   /*
-    Press button. Sets button 'buttonNumber' state to 1.
-    Release button. Sets button 'buttonNumber' state to 0.
-    Toggle button. Invert the current state of the button 'buttonNumber'.
-    Set button 'buttonNumber' state to 0 if value is 0, 1 if value is non-zero.
+    Wakes up the pump when the interrupt-IN endpoint is free, does nothing when the pump is not running.
   */
-  void pressButton(uint8_t buttonNumber);
-  void releaseButton(uint8_t buttonNumber);
-  void toggleButton(uint8_t buttonNumber);
-  void setButton(uint8_t buttonNumber, uint8_t value);
+  virtual void transportReady(void);
 
 
 protected:
   /*
-   Get configuration descriptor.
-
-   @returns pointer to the configuration descriptor.
+    'JoystickCore' interface: wake up the pump.
   */
-  // TODO: Who calls this function? Something deep inside the USB-stack???
-  virtual const uint8_t *configuration_desc(uint8_t index);
+  virtual void stateChanged(void);
+  virtual bool sendsInBackground(void) const { return this->_pumpThread != nullptr; }
 
 
 } ; // End of 'class USBJoystick'.
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickAnalog.h"
+
+using namespace arduino;
+
+
+JoystickAnalog::JoystickAnalog(JoystickCore &joystick, JoystickAnalogHardware &hardware):
+  _joystick(joystick),
+  _hardware(hardware)
+{
+  memset(this->_buffers, 0, sizeof(this->_buffers));
+}
+
+JoystickAnalog::~JoystickAnalog(void)
+{
+  this->stop();
+}
+
+
+bool JoystickAnalog::addChannel(uint8_t input, uint8_t axisNumber)
+{
+  if (this->_running || this->_channelCount >= MAX_CHANNELS || axisNumber >= AXIS_COUNT) return false;
+  if (this->_axisMask & (0x01 << axisNumber)) return false;   // One input per axis.
+
+  this->_inputs[ this->_channelCount ] = input;
+  this->_axes[ this->_channelCount ] = axisNumber;
+  this->_axisMask |= 0x01 << axisNumber;
+  this->_channelCount++;
+  return true;
+}
+
+bool JoystickAnalog::start(uint32_t interval)
+{
+  if (this->_running || this->_channelCount == 0) return false;
+
+  core_util_atomic_store_u8(&this->_ready, 0);
+  this->_running = this->_hardware.start(*this, this->_inputs, this->_channelCount, interval);
+  return this->_running;
+}
+
+void JoystickAnalog::stop(void)
+{
+  if (!this->_running) return;
+
+  this->_hardware.stop();
+  this->_running = false;
+}
+
+
+void JoystickAnalog::scanComplete(uint8_t index)
+{
+  if (this->deliverFromInterrupt) {
+    core_util_atomic_incr_u32(&this->_scans, 1);
+    this->deliver(this->_buffers[ index & 0x01 ]);
+    return;
+  }
+
+  core_util_atomic_store_u8(&this->_latest, index & 0x01);
+  core_util_atomic_incr_u32(&this->_scans, 1);
+
+  // The previous scan is replaced before 'poll' took it.
+  if (core_util_atomic_exchange_u8(&this->_ready, 1) != 0) core_util_atomic_incr_u32(&this->_overruns, 1);
+}
+
+bool JoystickAnalog::poll(void)
+{
+  if (core_util_atomic_exchange_u8(&this->_ready, 0) == 0) return false;
+
+  // The hardware writes to the other buffer meanwhile; copy, and again if a scan completed during the copy.
+  int16_t samples[ MAX_CHANNELS ];
+  uint32_t scans;
+  do {
+    scans = core_util_atomic_load_u32(&this->_scans);
+    memcpy(samples, this->_buffers[ core_util_atomic_load_u8(&this->_latest) ], sizeof(samples));
+  } while (core_util_atomic_load_u32(&this->_scans) != scans);
+
+  this->deliver(samples);
+  return true;
+}
+
+void JoystickAnalog::deliver(const int16_t *samples)
+{
+  int16_t values[ AXIS_COUNT ];
+  for (uint8_t i=0; i < this->_channelCount; i++) {
+    values[ this->_axes[i] ] = samples[i];
+  }
+  this->_joystick.setAxes(values, this->_axisMask);
+}
+
+
+#if defined(NRF52840_XXAA)
+JoystickAnalogSAADC *JoystickAnalogSAADC::_active = nullptr;
+
+JoystickAnalogSAADC::JoystickAnalogSAADC(NRF_TIMER_Type *timer, uint8_t ppiChannel):
+  _timer(timer),
+  _ppiChannel(ppiChannel)
+{
+
+}
+
+bool JoystickAnalogSAADC::start(JoystickAnalog &analog, const uint8_t *inputs, uint8_t count, uint32_t interval)
+{
+  if (_active != nullptr || count == 0 || count > 8) return false;
+  _active = this;
+  this->_analog = &analog;
+
+  NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled << SAADC_ENABLE_ENABLE_Pos;
+  NRF_SAADC->RESOLUTION = SAADC_RESOLUTION_VAL_12bit << SAADC_RESOLUTION_VAL_Pos;
+  NRF_SAADC->OVERSAMPLE = SAADC_OVERSAMPLE_OVERSAMPLE_Bypass << SAADC_OVERSAMPLE_OVERSAMPLE_Pos;
+  NRF_SAADC->SAMPLERATE = SAADC_SAMPLERATE_MODE_Task << SAADC_SAMPLERATE_MODE_Pos;
+
+  // Ratiometric to VDD, so the pots read the same whatever the supply. Scan mode converts every
+  // channel with a PSELP on one SAMPLE task, in channel order.
+  for (uint8_t i=0; i < 8; i++) {
+    NRF_SAADC->CH[i].PSELN = SAADC_CH_PSELN_PSELN_NC;
+    if (i >= count) {
+      NRF_SAADC->CH[i].PSELP = SAADC_CH_PSELP_PSELP_NC;
+      continue;
+    }
+    NRF_SAADC->CH[i].CONFIG = (SAADC_CH_CONFIG_GAIN_Gain1_4 << SAADC_CH_CONFIG_GAIN_Pos)
+                            | (SAADC_CH_CONFIG_REFSEL_VDD1_4 << SAADC_CH_CONFIG_REFSEL_Pos)
+                            | (SAADC_CH_CONFIG_TACQ_10us << SAADC_CH_CONFIG_TACQ_Pos)
+                            | (SAADC_CH_CONFIG_MODE_SE << SAADC_CH_CONFIG_MODE_Pos)
+                            | (SAADC_CH_CONFIG_BURST_Disabled << SAADC_CH_CONFIG_BURST_Pos);
+    NRF_SAADC->CH[i].PSELP = SAADC_CH_PSELP_PSELP_AnalogInput0 + inputs[i];
+  }
+
+  NRF_SAADC->RESULT.PTR = reinterpret_cast<uint32_t>(analog.buffer(0));
+  NRF_SAADC->RESULT.MAXCNT = count;
+  this->_filling = 0;
+
+  NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Enabled << SAADC_ENABLE_ENABLE_Pos;
+  NRF_SAADC->EVENTS_CALIBRATEDONE = 0;
+  NRF_SAADC->TASKS_CALIBRATEOFFSET = 1;
+  while (NRF_SAADC->EVENTS_CALIBRATEDONE == 0) { }
+
+  NRF_SAADC->EVENTS_STARTED = 0;
+  NRF_SAADC->EVENTS_END = 0;
+  NRF_SAADC->INTENCLR = 0xFFFFFFFF;
+  NRF_SAADC->INTENSET = SAADC_INTENSET_STARTED_Msk | SAADC_INTENSET_END_Msk;
+  NVIC_SetVector(SAADC_IRQn, reinterpret_cast<uint32_t>(&JoystickAnalogSAADC::irqHandler));
+  NVIC_ClearPendingIRQ(SAADC_IRQn);
+  NVIC_EnableIRQ(SAADC_IRQn);
+
+  // The timer samples, the end of a scan starts the next buffer.
+  this->_timer->TASKS_STOP = 1;
+  this->_timer->MODE = TIMER_MODE_MODE_Timer << TIMER_MODE_MODE_Pos;
+  this->_timer->BITMODE = TIMER_BITMODE_BITMODE_32Bit << TIMER_BITMODE_BITMODE_Pos;
+  this->_timer->PRESCALER = 4;   // 16 MHz / 2^4, 1 MHz.
+  this->_timer->CC[0] = interval;
+  this->_timer->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+  this->_timer->TASKS_CLEAR = 1;
+
+  NRF_PPI->CH[ this->_ppiChannel ].EEP = reinterpret_cast<uint32_t>(&this->_timer->EVENTS_COMPARE[0]);
+  NRF_PPI->CH[ this->_ppiChannel ].TEP = reinterpret_cast<uint32_t>(&NRF_SAADC->TASKS_SAMPLE);
+  NRF_PPI->CH[ this->_ppiChannel + 1 ].EEP = reinterpret_cast<uint32_t>(&NRF_SAADC->EVENTS_END);
+  NRF_PPI->CH[ this->_ppiChannel + 1 ].TEP = reinterpret_cast<uint32_t>(&NRF_SAADC->TASKS_START);
+  NRF_PPI->CHENSET = (1UL << this->_ppiChannel) | (1UL << (this->_ppiChannel + 1));
+
+  NRF_SAADC->TASKS_START = 1;
+  this->_timer->TASKS_START = 1;
+  return true;
+}
+
+void JoystickAnalogSAADC::stop(void)
+{
+  if (_active != this) return;
+
+  this->_timer->TASKS_STOP = 1;
+  NRF_PPI->CHENCLR = (1UL << this->_ppiChannel) | (1UL << (this->_ppiChannel + 1));
+
+  NVIC_DisableIRQ(SAADC_IRQn);
+  NRF_SAADC->INTENCLR = 0xFFFFFFFF;
+  NRF_SAADC->EVENTS_STOPPED = 0;
+  NRF_SAADC->TASKS_STOP = 1;
+  while (NRF_SAADC->EVENTS_STOPPED == 0) { }
+  NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled << SAADC_ENABLE_ENABLE_Pos;
+
+  this->_analog = nullptr;
+  _active = nullptr;
+}
+
+void JoystickAnalogSAADC::irqHandler(void)
+{
+  JoystickAnalogSAADC *self = _active;
+
+  // END before STARTED: when both are pending the scan that ended was started before the new one.
+  if (NRF_SAADC->EVENTS_END) {
+    NRF_SAADC->EVENTS_END = 0;
+    uint8_t completed = self->_filling;
+    self->_filling ^= 0x01;
+    self->_analog->scanComplete(completed);
+  }
+
+  // The pointer is latched at START, so the one written now is used by the scan after the current one.
+  if (NRF_SAADC->EVENTS_STARTED) {
+    NRF_SAADC->EVENTS_STARTED = 0;
+    NRF_SAADC->RESULT.PTR = reinterpret_cast<uint32_t>(self->_analog->buffer( self->_filling ^ 0x01 ));
+  }
+}
+#endif
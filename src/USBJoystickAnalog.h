@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKANALOG_H
+#define USBJOYSTICKANALOG_H
+
+#include <stdint.h>
+#include "mbed.h"
+#include "USBJoystickCore.h"
+
+namespace arduino {
+
+class JoystickAnalog;
+
+/*
+  ADC that scans its inputs continuously by itself, for 'JoystickAnalog'. Implement this for other MCUs,
+  or with simulated samples to run the acquisition on a host.
+
+  'start' converts 'count' inputs every 'interval' microseconds, all of them in one scan, into
+  'JoystickAnalog::buffer(0)' and 'buffer(1)' in turn, and calls 'JoystickAnalog::scanComplete' with
+  the number of the buffer after each scan. The next scan goes to the other buffer.
+*/
+class JoystickAnalogHardware {
+public:
+  virtual ~JoystickAnalogHardware(void) { }
+
+  virtual bool start(JoystickAnalog &analog, const uint8_t *inputs, uint8_t count, uint32_t interval) = 0;
+  virtual void stop(void) = 0;
+} ;
+
+
+#if defined(NRF52840_XXAA)
+/*
+  SAADC of the nRF52840 (Nano 33 BLE). TIMER 'timer' triggers a scan of all the channels through a
+  PPI channel, EasyDMA writes the results and a second PPI channel restarts the SAADC on the next
+  buffer at the end of each scan; the CPU only sees one interrupt per scan.
+
+  'inputs' are the analog inputs AIN0 ... AIN7 (A0 of the Nano 33 BLE is AIN2, see its pinout). 12 bits,
+  0 ... 4095 from GND to VDD. Takes over the SAADC, don't use 'analogRead' while started.
+*/
+class JoystickAnalogSAADC : public JoystickAnalogHardware {
+public:
+  JoystickAnalogSAADC(NRF_TIMER_Type *timer = NRF_TIMER4, uint8_t ppiChannel = 10);
+
+  virtual bool start(JoystickAnalog &analog, const uint8_t *inputs, uint8_t count, uint32_t interval);
+  virtual void stop(void);
+
+
+private:
+  static JoystickAnalogSAADC *_active;   // The instance the interrupt handler serves.
+  static void irqHandler(void);
+
+  NRF_TIMER_Type *_timer;
+  uint8_t _ppiChannel;   // This one and the next.
+  JoystickAnalog *_analog = nullptr;
+  uint8_t _filling = 0;  // Buffer the EasyDMA writes to.
+} ;
+#endif
+
+
+/*
+  Continuous analog acquisition for the axes: the ADC scans all the inputs in the background, so
+  nothing waits for 'analogRead' and all the axes of a report are sampled together.
+
+    JoystickAnalogSAADC adc;
+    JoystickAnalog analog( joystick, adc );
+    analog.addChannel( 2, X_AXIS );   // AIN2
+    analog.addChannel( 3, Y_AXIS );
+    joystick.setXAxisRange( 0, 4095 );
+    joystick.setYAxisRange( 0, 4095 );
+    analog.start( 1000 );             // Every millisecond.
+
+  Each complete scan goes to the joystick with one 'setAxes' call: the whole scan is one state update,
+  through the calibration, filter and curve of each axis. By default that happens in the interrupt
+  of the scan; with 'deliverFromInterrupt' off it waits for 'poll' instead, and a scan that was not
+  polled before the next one completes is counted in 'overruns' and replaced by the newer one.
+*/
+class JoystickAnalog {
+public:
+  static const uint8_t MAX_CHANNELS = AXIS_COUNT;
+
+  bool deliverFromInterrupt = true;
+
+  JoystickAnalog(JoystickCore &joystick, JoystickAnalogHardware &hardware);
+  ~JoystickAnalog(void);
+
+  JoystickAnalog(const JoystickAnalog &) = delete;
+  JoystickAnalog &operator=(const JoystickAnalog &) = delete;
+
+  /*
+    Sample input 'input' of the hardware into axis 'axisNumber'. Add the channels before 'start'.
+
+    @returns false if all the channels are in use.
+  */
+  bool addChannel(uint8_t input, uint8_t axisNumber);
+
+  /*
+    Start or stop the scans, one every 'interval' microseconds.
+  */
+  bool start(uint32_t interval = 1000);
+  void stop(void);
+
+  /*
+    Deliver the latest complete scan when 'deliverFromInterrupt' is off.
+
+    @returns true if there was a new scan.
+  */
+  bool poll(void);
+
+  /*
+    Hardware side: the two scan buffers, MAX_CHANNELS samples each in the order of 'addChannel',
+    and the end of a scan into buffer 'index'. Called from the ADC interrupt.
+  */
+  int16_t *buffer(uint8_t index) { return this->_buffers[ index & 0x01 ]; }
+  void scanComplete(uint8_t index);
+
+  uint32_t scans(void) const { return core_util_atomic_load_u32(&this->_scans); }
+  uint32_t overruns(void) const { return core_util_atomic_load_u32(&this->_overruns); }
+
+
+private:
+  JoystickCore &_joystick;
+  JoystickAnalogHardware &_hardware;
+
+  uint8_t _inputs[ MAX_CHANNELS ];
+  uint8_t _axes[ MAX_CHANNELS ];     // Axis of each channel.
+  uint8_t _axisMask = 0;
+  uint8_t _channelCount = 0;
+  bool _running = false;
+
+  int16_t _buffers[2][ MAX_CHANNELS ];
+  volatile uint32_t _scans = 0;      // Complete scans, the latest is in buffer '_latest'.
+  volatile uint8_t _latest = 0;
+  volatile uint8_t _ready = 0;       // A scan is waiting for 'poll'.
+  volatile uint32_t _overruns = 0;
+
+  /*
+    Pass one scan to the joystick.
+  */
+  void deliver(const int16_t *samples);
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKANALOG_H
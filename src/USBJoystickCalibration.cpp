@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickCalibration.h"
+#include "USBJoystickCore.h"
+
+using namespace arduino;
+
+
+#if DEVICE_FLASH
+JoystickCalibrationFlash::JoystickCalibrationFlash(uint32_t address, uint32_t size)
+{
+  if (this->_flash.init() != 0) {
+    this->_address = 0;
+    this->_size = 0;
+    return;
+  }
+
+  if (address == 0) {
+    uint32_t end = this->_flash.get_flash_start() + this->_flash.get_flash_size();
+    address = end - 2 * this->_flash.get_sector_size(end - 1);
+  }
+  if (size == 0) size = 2 * this->_flash.get_sector_size(address);
+
+  this->_address = address;
+  this->_size = size;
+  this->_programSize = this->_flash.get_page_size();
+  this->_erasedValue = this->_flash.get_erase_value();
+  this->_ready = true;
+}
+
+JoystickCalibrationFlash::~JoystickCalibrationFlash(void)
+{
+  if (this->_ready) this->_flash.deinit();
+}
+
+bool JoystickCalibrationFlash::read(uint32_t offset, void *data, uint32_t length)
+{
+  if (!this->_ready || offset + length > this->_size) return false;
+  return this->_flash.read(data, this->_address + offset, length) == 0;
+}
+
+bool JoystickCalibrationFlash::program(uint32_t offset, const void *data, uint32_t length)
+{
+  if (!this->_ready || offset + length > this->_size) return false;
+  return this->_flash.program(data, this->_address + offset, length) == 0;
+}
+
+bool JoystickCalibrationFlash::erase(uint32_t offset, uint32_t length)
+{
+  if (!this->_ready || offset + length > this->_size) return false;
+  return this->_flash.erase(this->_address + offset, length) == 0;
+}
+#endif
+
+
+JoystickCalibration::JoystickCalibration(JoystickCore &joystick, JoystickCalibrationStorage &storage)
+  : _joystick(joystick), _storage(storage)
+{
+  uint32_t programSize = (storage.programSize() > 0) ? storage.programSize() : 1;
+  this->_slotLength = (RECORD_LENGTH + programSize - 1) / programSize * programSize;
+  if (this->_slotLength > MAX_SLOT_LENGTH) this->_slotLength = 0;
+  this->_halfLength = storage.size() / 2;
+  if (this->_halfLength < this->_slotLength) this->_slotLength = 0;   // Not even one record per half.
+
+  memset(this->_stored, 0, sizeof(this->_stored));
+  this->restart();
+  this->load();
+
+  joystick.setCalibration(this);
+}
+
+JoystickCalibration::~JoystickCalibration(void)
+{
+  if (this->_joystick.calibration() == this) this->_joystick.setCalibration(nullptr);
+}
+
+
+void JoystickCalibration::sample(uint8_t axisNumber, int32_t value)
+{
+  if (!this->learning) return;
+
+  // The setters take 16-bit ranges.
+  value = constrain( value, INT16_MIN, INT16_MAX );
+  Axis &axis = this->_axes[axisNumber];
+  uint8_t bit = 0x01 << axisNumber;
+
+  if ((this->_calibrated & bit) == 0) {
+    axis.minimum = value;
+    axis.maximum = value;
+    axis.center = value * 16;
+    axis.last = value;
+    this->_calibrated |= bit;
+    return;
+  }
+
+  bool widened = false;
+  if (value < axis.minimum) {
+    axis.minimum = value;
+    widened = true;
+  }
+  else if (value > axis.maximum) {
+    axis.maximum = value;
+    widened = true;
+  }
+
+  // Moving average over the samples at rest, weight 1/8.
+  int32_t step = value - axis.last;
+  if (step >= -this->restBand && step <= this->restBand) axis.center += (value * 16 - axis.center) / 8;
+  axis.last = value;
+
+  if (widened && axis.maximum - axis.minimum >= this->minimumSpan) {
+    this->_joystick.setAxisRange(axisNumber, axis.minimum, axis.maximum);
+  }
+}
+
+
+void JoystickCalibration::restart(void)
+{
+  // The setters sample inside a critical section, see 'JoystickCore::setAxisRange'.
+  core_util_critical_section_enter();
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    this->_axes[i].minimum = 0;
+    this->_axes[i].maximum = 0;
+    this->_axes[i].center = 0;
+    this->_axes[i].last = 0;
+  }
+  this->_calibrated = 0;
+  core_util_critical_section_exit();
+}
+
+
+bool JoystickCalibration::load(void)
+{
+  if (this->_slotLength == 0) return false;
+
+  // The half with the newer latest record is the one in use; the other one is erased or, after a
+  // power loss during the switch, holds older records.
+  uint8_t latest[ RECORD_LENGTH ];
+  uint8_t other[ RECORD_LENGTH ];
+  uint32_t next;
+  uint32_t otherNext;
+  bool found = this->findLatest(0, latest, next);
+  this->_half = 0;
+  if (this->findLatest(this->_halfLength, other, otherNext)) {
+    uint16_t otherSequence = other[2] | (other[3] << 8);
+    if (!found || static_cast<int16_t>(otherSequence - (latest[2] | (latest[3] << 8))) > 0) {
+      memcpy(latest, other, RECORD_LENGTH);
+      next = otherNext;
+      found = true;
+      this->_half = this->_halfLength;
+    }
+  }
+  this->_nextSlot = next;
+
+  if (!found) return false;
+
+  core_util_critical_section_enter();
+  bool valid = this->decode(latest);
+  core_util_critical_section_exit();
+  if (!valid) {
+    this->restart();
+    return false;
+  }
+
+  memcpy(this->_stored, latest, RECORD_LENGTH);
+  this->_sequence = latest[2] | (latest[3] << 8);
+  this->apply();
+  return true;
+}
+
+bool JoystickCalibration::findLatest(uint32_t half, uint8_t *latest, uint32_t &next)
+{
+  // Records are appended in order, so the latest one is the last valid record before the first erased slot.
+  uint8_t record[ RECORD_LENGTH ];
+  bool found = false;
+  uint8_t erased = this->_storage.erasedValue();
+
+  next = 0;
+  for (; next + this->_slotLength <= this->_halfLength; next += this->_slotLength) {
+    if (!this->_storage.read(half + next, record, RECORD_LENGTH)) break;
+
+    bool empty = true;
+    for (uint8_t i=0; i < RECORD_LENGTH && empty; i++) empty = (record[i] == erased);
+    if (empty) break;
+
+    uint16_t magic = record[0] | (record[1] << 8);
+    uint16_t crc = record[RECORD_LENGTH - 2] | (record[RECORD_LENGTH - 1] << 8);
+    if (magic == MAGIC && crc == crc16(record, RECORD_LENGTH - 2)) {
+      memcpy(latest, record, RECORD_LENGTH);
+      found = true;
+    }
+  }
+  return found;
+}
+
+
+bool JoystickCalibration::save(void)
+{
+  // Programming the flash stalls the CPU and may take a mutex.
+  if (core_util_is_isr_active() || this->_slotLength == 0) return false;
+
+  uint8_t slot[ MAX_SLOT_LENGTH ];
+  memset(slot, this->_storage.erasedValue(), this->_slotLength);
+  core_util_critical_section_enter();   // A consistent snapshot, the setters may be sampling.
+  this->encode(slot, this->_sequence + 1);
+  core_util_critical_section_exit();
+
+  // Same values as stored, apart from the sequence and the CRC.
+  bool stored = (this->_stored[0] == (MAGIC & 0xFF));
+  if (stored && memcmp(slot + 4, this->_stored + 4, RECORD_LENGTH - 6) == 0) return true;
+
+  // A full half is left as it is until the record is safe in the other one.
+  uint32_t full = this->_half;
+  bool switching = this->_nextSlot + this->_slotLength > this->_halfLength;
+  if (switching) {
+    uint32_t half = (this->_half == 0) ? this->_halfLength : 0;
+    if (!this->eraseHalf(half)) return false;
+    this->_half = half;
+    this->_nextSlot = 0;
+  }
+
+  uint32_t offset = this->_half + this->_nextSlot;
+  this->_nextSlot += this->_slotLength;   // A failed slot is not reused before the next erase.
+
+  uint8_t check[ RECORD_LENGTH ];
+  if (!this->_storage.program(offset, slot, this->_slotLength)) return false;
+  if (!this->_storage.read(offset, check, RECORD_LENGTH) || memcmp(check, slot, RECORD_LENGTH) != 0) return false;
+
+  memcpy(this->_stored, slot, RECORD_LENGTH);
+  this->_sequence++;
+  this->_saves++;
+
+  // The old records are not needed any more. If this fails, the next switch erases the half.
+  if (switching && this->_storage.erase(full, this->_halfLength)) this->_erases++;
+  return true;
+}
+
+bool JoystickCalibration::eraseHalf(uint32_t half)
+{
+  uint8_t erased = this->_storage.erasedValue();
+  uint8_t data[ 64 ];
+  for (uint32_t offset = 0; offset < this->_halfLength; offset += sizeof(data)) {
+    uint32_t length = (this->_halfLength - offset < sizeof(data)) ? this->_halfLength - offset : sizeof(data);
+    bool blank = this->_storage.read(half + offset, data, length);
+    for (uint32_t i=0; i < length && blank; i++) blank = (data[i] == erased);
+    if (blank) continue;
+
+    // Left over from a power loss, or an erase that failed.
+    if (!this->_storage.erase(half, this->_halfLength)) return false;
+    this->_erases++;
+    return true;
+  }
+  return true;
+}
+
+
+void JoystickCalibration::apply(void)
+{
+  for (uint8_t i=0; i < AXIS_COUNT; i++) this->applyAxis(i);
+}
+
+void JoystickCalibration::applyAxis(uint8_t axisNumber)
+{
+  if (!this->calibrated(axisNumber)) return;
+
+  const Axis &axis = this->_axes[axisNumber];
+  if (axis.maximum - axis.minimum < this->minimumSpan) return;
+
+  // Range and deadzone center together, so no setter maps with one and not the other.
+  core_util_critical_section_enter();
+  this->_joystick.setAxisRange(axisNumber, axis.minimum, axis.maximum);
+
+  // The filter works on mapped values.
+  JoystickAxisFilter &filter = this->_joystick.axisFilter(axisNumber);
+  filter.setDeadzone(filter.deadzone(), this->_joystick.mapAxis(axisNumber, axis.center >> 4));
+  core_util_critical_section_exit();
+}
+
+
+void JoystickCalibration::encode(uint8_t *record, uint16_t sequence) const
+{
+  uint8_t *p = record;
+  *p++ = MAGIC & 0xFF;
+  *p++ = MAGIC >> 8;
+  *p++ = sequence & 0xFF;
+  *p++ = sequence >> 8;
+
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    *p++ = this->_axes[i].minimum & 0xFF;
+    *p++ = this->_axes[i].minimum >> 8;
+  }
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    *p++ = this->_axes[i].maximum & 0xFF;
+    *p++ = this->_axes[i].maximum >> 8;
+  }
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    int16_t center = this->_axes[i].center >> 4;
+    *p++ = center & 0xFF;
+    *p++ = center >> 8;
+  }
+  *p++ = this->_calibrated;
+  *p++ = 0;
+
+  uint16_t crc = crc16(record, RECORD_LENGTH - 2);
+  *p++ = crc & 0xFF;
+  *p++ = crc >> 8;
+}
+
+bool JoystickCalibration::decode(const uint8_t *record)
+{
+  const uint8_t *p = record + 4;
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    Axis &axis = this->_axes[i];
+    axis.minimum = static_cast<int16_t>(p[0] | (p[1] << 8));
+    axis.maximum = static_cast<int16_t>(p[2 * AXIS_COUNT] | (p[2 * AXIS_COUNT + 1] << 8));
+    axis.center = static_cast<int16_t>(p[4 * AXIS_COUNT] | (p[4 * AXIS_COUNT + 1] << 8)) * 16;
+    axis.last = axis.center >> 4;
+    if (axis.minimum > axis.maximum) return false;
+    p += 2;
+  }
+  this->_calibrated = record[4 + 6 * AXIS_COUNT];
+  return true;
+}
+
+uint16_t JoystickCalibration::crc16(const uint8_t *data, uint32_t length)
+{
+  // CRC-16/CCITT-FALSE, bitwise. A record is checked once at load and once per save.
+  uint16_t crc = 0xFFFF;
+  for (uint32_t i=0; i < length; i++) {
+    crc ^= static_cast<uint16_t>(data[i]) << 8;
+    for (uint8_t bit=0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
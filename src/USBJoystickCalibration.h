@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKCALIBRATION_H
+#define USBJOYSTICKCALIBRATION_H
+
+#include <stdint.h>
+#include "mbed.h"
+#include "USBJoystickLayout.h"
+
+namespace arduino {
+
+class JoystickCore;
+
+/*
+  Storage region of the calibration records. 'erase' clears 'length' bytes from 'offset' to 'erasedValue',
+  both aligned to the sectors; 'program' writes into erased bytes only, in multiples of 'programSize'.
+  The calibration uses the two halves of the region in turn, so each half must be whole sectors.
+*/
+class JoystickCalibrationStorage {
+public:
+  virtual ~JoystickCalibrationStorage(void) { }
+
+  virtual uint32_t size(void) const = 0;
+  virtual uint32_t programSize(void) const = 0;
+  virtual uint8_t erasedValue(void) const { return 0xFF; }
+
+  virtual bool read(uint32_t offset, void *data, uint32_t length) = 0;
+  virtual bool program(uint32_t offset, const void *data, uint32_t length) = 0;
+  virtual bool erase(uint32_t offset, uint32_t length) = 0;
+} ;
+
+
+#if DEVICE_FLASH
+/*
+  Region of the internal flash, through 'mbed::FlashIAP'. 'address', 'size' and the middle of the region
+  must be aligned to the sectors; without them the last two sectors of the flash are used. Make sure the
+  sketch does not reach there.
+*/
+class JoystickCalibrationFlash : public JoystickCalibrationStorage {
+public:
+  JoystickCalibrationFlash(uint32_t address = 0, uint32_t size = 0);
+  virtual ~JoystickCalibrationFlash(void);
+
+  virtual uint32_t size(void) const { return this->_size; }
+  virtual uint32_t programSize(void) const { return this->_programSize; }
+  virtual uint8_t erasedValue(void) const { return this->_erasedValue; }
+
+  virtual bool read(uint32_t offset, void *data, uint32_t length);
+  virtual bool program(uint32_t offset, const void *data, uint32_t length);
+  virtual bool erase(uint32_t offset, uint32_t length);
+
+private:
+  mbed::FlashIAP _flash;
+  uint32_t _address;
+  uint32_t _size;
+  uint32_t _programSize = 1;
+  uint8_t _erasedValue = 0xFF;
+  bool _ready = false;
+} ;
+#endif
+
+
+/*
+  Learns the range and the rest position of the axes from the raw samples and keeps them in storage,
+  so the device comes up calibrated.
+
+  Attached to a joystick, every integer sample of 'setAxisRaw' and 'setAxes' goes through 'sample'
+  before it is mapped: minimum and maximum widen to the samples (the axis range of the joystick
+  follows right away), and the center is the average of the samples taken while the axis is at rest,
+  when it moves less than 'restBand' between two samples. Each sample is a handful of comparisons.
+  The 'float' setters are not calibrated. The center becomes the deadzone center of the axis filter.
+
+  The constructor loads the latest stored record and applies it. 'save' writes the learned values as
+  a new record after the previous ones in one half of the storage. When that half is full the record
+  goes to the start of the other half, and the full half is erased only after the new record has been
+  written and read back, so a power loss at any point leaves the latest or the previous record intact.
+  Each record takes RECORD_LENGTH bytes rounded up to the program size: with 4 kB sectors that is 73
+  saves per erase for program sizes up to 8 bytes, 64 for 16 or 32 bytes. Nothing is written when the
+  values have not changed. Each record has a CRC; a damaged record is skipped and the previous one is used.
+  Saving blocks for the flash write, so call it from the loop, never from an interrupt; the joystick
+  itself never saves.
+
+  The setters call 'sample' inside the critical section they map in, so learning is safe from any thread
+  or ISR feeding the axes, and a widened range is applied as a whole like any 'setAxisRange'.
+*/
+class JoystickCalibration {
+public:
+  static const uint16_t MAGIC = 0x4A43;          // "JC"
+  static const uint8_t RECORD_LENGTH = 56;       // Before padding to the program size.
+  static const uint16_t MAX_SLOT_LENGTH = 256;   // Longest padded record, limits the program size.
+
+  bool learning = true;       // Widen the ranges with the samples.
+  int16_t restBand = 4;       // Largest change between samples that still counts as rest.
+  int16_t minimumSpan = 64;   // The range is applied to the joystick once it is at least this wide.
+
+  JoystickCalibration(JoystickCore &joystick, JoystickCalibrationStorage &storage);
+  ~JoystickCalibration(void);
+
+  JoystickCalibration(const JoystickCalibration &) = delete;
+  JoystickCalibration &operator=(const JoystickCalibration &) = delete;
+
+  /*
+    Called by the joystick with raw sample 'value' of axis 'axisNumber'.
+  */
+  void sample(uint8_t axisNumber, int32_t value);
+
+  /*
+    Forget what has been learned for all the axes, for a fresh sweep. The stored record is kept
+    until the next 'save'.
+  */
+  void restart(void);
+
+  /*
+    Read the latest valid record and apply it to the joystick.
+
+    @returns false if there is no valid record.
+  */
+  bool load(void);
+
+  /*
+    Store the learned values if they differ from the stored ones.
+
+    @returns false if the write failed or was attempted from an interrupt.
+  */
+  bool save(void);
+
+  /*
+    Apply the learned ranges and centers to the joystick.
+  */
+  void apply(void);
+
+  bool calibrated(uint8_t axisNumber) const { return (this->_calibrated & (0x01 << axisNumber)) != 0; }
+  int16_t minimum(uint8_t axisNumber) const { return this->_axes[ axisNumber % AXIS_COUNT ].minimum; }
+  int16_t maximum(uint8_t axisNumber) const { return this->_axes[ axisNumber % AXIS_COUNT ].maximum; }
+  int16_t center(uint8_t axisNumber) const { return this->_axes[ axisNumber % AXIS_COUNT ].center >> 4; }
+
+  uint32_t saves(void) const { return this->_saves; }
+  uint32_t erases(void) const { return this->_erases; }
+
+
+private:
+  struct Axis {
+    int16_t minimum;
+    int16_t maximum;
+    int32_t center;     // Fixed point, 4 fractional bits.
+    int32_t last;
+  } ;
+
+  JoystickCore &_joystick;
+  JoystickCalibrationStorage &_storage;
+
+  Axis _axes[ AXIS_COUNT ];
+  uint8_t _calibrated = 0;    // Bit n set when axis n has samples.
+
+  uint8_t _stored[ RECORD_LENGTH ];   // Latest record in storage, to skip saves that change nothing.
+  uint32_t _slotLength;       // RECORD_LENGTH rounded up to the program size, 0 if that is too long.
+  uint32_t _halfLength;       // Size of each half of the storage.
+  uint32_t _half = 0;         // Offset of the half the records go to.
+  uint32_t _nextSlot = 0;     // Offset of the first free slot, in that half.
+  uint16_t _sequence = 0;     // Sequence number of the latest record.
+  uint32_t _saves = 0;
+  uint32_t _erases = 0;
+
+  void applyAxis(uint8_t axisNumber);
+
+  /*
+    Latest valid record in the half at 'half', into 'latest'. 'next' is set to the offset of the
+    first erased slot of the half, or its end.
+
+    @returns false if the half has no valid record.
+  */
+  bool findLatest(uint32_t half, uint8_t *latest, uint32_t &next);
+
+  /*
+    Erase the half at 'half' unless it is erased already.
+  */
+  bool eraseHalf(uint32_t half);
+
+  /*
+    Record layout, little-endian: magic, sequence, minimum[8], maximum[8], center[8] (int16),
+    calibrated axes mask, reserved byte, CRC-16/CCITT of the preceding bytes.
+  */
+  void encode(uint8_t *record, uint16_t sequence) const;
+  bool decode(const uint8_t *record);
+  static uint16_t crc16(const uint8_t *data, uint32_t length);
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKCALIBRATION_H
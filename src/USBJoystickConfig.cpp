@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickConfig.h"
+#include "USBJoystickCore.h"
+#include "mbed_critical.h"
+
+using namespace arduino;
+
+
+const uint8_t JoystickConfig::DESCRIPTOR[] = {
+  USAGE_PAGE(2), 0x00, 0xFF,        // Vendor defined
+  USAGE(1), 0x02,
+  COLLECTION(1), 0x01,              // Application
+    REPORT_ID(1), COMMAND_REPORT_ID,
+    USAGE(1), 0x01,
+    LOGICAL_MINIMUM(1), 0x00,
+    LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+    REPORT_SIZE(1), 0x08,
+    REPORT_COUNT(1), COMMAND_LENGTH - 1,
+    OUTPUT(1), 0x02,                // Data, Variable, Absolute
+    REPORT_ID(1), CONFIG_REPORT_ID,
+    USAGE(1), 0x02,
+    REPORT_COUNT(1), CONFIG_REPORT_LENGTH - 1,
+    FEATURE(1), 0x02,               // Data, Variable, Absolute
+  END_COLLECTION(0)
+};
+
+static_assert( sizeof(JoystickConfig::DESCRIPTOR) == JoystickConfig::DESCRIPTOR_LENGTH, "DESCRIPTOR_LENGTH does not match DESCRIPTOR" );
+
+
+static int16_t readS16(const uint8_t *data) { return static_cast<int16_t>(data[0] | (data[1] << 8)); }
+static uint16_t readU16(const uint8_t *data) { return static_cast<uint16_t>(data[0] | (data[1] << 8)); }
+
+static void writeS16(uint8_t *report, int16_t value)
+{
+  report[0] = static_cast<uint16_t>(value);
+  report[1] = static_cast<uint16_t>(value) >> 8;
+}
+
+
+bool JoystickConfig::push(const uint8_t *report, uint8_t length)
+{
+  if (length < 3 || report[0] != COMMAND_REPORT_ID) return false;
+
+  uint8_t head = this->_head;
+  if (static_cast<uint8_t>(head - core_util_atomic_load_u8(&this->_tail)) >= QUEUE_LENGTH) {
+    this->_status = STATUS_OVERFLOW;
+    return false;
+  }
+
+  uint8_t *slot = this->_queue[ head % QUEUE_LENGTH ];
+  if (length > COMMAND_LENGTH) length = COMMAND_LENGTH;
+  memcpy(slot, report, length);
+  memset(slot + length, 0, COMMAND_LENGTH - length);   // Short reports read as zero arguments.
+
+  core_util_atomic_store_u8(&this->_head, head + 1);   // Publish after the copy.
+  return true;
+}
+
+
+void JoystickConfig::apply(JoystickCore &device)
+{
+  uint8_t tail = this->_tail;
+  while (tail != core_util_atomic_load_u8(&this->_head)) {
+    this->_status = this->execute(device, this->_queue[ tail % QUEUE_LENGTH ]);
+    this->_applied++;
+    tail++;
+    core_util_atomic_store_u8(&this->_tail, tail);
+  }
+}
+
+
+uint8_t JoystickConfig::execute(JoystickCore &device, const uint8_t *command)
+{
+  uint8_t index = command[2];
+  if (index > device._joystickCount) return STATUS_BAD_ARGUMENT;
+  JoystickCore &joystick = *device.joystick(index);
+  this->_selected = index;
+
+  uint8_t axis = command[3];
+  uint8_t firstAxis = (axis == 0xFF) ? 0 : axis;
+  uint8_t lastAxis = (axis == 0xFF) ? AXIS_COUNT - 1 : axis;
+
+  switch (command[1]) {
+    case SET_AXIS_RANGE: {
+      if (firstAxis >= AXIS_COUNT) return STATUS_BAD_ARGUMENT;
+      int16_t minimum = readS16(command + 4);
+      int16_t maximum = readS16(command + 6);
+      if (minimum >= maximum) return STATUS_BAD_ARGUMENT;
+      for (uint8_t i = firstAxis; i <= lastAxis; i++) joystick.setAxisRange(i, minimum, maximum);
+      return STATUS_OK;
+    }
+
+    case SET_FLAGS: {
+      uint8_t mask = command[3];
+      uint8_t values = command[4];
+      if (mask & FLAG_SEND_BLOCKING) joystick.sendBlocking = (values & FLAG_SEND_BLOCKING) != 0;
+      if (mask & FLAG_AUTO_SEND) joystick.autoSend = (values & FLAG_AUTO_SEND) != 0;
+      return STATUS_OK;
+    }
+
+    case SET_FILTER: {
+      if (firstAxis >= AXIS_COUNT) return STATUS_BAD_ARGUMENT;
+      int16_t deadzone = readS16(command + 4);
+      int16_t center = readS16(command + 6);
+      int16_t hysteresis = readS16(command + 8);
+      uint8_t smoothing = command[10];
+      uint8_t samples = command[11];
+      if (deadzone < 0 || hysteresis < 0 || smoothing > 15 || samples > JoystickAxisFilter::OVERSAMPLE_MAX) {
+        return STATUS_BAD_ARGUMENT;
+      }
+      for (uint8_t i = firstAxis; i <= lastAxis; i++) {
+        // The setters run the filter in a critical section, see 'JoystickCore::axisFilter'.
+        JoystickAxisFilter &filter = joystick.axisFilter(i);
+        core_util_critical_section_enter();
+        filter.setDeadzone(deadzone, center);
+        filter.setHysteresis(hysteresis);
+        filter.setSmoothing(smoothing);
+        filter.setOversampling((samples > 0) ? samples : 1, command[12] != 0);
+        filter.reset();
+        core_util_critical_section_exit();
+      }
+      return STATUS_OK;
+    }
+
+    case SET_KEEP_ALIVE:
+      joystick.keepAliveInterval = readU16(command + 3);
+      return STATUS_OK;
+
+    case SELECT:
+      return STATUS_OK;
+
+    case LOAD_CURVE: {
+      uint8_t slot = command[3];
+      int8_t amount = static_cast<int8_t>(command[5]);
+      if (slot >= CURVE_SLOTS || amount < -100 || amount > 100) return STATUS_BAD_ARGUMENT;
+
+      // Built outside the critical section, only the copy is inside.
+      JoystickCurve curve;
+      if (command[4] == CURVE_EXPO) curve = JoystickCurve::expo(amount / 100.0f);
+      else if (command[4] == CURVE_S) curve = JoystickCurve::sCurve(amount / 100.0f);
+      else if (command[4] != CURVE_LINEAR) return STATUS_BAD_ARGUMENT;
+
+      core_util_critical_section_enter();
+      this->_curves[slot] = curve;
+      core_util_critical_section_exit();
+      return STATUS_OK;
+    }
+
+    case SET_CURVE_POINTS: {
+      uint8_t slot = command[3];
+      uint8_t count = command[5];
+      if (slot >= CURVE_SLOTS || count == 0 || count > 5) return STATUS_BAD_ARGUMENT;
+
+      uint16_t outputs[5];
+      for (uint8_t i=0; i < count; i++) {
+        outputs[i] = readU16(command + 6 + 2 * i);
+        if (outputs[i] > JoystickCurve::ONE) return STATUS_BAD_ARGUMENT;
+      }
+
+      core_util_critical_section_enter();
+      bool fits = this->_curves[slot].setPoints(command[4], outputs, count);
+      core_util_critical_section_exit();
+      return fits ? STATUS_OK : STATUS_BAD_ARGUMENT;
+    }
+
+    case SET_CURVE: {
+      uint8_t slot = command[4];
+      if (firstAxis >= AXIS_COUNT || (slot >= CURVE_SLOTS && slot != NO_CURVE)) return STATUS_BAD_ARGUMENT;
+      const JoystickCurve *curve = (slot == NO_CURVE) ? nullptr : &this->_curves[slot];
+      for (uint8_t i = firstAxis; i <= lastAxis; i++) joystick.setAxisCurve(i, curve);
+      return STATUS_OK;
+    }
+
+    default:
+      return STATUS_UNKNOWN_COMMAND;
+  }
+}
+
+
+uint8_t JoystickConfig::writeReport(const JoystickCore &device, uint8_t *report) const
+{
+  uint8_t index = (this->_selected <= device._joystickCount) ? this->_selected : 0;
+  const JoystickCore &joystick = (index == 0) ? device : *device._joysticks[index - 1];
+
+  report[0] = CONFIG_REPORT_ID;
+  report[1] = VERSION;
+  report[2] = index;
+  report[3] = device._joystickCount + 1;
+  report[4] = (joystick.sendBlocking ? FLAG_SEND_BLOCKING : 0) | (joystick.autoSend ? FLAG_AUTO_SEND : 0);
+  uint32_t keepAlive = (joystick.keepAliveInterval > 0xFFFF) ? 0xFFFF : joystick.keepAliveInterval;
+  report[5] = keepAlive;
+  report[6] = keepAlive >> 8;
+  report[7] = this->_status;
+  report[8] = this->_applied;
+
+  uint8_t length = 9;
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    const JoystickAxisFilter &filter = joystick._axisFilter[i];
+    core_util_critical_section_enter();   // The settings of one axis as a whole.
+    writeS16(report + length, joystick.axisMin.*JoystickCore::AXIS_FIELDS[i]);
+    writeS16(report + length + 2, joystick.axisMax.*JoystickCore::AXIS_FIELDS[i]);
+    writeS16(report + length + 4, filter.deadzone());
+    writeS16(report + length + 6, filter.center());
+    writeS16(report + length + 8, filter.hysteresis());
+    report[length + 10] = filter.smoothing();
+    report[length + 11] = filter.oversampling();
+    core_util_critical_section_exit();
+    length += 12;
+  }
+  for (uint8_t i=0; i < AXIS_COUNT; i++) report[length++] = this->curveSlot(joystick, i);
+  return length;
+}
+
+uint8_t JoystickConfig::curveSlot(const JoystickCore &joystick, uint8_t axisNumber) const
+{
+  const JoystickCurve *curve = joystick.axisCurve(axisNumber);
+  if (curve == nullptr) return NO_CURVE;
+
+  for (uint8_t slot=0; slot < CURVE_SLOTS; slot++) {
+    if (curve == &this->_curves[slot]) return slot;
+  }
+  return OTHER_CURVE;
+}
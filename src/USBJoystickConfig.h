@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKCONFIG_H
+#define USBJOYSTICKCONFIG_H
+
+#include <stdint.h>
+#include "PluggableUSBHID.h"
+#include "mbed_atomic.h"
+#include "USBJoystickCurve.h"
+
+namespace arduino {
+
+class JoystickCore;
+
+/*
+  Configuration channel from the host, so ranges and settings can be changed without reflashing.
+
+  The host writes commands as vendor-defined output report 'COMMAND_REPORT_ID', over the interrupt-OUT
+  endpoint or with SET_REPORT, and reads the configuration of one joystick back as feature report
+  'CONFIG_REPORT_ID'. The USB interrupt only queues the commands; they are applied by 'update' (or the
+  report pump) with the send mutex held, between two reports, and the setters never parse anything.
+  The send mutex does not hold off the setters, which may run in other threads or ISRs meanwhile. Each
+  axis changes its range and its filter settings inside a critical section instead, the section the
+  setters map and filter in, so every value is conditioned entirely with the old settings of its axis or
+  entirely with the new ones. A command for all axes may still reach the report half applied, one axis
+  changed and the next not yet. Settings changed this way are not stored, see 'JoystickCalibration'
+  for that.
+
+  Command report, COMMAND_LENGTH bytes, multi-byte fields little-endian:
+
+    0   report ID
+    1   command
+    2   joystick index in the device, 0 is the first one; also selects it for the configuration report
+    3   arguments:
+          SET_AXIS_RANGE  3 axis (X_AXIS etc., 0xFF for all), 4 int16 minimum, 6 int16 maximum
+          SET_FLAGS       3 mask of the flags to change, 4 new values: bit 0 'sendBlocking', bit 1 'autoSend'
+          SET_FILTER      3 axis (0xFF for all), 4 int16 deadzone, 6 int16 center, 8 int16 hysteresis,
+                          10 smoothing shift, 11 oversampling samples, 12 decimate (0 or 1)
+          SET_KEEP_ALIVE  3 uint16 'keepAliveInterval' in milliseconds
+          SELECT          none
+          LOAD_CURVE      3 curve slot, 4 shape (CURVE_LINEAR, CURVE_EXPO or CURVE_S), 5 int8 amount in percent,
+                          see 'JoystickCurve::expo' and 'JoystickCurve::sCurve'
+          SET_CURVE_POINTS  3 curve slot, 4 first point, 5 number of points (1 to 5),
+                          6 uint16 outputs from 0 to JoystickCurve::ONE, see 'JoystickCurve::setPoints'
+          SET_CURVE       3 axis (0xFF for all), 4 curve slot, NO_CURVE for linear
+
+  The CURVE_SLOTS curves are shared by the joysticks of the device, any number of axes can use one.
+  A slot is rewritten inside a critical section, so a setter never evaluates half of a new curve, but
+  a table uploaded with SET_CURVE_POINTS takes several commands: upload into a slot no axis uses and
+  select it with SET_CURVE once the table is complete. All slots start linear.
+
+  Configuration report, CONFIG_REPORT_LENGTH bytes:
+
+    0   report ID
+    1   format version, 'VERSION'
+    2   selected joystick index
+    3   joysticks in the device
+    4   flags, as in SET_FLAGS
+    5   uint16 'keepAliveInterval', saturated
+    7   status of the last command, STATUS_*
+    8   commands applied, uint8 wrapping
+    9   8 x 12 bytes, one block per axis X_AXIS ... RUDDER_AXIS:
+          int16 minimum, int16 maximum, int16 deadzone, int16 center, int16 hysteresis,
+          uint8 smoothing, uint8 oversampling
+  105   8 x curve slot of the axis, NO_CURVE for linear, OTHER_CURVE for a curve set by the sketch
+*/
+class JoystickConfig {
+public:
+  static const uint8_t COMMAND_REPORT_ID = 0xF1;
+  static const uint8_t CONFIG_REPORT_ID = 0xF2;
+  static const uint8_t VERSION = 2;
+  static const uint8_t COMMAND_LENGTH = 16;         // Including the report ID.
+  static const uint8_t CONFIG_REPORT_LENGTH = 113;   // Including the report ID.
+  static const uint8_t QUEUE_LENGTH = 4;            // Power of two.
+  static const uint8_t CURVE_SLOTS = 4;
+  static const uint8_t NO_CURVE = 0xFF;
+  static const uint8_t OTHER_CURVE = 0xFE;
+
+  enum {
+    SET_AXIS_RANGE = 0x01,
+    SET_FLAGS = 0x02,
+    SET_FILTER = 0x03,
+    SET_KEEP_ALIVE = 0x04,
+    SELECT = 0x05,
+    LOAD_CURVE = 0x06,
+    SET_CURVE_POINTS = 0x07,
+    SET_CURVE = 0x08
+  } ;
+
+  enum {
+    CURVE_LINEAR,
+    CURVE_EXPO,
+    CURVE_S
+  } ;
+
+  enum {
+    STATUS_OK,
+    STATUS_UNKNOWN_COMMAND,
+    STATUS_BAD_ARGUMENT,
+    STATUS_OVERFLOW       // A command arrived while the queue was full and was dropped.
+  } ;
+
+  static const uint8_t FLAG_SEND_BLOCKING = 0x01;
+  static const uint8_t FLAG_AUTO_SEND = 0x02;
+
+  // Vendor-defined top-level collection with the command and configuration reports. Appended to the
+  // report descriptor of the device after the telemetry.
+  static const uint8_t DESCRIPTOR[];
+  static const uint8_t DESCRIPTOR_LENGTH = 31;
+
+  /*
+    Queue a command report. Called from the USB interrupt, one producer at a time.
+
+    @returns false if the report is not a command or the queue is full.
+  */
+  bool push(const uint8_t *report, uint8_t length);
+
+  /*
+    True if commands are waiting.
+  */
+  bool pending(void) const {
+    return core_util_atomic_load_u8(&this->_head) != core_util_atomic_load_u8(&this->_tail);
+  }
+
+  /*
+    Apply the queued commands to 'device', the first joystick of the device. Called with its send mutex held.
+  */
+  void apply(JoystickCore &device);
+
+  /*
+    Write the configuration report of the selected joystick of 'device'. 'report' must have room for
+    CONFIG_REPORT_LENGTH bytes.
+
+    @returns length of the report.
+  */
+  uint8_t writeReport(const JoystickCore &device, uint8_t *report) const;
+
+
+private:
+  uint8_t _queue[ QUEUE_LENGTH ][ COMMAND_LENGTH ];
+  volatile uint8_t _head = 0;   // Written by the producer.
+  volatile uint8_t _tail = 0;   // Written by the consumer.
+
+  volatile uint8_t _status = STATUS_OK;
+  uint8_t _selected = 0;
+  uint8_t _applied = 0;
+
+  JoystickCurve _curves[ CURVE_SLOTS ];   // Written only inside a critical section.
+
+  uint8_t execute(JoystickCore &device, const uint8_t *command);
+
+  /*
+    Slot of the curve of axis 'axisNumber' of 'joystick', for the configuration report.
+  */
+  uint8_t curveSlot(const JoystickCore &joystick, uint8_t axisNumber) const;
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKCONFIG_H
@@ -0,0 +1,794 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stdint.h"
+#include "USBJoystickCore.h"
+#include "mbed_critical.h"
+
+using namespace arduino;
+
+
+JoystickCore::JoystickCore(const JoystickLayout &layout):
+  _layout(&layout),
+  _reportId(layout.reportId)
+{
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    this->updateAxisScale(i);
+    this->_axisFilter[i].setRange(this->_layout->axisMinimum, this->_layout->axisMaximum);
+  }
+
+  // Rounded up so the layout maximum reaches the end of the curve, 'applyCurve' clamps the overshoot.
+  uint32_t range = this->_layout->axisMaximum - this->_layout->axisMinimum;
+  this->_curveScale = (range > 0) ? ((static_cast<uint32_t>(JoystickCurve::ONE) << 16) + range - 1) / range : 0;
+}
+
+
+bool JoystickCore::addJoystick(JoystickCore &joystick)
+{
+  if (this->_parent != nullptr || this->_joystickCount >= MAX_JOYSTICKS - 1) return false;
+  if (&joystick == this || joystick._parent != nullptr || joystick._joystickCount != 0) return false;
+
+  // Report IDs are given in attach order after the IDs of the previous joystick.
+  const JoystickCore *previous = this->joystick(this->_joystickCount);
+  uint16_t nextId = previous->_reportId + previous->_layout->reportCount;
+  if (nextId + joystick._layout->reportCount > JoystickTelemetry::REPORT_ID) return false;
+
+  joystick._reportId = nextId;
+  joystick._parent = this;
+  this->_joysticks[ this->_joystickCount++ ] = &joystick;
+  return true;
+}
+
+
+uint16_t JoystickCore::writeReportDescriptor(uint8_t *buffer, uint16_t size) const
+{
+  uint16_t length = 0;
+
+  for (uint8_t n=0; n <= this->_joystickCount; n++) {
+    const JoystickCore *joystick = (n == 0) ? this : this->_joysticks[n - 1];
+    const JoystickLayout &layout = *joystick->_layout;
+    if (length + layout.descriptorLength > size) return 0;
+    bool forceFeedback = (this->_forceFeedback != nullptr && &this->_forceFeedback->joystick() == joystick);
+
+    memcpy(buffer + length, layout.descriptor, layout.descriptorLength);
+
+    // Walk the items of the copy and move the report IDs to the ones assigned to this joystick.
+    uint16_t end = length + layout.descriptorLength;
+    uint16_t i = length;
+    while (i < end) {
+      uint8_t prefix = buffer[i];
+      if (prefix == 0xFE) {         // Long item: prefix, data size, tag, data.
+        i += 3 + buffer[i + 1];
+        continue;
+      }
+      uint8_t dataSize = ((prefix & 0x03) == 0x03) ? 4 : (prefix & 0x03);
+      if ((prefix & 0xFC) == REPORT_ID(0) && dataSize == 1) {
+        buffer[i + 1] = buffer[i + 1] - layout.reportId + joystick->_reportId;
+      }
+      i += 1 + dataSize;
+    }
+    length = end;
+
+    if (forceFeedback) {
+      // Windows only finds the PID reports inside the application collection of the joystick:
+      // insert them before its END_COLLECTION.
+      if (length + JoystickForceFeedback::DESCRIPTOR_LENGTH > size) return 0;
+      length--;
+      memcpy(buffer + length, JoystickForceFeedback::DESCRIPTOR, JoystickForceFeedback::DESCRIPTOR_LENGTH);
+      length += JoystickForceFeedback::DESCRIPTOR_LENGTH;
+      buffer[length++] = END_COLLECTION(0);
+    }
+  }
+
+  if (length + JoystickTelemetry::DESCRIPTOR_LENGTH + JoystickConfig::DESCRIPTOR_LENGTH > size) return 0;
+  memcpy(buffer + length, JoystickTelemetry::DESCRIPTOR, JoystickTelemetry::DESCRIPTOR_LENGTH);
+  length += JoystickTelemetry::DESCRIPTOR_LENGTH;
+  memcpy(buffer + length, JoystickConfig::DESCRIPTOR, JoystickConfig::DESCRIPTOR_LENGTH);
+  return length + JoystickConfig::DESCRIPTOR_LENGTH;
+}
+
+
+uint8_t JoystickCore::writeFeatureReport(uint8_t reportId, uint8_t *report) const
+{
+  static_assert( JoystickTelemetry::REPORT_LENGTH <= FEATURE_REPORT_MAX_LENGTH, "Telemetry report does not fit" );
+  static_assert( JoystickConfig::CONFIG_REPORT_LENGTH <= FEATURE_REPORT_MAX_LENGTH, "Configuration report does not fit" );
+
+  if (reportId == JoystickTelemetry::REPORT_ID) return this->telemetry().writeReport(report);
+  if (reportId == JoystickConfig::CONFIG_REPORT_ID) return this->root()->_config.writeReport(*this->root(), report);
+  if (this->root()->_forceFeedback != nullptr) return this->root()->_forceFeedback->writeFeatureReport(reportId, report);
+  return 0;
+}
+
+
+bool JoystickCore::receiveReport(const uint8_t *report, uint8_t length)
+{
+  JoystickCore *first = this->root();
+  if (length == 0) return false;
+
+  if (report[0] == JoystickConfig::COMMAND_REPORT_ID) {
+    if (!first->_config.push(report, length)) return false;
+    first->stateChanged();  // Wake up the pump to apply it.
+    return true;
+  }
+  if (first->_forceFeedback != nullptr) return first->_forceFeedback->receiveReport(report, length);
+  return false;
+}
+
+
+bool JoystickCore::sendReport(HID_REPORT * /* report */, bool /* blocking */)
+{
+  return false;   // Not attached to any transport.
+}
+
+
+bool JoystickCore::pending(void) const
+{
+  const JoystickCore *first = (this->_parent != nullptr) ? this->_parent : this;
+
+  if (core_util_atomic_load_u32(&first->_dirty) != 0 || first->_config.pending()) return true;
+  for (uint8_t n=0; n < first->_joystickCount; n++) {
+    if (core_util_atomic_load_u32(&first->_joysticks[n]->_dirty) != 0) return true;
+  }
+  return false;
+}
+
+
+bool JoystickCore::readState(uint8_t *buttons, int16_t *axes)
+{
+  uint8_t dataBytesAmount = this->_layout->buttons / this->BYTE_LENGTH;
+
+  for (uint8_t attempt = 0; attempt < this->STATE_READ_ATTEMPTS; attempt++) {
+    uint32_t sequence = core_util_atomic_load_u32(&this->_stateSequence);
+    if (core_util_atomic_load_u32(&this->_activeWriters) != 0) continue;
+
+    for (uint8_t i=0; i < dataBytesAmount; i++) {
+      buttons[i] = core_util_atomic_load_u8(&this->buttonState[i]);
+    }
+    for (uint8_t i=0; i < AXIS_COUNT; i++) {
+      axes[i] = core_util_atomic_load_s16(&(this->axis.*AXIS_FIELDS[i]));
+    }
+
+    // Valid only if no writer was active at the end and none finished in between.
+    if (core_util_atomic_load_u32(&this->_activeWriters) == 0 &&
+        core_util_atomic_load_u32(&this->_stateSequence) == sequence) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool JoystickCore::updateHIDreport(void) {
+
+  uint8_t buttons[ BUTTON_ARRAY_MAX_SIZE ];
+  int16_t axes[ AXIS_COUNT ];
+  if (!this->readState(buttons, axes)) return false;
+
+  this->buildReport(0, buttons, axes);
+  return true;
+}
+
+
+void JoystickCore::buildReport(uint8_t index, const uint8_t *buttons, const int16_t *axes)
+{
+  this->HIDreport.length = this->_layout->writeReport(this->HIDreport.data, index, buttons, axes);
+  this->HIDreport.data[0] = this->_reportId + index;  // The layout writes its own ID, the device may have renumbered it.
+}
+
+
+bool JoystickCore::readReportState(uint8_t *buttons, int16_t *axes)
+{
+  if (this->_events == nullptr) return this->readState(buttons, axes);
+
+  // Drain before taking the snapshot, the snapshot is then at least as new as the drained events.
+  // The setters queue their events before 'endWrite' publishes the change, so every change in the
+  // snapshot has its event queued already; 'sync' only takes the snapshot if none of them is left.
+  this->_events->drain( JoystickTelemetry::ticks() );
+
+  if (!this->readState(buttons, axes)) return false;
+
+  uint8_t dataBytesAmount = this->_layout->buttons / this->BYTE_LENGTH;
+  this->_events->sync(buttons, dataBytesAmount, axes);
+
+  memcpy(buttons, this->_events->buttons(), dataBytesAmount);
+  if (this->_events->queueAxes) memcpy(axes, this->_events->axes(), sizeof(int16_t) * AXIS_COUNT);
+  return true;
+}
+
+
+uint32_t JoystickCore::reportDirtyMask(uint8_t index) const
+{
+  uint16_t buttonsPerReport = this->_layout->buttonsPerReport;
+  if (buttonsPerReport == 0) return DIRTY_ALL;   // Buttons and axes in one report.
+
+  uint16_t firstButton = index * buttonsPerReport;
+  if (firstButton >= this->_layout->buttons) return DIRTY_ALL & ~DIRTY_BUTTONS;   // The axis report.
+
+  uint16_t lastButton = firstButton + buttonsPerReport - 1;
+  uint32_t mask = 0;
+  for (uint16_t group = firstButton / 32; group <= lastButton / 32; group++) {
+    mask |= DIRTY_BUTTON_GROUP << group;
+  }
+  return mask & DIRTY_BUTTONS;
+}
+
+
+void JoystickCore::setRecorder(JoystickRecorder *recorder)
+{
+  if (recorder != nullptr) recorder->start(this->_layout->buttons / this->BYTE_LENGTH);
+  this->_recorder = recorder;
+}
+
+
+void JoystickCore::setEventQueue(JoystickEventQueue *queue)
+{
+  this->_events = queue;
+  this->markChanged(DIRTY_ALL);
+}
+
+
+void JoystickCore::queueButtons(uint16_t firstButton, uint32_t changed, uint32_t state)
+{
+  while (changed != 0) {
+    uint8_t bit = __builtin_ctz(changed);
+    this->_events->push(JoystickEvent::BUTTON, firstButton + bit, (state >> bit) & 0x01);
+    changed &= changed - 1;
+  }
+}
+
+
+bool JoystickCore::reportDue(uint32_t now) const
+{
+  if (core_util_atomic_load_u8(&this->_batchDepth) > 0) return false;  // 'commitBatch' sends the whole batch at once.
+  if (core_util_atomic_load_u32(&this->_dirty) != 0) return true;
+  uint32_t interval = this->keepAlive(now);
+  return (interval != 0) && (now - this->_lastSendTime >= interval);
+}
+
+
+uint32_t JoystickCore::keepAlive(uint32_t now) const
+{
+  const JoystickRateGovernor *governor = this->root()->_governor;
+  return (governor != nullptr) ? governor->interval(now) : this->keepAliveInterval;
+}
+
+
+bool JoystickCore::sendPending(uint32_t now, bool blocking)
+{
+  // Take the dirty-bits before building the reports so changes made while we are
+  // sending are not lost. Put them back if a send fails.
+  uint32_t dirty = core_util_atomic_exchange_u32(&this->_dirty, 0);
+  uint32_t wanted = (dirty != 0) ? dirty : DIRTY_ALL;   // A keep-alive repeats every report.
+
+  uint8_t buttons[ BUTTON_ARRAY_MAX_SIZE ];
+  int16_t axes[ AXIS_COUNT ];
+  if (!this->readReportState(buttons, axes)) {
+    this->markChanged(dirty);
+    return false;
+  }
+
+  // With split reports only the reports covering the changed fields are sent,
+  // all of them from the same snapshot.
+  JoystickTelemetry &telemetry = this->root()->_telemetry;
+  uint8_t reportCount = this->_layout->reportCount;
+  uint8_t index = 0;
+  bool sendSuccessful = true;
+
+  for (; index < reportCount; index++) {
+    if ((wanted & this->reportDirtyMask(index)) == 0) continue;
+
+    this->buildReport(index, buttons, axes);
+    sendSuccessful = this->root()->sendReport( &(this->HIDreport), blocking );
+    telemetry.recordSend(sendSuccessful, blocking);
+    if (!sendSuccessful) break;
+  }
+
+  if (sendSuccessful) {
+    this->_lastSendTime = now;
+    if (dirty != 0 && this->root()->_governor != nullptr) this->root()->_governor->activity(now);
+    if (this->_recorder != nullptr) this->_recorder->record(micros(), buttons, axes);
+    if (this->_events != nullptr) {
+      this->_events->frameSent();
+      if (!this->_events->empty()) this->markChanged(DIRTY_BUTTONS);  // More transitions for the next report.
+    }
+  }
+  else {
+    // The failed report and the ones after it are still unsent. A group shared with a sent report
+    // is marked again too, resending it is harmless.
+    uint32_t unsent = 0;
+    for (; index < reportCount; index++) unsent |= this->reportDirtyMask(index);
+    this->markChanged(dirty & unsent);
+  }
+  return sendSuccessful;
+}
+
+
+bool JoystickCore::update(void)
+{
+  if (this->_parent != nullptr) return this->_parent->update();  // The first joystick sends for the whole device.
+
+  uint32_t now = millis();
+  uint8_t count = this->_joystickCount + 1;
+
+  bool due = this->_config.pending();
+  for (uint8_t n=0; n < count && !due; n++) {
+    due = this->joystick(n)->reportDue(now);
+  }
+  if (!due) {
+    this->_telemetry.recordSkip();  // Nothing new for the host, don't spend time on the bus.
+    return true;
+  }
+
+  uint32_t startTicks = JoystickTelemetry::ticks();
+  this->_mutex.lock();  // The underlying USB-system and -hardware is most probably shared
+                        // by all threads, so we need to acquire lock before using it.
+                        // Also protects the reports from other threads calling 'update'.
+  uint32_t lockedTicks = JoystickTelemetry::ticks();
+
+  // Host commands go in between two reports, never in the middle of building one.
+  if (this->_config.pending()) this->_config.apply(*this);
+
+  // Pick the due joysticks in priority order. The scan starts from a different joystick on
+  // every call, so joysticks with equal priority take turns when the endpoint is busy.
+  uint8_t handled = 0;    // Bit n set when joystick n has been considered.
+  bool sendSuccessful = true;
+
+  while (sendSuccessful) {
+    int8_t next = -1;
+    for (uint8_t k=0; k < count; k++) {
+      uint8_t n = (this->_nextJoystick + k) % count;
+      if (handled & (0x01 << n)) continue;
+
+      JoystickCore *joystick = this->joystick(n);
+      if (!joystick->reportDue(now)) {
+        handled |= 0x01 << n;
+        continue;
+      }
+      if (next < 0 || joystick->priority > this->joystick(next)->priority) next = n;
+    }
+    if (next < 0) break;
+
+    handled |= 0x01 << next;
+    sendSuccessful = this->joystick(next)->sendPending(now, this->sendBlocking);
+  }
+  this->_nextJoystick = (this->_nextJoystick + 1) % count;
+
+  this->_telemetry.recordUpdate(startTicks, lockedTicks, JoystickTelemetry::ticks());
+
+  this->_mutex.unlock();
+  return sendSuccessful;
+}
+
+
+void JoystickCore::autoUpdate(void)
+{
+  if (!this->autoSend || core_util_atomic_load_u8(&this->_batchDepth) > 0) return;
+  if (core_util_is_isr_active()) return;  // Can't take the mutex or block here, 'update' or the pump sends it.
+  if (this->root()->sendsInBackground()) return;  // The device sends it.
+
+  // Inside the coalescing window the change stays dirty and goes out with the next report.
+  if (this->autoSendWindow != 0 && millis() - this->_lastSendTime < this->autoSendWindow) return;
+
+  this->update();
+}
+
+
+void JoystickCore::beginBatch(void)
+{
+  core_util_atomic_incr_u8(&this->_batchDepth, 1);
+  this->beginWrite();
+}
+
+bool JoystickCore::commitBatch(void)
+{
+  if (core_util_atomic_load_u8(&this->_batchDepth) == 0) return this->update();  // Unbalanced commit, just send.
+
+  this->endWrite();
+  if (core_util_atomic_decr_u8(&this->_batchDepth, 1) > 0) return true;
+
+  if (this->root()->sendsInBackground()) {
+    this->root()->stateChanged();  // Let the device send it, don't block the caller.
+    return true;
+  }
+  return this->update();
+}
+
+
+void JoystickCore::pressButton(uint8_t buttonNumber)
+{
+  // buttonState is array of 8-bit integers where each bit represents current button state.
+  // buttonState[0] has buttons 0-7, buttonState[1] has buttons 8-15 etc. 
+ 
+  // Get the array index and bit position for the button number 'buttonNumber'.
+  uint8_t index = buttonNumber / this->BYTE_LENGTH;
+  uint8_t mask = 0x01 << (buttonNumber % this->BYTE_LENGTH); 
+
+  // The event is queued before 'endWrite' publishes the change, see 'readReportState'.
+  this->beginWrite();
+  uint8_t previous = core_util_atomic_fetch_or_u8(&this->buttonState[index], mask);
+  bool changed = (previous & mask) == 0;
+  if (changed && this->_events != nullptr) this->_events->push(JoystickEvent::BUTTON, buttonNumber, 1);
+  this->endWrite();
+
+  if (changed) this->markChanged(buttonDirtyBit(buttonNumber));
+  this->autoUpdate();
+}
+
+void JoystickCore::releaseButton(uint8_t buttonNumber)
+{
+  // See 'JoystickCore::pressButton for explanation of 'index' and 'mask'.
+  uint8_t index = buttonNumber / this->BYTE_LENGTH; 
+  uint8_t mask = 0x01 << (buttonNumber % this->BYTE_LENGTH);
+
+  this->beginWrite();
+  uint8_t previous = core_util_atomic_fetch_and_u8(&this->buttonState[index], ~mask);
+  bool changed = (previous & mask) != 0;
+  if (changed && this->_events != nullptr) this->_events->push(JoystickEvent::BUTTON, buttonNumber, 0);
+  this->endWrite();
+
+  if (changed) this->markChanged(buttonDirtyBit(buttonNumber));
+  this->autoUpdate();
+}
+
+void JoystickCore::toggleButton(uint8_t buttonNumber)
+{
+  // See 'JoystickCore::pressButton for explanation of 'index' and 'mask'.
+  uint8_t index = buttonNumber / this->BYTE_LENGTH; 
+  uint8_t mask = 0x01 << (buttonNumber % this->BYTE_LENGTH);
+
+  this->beginWrite();
+  uint8_t previous = core_util_atomic_fetch_xor_u8(&this->buttonState[index], mask); // XOR to toggle a bit.
+  if (this->_events != nullptr) this->_events->push(JoystickEvent::BUTTON, buttonNumber, (previous & mask) == 0);
+  this->endWrite();
+
+  this->markChanged(buttonDirtyBit(buttonNumber));
+  this->autoUpdate();
+}
+
+void JoystickCore::setButton(uint8_t buttonNumber, uint8_t value)
+{
+  if (value == 0) this->releaseButton(buttonNumber);
+  else this->pressButton(buttonNumber);
+}
+
+
+
+void JoystickCore::setButtons(uint64_t values, uint8_t bank)
+{
+  this->setButtonsMasked(~static_cast<uint64_t>(0), values, bank);
+}
+
+void JoystickCore::setButtonsMasked(uint64_t mask, uint64_t values, uint8_t bank)
+{
+  if (bank >= BUTTON_ARRAY_MAX_SIZE / 8) return;
+
+  // Two 32-bit words per bank. The words are little-endian so bit n of a word is
+  // button n, same as with the byte-wise access in 'pressButton'.
+  uint32_t changed[2] = { 0, 0 };   // Changed bits of the two words.
+  uint32_t state[2] = { 0, 0 };
+  this->beginWrite();
+  for (uint8_t i=0; i < 2; i++) {
+    uint32_t wordMask = static_cast<uint32_t>(mask >> (32 * i));
+    if (wordMask == 0) continue;
+
+    uint32_t set = static_cast<uint32_t>(values >> (32 * i)) & wordMask;
+    uint32_t clear = ~set & wordMask;
+    volatile uint32_t *word = &this->_buttonWords[bank * 2 + i];
+
+    uint32_t previous = core_util_atomic_fetch_or_u32(word, set);
+    changed[i] |= ~previous & set;
+    previous = core_util_atomic_fetch_and_u32(word, ~clear);
+    changed[i] |= previous & clear;
+    state[i] = set;
+  }
+  if (this->_events != nullptr) {
+    this->queueButtons(bank * 64, changed[0], state[0]);
+    this->queueButtons(bank * 64 + 32, changed[1], state[1]);
+  }
+  this->endWrite();
+
+  if ((changed[0] | changed[1]) != 0) {
+    uint32_t dirty = 0;
+    if (changed[0] != 0) dirty |= buttonDirtyBit(bank * 64);
+    if (changed[1] != 0) dirty |= buttonDirtyBit(bank * 64 + 32);
+    this->markChanged(dirty);
+  }
+  this->autoUpdate();
+}
+
+
+
+void JoystickCore::setButtonBytes(uint8_t firstByte, const uint8_t *values, uint8_t count, uint8_t lastByteMask)
+{
+  if (firstByte >= BUTTON_ARRAY_MAX_SIZE) return;
+  if (count > BUTTON_ARRAY_MAX_SIZE - firstByte) {
+    count = BUTTON_ARRAY_MAX_SIZE - firstByte;
+    lastByteMask = 0xFF;   // The partial byte was cut off, the new last byte is a whole one.
+  }
+
+  uint32_t dirty = 0;
+  this->beginWrite();
+  for (uint8_t i=0; i < count; i++) {
+    uint8_t index = firstByte + i;
+    uint8_t changed;
+    if (i + 1 < count || lastByteMask == 0xFF) {
+      changed = core_util_atomic_exchange_u8(&this->buttonState[index], values[i]) ^ values[i];
+    }
+    else {
+      // Partial last byte, the other bits belong to someone else.
+      uint8_t set = values[i] & lastByteMask;
+      uint8_t clear = ~values[i] & lastByteMask;
+      changed = ~core_util_atomic_fetch_or_u8(&this->buttonState[index], set) & set;
+      changed |= core_util_atomic_fetch_and_u8(&this->buttonState[index], ~clear) & clear;
+    }
+
+    if (changed != 0) {
+      if (this->_events != nullptr) this->queueButtons(index * this->BYTE_LENGTH, changed, values[i]);
+      dirty |= buttonDirtyBit(index * this->BYTE_LENGTH);
+    }
+  }
+  this->endWrite();
+
+  if (dirty != 0) this->markChanged(dirty);
+  this->autoUpdate();
+}
+
+
+
+int8_t JoystickCore::axis16bitToByte(int16_t axisValue, bool MSB_OR_LSB) {
+  if (MSB_OR_LSB == MSB) {
+    return static_cast<int8_t>( axisValue >> this->BYTE_LENGTH );
+  }
+  return static_cast<int8_t>( axisValue );   // LSB
+}
+
+
+int16_t JoystickCore::_axis_::* const JoystickCore::AXIS_FIELDS[AXIS_COUNT] = {
+  &JoystickCore::_axis_::X,
+  &JoystickCore::_axis_::Y,
+  &JoystickCore::_axis_::Z,
+  &JoystickCore::_axis_::Rx,
+  &JoystickCore::_axis_::Ry,
+  &JoystickCore::_axis_::Rz,
+  &JoystickCore::_axis_::throttle,
+  &JoystickCore::_axis_::rudder
+};
+
+void JoystickCore::updateAxisScale(uint8_t axisNumber) {
+  int32_t inputRange = this->axisMax.*AXIS_FIELDS[axisNumber] - this->axisMin.*AXIS_FIELDS[axisNumber];
+  int32_t outputRange = this->_layout->axisMaximum - this->_layout->axisMinimum;
+
+  _axisScale_ &scale = this->_axisScale[axisNumber];
+  if (inputRange <= 0) {
+    scale.fixedScale = 0;
+    scale.floatScale = 0.0f;
+    return;
+  }
+  // Rounded to nearest. Fits in 32 bits, the output range is below 2^16.
+  scale.fixedScale = ((static_cast<uint64_t>(outputRange) << 16) + inputRange / 2) / inputRange;
+  scale.floatScale = static_cast<float>(outputRange) / inputRange;
+}
+
+void JoystickCore::setAxis(uint8_t axisNumber, float value) {
+  // Range, scale, filter and curve in one critical section, see 'setAxisRange'.
+  core_util_critical_section_enter();
+  int16_t minimum = this->axisMin.*AXIS_FIELDS[axisNumber];
+  int16_t maximum = this->axisMax.*AXIS_FIELDS[axisNumber];
+
+  // Same as 'mapfi' but with the division done once in 'updateAxisScale'.
+  value = constrain( value, minimum, maximum );
+  int16_t mapped = (value - minimum) * this->_axisScale[axisNumber].floatScale + this->_layout->axisMinimum;
+  bool output = this->_axisFilter[axisNumber].process(mapped, mapped);
+  if (output) mapped = this->applyCurve(axisNumber, mapped);
+  core_util_critical_section_exit();
+
+  if (output) this->storeAxis(axisNumber, mapped);
+}
+
+void JoystickCore::setAxis(uint8_t axisNumber, int32_t value) {
+  int16_t mapped;
+  core_util_critical_section_enter();
+  if (this->_calibration != nullptr) this->_calibration->sample(axisNumber, value);
+  bool output = this->_axisFilter[axisNumber].process(this->mapAxis(axisNumber, value), mapped);
+  if (output) mapped = this->applyCurve(axisNumber, mapped);
+  core_util_critical_section_exit();
+
+  if (output) this->storeAxis(axisNumber, mapped);
+}
+
+int16_t JoystickCore::mapAxis(uint8_t axisNumber, int32_t value) const {
+  int32_t minimum = this->axisMin.*AXIS_FIELDS[axisNumber];
+  int32_t maximum = this->axisMax.*AXIS_FIELDS[axisNumber];
+
+  // 32x32->64 bit multiply is a single UMULL on the Cortex-M4. The rounded scale is off by less than
+  // 0.5 LSB over the whole input range, so rounding the result to nearest lands exactly on the ends
+  // of the layout range. 'mapfi' rounds towards zero instead, the two differ by at most 1 LSB.
+  value = constrain( value, minimum, maximum );
+  uint32_t offset = static_cast<uint32_t>(value - minimum);
+  int64_t fixed = static_cast<int64_t>(static_cast<uint64_t>(offset) * this->_axisScale[axisNumber].fixedScale)
+                + (static_cast<int64_t>(this->_layout->axisMinimum) << 16);
+  return (fixed >= 0) ? ((fixed + 0x8000) >> 16) : -((-fixed + 0x8000) >> 16);
+}
+
+int16_t JoystickCore::applyCurve(uint8_t axisNumber, int16_t mapped) const {
+  const JoystickCurve *curve = core_util_atomic_load(&this->_axisCurve[axisNumber]);
+  if (curve == nullptr) return mapped;
+
+  int32_t minimum = this->_layout->axisMinimum;
+  uint32_t range = this->_layout->axisMaximum - minimum;
+  uint32_t position = (static_cast<uint64_t>(mapped - minimum) * this->_curveScale) >> 16;
+  if (position > JoystickCurve::ONE) position = JoystickCurve::ONE;
+
+  // Rounded to nearest, the table ends map exactly to the layout ends.
+  uint32_t output = curve->evaluate(position);
+  return minimum + static_cast<int32_t>((output * range + JoystickCurve::ONE / 2) >> 15);
+}
+
+void JoystickCore::setAxisCurve(uint8_t axisNumber, const JoystickCurve *curve) {
+  if (axisNumber >= AXIS_COUNT) return;
+  core_util_atomic_store(&this->_axisCurve[axisNumber], curve);
+}
+
+const JoystickCurve *JoystickCore::axisCurve(uint8_t axisNumber) const {
+  if (axisNumber >= AXIS_COUNT) return nullptr;
+  return core_util_atomic_load(&this->_axisCurve[axisNumber]);
+}
+
+void JoystickCore::storeAxis(uint8_t axisNumber, int16_t mapped) {
+  this->beginWrite();
+  int16_t previous = core_util_atomic_exchange_s16(&(this->axis.*AXIS_FIELDS[axisNumber]), mapped);
+  bool changed = previous != mapped;
+  if (changed && this->_events != nullptr && this->_events->queueAxes) this->_events->push(JoystickEvent::AXIS, axisNumber, mapped);
+  this->endWrite();
+
+  if (changed) this->markChanged(0x01 << axisNumber);
+}
+
+void JoystickCore::setAxisRaw(uint8_t axisNumber, int32_t value) {
+  if (axisNumber >= AXIS_COUNT) return;
+
+  this->setAxis(axisNumber, value);
+  this->autoUpdate();
+}
+
+void JoystickCore::setAxes(const int16_t *values, uint8_t mask) {
+  // Map and filter everything first so the write section only holds the stores.
+  int16_t mapped[ AXIS_COUNT ];
+  uint32_t store = 0;
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    if ((mask & (0x01 << i)) == 0) continue;
+    // One axis per critical section, so the interrupts wait for one mapping at most.
+    core_util_critical_section_enter();
+    if (this->_calibration != nullptr) this->_calibration->sample(i, values[i]);
+    if (this->_axisFilter[i].process(this->mapAxis(i, values[i]), mapped[i])) {
+      mapped[i] = this->applyCurve(i, mapped[i]);
+      store |= 0x01 << i;
+    }
+    core_util_critical_section_exit();
+  }
+
+  this->storeAxes(mapped, store);
+  this->autoUpdate();
+}
+
+void JoystickCore::setAxesMapped(const int16_t *values, uint8_t mask) {
+  this->storeAxes(values, mask);
+  this->autoUpdate();
+}
+
+void JoystickCore::storeAxes(const int16_t *mapped, uint32_t store) {
+  uint32_t changed = 0;
+  this->beginWrite();
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    if ((store & (0x01 << i)) == 0) continue;
+    if (core_util_atomic_exchange_s16(&(this->axis.*AXIS_FIELDS[i]), mapped[i]) != mapped[i]) {
+      changed |= 0x01 << i;
+      if (this->_events != nullptr && this->_events->queueAxes) this->_events->push(JoystickEvent::AXIS, i, mapped[i]);
+    }
+  }
+  this->endWrite();
+
+  if (changed != 0) this->markChanged(changed);
+}
+
+void JoystickCore::setXAxis(float value) {
+  this->setAxis(X_AXIS, value);
+  this->autoUpdate();
+}
+
+void JoystickCore::setYAxis(float value) {
+  this->setAxis(Y_AXIS, value);
+  this->autoUpdate();
+}
+
+void JoystickCore::setZAxis(float value) {
+  this->setAxis(Z_AXIS, value);
+  this->autoUpdate();
+}
+
+void JoystickCore::setRxAxis(float value) {
+  this->setAxis(RX_AXIS, value);
+  this->autoUpdate();
+}
+
+void JoystickCore::setRyAxis(float value) {
+  this->setAxis(RY_AXIS, value);
+  this->autoUpdate();
+}
+
+void JoystickCore::setRzAxis(float value) {
+  this->setAxis(RZ_AXIS, value);
+  this->autoUpdate();
+}
+
+void JoystickCore::setThrottleAxis(float value) {
+  this->setAxis(THROTTLE_AXIS, value);
+  this->autoUpdate();
+}
+
+void JoystickCore::setRudderAxis(float value) {
+  this->setAxis(RUDDER_AXIS, value);
+  this->autoUpdate();
+}
+
+
+void JoystickCore::setAxisRange(uint8_t axisNumber, int16_t minimum, int16_t maximum) {
+  if (axisNumber >= AXIS_COUNT) return;
+
+  // The setters map inside a critical section too, so none of them sees half of a range.
+  core_util_critical_section_enter();
+  this->axisMin.*AXIS_FIELDS[axisNumber] = min(minimum, maximum);
+  this->axisMax.*AXIS_FIELDS[axisNumber] = max(minimum, maximum);
+  this->updateAxisScale(axisNumber);
+  core_util_critical_section_exit();
+}
+
+void JoystickCore::setXAxisRange(int16_t minimum, int16_t maximum) {
+  this->setAxisRange(X_AXIS, minimum, maximum);
+}
+void JoystickCore::setYAxisRange(int16_t minimum, int16_t maximum) {
+  this->setAxisRange(Y_AXIS, minimum, maximum);
+}
+void JoystickCore::setZAxisRange(int16_t minimum, int16_t maximum) {
+  this->setAxisRange(Z_AXIS, minimum, maximum);
+}
+void JoystickCore::setRxAxisRange(int16_t minimum, int16_t maximum) {
+  this->setAxisRange(RX_AXIS, minimum, maximum);
+}
+void JoystickCore::setRyAxisRange(int16_t minimum, int16_t maximum) {
+  this->setAxisRange(RY_AXIS, minimum, maximum);
+}
+void JoystickCore::setRzAxisRange(int16_t minimum, int16_t maximum) {
+  this->setAxisRange(RZ_AXIS, minimum, maximum);
+}
+void JoystickCore::setThrottleAxisRange(int16_t minimum, int16_t maximum) {
+  this->setAxisRange(THROTTLE_AXIS, minimum, maximum);
+}
+void JoystickCore::setRudderAxisRange(int16_t minimum, int16_t maximum) {
+  this->setAxisRange(RUDDER_AXIS, minimum, maximum);
+}
+void JoystickCore::setAllAxisRange(int16_t minimum, int16_t maximum) {
+  this->setXAxisRange(minimum, maximum);
+  this->setYAxisRange(minimum, maximum);
+  this->setZAxisRange(minimum, maximum);
+  this->setRxAxisRange(minimum, maximum);
+  this->setRyAxisRange(minimum, maximum);
+  this->setRzAxisRange(minimum, maximum);
+  this->setThrottleAxisRange(minimum, maximum);
+  this->setRudderAxisRange(minimum, maximum);
+}
+
@@ -0,0 +1,629 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKCORE_H
+#define USBJOYSTICKCORE_H
+
+#include "PluggableUSBHID.h"
+#include "PlatformMutex.h"
+#include "mbed_atomic.h"
+#include "USBJoystickLayout.h"
+#include "USBJoystickFilter.h"
+#include "USBJoystickCurve.h"
+#include "USBJoystickTelemetry.h"
+#include "USBJoystickEvents.h"
+#include "USBJoystickRate.h"
+#include "USBJoystickRecord.h"
+#include "USBJoystickConfig.h"
+#include "USBJoystickForce.h"
+#include "USBJoystickCalibration.h"
+
+namespace arduino {
+
+enum {
+  MSB,
+  LSB
+} ;
+
+
+/*
+  State of one logical joystick: buttons, axes, their ranges and filters, and the report built from them.
+
+  'USBJoystick' is a JoystickCore itself. More logical joysticks can be attached to it with 'addJoystick';
+  each one gets its own report ID in the same report descriptor, its own state and its own dirty tracking.
+  Calling 'update' on any of them sends the changed ones, so only the sub-devices that changed use a slot
+  on the bus. For example a stick, a throttle quadrant and a button box on one board:
+
+    JoystickCore throttle( USBJoystickLayout<16, AXIS_THROTTLE | AXIS_RUDDER | AXIS_Z>::layout );
+    JoystickCore buttonBox( USBJoystickLayout<128, 0>::layout );
+    JoystickCore *joysticks[] = { &throttle, &buttonBox };
+
+    USBJoystick stick( USBJoystickLayout<>::layout, joysticks, 2 );
+*/
+class JoystickCore {
+public:
+  static const uint8_t MAX_JOYSTICKS = 4;   // Logical joysticks in one device, including the first one.
+
+protected:
+  static const uint8_t BUTTON_ARRAY_MAX_SIZE = 32;  // Absolute maximum number of buttons 32*8 = 256.
+  static const uint8_t BYTE_LENGTH = 8;             // How many bits is in a single byte of data.
+
+  // Bits of the '_dirty' mask. Bits 0-7 are the axes (1 << X_AXIS etc.), bits 8-15 the buttons
+  // in groups of 32 (buttons 0-31 are bit 8, 32-63 bit 9 etc.).
+  static const uint32_t DIRTY_BUTTON_GROUP = 0x0100;
+  static const uint32_t DIRTY_BUTTONS = 0xFF00;
+  static const uint32_t DIRTY_ALL = 0xFFFF;
+
+  static uint32_t buttonDirtyBit(uint16_t buttonNumber) { return DIRTY_BUTTON_GROUP << (buttonNumber / 32); }
+
+  // How many times 'readState' retries before giving up on a state that is being written.
+  static const uint8_t STATE_READ_ATTEMPTS = 4;
+
+  // Longest feature report, sent through the control endpoint so it may exceed MAX_HID_REPORT_SIZE.
+  static const uint8_t FEATURE_REPORT_MAX_LENGTH = 128;
+
+  /*
+    Send one report built by 'updateHIDreport'. Implemented by the device class, the default fails.
+    Called with '_mutex' held, 'blocking' is 'sendBlocking' of the first joystick.
+
+    @returns true if the report was sent or queued.
+  */
+  virtual bool sendReport(HID_REPORT *report, bool blocking);
+
+  /*
+    Called after the state of any of the joysticks changed, may be called from an ISR.
+    The device class uses this to wake up a background sender.
+  */
+  virtual void stateChanged(void) { }
+
+  /*
+    True while the device sends the reports by itself, then the setters don't call 'update'.
+  */
+  virtual bool sendsInBackground(void) const { return false; }
+
+  /*
+    True if any of the joysticks has unsent changes.
+  */
+  bool pending(void) const;
+
+  /*
+    Build the report descriptor of all the joysticks into 'buffer': the layout descriptors one after another
+    with the report IDs renumbered and the force feedback reports inside the collection of their joystick,
+    followed by the telemetry and configuration collections.
+
+    @returns length of the descriptor, 0 if it doesn't fit in 'size' bytes.
+  */
+  uint16_t writeReportDescriptor(uint8_t *buffer, uint16_t size) const;
+
+  /*
+    Output or feature report written by the host. Configuration commands are queued for the next 'update',
+    see 'JoystickConfig', force feedback reports go to the attached 'JoystickForceFeedback'.
+    Called by the device from the USB interrupt.
+
+    @returns false if the report was not taken.
+  */
+  bool receiveReport(const uint8_t *report, uint8_t length);
+
+  /*
+    Answer a GET_REPORT request of the host for feature report 'reportId'. 'report' has room for
+    FEATURE_REPORT_MAX_LENGTH bytes. Called from the USB interrupt, must not block.
+
+    @returns length of the report, 0 if there is no such feature report.
+  */
+  uint8_t writeFeatureReport(uint8_t reportId, uint8_t *report) const;
+
+
+private:
+  friend class JoystickConfig;   // Applies the host commands to the joysticks of the device.
+  friend class JoystickCalibration;   // Maps the learned center to the filter.
+
+  const JoystickLayout *_layout;   // Report layout, descriptor and report writer. Lives in flash.
+  uint8_t _reportId;               // Report ID of this joystick in the device, assigned by 'addJoystick'.
+
+  JoystickCore *_parent = nullptr;  // The joystick this one is attached to, null for the first one.
+  JoystickCore *_joysticks[ MAX_JOYSTICKS - 1 ];   // Attached joysticks, only used in the first one.
+  uint8_t _joystickCount = 0;
+  uint8_t _nextJoystick = 0;       // Where the round-robin scheduling starts in the next 'update'.
+
+  HID_REPORT HIDreport;
+  PlatformMutex _mutex;            // Used in the first joystick only, serialises the sends of the whole device.
+
+  // Shared between the producer threads and the thread running 'update'. Accessed only with the
+  // 'core_util_atomic_*' functions so none of the setters need to take '_mutex'.
+  volatile uint32_t _dirty = DIRTY_ALL;    // Fields changed since the last sent report. Everything is unsent at start.
+  volatile uint32_t _stateSequence = 0;    // Incremented every time a writer finishes changing the state.
+  volatile uint32_t _activeWriters = 0;    // Writers currently between 'beginWrite' and 'endWrite'.
+  volatile uint8_t _batchDepth = 0;        // Nesting level of 'beginBatch'. Nothing is sent while this is non-zero.
+
+  uint32_t _lastSendTime = 0;     // 'millis()' of the last successfully sent report.
+
+  JoystickTelemetry _telemetry;   // Used in the first joystick only.
+
+  JoystickEventQueue *_events = nullptr;   // Optional, see 'setEventQueue'.
+  JoystickRateGovernor *_governor = nullptr;   // Optional, first joystick only, see 'setRateGovernor'.
+  JoystickRecorder *_recorder = nullptr;       // Optional, see 'setRecorder'.
+  JoystickConfig _config;   // Host commands, used by the first joystick only.
+  JoystickForceFeedback *_forceFeedback = nullptr;   // First joystick only, see 'setForceFeedback'.
+  JoystickCalibration *_calibration = nullptr;   // Optional, see 'setCalibration'.
+
+  /*
+    The first joystick of the device, the one which owns the mutex and does the sending.
+  */
+  JoystickCore *root(void) { return (this->_parent != nullptr) ? this->_parent : this; }
+  const JoystickCore *root(void) const { return (this->_parent != nullptr) ? this->_parent : this; }
+
+  /*
+    Joystick 'index' of the device, 0 is the first one.
+  */
+  JoystickCore *joystick(uint8_t index) { return (index == 0) ? this : this->_joysticks[index - 1]; }
+
+  /*
+    True if this joystick has something to send: unsent changes or a due keep-alive.
+  */
+  bool reportDue(uint32_t now) const;
+
+  /*
+    Send the reports of this joystick that have changed. Called by the first joystick with its '_mutex' held.
+  */
+  bool sendPending(uint32_t now, bool blocking);
+
+  /*
+    Snapshot of the state to report: the latest state, or the state built from the event queue.
+  */
+  bool readReportState(uint8_t *buttons, int16_t *axes);
+
+  /*
+    Write report 'index' of the layout into 'HIDreport' with the report ID of this joystick.
+  */
+  void buildReport(uint8_t index, const uint8_t *buttons, const int16_t *axes);
+
+  /*
+    Dirty-bits of the fields in report 'index'.
+  */
+  uint32_t reportDirtyMask(uint8_t index) const;
+
+  /*
+    Push the buttons in 'changed' to the event queue, bit n is button 'firstButton' + n and its new state
+    is bit n of 'state'.
+  */
+  void queueButtons(uint16_t firstButton, uint32_t changed, uint32_t state);
+
+  /*
+    Called by the setters after changing the state. Sends the report if 'autoSend' is enabled,
+    no batch is open, the caller is not an ISR and the 'autoSendWindow' since the last sent report has passed.
+  */
+  void autoUpdate(void);
+
+  // Mapping from the axis range to the logical range of the layout, precomputed by 'setAxisRange'
+  // so the setters multiply instead of divide.
+  struct _axisScale_ {
+    uint32_t fixedScale;    // Output steps per input step, 16.16 fixed-point.
+    float floatScale;       // Same for the 'float' setters.
+  } ;
+  _axisScale_ _axisScale[ AXIS_COUNT ];
+
+  // Conditioning between the setters and 'axis'. Run and reconfigured only inside a critical section.
+  JoystickAxisFilter _axisFilter[ AXIS_COUNT ];
+
+  // Response curves after the filter, swapped atomically by 'setAxisCurve' and evaluated in the
+  // critical section of the filter. Null is linear.
+  const JoystickCurve *volatile _axisCurve[ AXIS_COUNT ] = { };
+  uint32_t _curveScale;     // Curve positions per step of the layout range, 16.16 fixed-point.
+
+  /*
+    Recompute '_axisScale' of axis 'axisNumber' from 'axisMin', 'axisMax' and the layout.
+  */
+  void updateAxisScale(uint8_t axisNumber);
+
+  /*
+    Map value to the logical range of the layout and store it to axis 'axisNumber'.
+    Floating-point and fixed-point versions.
+  */
+  void setAxis(uint8_t axisNumber, float value);
+  void setAxis(uint8_t axisNumber, int32_t value);
+
+  /*
+    Fixed-point mapping of 'value' with the precomputed scale of axis 'axisNumber'.
+  */
+  int16_t mapAxis(uint8_t axisNumber, int32_t value) const;
+
+  /*
+    Run mapped value through the response curve of axis 'axisNumber', if it has one.
+  */
+  int16_t applyCurve(uint8_t axisNumber, int16_t mapped) const;
+
+  /*
+    Store the conditioned value of axis 'axisNumber' and mark the axis dirty if it changed.
+  */
+  void storeAxis(uint8_t axisNumber, int16_t mapped);
+
+  /*
+    Store the mapped values of the axes with bit n set in 'store' in one write section and mark the changed ones dirty.
+  */
+  void storeAxes(const int16_t *mapped, uint32_t store);
+
+  /*
+    Sequence lock around writes to 'buttonState' and 'axis'. The writers never wait; each field is
+    written with a single atomic operation and 'readState' retries if a writer was active meanwhile.
+    A batch is one long write so the report never contains half of a batch.
+  */
+  void beginWrite(void) { core_util_atomic_incr_u32(&this->_activeWriters, 1); }
+  void endWrite(void) {
+    core_util_atomic_incr_u32(&this->_stateSequence, 1);
+    core_util_atomic_decr_u32(&this->_activeWriters, 1);
+  }
+
+  void markChanged(uint32_t dirtyBits) {
+    core_util_atomic_fetch_or_u32(&this->_dirty, dirtyBits);
+    this->root()->stateChanged();
+  }
+
+  /*
+    Copy a consistent snapshot of the button array and axis values, no writer was active during the copy.
+
+    @returns false if writers kept changing the state for 'STATE_READ_ATTEMPTS' tries.
+  */
+  bool readState(uint8_t *buttons, int16_t *axes);
+
+
+public:
+
+  bool sendBlocking = true;   // Only the setting of the first joystick is used.
+  bool autoSend = false;
+
+  // Resend the report after this many milliseconds even if nothing changed. 0 disables the keep-alive.
+  uint32_t keepAliveInterval = 0;
+
+  // With 'autoSend', changes made within this many milliseconds of the last sent report are
+  // held back and go out together. 0 sends on every change. Held changes are sent by the next
+  // setter after the window or by the next 'update', so call 'update' from the loop when using this.
+  uint32_t autoSendWindow = 0;
+
+  // When several joysticks have changes, the one with the highest priority is sent first.
+  // Joysticks with equal priority take turns.
+  uint8_t priority = 0;
+
+  // Written by the setters with atomic operations. Writing the array or 'axis' directly from
+  // several threads is not safe, use the setters for that.
+  union {
+    uint8_t buttonState[ BUTTON_ARRAY_MAX_SIZE ] = { };   // All released, also for joysticks not in static storage.
+    uint32_t _buttonWords[ BUTTON_ARRAY_MAX_SIZE / 4 ];   // Same memory, for the word-wide bulk setters.
+  } ;
+
+  struct _axis_ {
+    int16_t X;
+    int16_t Y;
+    int16_t Z;
+    int16_t Rx;
+    int16_t Ry;
+    int16_t Rz;
+    int16_t throttle;
+    int16_t rudder;
+  } ;
+
+  // TODO: Hardcoded magic default numbers.
+  // Change the ranges with the range setters, writing 'axisMin'/'axisMax' directly skips the scale precomputation.
+  _axis_ axis = {0, 0, 0, 0, 0, 0, 0, 0};
+  _axis_ axisMin = {-511, -511, -511, -511, -511, -511, -511, -511 };
+  _axis_ axisMax = {511, 511, 511, 511, 511, 511, 511, 511 };
+
+  // Pointers to the '_axis_' fields, indexed with X_AXIS, Y_AXIS etc.
+  static int16_t _axis_::* const AXIS_FIELDS[AXIS_COUNT];
+
+
+  /*
+    Constuctors and destructors.
+  */
+  explicit JoystickCore(const JoystickLayout &layout = USBJoystickLayout<>::layout);
+  virtual ~JoystickCore(void) { }
+
+  JoystickCore(const JoystickCore &) = delete;
+  JoystickCore &operator=(const JoystickCore &) = delete;
+
+
+  /*
+    Report layout given in the constructor.
+  */
+  const JoystickLayout &layout(void) const { return *this->_layout; }
+
+  /*
+    Report ID of this joystick in the device, the first one with split reports.
+  */
+  uint8_t reportId(void) const { return this->_reportId; }
+
+  /*
+    Attach another logical joystick to this device. It gets the next free report IDs and is sent by
+    'update' together with this one. The report descriptor is read by the host when it enumerates the
+    device, so attach all the joysticks before that: in the constructor of 'USBJoystick' or before
+    'connect' when constructed with a 'USBPhy'.
+
+    @returns false if the device is full, 'joystick' is already attached somewhere or has joysticks
+             of its own, or this joystick is attached to another one.
+  */
+  bool addJoystick(JoystickCore &joystick);
+
+  /*
+    Number of logical joysticks in the device, at least 1.
+  */
+  uint8_t joystickCount(void) const { return (this->_parent != nullptr) ? this->_parent->joystickCount() : this->_joystickCount + 1; }
+
+
+  /*
+    Send joystick state update to the host.
+    A report is sent for each joystick of the device whose state has changed since its last sent report
+    or whose 'keepAliveInterval' has passed, highest 'priority' first. If nothing is due the call returns
+    immediately. Calling this on any of the joysticks of the device does the same.
+
+    @returns true if there was no error, false otherwise. Return values passed through from 'sendReport'.
+  */
+  virtual bool update(void);
+
+  /*
+    Group several changes into one report. Between 'beginBatch' and 'commitBatch' the setters
+    only change the state and 'update' sends nothing for this joystick. 'commitBatch' of the outermost
+    batch sends everything changed within the batch as a single report. Batches can be nested.
+
+    @returns result of the final 'update', true for inner batches.
+  */
+  void beginBatch(void);
+  bool commitBatch(void);
+
+  /*
+    Scope guard for 'beginBatch' and 'commitBatch'.
+
+      {
+        USBJoystick::Batch batch(joystick);
+        joystick.setXAxis(x);
+        joystick.setYAxis(y);
+        joystick.pressButton(0);
+      } // Single report sent here.
+  */
+  class Batch {
+  public:
+    explicit Batch(JoystickCore &joystick): _joystick(joystick) { this->_joystick.beginBatch(); }
+    ~Batch(void) { this->_joystick.commitBatch(); }
+
+    Batch(const Batch &) = delete;
+    Batch &operator=(const Batch &) = delete;
+
+  private:
+    JoystickCore &_joystick;
+  } ;
+
+  /*
+    Force the next 'update' to send the report. Use this after writing 'buttonState' or 'axis' directly,
+    the setters mark the changed fields by themselves.
+  */
+  void markDirty(void) { this->markChanged(DIRTY_ALL); }
+
+  /*
+    Number of reports sent to the host and number of 'update' calls skipped because nothing had changed.
+    Counted for the whole device.
+  */
+  uint32_t reportsSent(void) const { return this->telemetry().reportsSent(); }
+  uint32_t reportsSkipped(void) const { return this->telemetry().updatesSkipped(); }
+
+  /*
+    Send counters and timings of the whole device. The host can read the same data as a feature report,
+    see 'JoystickTelemetry'.
+  */
+  const JoystickTelemetry &telemetry(void) const { return (this->_parent != nullptr) ? this->_parent->_telemetry : this->_telemetry; }
+
+  /*
+    Wrapper. For API-compliance with the MHeironimus-ArduinoJoystickLibrary.
+  */
+  void sendState(void) { this->update(); }
+
+  /*
+    These don't really do much currently. For API-compliance with the MHeironimus-ArduinoJoystickLibrary.
+  */
+  void begin(bool autoSendState) { this->autoSend = autoSendState; }
+  void end(void) { }
+
+  /*
+    Update the HID-report with the current joystick-state (axis-values, button-states etc.).
+    The report is built from a consistent snapshot of the state, never from a half-written one.
+    With split reports this builds the first report of the layout.
+
+    @returns false if the snapshot could not be taken because the state was being written,
+             the previous report is left untouched in that case.
+  */
+  bool updateHIDreport(void);
+
+  /*
+    Get the lower (LSB) or higher (MSB) 8-bits of 16-bit axis-value.
+    You have to call this twice with MSB and LSB to get the full axis value.
+    Used to store the axis value in the HID-report which is made of 8-bit fields.
+
+    @returns 8-bit integer containing the least-significant or most significant byte.
+  */
+  int8_t axis16bitToByte(int16_t axisValue, bool MSB_OR_LSB);
+
+
+  /*
+    Template implementation of Arduino map-function for arbitary input and output data-types.
+  */
+  //template<typename fromType, typename toType>
+  //static toType map(fromType x, fromType in_min, fromType in_max, toType out_min, toType out_max)
+  //{
+  //  return (x -in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+  //}
+
+
+  /*
+    Maps value in the range [in_min:in_max] to [out_min:out_max].
+    Local implementation of Arduino map-function for floating-point data input.
+    Takes input as 'float' and output as 'int16_t'.
+
+    @returns mapped value as 16-bit integer.
+  */
+  static inline int16_t mapfi(float x, float in_min, float in_max, int16_t out_min, int16_t out_max)
+  {
+    return (x-in_min) * (out_max-out_min) / (in_max-in_min) + out_min;
+  }
+
+
+  /*
+    Set axis value to the given value.
+  */
+  void setXAxis(float value);
+  void setYAxis(float value);
+  void setZAxis(float value);
+  void setRxAxis(float value);
+  void setRyAxis(float value);
+  void setRzAxis(float value);
+  void setThrottleAxis(float value);
+  void setRudderAxis(float value);
+
+  /*
+    Set axis 'axisNumber' (X_AXIS, Y_AXIS etc.) from a raw integer sample, for example an ADC reading.
+    Uses only integer arithmetic; the result is within 1 LSB of the 'float' setters.
+  */
+  void setAxisRaw(uint8_t axisNumber, int32_t value);
+
+
+  /*
+    Set all axes at once from raw integer samples, 'values' is indexed with X_AXIS, Y_AXIS etc. and
+    has AXIS_COUNT elements. All axes are written in one go: one state update, at most one report.
+    Only the axes with bit n set in 'mask' are set, the others are left alone.
+  */
+  void setAxes(const int16_t *values, uint8_t mask = 0xFF);
+
+  /*
+    Set the axes with bit n set in 'mask' to already mapped values, in the logical range of the layout.
+    Bypasses the axis range and the filter; used to replay recorded reports.
+  */
+  void setAxesMapped(const int16_t *values, uint8_t mask = 0xFF);
+
+
+  /*
+    Send every button transition to the host, also the ones that happen between two reports.
+    With a queue attached the setters record their changes in it and the reports are built from the
+    queued changes in order, see 'JoystickEventQueue'. Attach before sending starts, null detaches.
+  */
+  void setEventQueue(JoystickEventQueue *queue);
+  JoystickEventQueue *eventQueue(void) const { return this->_events; }
+
+  /*
+    Record every report sent for this joystick, see 'JoystickRecorder'. Attaching starts a new
+    recording, null detaches. Attach and detach while nothing is sending.
+  */
+  void setRecorder(JoystickRecorder *recorder);
+  JoystickRecorder *recorder(void) const { return this->_recorder; }
+
+  /*
+    Attach force feedback, called by the constructor of 'JoystickForceFeedback'. The report descriptor
+    is read when the host enumerates the device, so this must happen before that.
+  */
+  void setForceFeedback(JoystickForceFeedback *forceFeedback) { this->root()->_forceFeedback = forceFeedback; }
+  JoystickForceFeedback *forceFeedback(void) const { return this->root()->_forceFeedback; }
+
+  /*
+    Feed the integer axis samples to 'calibration' before they are mapped, called by the constructor
+    of 'JoystickCalibration'. Null detaches.
+  */
+  void setCalibration(JoystickCalibration *calibration) { this->_calibration = calibration; }
+  JoystickCalibration *calibration(void) const { return this->_calibration; }
+
+  /*
+    Let the input activity set the keep-alive interval instead of 'keepAliveInterval', see
+    'JoystickRateGovernor'. One governor serves the whole device; attaching to any of its
+    joysticks attaches it to the first one. Null detaches.
+  */
+  void setRateGovernor(JoystickRateGovernor *governor) { this->root()->_governor = governor; }
+  JoystickRateGovernor *rateGovernor(void) const { return this->root()->_governor; }
+
+  /*
+    Milliseconds between keep-alive reports at time 'now': from the rate governor if one is attached,
+    otherwise 'keepAliveInterval'. 0 means no keep-alive.
+  */
+  uint32_t keepAlive(uint32_t now) const;
+
+
+  /*
+    Filter stage of axis 'axisNumber' (X_AXIS, Y_AXIS etc.). Deadzone, hysteresis, smoothing and
+    oversampling are all disabled by default, see 'JoystickAxisFilter'. Works on the mapped values.
+    The setters run the filter inside a critical section; change its settings inside one as well
+    (core_util_critical_section_enter/exit) when the axis may be set meanwhile, from a thread or an ISR.
+  */
+  JoystickAxisFilter &axisFilter(uint8_t axisNumber) { return this->_axisFilter[ axisNumber % AXIS_COUNT ]; }
+
+  /*
+    Response curve of axis 'axisNumber', applied to the mapped value after the filter. Null is linear.
+    The pointer is swapped atomically, so a curve can be changed while the axis is being set; the
+    previous curve may still be read by a setter that is running, keep it alive until then. The setters
+    evaluate the curve inside the critical section they filter in, so a curve in use can also be
+    rewritten in place inside one, as 'JoystickConfig' does with the curves uploaded by the host.
+  */
+  void setAxisCurve(uint8_t axisNumber, const JoystickCurve *curve);
+  const JoystickCurve *axisCurve(uint8_t axisNumber) const;
+
+
+  /*
+    Set the allowed minimum and maximum values.
+    The mapping to the report range is precomputed here, not in the setters. Safe while the axis is
+    being set from another thread or an ISR: the range changes inside a critical section, and the setters
+    map inside one, so each value is mapped entirely with the old range or entirely with the new one.
+  */
+  void setAxisRange(uint8_t axisNumber, int16_t min, int16_t max);
+  void setXAxisRange(int16_t min, int16_t max);
+  void setYAxisRange(int16_t min, int16_t max);
+  void setZAxisRange(int16_t min, int16_t max);
+  void setRxAxisRange(int16_t min, int16_t max);
+  void setRyAxisRange(int16_t min, int16_t max);
+  void setRzAxisRange(int16_t min, int16_t max);
+  void setThrottleAxisRange(int16_t min, int16_t max);
+  void setRudderAxisRange(int16_t min, int16_t max);
+  void setAllAxisRange(int16_t min, int16_t max);
+
+
+  /*
+    Press button. Sets button 'buttonNumber' state to 1.
+    Release button. Sets button 'buttonNumber' state to 0.
+    Toggle button. Invert the current state of the button 'buttonNumber'.
+    Set button 'buttonNumber' state to 0 if value is 0, 1 if value is non-zero.
+  */
+  void pressButton(uint8_t buttonNumber);
+  void releaseButton(uint8_t buttonNumber);
+  void toggleButton(uint8_t buttonNumber);
+  void setButton(uint8_t buttonNumber, uint8_t value);
+
+  /*
+    Set 64 buttons at once. Bit n of 'values' is button 'bank' * 64 + n, bank is 0-3.
+    Set only the buttons whose bit is set in 'mask', the rest keep their state.
+    Written with word-wide atomic operations, at most one report per call.
+  */
+  void setButtons(uint64_t values, uint8_t bank = 0);
+  void setButtonsMasked(uint64_t mask, uint64_t values, uint8_t bank = 0);
+
+  /*
+    Write 'count' whole bytes of 'buttonState' starting from byte 'firstByte', for input scanners that
+    produce the buttons eight at a time. Only the bits set in 'lastByteMask' are written in the last byte.
+    Bytes past the end of the array are dropped, and with them the mask.
+    Only the changed groups of 32 buttons are marked dirty. Safe from ISRs, the report is then sent by
+    the next 'update' or the pump instead of 'autoSend'.
+  */
+  void setButtonBytes(uint8_t firstByte, const uint8_t *values, uint8_t count, uint8_t lastByteMask = 0xFF);
+
+} ; // End of 'class JoystickCore'.
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKCORE_H
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKCURVE_H
+#define USBJOYSTICKCURVE_H
+
+#include <stdint.h>
+
+namespace arduino {
+
+/*
+  Response curve of an axis as a lookup table, see 'JoystickCore::setAxisCurve'.
+
+  The table holds the output at POINTS evenly spaced inputs across the axis range, both as fractions
+  of the range in Q15 (0 is the minimum, ONE the maximum). In between the output is interpolated
+  linearly, so evaluating a curve is a shift, two table reads and a multiply, whatever it was built
+  from. 32 segments follow smooth curves to within a fraction of a percent; a step in a curve built
+  from control points is spread over one segment, 1/32 of the range.
+
+  All the constructors are 'constexpr', so a curve built from constants can live in flash:
+
+    static constexpr JoystickCurve stickCurve = JoystickCurve::expo(0.4f);
+
+  Curves are normalised to the range, one curve can serve several axes and joysticks.
+*/
+class JoystickCurve {
+public:
+  static const uint8_t SEGMENTS = 32;
+  static const uint8_t POINTS = SEGMENTS + 1;
+  static const uint16_t ONE = 0x8000;       // Full range in the table.
+  static const uint16_t SCALE = 10000;      // Full range of the control points.
+
+  struct Point {
+    uint16_t input;     // 0 ... SCALE
+    uint16_t output;    // 0 ... SCALE
+  } ;
+
+  /*
+    Straight line, output equals input.
+  */
+  constexpr JoystickCurve(void) : _points{} {
+    for (uint8_t i=0; i < POINTS; i++) this->_points[i] = i * SEGMENT_LENGTH;
+  }
+
+  /*
+    Straight lines through 'count' control points, sorted by input. The output is flat before the
+    first point and after the last one. A flat section around a point makes a detent.
+  */
+  constexpr JoystickCurve(const Point *points, uint8_t count) : _points{} {
+    uint8_t next = 0;
+    for (uint8_t i=0; i < POINTS; i++) {
+      uint32_t input = static_cast<uint32_t>(i) * SCALE / SEGMENTS;
+      while (next < count && points[next].input < input) next++;
+
+      uint32_t output = input;   // Linear without points.
+      if (count > 0 && next == 0) output = points[0].output;
+      else if (count > 0 && next == count) output = points[count - 1].output;
+      else if (count > 0) {
+        const Point &a = points[next - 1];
+        const Point &b = points[next];
+        output = a.output + static_cast<int32_t>(b.output - a.output) * static_cast<int32_t>(input - a.input)
+                            / (b.input - a.input);
+      }
+      this->_points[i] = (output * ONE + SCALE / 2) / SCALE;
+    }
+  }
+
+  /*
+    Centered curve for sticks, y = (1 - amount) * x + amount * x^3 with x and y from -1 to 1.
+    0 is linear, 1 the flattest center. Negative values down to -1 make the center more sensitive.
+  */
+  static constexpr JoystickCurve expo(float amount) {
+    JoystickCurve curve;
+    for (uint8_t i=0; i < POINTS; i++) {
+      float x = 2.0f * i / SEGMENTS - 1.0f;
+      float y = (1.0f - amount) * x + amount * x * x * x;
+      curve._points[i] = toTable((y + 1.0f) / 2.0f);
+    }
+    return curve;
+  }
+
+  /*
+    Blend of the input and smoothstep, y = (1 - amount) * x + amount * (3x^2 - 2x^3) with x and y
+    from 0 to 1. Flat at both ends and steep in the middle, for throttles and pedals.
+  */
+  static constexpr JoystickCurve sCurve(float amount) {
+    JoystickCurve curve;
+    for (uint8_t i=0; i < POINTS; i++) {
+      float x = static_cast<float>(i) / SEGMENTS;
+      float y = (1.0f - amount) * x + amount * x * x * (3.0f - 2.0f * x);
+      curve._points[i] = toTable(y);
+    }
+    return curve;
+  }
+
+  /*
+    Replace 'count' outputs of the table from point 'first' with 'outputs', from 0 to ONE; larger values
+    are clamped to ONE. Not atomic: change a curve in use only inside a critical section.
+
+    @returns false if the points do not fit in the table, nothing is changed then.
+  */
+  bool setPoints(uint8_t first, const uint16_t *outputs, uint8_t count) {
+    if (first >= POINTS || count > POINTS - first) return false;
+    for (uint8_t i=0; i < count; i++) this->_points[first + i] = (outputs[i] < ONE) ? outputs[i] : ONE;
+    return true;
+  }
+
+  /*
+    Output for 'position' from 0 to ONE, from 0 to ONE.
+  */
+  int32_t evaluate(uint32_t position) const {
+    uint32_t segment = position / SEGMENT_LENGTH;
+    if (segment >= SEGMENTS) return this->_points[SEGMENTS];
+
+    int32_t low = this->_points[segment];
+    int32_t fraction = position % SEGMENT_LENGTH;
+    return low + (static_cast<int32_t>(this->_points[segment + 1]) - low) * fraction / SEGMENT_LENGTH;
+  }
+
+  const uint16_t *points(void) const { return this->_points; }
+
+
+private:
+  static const uint16_t SEGMENT_LENGTH = ONE / SEGMENTS;
+
+  uint16_t _points[ POINTS ];
+
+  static constexpr uint16_t toTable(float y) {
+    return (y <= 0.0f) ? 0 : (y >= 1.0f) ? ONE : static_cast<uint16_t>(y * ONE + 0.5f);
+  }
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKCURVE_H
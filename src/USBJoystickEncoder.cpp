@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickEncoder.h"
+
+using namespace arduino;
+
+
+// Index is (previous A B) << 2 | (current A B). 00 -> 01 -> 11 -> 10 -> 00 counts up. No change and
+// changes of both pins (a missed edge) give 0.
+const int8_t JoystickEncoders::QUADRATURE[16] = {
+   0, +1, -1,  0,
+  -1,  0,  0, +1,
+  +1,  0,  0, -1,
+   0, -1, +1,  0
+};
+
+
+JoystickEncoders::JoystickEncoders(JoystickCore &joystick):
+  _joystick(joystick)
+{
+
+}
+
+JoystickEncoders::~JoystickEncoders(void)
+{
+#if DEVICE_INTERRUPTIN
+  for (uint8_t i=0; i < this->_count; i++) {
+    delete this->_encoders[i].pinA;
+    delete this->_encoders[i].pinB;
+  }
+#endif
+}
+
+
+uint8_t JoystickEncoders::add(uint8_t pinA, uint8_t pinB, uint8_t stepsPerDetent)
+{
+  if (this->_count >= MAX_ENCODERS) return NONE;
+
+  uint8_t index = this->_count;
+  Encoder &encoder = this->_encoders[index];
+  encoder.owner = this;
+  encoder.index = index;
+  encoder.steps = 0;
+  encoder.errors = 0;
+  encoder.state = STATE_UNKNOWN;
+  encoder.stepsPerDetent = (stepsPerDetent > 0) ? stepsPerDetent : 1;
+  encoder.residual = 0;
+  encoder.position = 0;
+  encoder.pending = 0;
+  encoder.pulsePhase = PULSE_IDLE;
+  encoder.pulseButton = 0;
+  encoder.pulseTime = 0;
+
+#if DEVICE_INTERRUPTIN
+  encoder.pinA = nullptr;
+  encoder.pinB = nullptr;
+  if (pinA != NO_PIN && pinB != NO_PIN) {
+    encoder.pinA = new mbed::InterruptIn(digitalPinToPinName(pinA), PullUp);
+    encoder.pinB = new mbed::InterruptIn(digitalPinToPinName(pinB), PullUp);
+    encoder.state = (encoder.pinA->read() << 1) | encoder.pinB->read();
+
+    mbed::Callback<void()> handler = mbed::callback(&encoder, &Encoder::pinChanged);
+    encoder.pinA->rise(handler);
+    encoder.pinA->fall(handler);
+    encoder.pinB->rise(handler);
+    encoder.pinB->fall(handler);
+  }
+#else
+  (void)pinA;
+  (void)pinB;
+#endif
+
+  this->_count++;
+  return index;
+}
+
+uint8_t JoystickEncoders::addAxis(uint8_t pinA, uint8_t pinB, uint8_t axisNumber, int16_t step, int16_t initial,
+                                  uint8_t stepsPerDetent)
+{
+  if (axisNumber >= AXIS_COUNT) return NONE;
+
+  uint8_t index = this->add(pinA, pinB, stepsPerDetent);
+  if (index == NONE) return NONE;
+
+  Encoder &encoder = this->_encoders[index];
+  encoder.mode = MODE_AXIS;
+  encoder.axisNumber = axisNumber;
+  encoder.step = step;
+  encoder.position = initial;
+  this->_joystick.setAxisRaw(axisNumber, initial);
+  return index;
+}
+
+uint8_t JoystickEncoders::addButtons(uint8_t pinA, uint8_t pinB, uint8_t upButton, uint8_t downButton,
+                                     uint8_t stepsPerDetent)
+{
+  uint8_t index = this->add(pinA, pinB, stepsPerDetent);
+  if (index == NONE) return NONE;
+
+  Encoder &encoder = this->_encoders[index];
+  encoder.mode = MODE_BUTTONS;
+  encoder.upButton = upButton;
+  encoder.downButton = downButton;
+  return index;
+}
+
+
+void JoystickEncoders::edge(uint8_t encoderNumber, bool a, bool b)
+{
+  if (encoderNumber >= this->_count) return;
+  Encoder &encoder = this->_encoders[encoderNumber];
+
+  uint8_t previous = encoder.state;
+  uint8_t state = (a ? 0x02 : 0) | (b ? 0x01 : 0);
+  encoder.state = state;
+  if (previous == STATE_UNKNOWN) return;
+
+  int8_t quarterSteps = QUADRATURE[ (previous << 2) | state ];
+  if (quarterSteps != 0) {
+    core_util_atomic_fetch_add_s32(&encoder.steps, quarterSteps);
+  }
+  else if ((previous ^ state) == 0x03) {
+    core_util_atomic_incr_u32(&encoder.errors, 1);
+  }
+}
+
+
+void JoystickEncoders::poll(uint32_t now)
+{
+  bool batch = false;
+
+  for (uint8_t i=0; i < this->_count; i++) {
+    Encoder &encoder = this->_encoders[i];
+
+    encoder.residual += core_util_atomic_exchange_s32(&encoder.steps, 0);
+    int32_t detents = encoder.residual / encoder.stepsPerDetent;   // Towards zero, the rest waits.
+    encoder.residual -= detents * encoder.stepsPerDetent;
+
+    if (encoder.mode == MODE_AXIS) {
+      if (detents == 0) continue;
+
+      core_util_critical_section_enter();   // Both ends of the same range, see 'setAxisRange'.
+      int32_t minimum = this->_joystick.axisMin.*JoystickCore::AXIS_FIELDS[encoder.axisNumber];
+      int32_t maximum = this->_joystick.axisMax.*JoystickCore::AXIS_FIELDS[encoder.axisNumber];
+      core_util_critical_section_exit();
+      int32_t position = constrain( encoder.position + detents * encoder.step, minimum, maximum );
+      if (position == encoder.position) continue;
+      encoder.position = position;
+
+      this->openBatch(batch);
+      this->_joystick.setAxisRaw(encoder.axisNumber, position);
+    }
+    else {
+      // Signed, so turning back cancels the detents still waiting in the other direction.
+      encoder.pending += detents;
+      this->pulse(encoder, now, batch);
+    }
+  }
+
+  if (batch) this->_joystick.commitBatch();
+}
+
+void JoystickEncoders::openBatch(bool &batch)
+{
+  if (!batch) this->_joystick.beginBatch();
+  batch = true;
+}
+
+void JoystickEncoders::pulse(Encoder &encoder, uint32_t now, bool &batch)
+{
+  if (encoder.pulsePhase == PULSE_PRESSED) {
+    if (now - encoder.pulseTime < this->pulseLength) return;
+    this->openBatch(batch);
+    this->_joystick.releaseButton(encoder.pulseButton);
+    encoder.pulsePhase = PULSE_GAP;
+    encoder.pulseTime = now;
+    return;
+  }
+
+  if (encoder.pulsePhase == PULSE_GAP) {
+    if (now - encoder.pulseTime < this->pulseLength) return;
+    encoder.pulsePhase = PULSE_IDLE;
+  }
+
+  if (encoder.pending == 0) return;
+
+  encoder.pulseButton = (encoder.pending > 0) ? encoder.upButton : encoder.downButton;
+  encoder.pending += (encoder.pending > 0) ? -1 : 1;
+  this->openBatch(batch);
+  this->_joystick.pressButton(encoder.pulseButton);
+  encoder.pulsePhase = PULSE_PRESSED;
+  encoder.pulseTime = now;
+}
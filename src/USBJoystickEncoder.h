@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKENCODER_H
+#define USBJOYSTICKENCODER_H
+
+#include <stdint.h>
+#include "mbed.h"
+#include "USBJoystickCore.h"
+
+namespace arduino {
+
+/*
+  Rotary encoders on a joystick, for trims and radio knobs.
+
+  Both pins of each encoder interrupt on both edges; the interrupt reads the two pins and decodes the
+  transition with a 16-entry table (previous A B, current A B) into -1, 0 or +1 quarter steps, added
+  to an atomic counter. A transition that changes both pins means an edge was missed, it is counted
+  in 'errors' and gives no step. The counters are only ever added to and taken whole, so a burst
+  of any length is never lost, just applied on the next 'poll'.
+
+  'poll', from the loop or a thread, turns the counted detents into joystick input:
+    - axis encoders move an absolute position by 'step' raw units per detent, clamped to the axis
+      range, and set the axis with 'setAxisRaw';
+    - button encoders press 'upButton' or 'downButton' for 'pulseLength' milliseconds per detent,
+      with an equal gap, so the host sees every detent. Detents arriving faster wait their turn.
+  All the changes of one 'poll' go out as one report.
+
+  Without interrupt-capable pins, or on a host, pass NO_PIN and feed the pin states to 'edge'. The
+  first 'edge' of such an encoder only records the pins it starts from, so whatever they rest at
+  gives no step.
+*/
+class JoystickEncoders {
+public:
+  static const uint8_t MAX_ENCODERS = 16;
+  static const uint8_t NO_PIN = 0xFF;
+  static const uint8_t NONE = 0xFF;    // Returned by the 'add' functions when the encoders are used up.
+
+  uint16_t pulseLength = 20;   // Milliseconds a button encoder holds the button, and the gap after it.
+
+  JoystickEncoders(JoystickCore &joystick);
+  ~JoystickEncoders(void);
+
+  JoystickEncoders(const JoystickEncoders &) = delete;
+  JoystickEncoders &operator=(const JoystickEncoders &) = delete;
+
+  /*
+    Encoder moving axis 'axisNumber' by 'step' raw units per detent, starting from 'initial'.
+    'stepsPerDetent' is the number of quarter steps per detent, 4 for most encoders.
+
+    @returns index of the encoder, NONE if there is no room.
+  */
+  uint8_t addAxis(uint8_t pinA, uint8_t pinB, uint8_t axisNumber, int16_t step, int16_t initial = 0,
+                  uint8_t stepsPerDetent = 4);
+
+  /*
+    Encoder pulsing 'upButton' when turned one way and 'downButton' the other way.
+  */
+  uint8_t addButtons(uint8_t pinA, uint8_t pinB, uint8_t upButton, uint8_t downButton, uint8_t stepsPerDetent = 4);
+
+  /*
+    Pins of encoder 'encoder' changed to 'a' and 'b'. Called by the pin interrupts; safe from any ISR,
+    one call at a time per encoder. The first call for a NO_PIN encoder sets the starting state.
+  */
+  void edge(uint8_t encoder, bool a, bool b);
+
+  /*
+    Apply the detents counted since the last call and advance the button pulses.
+  */
+  void poll(uint32_t now = millis());
+
+  /*
+    Axis position, detents waiting to be pulsed (negative for down), and missed edges of 'encoder'.
+  */
+  int32_t position(uint8_t encoder) const { return this->_encoders[ encoder % MAX_ENCODERS ].position; }
+  int32_t pendingPulses(uint8_t encoder) const { return this->_encoders[ encoder % MAX_ENCODERS ].pending; }
+  uint32_t errors(uint8_t encoder) const { return core_util_atomic_load_u32(&this->_encoders[ encoder % MAX_ENCODERS ].errors); }
+
+  uint8_t count(void) const { return this->_count; }
+
+
+private:
+  enum {
+    MODE_AXIS,
+    MODE_BUTTONS
+  } ;
+
+  enum {
+    PULSE_IDLE,
+    PULSE_PRESSED,
+    PULSE_GAP
+  } ;
+
+  // Quarter steps of the transition (previous A B << 2 | current A B).
+  static const int8_t QUADRATURE[16];
+  static const uint8_t STATE_UNKNOWN = 0xFF;   // 'state' of a NO_PIN encoder before its first 'edge'.
+
+  struct Encoder {
+    JoystickEncoders *owner;
+    uint8_t index;
+#if DEVICE_INTERRUPTIN
+    mbed::InterruptIn *pinA;
+    mbed::InterruptIn *pinB;
+    void pinChanged(void) { this->owner->edge(this->index, this->pinA->read(), this->pinB->read()); }
+#endif
+
+    volatile int32_t steps;     // Quarter steps counted by the interrupts, taken by 'poll'.
+    volatile uint32_t errors;
+    uint8_t state;              // A B of the previous edge or STATE_UNKNOWN, interrupt only.
+
+    uint8_t mode;
+    uint8_t stepsPerDetent;
+    uint8_t axisNumber;
+    uint8_t upButton;
+    uint8_t downButton;
+    int16_t step;
+
+    // 'poll' only.
+    int32_t residual;           // Quarter steps short of a detent.
+    int32_t position;
+    int32_t pending;
+    uint8_t pulsePhase;
+    uint8_t pulseButton;
+    uint32_t pulseTime;
+  } ;
+
+  JoystickCore &_joystick;
+  Encoder _encoders[ MAX_ENCODERS ];
+  uint8_t _count = 0;
+
+  uint8_t add(uint8_t pinA, uint8_t pinB, uint8_t stepsPerDetent);
+
+  /*
+    Advance the pulse of a button encoder. 'batch' tells if 'poll' has already opened its batch.
+  */
+  void pulse(Encoder &encoder, uint32_t now, bool &batch);
+  void openBatch(bool &batch);
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKENCODER_H
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBJoystickEvents.h"
+
+using namespace arduino;
+
+
+JoystickEventQueue::JoystickEventQueue(void)
+{
+  for (uint32_t i=0; i < CAPACITY; i++) {
+    this->_cells[i].sequence = i;
+  }
+  for (uint8_t i=0; i < BUTTON_BYTES; i++) {
+    this->_buttons[i] = 0;
+    this->_frameChanged[i] = 0;
+  }
+  for (uint8_t i=0; i < AXIS_COUNT; i++) {
+    this->_axes[i] = 0;
+  }
+}
+
+
+bool JoystickEventQueue::push(uint8_t type, uint8_t index, int16_t value)
+{
+  uint32_t position = core_util_atomic_load_u32(&this->_enqueuePosition);
+  Cell *cell;
+
+  while (true) {
+    cell = &this->_cells[ position & (CAPACITY - 1) ];
+    int32_t difference = static_cast<int32_t>(core_util_atomic_load_u32(&cell->sequence) - position);
+
+    if (difference == 0) {
+      // Cell is free, claim the position. On failure 'position' is reloaded by the CAS.
+      if (core_util_atomic_cas_u32(&this->_enqueuePosition, &position, position + 1)) break;
+    }
+    else if (difference < 0) {
+      core_util_atomic_incr_u32(&this->_overflows, 1);   // Consumer hasn't freed the cell yet, queue is full.
+      return false;
+    }
+    else {
+      position = core_util_atomic_load_u32(&this->_enqueuePosition);   // Another producer took it.
+    }
+  }
+
+  cell->event.time = JoystickTelemetry::ticks();
+  cell->event.type = type;
+  cell->event.index = index;
+  cell->event.value = value;
+  core_util_atomic_store_u32(&cell->sequence, position + 1);   // Publish.
+
+  core_util_atomic_incr_u32(&this->_queued, 1);
+  return true;
+}
+
+
+uint32_t JoystickEventQueue::depth(void) const
+{
+  return core_util_atomic_load_u32(&this->_enqueuePosition) - this->_dequeuePosition;
+}
+
+
+void JoystickEventQueue::drain(uint32_t now)
+{
+  if (this->_frameHeld) return;   // The previous report must go out first, it has transitions in it.
+  this->_frameHeld = true;
+
+  uint32_t currentDepth = this->depth();
+  if (currentDepth > this->_maxDepth) this->_maxDepth = currentDepth;
+
+  for (uint8_t i=0; i < BUTTON_BYTES; i++) this->_frameChanged[i] = 0;
+
+  while (true) {
+    Cell &cell = this->_cells[ this->_dequeuePosition & (CAPACITY - 1) ];
+    if (core_util_atomic_load_u32(&cell.sequence) != this->_dequeuePosition + 1) {
+      // Empty, or the next producer has not finished writing; it goes to the next report.
+      this->_emptied = true;
+      return;
+    }
+
+    const JoystickEvent &event = cell.event;
+    if (event.type == JoystickEvent::BUTTON) {
+      uint8_t byte = (event.index / 8) % BUTTON_BYTES;
+      uint8_t mask = 0x01 << (event.index % 8);
+      bool pressed = event.value != 0;
+
+      if (((this->_buttons[byte] & mask) != 0) != pressed) {
+        if (this->_frameChanged[byte] & mask) {
+          this->_emptied = false;     // Second change of the same button, leave it for the next report.
+          return;
+        }
+        this->_buttons[byte] ^= mask;
+        this->_frameChanged[byte] |= mask;
+      }
+    }
+    else if (event.index < AXIS_COUNT) {
+      this->_axes[ event.index ] = event.value;
+    }
+
+    uint32_t latency = now - event.time;
+    this->_applied++;
+    this->_latencyTotal += latency;
+    if (latency > this->_latencyMax) this->_latencyMax = latency;
+
+    core_util_atomic_store_u32(&cell.sequence, this->_dequeuePosition + CAPACITY);   // Free the cell.
+    this->_dequeuePosition++;
+  }
+}
+
+void JoystickEventQueue::sync(const uint8_t *buttons, uint8_t buttonBytes, const int16_t *axes)
+{
+  // With the queue still empty after the snapshot the latest state is at least as new as every event,
+  // and it also covers events lost to an overflow and direct writes to the state. An event queued since
+  // 'drain' belongs to a change the snapshot may already have, it goes to the next report first.
+  if (!this->_emptied || !this->empty()) return;
+
+  for (uint8_t i=0; i < buttonBytes && i < BUTTON_BYTES; i++) this->_buttons[i] = buttons[i];
+  if (this->queueAxes) {
+    for (uint8_t i=0; i < AXIS_COUNT; i++) this->_axes[i] = axes[i];
+  }
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKEVENTS_H
+#define USBJOYSTICKEVENTS_H
+
+#include <stdint.h>
+#include "mbed_atomic.h"
+#include "USBJoystickLayout.h"
+#include "USBJoystickTelemetry.h"
+
+namespace arduino {
+
+/*
+  One change of the joystick state. 'time' is in 'JoystickTelemetry::ticks'.
+*/
+struct JoystickEvent {
+  enum {
+    BUTTON,     // 'index' is the button number, 'value' 0 or 1.
+    AXIS        // 'index' is X_AXIS etc., 'value' the mapped axis value.
+  } ;
+
+  uint32_t time;
+  uint8_t type;
+  uint8_t index;
+  int16_t value;
+} ;
+
+
+/*
+  Queue of the button and axis changes of one joystick, so a press and release between two reports
+  are both sent instead of cancelling out. Attach with 'JoystickCore::setEventQueue'.
+
+  The setters (threads or ISRs, any number of them) push the changes, the sending side drains them into
+  the state that goes to the host. A report takes events in order until a button would change a second
+  time; the rest waits for the next report. So every press is held for at least one report and the host
+  sees the transitions in the order they happened. A report that failed to send is resent as it was.
+
+  Axis changes are only queued with 'queueAxes', otherwise the report has the latest axis values.
+  If the queue overflows the newest events are dropped and the report falls back to the latest state
+  once the queue has been emptied.
+
+  Bounded lock-free multi-producer queue with a sequence number in each cell (D. Vyukov), the producers
+  never wait for each other or for the consumer.
+*/
+class JoystickEventQueue {
+public:
+  static const uint32_t CAPACITY = 64;   // Power of two.
+
+  bool queueAxes = false;
+
+  JoystickEventQueue(void);
+
+  /*
+    Producer side, safe from any thread and from ISRs.
+
+    @returns false if the queue was full and the event was dropped.
+  */
+  bool push(uint8_t type, uint8_t index, int16_t value);
+
+  /*
+    Consumer side, called by the joystick with the send mutex held.
+
+    'drain' applies queued events to the report state until a button would change twice,
+    unless the previous report is still unsent. 'sync' then copies the latest state to the report
+    state if the queue was emptied and nothing was queued since; the setters queue their events
+    before the change is visible to the snapshot. 'frameSent' tells the report made of them reached the host.
+  */
+  void drain(uint32_t now);
+  void sync(const uint8_t *buttons, uint8_t buttonBytes, const int16_t *axes);
+  void frameSent(void) { this->_frameHeld = false; }
+
+  const uint8_t *buttons(void) const { return this->_buttons; }
+  const int16_t *axes(void) const { return this->_axes; }
+
+  bool empty(void) const { return this->depth() == 0; }
+
+  /*
+    Events in the queue now and at most, events accepted and dropped, and the time from a push
+    to the report containing it in 'JoystickTelemetry::ticks'.
+  */
+  uint32_t depth(void) const;
+  uint32_t maxDepth(void) const { return this->_maxDepth; }
+  uint32_t queued(void) const { return core_util_atomic_load_u32(&this->_queued); }
+  uint32_t overflows(void) const { return core_util_atomic_load_u32(&this->_overflows); }
+  uint32_t latencyMax(void) const { return this->_latencyMax; }
+  uint32_t latencyAverage(void) const { return (this->_applied > 0) ? this->_latencyTotal / this->_applied : 0; }
+
+
+private:
+  static const uint8_t BUTTON_BYTES = 32;
+
+  struct Cell {
+    volatile uint32_t sequence;   // Position + 1 when written, position + CAPACITY when free again.
+    JoystickEvent event;
+  } ;
+  Cell _cells[ CAPACITY ];
+
+  volatile uint32_t _enqueuePosition = 0;
+  uint32_t _dequeuePosition = 0;    // Consumer only.
+
+  volatile uint32_t _queued = 0;
+  volatile uint32_t _overflows = 0;
+  uint32_t _maxDepth = 0;
+  uint32_t _applied = 0;
+  uint64_t _latencyTotal = 0;
+  uint32_t _latencyMax = 0;
+
+  // State of the report being built, consumer only.
+  uint8_t _buttons[ BUTTON_BYTES ];
+  int16_t _axes[ AXIS_COUNT ];
+  uint8_t _frameChanged[ BUTTON_BYTES ];   // Buttons changed in the current report.
+  bool _frameHeld = false;   // Events applied, report not sent yet.
+  bool _emptied = true;      // The last 'drain' emptied the queue.
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKEVENTS_H
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBJoystickFilter.h"
+
+using namespace arduino;
+
+
+void JoystickAxisFilter::setRange(int16_t minimum, int16_t maximum)
+{
+  this->_rangeMin = minimum;
+  this->_rangeMax = maximum;
+  this->updateDeadzoneScale();
+}
+
+void JoystickAxisFilter::setDeadzone(int16_t deadzone, int16_t center)
+{
+  this->_deadzone = (deadzone > 0) ? deadzone : 0;
+  this->_center = center;
+  this->updateDeadzoneScale();
+  this->updateEnabled();
+}
+
+void JoystickAxisFilter::setHysteresis(int16_t hysteresis)
+{
+  this->_hysteresis = (hysteresis > 0) ? hysteresis : 0;
+  this->updateEnabled();
+}
+
+void JoystickAxisFilter::setSmoothing(uint8_t shift)
+{
+  this->_emaShift = (shift > 15) ? 15 : shift;
+  this->updateEnabled();
+  this->reset();
+}
+
+void JoystickAxisFilter::setOversampling(uint8_t samples, bool decimate)
+{
+  if (samples < 1) samples = 1;
+  if (samples > OVERSAMPLE_MAX) samples = OVERSAMPLE_MAX;
+
+  this->_sampleCount = samples;
+  this->_decimate = decimate;
+  this->updateEnabled();
+  this->reset();
+}
+
+void JoystickAxisFilter::reset(void)
+{
+  this->_sampleSum = 0;
+  this->_sampleIndex = 0;
+  this->_sampleFill = 0;
+  this->_primed = false;
+}
+
+
+void JoystickAxisFilter::updateEnabled(void)
+{
+  this->_enabled = (this->_deadzone > 0) || (this->_hysteresis > 0) ||
+                   (this->_emaShift > 0) || (this->_sampleCount > 1);
+}
+
+void JoystickAxisFilter::updateDeadzoneScale(void)
+{
+  // Stretch [center+deadzone, max] to [center, max] and same on the negative side.
+  // Rounded up so the ends are reached, 'process' clamps the overshoot.
+  int32_t positiveRange = this->_rangeMax - this->_center;
+  int32_t negativeRange = this->_center - this->_rangeMin;
+  int32_t positiveLive = positiveRange - this->_deadzone;
+  int32_t negativeLive = negativeRange - this->_deadzone;
+
+  this->_positiveScale = (positiveLive > 0) ?
+      ((static_cast<uint32_t>(positiveRange) << 16) + positiveLive - 1) / positiveLive : 0;
+  this->_negativeScale = (negativeLive > 0) ?
+      ((static_cast<uint32_t>(negativeRange) << 16) + negativeLive - 1) / negativeLive : 0;
+}
+
+int32_t JoystickAxisFilter::applyDeadzone(int32_t value) const
+{
+  int32_t distance = value - this->_center;
+
+  if (distance > this->_deadzone) {
+    int32_t stretched = static_cast<int32_t>((static_cast<uint64_t>(distance - this->_deadzone) * this->_positiveScale) >> 16);
+    return this->_center + stretched;
+  }
+  if (distance < -this->_deadzone) {
+    int32_t stretched = static_cast<int32_t>((static_cast<uint64_t>(-distance - this->_deadzone) * this->_negativeScale) >> 16);
+    return this->_center - stretched;
+  }
+  return this->_center;
+}
+
+
+bool JoystickAxisFilter::process(int16_t input, int16_t &output)
+{
+  if (!this->_enabled) {
+    output = input;
+    return true;
+  }
+
+  int32_t value = input;
+
+  // 1. Oversampling with a ring buffer and running sum.
+  if (this->_sampleCount > 1) {
+    if (this->_sampleFill == this->_sampleCount) {
+      this->_sampleSum -= this->_samples[ this->_sampleIndex ];
+    }
+    else {
+      this->_sampleFill++;
+    }
+    this->_samples[ this->_sampleIndex ] = input;
+    this->_sampleSum += input;
+    this->_sampleIndex = (this->_sampleIndex + 1 < this->_sampleCount) ? this->_sampleIndex + 1 : 0;
+
+    // Decimation outputs once per full round of the ring buffer.
+    if (this->_decimate && (this->_sampleFill < this->_sampleCount || this->_sampleIndex != 0)) return false;
+
+    value = this->_sampleSum / this->_sampleFill;
+  }
+
+  // 2. Exponential moving average, state has 8 fractional bits. Multiplied, a left shift of a
+  // negative value is undefined; the right shifts are arithmetic on the targets, rounding down.
+  if (this->_emaShift > 0) {
+    if (!this->_primed) {
+      this->_emaState = value * 256;
+    }
+    else {
+      this->_emaState += (value * 256 - this->_emaState) >> this->_emaShift;
+    }
+    value = (this->_emaState + 0x80) >> 8;
+  }
+
+  // 3. Deadzone.
+  if (this->_deadzone > 0) {
+    value = this->applyDeadzone(value);
+  }
+
+  // 4. Hysteresis against the last output.
+  if (this->_hysteresis > 0 && this->_primed) {
+    int32_t change = value - this->_lastOutput;
+    if (change < this->_hysteresis && change > -this->_hysteresis) {
+      // Always let the ends through so the full range stays reachable.
+      if (value != this->_rangeMin && value != this->_rangeMax) return false;
+    }
+  }
+
+  if (value < this->_rangeMin) value = this->_rangeMin;
+  if (value > this->_rangeMax) value = this->_rangeMax;
+
+  this->_primed = true;
+  this->_lastOutput = value;
+  output = value;
+  return true;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKFILTER_H
+#define USBJOYSTICKFILTER_H
+
+#include <stdint.h>
+
+namespace arduino {
+
+/*
+  Conditioning of one axis between the axis setters and the stored axis value.
+  Works on the mapped values (logical range of the layout), integer-only and without allocations.
+
+  The stages run in this order, each one is off by default:
+    1. Oversampling: average of the last N samples. With decimation only every Nth sample gives an output.
+    2. Exponential moving average with alpha = 1 / 2^shift.
+    3. Center deadzone. The rest of the range is stretched so the ends are still reachable.
+    4. Hysteresis. The output changes only when the input moves at least this much from the last output.
+
+  Not thread-safe by itself. 'JoystickCore' runs 'process' inside a critical section, so anything
+  changing the settings of a filter in use has to do that inside one as well.
+*/
+class JoystickAxisFilter {
+public:
+  static const uint8_t OVERSAMPLE_MAX = 16;   // Size of the sample ring buffer.
+
+  /*
+    Logical range of the axis. Set by 'USBJoystick' from the layout.
+  */
+  void setRange(int16_t minimum, int16_t maximum);
+
+  /*
+    Values within 'deadzone' of 'center' are output as 'center'. 0 disables.
+  */
+  void setDeadzone(int16_t deadzone, int16_t center = 0);
+
+  /*
+    Minimum change of the output. 0 disables.
+  */
+  void setHysteresis(int16_t hysteresis);
+
+  /*
+    Exponential moving average, alpha = 1 / 2^shift. 0 disables, 1-8 are sensible values.
+  */
+  void setSmoothing(uint8_t shift);
+
+  /*
+    Average of 'samples' samples, 1 disables. At most OVERSAMPLE_MAX.
+    With 'decimate' only every 'samples'th input produces an output, otherwise every input
+    produces the moving average of the latest samples.
+  */
+  void setOversampling(uint8_t samples, bool decimate = true);
+
+  /*
+    Forget the filter history, settings are kept.
+  */
+  void reset(void);
+
+  /*
+    True if any of the stages is enabled.
+  */
+  bool enabled(void) const { return this->_enabled; }
+
+  /*
+    Current settings.
+  */
+  int16_t deadzone(void) const { return this->_deadzone; }
+  int16_t center(void) const { return this->_center; }
+  int16_t hysteresis(void) const { return this->_hysteresis; }
+  uint8_t smoothing(void) const { return this->_emaShift; }
+  uint8_t oversampling(void) const { return this->_sampleCount; }
+  bool decimating(void) const { return this->_decimate; }
+
+  /*
+    Run one sample through the filter.
+
+    @returns true if 'output' was written and should be stored, false if the sample was
+             absorbed by the decimation or the hysteresis.
+  */
+  bool process(int16_t input, int16_t &output);
+
+
+private:
+  int16_t _rangeMin = -32767;
+  int16_t _rangeMax = 32767;
+
+  int16_t _deadzone = 0;
+  int16_t _center = 0;
+  uint32_t _positiveScale = 0x10000;  // Stretch factors outside the deadzone, 16.16 fixed-point.
+  uint32_t _negativeScale = 0x10000;
+
+  int16_t _hysteresis = 0;
+
+  uint8_t _emaShift = 0;
+  int32_t _emaState = 0;      // Filtered value, 8 fractional bits.
+
+  int16_t _samples[ OVERSAMPLE_MAX ];
+  int32_t _sampleSum = 0;
+  uint8_t _sampleCount = 1;
+  uint8_t _sampleIndex = 0;
+  uint8_t _sampleFill = 0;
+  bool _decimate = true;
+
+  int16_t _lastOutput = 0;
+  bool _primed = false;       // False until the first sample after 'reset'.
+  bool _enabled = false;
+
+  void updateEnabled(void);
+  void updateDeadzoneScale(void);
+  int32_t applyDeadzone(int32_t value) const;
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKFILTER_H
@@ -0,0 +1,633 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickForce.h"
+#include "USBJoystickCore.h"
+#include "USBJoystickTelemetry.h"
+#include "mbed_critical.h"
+
+using namespace arduino;
+
+
+// Effect Type usages of the PID page, in EFFECT_* order.
+#define EFFECT_TYPE_USAGES \
+  USAGE(1), 0x26, /* ET Constant Force */ \
+  USAGE(1), 0x30, /* ET Square */ \
+  USAGE(1), 0x31, /* ET Sine */ \
+  USAGE(1), 0x32, /* ET Triangle */ \
+  USAGE(1), 0x33, /* ET Sawtooth Up */ \
+  USAGE(1), 0x34, /* ET Sawtooth Down */ \
+  USAGE(1), 0x40, /* ET Spring */ \
+  USAGE(1), 0x41  /* ET Damper */
+
+#define EFFECT_BLOCK_INDEX(type) \
+  USAGE(1), 0x22, /* Effect Block Index */ \
+  LOGICAL_MINIMUM(1), 1, \
+  LOGICAL_MAXIMUM(1), MAX_EFFECTS, \
+  REPORT_SIZE(1), 8, \
+  REPORT_COUNT(1), 1, \
+  type(1), 0x02
+
+const uint8_t JoystickForceFeedback::DESCRIPTOR[] = {
+  USAGE_PAGE(1), 0x0F,                // Physical Interface Device
+
+  USAGE(1), 0x21,                     // Set Effect Report
+  COLLECTION(1), 0x02,                // Logical
+    REPORT_ID(1), REPORT_SET_EFFECT,
+    EFFECT_BLOCK_INDEX(OUTPUT),
+    USAGE(1), 0x25,                   // Effect Type
+    COLLECTION(1), 0x02,
+      EFFECT_TYPE_USAGES,
+      LOGICAL_MAXIMUM(1), EFFECT_TYPE_COUNT - 1,
+      OUTPUT(1), 0x00,                // Data, Array
+    END_COLLECTION(0),
+    USAGE(1), 0x50,                   // Duration
+    LOGICAL_MINIMUM(1), 0,
+    LOGICAL_MAXIMUM(3), 0xFF, 0xFF, 0x00, 0x00,
+    UNIT(2), 0x03, 0x10,              // Time, seconds...
+    UNIT_EXPONENT(1), 0x0D,           // ...x 10^-3
+    REPORT_SIZE(1), 16,
+    OUTPUT(1), 0x02,
+    UNIT(1), 0x00,
+    UNIT_EXPONENT(1), 0x00,
+    USAGE(1), 0x52,                   // Gain
+    LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+    REPORT_SIZE(1), 8,
+    OUTPUT(1), 0x02,
+    USAGE(1), 0x55,                   // Axes Enable
+    COLLECTION(1), 0x02,
+      USAGE_PAGE(1), 0x01,
+      USAGE(1), 0x30,                 // X
+      USAGE(1), 0x31,                 // Y
+      LOGICAL_MAXIMUM(1), 1,
+      REPORT_SIZE(1), 1,
+      REPORT_COUNT(1), 2,
+      OUTPUT(1), 0x02,
+    END_COLLECTION(0),
+    USAGE_PAGE(1), 0x0F,
+    USAGE(1), 0x56,                   // Direction Enable
+    REPORT_COUNT(1), 1,
+    OUTPUT(1), 0x02,
+    REPORT_COUNT(1), 5,               // Padding
+    OUTPUT(1), 0x03,
+    USAGE(1), 0x57,                   // Direction
+    COLLECTION(1), 0x02,
+      USAGE_PAGE(1), 0x0A,            // Ordinal
+      USAGE(1), 0x01,
+      LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+      PHYSICAL_MINIMUM(1), 0,
+      PHYSICAL_MAXIMUM(2), 0x68, 0x01,    // 360 degrees
+      UNIT(1), 0x14,                  // Degrees
+      REPORT_SIZE(1), 8,
+      REPORT_COUNT(1), 1,
+      OUTPUT(1), 0x02,
+      UNIT(1), 0x00,
+      PHYSICAL_MAXIMUM(1), 0,
+    END_COLLECTION(0),
+    USAGE_PAGE(1), 0x0F,
+  END_COLLECTION(0),
+
+  USAGE(1), 0x5F,                     // Set Condition Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_SET_CONDITION,
+    EFFECT_BLOCK_INDEX(OUTPUT),
+    USAGE(1), 0x23,                   // Parameter Block Offset, the axis
+    LOGICAL_MINIMUM(1), 0,
+    LOGICAL_MAXIMUM(1), AXES - 1,
+    OUTPUT(1), 0x02,
+    USAGE(1), 0x60,                   // CP Offset
+    USAGE(1), 0x61,                   // Positive Coefficient
+    USAGE(1), 0x62,                   // Negative Coefficient
+    LOGICAL_MINIMUM(2), 0xF0, 0xD8,   // -10000
+    LOGICAL_MAXIMUM(2), 0x10, 0x27,   // 10000
+    REPORT_SIZE(1), 16,
+    REPORT_COUNT(1), 3,
+    OUTPUT(1), 0x02,
+    USAGE(1), 0x65,                   // Dead Band
+    LOGICAL_MINIMUM(1), 0,
+    REPORT_COUNT(1), 1,
+    OUTPUT(1), 0x02,
+  END_COLLECTION(0),
+
+  USAGE(1), 0x6E,                     // Set Periodic Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_SET_PERIODIC,
+    EFFECT_BLOCK_INDEX(OUTPUT),
+    USAGE(1), 0x70,                   // Magnitude
+    USAGE(1), 0x6F,                   // Offset
+    LOGICAL_MINIMUM(2), 0xF0, 0xD8,
+    LOGICAL_MAXIMUM(2), 0x10, 0x27,
+    REPORT_SIZE(1), 16,
+    REPORT_COUNT(1), 2,
+    OUTPUT(1), 0x02,
+    USAGE(1), 0x71,                   // Phase
+    LOGICAL_MINIMUM(1), 0,
+    LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+    REPORT_SIZE(1), 8,
+    REPORT_COUNT(1), 1,
+    OUTPUT(1), 0x02,
+    USAGE(1), 0x72,                   // Period
+    LOGICAL_MAXIMUM(3), 0xFF, 0xFF, 0x00, 0x00,
+    UNIT(2), 0x03, 0x10,
+    UNIT_EXPONENT(1), 0x0D,
+    REPORT_SIZE(1), 16,
+    OUTPUT(1), 0x02,
+    UNIT(1), 0x00,
+    UNIT_EXPONENT(1), 0x00,
+  END_COLLECTION(0),
+
+  USAGE(1), 0x73,                     // Set Constant Force Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_SET_CONSTANT_FORCE,
+    EFFECT_BLOCK_INDEX(OUTPUT),
+    USAGE(1), 0x70,                   // Magnitude
+    LOGICAL_MINIMUM(2), 0xF0, 0xD8,
+    LOGICAL_MAXIMUM(2), 0x10, 0x27,
+    REPORT_SIZE(1), 16,
+    OUTPUT(1), 0x02,
+  END_COLLECTION(0),
+
+  USAGE(1), 0x77,                     // Effect Operation Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_EFFECT_OPERATION,
+    EFFECT_BLOCK_INDEX(OUTPUT),
+    USAGE(1), 0x78,                   // Effect Operation
+    COLLECTION(1), 0x02,
+      USAGE(1), 0x79,                 // Op Effect Start
+      USAGE(1), 0x7A,                 // Op Effect Start Solo
+      USAGE(1), 0x7B,                 // Op Effect Stop
+      LOGICAL_MAXIMUM(1), 3,
+      OUTPUT(1), 0x00,
+    END_COLLECTION(0),
+    USAGE(1), 0x7C,                   // Loop Count
+    LOGICAL_MINIMUM(1), 0,
+    LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+    OUTPUT(1), 0x02,
+  END_COLLECTION(0),
+
+  USAGE(1), 0x90,                     // PID Block Free Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_BLOCK_FREE,
+    EFFECT_BLOCK_INDEX(OUTPUT),
+  END_COLLECTION(0),
+
+  USAGE(1), 0x96,                     // PID Device Control
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_DEVICE_CONTROL,
+    USAGE(1), 0x97,                   // DC Enable Actuators
+    USAGE(1), 0x98,                   // DC Disable Actuators
+    USAGE(1), 0x99,                   // DC Stop All Effects
+    USAGE(1), 0x9A,                   // DC Device Reset
+    USAGE(1), 0x9B,                   // DC Device Pause
+    USAGE(1), 0x9C,                   // DC Device Continue
+    LOGICAL_MINIMUM(1), 1,
+    LOGICAL_MAXIMUM(1), 6,
+    OUTPUT(1), 0x00,
+  END_COLLECTION(0),
+
+  USAGE(1), 0x7D,                     // Device Gain Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_DEVICE_GAIN,
+    USAGE(1), 0x7E,                   // Device Gain
+    LOGICAL_MINIMUM(1), 0,
+    LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+    OUTPUT(1), 0x02,
+  END_COLLECTION(0),
+
+  USAGE(1), 0xAB,                     // Create New Effect Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_CREATE_EFFECT,
+    USAGE(1), 0x25,                   // Effect Type
+    COLLECTION(1), 0x02,
+      EFFECT_TYPE_USAGES,
+      LOGICAL_MINIMUM(1), 1,
+      LOGICAL_MAXIMUM(1), EFFECT_TYPE_COUNT - 1,
+      FEATURE(1), 0x00,
+    END_COLLECTION(0),
+    USAGE_PAGE(1), 0x01,
+    USAGE(1), 0x3B,                   // Byte Count
+    LOGICAL_MINIMUM(1), 0,
+    LOGICAL_MAXIMUM(2), 0xFF, 0x01,
+    REPORT_SIZE(1), 16,
+    FEATURE(1), 0x02,
+    USAGE_PAGE(1), 0x0F,
+  END_COLLECTION(0),
+
+  USAGE(1), 0x89,                     // PID Block Load Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_BLOCK_LOAD,
+    EFFECT_BLOCK_INDEX(FEATURE),
+    USAGE(1), 0x8B,                   // Block Load Status
+    COLLECTION(1), 0x02,
+      USAGE(1), 0x8C,                 // Block Load Success
+      USAGE(1), 0x8D,                 // Block Load Full
+      USAGE(1), 0x8E,                 // Block Load Error
+      LOGICAL_MAXIMUM(1), 3,
+      FEATURE(1), 0x00,
+    END_COLLECTION(0),
+    USAGE(1), 0xAC,                   // RAM Pool Available
+    LOGICAL_MINIMUM(1), 0,
+    LOGICAL_MAXIMUM(3), 0xFF, 0xFF, 0x00, 0x00,
+    REPORT_SIZE(1), 16,
+    FEATURE(1), 0x02,
+  END_COLLECTION(0),
+
+  USAGE(1), 0x7F,                     // PID Pool Report
+  COLLECTION(1), 0x02,
+    REPORT_ID(1), REPORT_POOL,
+    USAGE(1), 0x80,                   // RAM Pool Size
+    REPORT_COUNT(1), 1,
+    FEATURE(1), 0x02,
+    USAGE(1), 0x83,                   // Simultaneous Effects Max
+    LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+    REPORT_SIZE(1), 8,
+    FEATURE(1), 0x02,
+    USAGE(1), 0xA9,                   // Device Managed Pool
+    USAGE(1), 0xAA,                   // Shared Parameter Blocks
+    LOGICAL_MAXIMUM(1), 1,
+    REPORT_SIZE(1), 1,
+    REPORT_COUNT(1), 2,
+    FEATURE(1), 0x02,
+    REPORT_COUNT(1), 6,               // Padding
+    FEATURE(1), 0x03,
+  END_COLLECTION(0)
+};
+
+static_assert( sizeof(JoystickForceFeedback::DESCRIPTOR) == JoystickForceFeedback::DESCRIPTOR_LENGTH, "DESCRIPTOR_LENGTH does not match DESCRIPTOR" );
+
+
+// sin(i * 90 / 64 degrees) * FORCE_MAX, a quarter wave.
+static const int16_t SINE_TABLE[65] = {
+      0,   245,   491,   736,   980,  1224,  1467,  1710,
+   1951,  2191,  2430,  2667,  2903,  3137,  3369,  3599,
+   3827,  4052,  4276,  4496,  4714,  4929,  5141,  5350,
+   5556,  5758,  5957,  6152,  6344,  6532,  6716,  6895,
+   7071,  7242,  7410,  7572,  7730,  7883,  8032,  8176,
+   8315,  8449,  8577,  8701,  8819,  8932,  9040,  9142,
+   9239,  9330,  9415,  9495,  9569,  9638,  9700,  9757,
+   9808,  9853,  9892,  9925,  9952,  9973,  9988,  9997,
+  10000
+};
+
+// Sine of 'angle', 0 ... 255 = 0 ... 360 degrees.
+static int32_t sine(uint8_t angle)
+{
+  uint8_t step = angle & 0x3F;
+  switch (angle >> 6) {
+    case 0: return SINE_TABLE[step];
+    case 1: return SINE_TABLE[64 - step];
+    case 2: return -SINE_TABLE[step];
+    default: return -SINE_TABLE[64 - step];
+  }
+}
+
+static int16_t readS16(const uint8_t *data) { return static_cast<int16_t>(data[0] | (data[1] << 8)); }
+static uint16_t readU16(const uint8_t *data) { return static_cast<uint16_t>(data[0] | (data[1] << 8)); }
+
+static int32_t clampForce(int32_t force)
+{
+  if (force > JoystickForceFeedback::FORCE_MAX) return JoystickForceFeedback::FORCE_MAX;
+  if (force < -JoystickForceFeedback::FORCE_MAX) return -JoystickForceFeedback::FORCE_MAX;
+  return force;
+}
+
+
+
+JoystickForceFeedback::JoystickForceFeedback(JoystickCore &joystick):
+  _joystick(joystick)
+{
+  this->reset();
+  for (uint8_t a=0; a < AXES; a++) {
+    this->_forces[a] = 0;
+    this->_lastPosition[a] = 0;
+  }
+  joystick.setForceFeedback(this);
+}
+
+JoystickForceFeedback::~JoystickForceFeedback(void)
+{
+  this->stop();
+  this->_joystick.setForceFeedback(nullptr);
+}
+
+
+void JoystickForceFeedback::start(uint32_t tickInterval)
+{
+  this->_lastTick = millis();
+  this->_ticker.attach( mbed::callback(this, &JoystickForceFeedback::tickNow), std::chrono::microseconds(tickInterval) );
+}
+
+void JoystickForceFeedback::stop(void)
+{
+  this->_ticker.detach();
+}
+
+void JoystickForceFeedback::tickNow(void)
+{
+  this->tick( millis() );
+}
+
+
+JoystickForceFeedback::Effect *JoystickForceFeedback::block(uint8_t index)
+{
+  if (index < 1 || index > MAX_EFFECTS) return nullptr;
+  Effect *effect = &this->_effects[index - 1];
+  return (effect->type != EFFECT_NONE) ? effect : nullptr;
+}
+
+void JoystickForceFeedback::stopAll(void)
+{
+  for (uint8_t i=0; i < MAX_EFFECTS; i++) this->_effects[i].playing = false;
+}
+
+void JoystickForceFeedback::reset(void)
+{
+  memset(this->_effects, 0, sizeof(this->_effects));
+  this->_deviceGain = 255;
+  this->_enabled = true;
+  this->_paused = false;
+}
+
+
+uint8_t JoystickForceFeedback::playingEffects(void) const
+{
+  uint8_t count = 0;
+  for (uint8_t i=0; i < MAX_EFFECTS; i++) {
+    if (this->_effects[i].playing) count++;
+  }
+  return count;
+}
+
+
+int32_t JoystickForceFeedback::position(uint8_t axis) const
+{
+  const JoystickLayout &layout = this->_joystick.layout();
+  int32_t value = core_util_atomic_load_s16( (axis == 0) ? &this->_joystick.axis.X : &this->_joystick.axis.Y );
+  int32_t span = static_cast<int32_t>(layout.axisMaximum) - layout.axisMinimum;
+  if (span <= 0) return 0;
+  return (value - layout.axisMinimum) * (2 * FORCE_MAX) / span - FORCE_MAX;
+}
+
+
+int32_t JoystickForceFeedback::periodicForce(const Effect &effect, uint32_t elapsed) const
+{
+  if (effect.period == 0) return effect.offset;
+
+  uint8_t angle = static_cast<uint8_t>( (elapsed % effect.period) * 256 / effect.period + effect.phase );
+  int32_t wave;
+  switch (effect.type) {
+    case EFFECT_SQUARE:
+      wave = (angle < 128) ? FORCE_MAX : -FORCE_MAX;
+      break;
+    case EFFECT_TRIANGLE:
+      // Same shape as the sine: up from 0, peak at 90 degrees.
+      if (angle < 64) wave = angle * FORCE_MAX / 64;
+      else if (angle < 192) wave = FORCE_MAX - (angle - 64) * FORCE_MAX / 64;
+      else wave = (angle - 256) * FORCE_MAX / 64;
+      break;
+    case EFFECT_SAWTOOTH_UP:
+      wave = -FORCE_MAX + angle * (2 * FORCE_MAX) / 255;
+      break;
+    case EFFECT_SAWTOOTH_DOWN:
+      wave = FORCE_MAX - angle * (2 * FORCE_MAX) / 255;
+      break;
+    default:
+      wave = sine(angle);
+      break;
+  }
+  return effect.offset + effect.magnitude * wave / FORCE_MAX;
+}
+
+
+int32_t JoystickForceFeedback::conditionForce(const Effect &effect, uint8_t axis, int32_t position, int32_t velocity) const
+{
+  const Condition &condition = effect.conditions[axis];
+
+  // The spring pushes against the displacement, the damper against the movement.
+  int32_t displacement = ((effect.type == EFFECT_SPRING) ? position : velocity) - condition.offset;
+  if (displacement > condition.deadBand) {
+    return -(displacement - condition.deadBand) * condition.positive / FORCE_MAX;
+  }
+  if (displacement < -static_cast<int32_t>(condition.deadBand)) {
+    return -(displacement + condition.deadBand) * condition.negative / FORCE_MAX;
+  }
+  return 0;
+}
+
+
+void JoystickForceFeedback::tick(uint32_t now)
+{
+  uint32_t startTicks = JoystickTelemetry::ticks();
+
+  uint32_t interval = now - this->_lastTick;
+  this->_lastTick = now;
+
+  int32_t position[ AXES ];
+  int32_t velocity[ AXES ];
+  for (uint8_t a=0; a < AXES; a++) {
+    position[a] = this->position(a);
+    // Full range per second is FORCE_MAX.
+    velocity[a] = (interval > 0) ? clampForce( (position[a] - this->_lastPosition[a]) * 1000 / static_cast<int32_t>(interval) ) : 0;
+    this->_lastPosition[a] = position[a];
+  }
+
+  int32_t total[ AXES ] = { 0, 0 };
+  core_util_critical_section_enter();
+  bool active = this->_enabled && !this->_paused;
+  for (uint8_t i=0; i < MAX_EFFECTS && active; i++) {
+    Effect &effect = this->_effects[i];
+    if (!effect.playing) continue;
+
+    uint32_t elapsed = now - effect.startTime;
+    if (effect.duration != 0xFFFF && effect.duration != 0) {
+      uint32_t loops = (effect.loops == 0) ? 1 : effect.loops;
+      if (effect.loops != 0xFF && elapsed >= effect.duration * loops) {
+        effect.playing = false;
+        continue;
+      }
+      elapsed %= effect.duration;
+    }
+
+    if (effect.type == EFFECT_SPRING || effect.type == EFFECT_DAMPER) {
+      for (uint8_t a=0; a < AXES; a++) {
+        if ((effect.axes & 0x03) != 0 && (effect.axes & (0x01 << a)) == 0) continue;
+        total[a] += this->conditionForce(effect, a, position[a], velocity[a]) * effect.gain / 255;
+      }
+      continue;
+    }
+
+    int32_t force = (effect.type == EFFECT_CONSTANT) ? effect.magnitude : this->periodicForce(effect, elapsed);
+    force = force * effect.gain / 255;
+    if ((effect.axes & 0x04) != 0 || (effect.axes & 0x03) == 0x03) {
+      total[0] += force * sine(effect.direction) / FORCE_MAX;
+      total[1] += force * sine(effect.direction + 64) / FORCE_MAX;
+    }
+    else {
+      if ((effect.axes & 0x02) == 0) total[0] += force;   // X also when no axis is enabled.
+      else total[1] += force;
+    }
+  }
+  core_util_critical_section_exit();
+
+  for (uint8_t a=0; a < AXES; a++) {
+    this->_forces[a] = active ? clampForce( total[a] * this->_deviceGain / 255 ) : 0;
+  }
+
+  uint32_t elapsedTicks = JoystickTelemetry::ticks() - startTicks;
+  if (elapsedTicks > this->_tickTimeMax) this->_tickTimeMax = elapsedTicks;
+
+  if (this->_output) this->_output(this->_forces);
+}
+
+
+bool JoystickForceFeedback::receiveReport(const uint8_t *report, uint8_t length)
+{
+  if (length < 2 || report[0] < REPORT_SET_EFFECT || report[0] > REPORT_CREATE_EFFECT) return false;
+
+  uint8_t id = report[0];
+  uint32_t now = millis();
+
+  core_util_critical_section_enter();
+  Effect *effect = this->block(report[1]);
+
+  switch (id) {
+    case REPORT_SET_EFFECT:
+      if (effect != nullptr && length >= 8) {
+        if (report[2] > EFFECT_NONE && report[2] < EFFECT_TYPE_COUNT) effect->type = report[2];
+        effect->duration = readU16(report + 3);
+        effect->gain = report[5];
+        effect->axes = report[6];
+        effect->direction = report[7];
+      }
+      break;
+
+    case REPORT_SET_CONDITION:
+      if (effect != nullptr && length >= 11 && report[2] < AXES) {
+        Condition &condition = effect->conditions[ report[2] ];
+        condition.offset = readS16(report + 3);
+        condition.positive = readS16(report + 5);
+        condition.negative = readS16(report + 7);
+        condition.deadBand = readU16(report + 9);
+      }
+      break;
+
+    case REPORT_SET_PERIODIC:
+      if (effect != nullptr && length >= 9) {
+        effect->magnitude = readS16(report + 2);
+        effect->offset = readS16(report + 4);
+        effect->phase = report[6];
+        effect->period = readU16(report + 7);
+      }
+      break;
+
+    case REPORT_SET_CONSTANT_FORCE:
+      if (effect != nullptr && length >= 4) effect->magnitude = readS16(report + 2);
+      break;
+
+    case REPORT_EFFECT_OPERATION:
+      if (effect != nullptr && length >= 4) {
+        if (report[2] == 2) this->stopAll();   // Start solo.
+        if (report[2] == 1 || report[2] == 2) {
+          effect->playing = true;
+          effect->startTime = now;
+          effect->loops = report[3];
+        }
+        else if (report[2] == 3) {
+          effect->playing = false;
+        }
+      }
+      break;
+
+    case REPORT_BLOCK_FREE:
+      if (effect != nullptr) memset(effect, 0, sizeof(Effect));
+      break;
+
+    case REPORT_DEVICE_CONTROL:
+      switch (report[1]) {
+        case 1: this->_enabled = true; break;
+        case 2: this->_enabled = false; break;
+        case 3: this->stopAll(); break;
+        case 4: this->reset(); break;
+        case 5:
+          if (!this->_paused) this->_pauseTime = now;
+          this->_paused = true;
+          break;
+        case 6:
+          if (this->_paused) {
+            // Shift the playing effects by the pause so they continue where they were.
+            for (uint8_t i=0; i < MAX_EFFECTS; i++) this->_effects[i].startTime += now - this->_pauseTime;
+          }
+          this->_paused = false;
+          break;
+      }
+      break;
+
+    case REPORT_DEVICE_GAIN:
+      this->_deviceGain = report[1];
+      break;
+
+    case REPORT_CREATE_EFFECT:
+      this->_lastBlock = 0;
+      this->_lastLoadStatus = 3;   // Block Load Error
+      if (report[1] > EFFECT_NONE && report[1] < EFFECT_TYPE_COUNT) {
+        this->_lastLoadStatus = 2;   // Block Load Full
+        for (uint8_t i=0; i < MAX_EFFECTS; i++) {
+          if (this->_effects[i].type != EFFECT_NONE) continue;
+          memset(&this->_effects[i], 0, sizeof(Effect));
+          this->_effects[i].type = report[1];
+          this->_effects[i].gain = 255;
+          this->_effects[i].duration = 0xFFFF;
+          this->_lastBlock = i + 1;
+          this->_lastLoadStatus = 1;   // Block Load Success
+          break;
+        }
+      }
+      break;
+  }
+  core_util_critical_section_exit();
+  return true;
+}
+
+
+uint8_t JoystickForceFeedback::writeFeatureReport(uint8_t reportId, uint8_t *report) const
+{
+  uint16_t freeBlocks = 0;
+  for (uint8_t i=0; i < MAX_EFFECTS; i++) {
+    if (this->_effects[i].type == EFFECT_NONE) freeBlocks++;
+  }
+
+  if (reportId == REPORT_BLOCK_LOAD) {
+    uint16_t available = freeBlocks * sizeof(Effect);
+    report[0] = REPORT_BLOCK_LOAD;
+    report[1] = this->_lastBlock;
+    report[2] = this->_lastLoadStatus;
+    report[3] = available;
+    report[4] = available >> 8;
+    return 5;
+  }
+  if (reportId == REPORT_POOL) {
+    uint16_t size = MAX_EFFECTS * sizeof(Effect);
+    report[0] = REPORT_POOL;
+    report[1] = size;
+    report[2] = size >> 8;
+    report[3] = MAX_EFFECTS;
+    report[4] = 0x01;   // Device managed pool, no shared parameter blocks.
+    return 5;
+  }
+  return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKFORCE_H
+#define USBJOYSTICKFORCE_H
+
+#include <stdint.h>
+#include "mbed.h"
+#include "PluggableUSBHID.h"
+
+namespace arduino {
+
+class JoystickCore;
+
+/*
+  Force feedback with the HID Physical Interface Device (PID) class. Constructing one attaches it to
+  'joystick': the PID reports go into the report descriptor inside the collection of that joystick,
+  and the host uploads, starts and stops effects through output and feature reports. Construct it
+  right after the device, before the host enumerates it, and at most one per device.
+
+  Supported: constant force, square, sine, triangle and sawtooth up/down periodic effects, spring
+  and damper conditions, on the X and Y axes. Envelopes, ramps, custom forces, start delays and
+  trigger buttons are not supported and not declared, so the host does not offer them.
+
+  The effects live in a static pool of MAX_EFFECTS blocks, nothing is allocated. 'tick' evaluates all
+  the playing effects with integer arithmetic only and passes the summed force of each axis, in
+  -FORCE_MAX ... FORCE_MAX, to the output callback. 'start' calls it from a timer every millisecond.
+  Its cost is bounded by MAX_EFFECTS blocks of a few multiplications each, 'tickTimeMax' has the
+  longest tick seen.
+
+  Spring and damper effects need the stick position. It is read from the X and Y axes of the joystick
+  (the value of the last setter), so keep them updated. The damper uses the change of the position
+  between two ticks.
+
+  The USB interrupt writes the effect blocks and the timer reads them; both hold a critical section
+  while doing so, the timer for the whole evaluation, which is short.
+*/
+class JoystickForceFeedback {
+public:
+  static const uint8_t MAX_EFFECTS = 16;
+  static const uint8_t AXES = 2;                 // X and Y.
+  static const int16_t FORCE_MAX = 10000;        // Range of the magnitudes, coefficients and forces.
+
+  // Report IDs. Below the first joystick report ID so 'addJoystick' never collides with them.
+  enum {
+    REPORT_SET_EFFECT = 0x01,          // Output reports.
+    REPORT_SET_CONDITION = 0x02,
+    REPORT_SET_PERIODIC = 0x03,
+    REPORT_SET_CONSTANT_FORCE = 0x04,
+    REPORT_EFFECT_OPERATION = 0x05,
+    REPORT_BLOCK_FREE = 0x06,
+    REPORT_DEVICE_CONTROL = 0x07,
+    REPORT_DEVICE_GAIN = 0x08,
+    REPORT_CREATE_EFFECT = 0x09,       // Feature reports.
+    REPORT_BLOCK_LOAD = 0x0A,
+    REPORT_POOL = 0x0B
+  } ;
+  static const uint8_t REPORT_MAX_LENGTH = 11;   // Longest output or feature report, including the report ID.
+
+  // Effect types, in the order of the Effect Type usages of the descriptor.
+  enum {
+    EFFECT_NONE,
+    EFFECT_CONSTANT,
+    EFFECT_SQUARE,
+    EFFECT_SINE,
+    EFFECT_TRIANGLE,
+    EFFECT_SAWTOOTH_UP,
+    EFFECT_SAWTOOTH_DOWN,
+    EFFECT_SPRING,
+    EFFECT_DAMPER,
+    EFFECT_TYPE_COUNT
+  } ;
+
+  // PID collection, inserted at the end of the application collection of the joystick.
+  static const uint8_t DESCRIPTOR[];
+  static const uint16_t DESCRIPTOR_LENGTH = 528;
+
+  JoystickForceFeedback(JoystickCore &joystick);
+  ~JoystickForceFeedback(void);
+
+  JoystickForceFeedback(const JoystickForceFeedback &) = delete;
+  JoystickForceFeedback &operator=(const JoystickForceFeedback &) = delete;
+
+  /*
+    Receives the force of each axis, indexed 0 = X, 1 = Y, after every tick. Called from the timer
+    interrupt when started with 'start'. All zero while the actuators are disabled or the device is paused.
+  */
+  void onOutput(mbed::Callback<void(const int16_t *forces)> output) { this->_output = output; }
+
+  /*
+    Run 'tick' from a timer every 'tickInterval' microseconds, or stop it.
+  */
+  void start(uint32_t tickInterval = 1000);
+  void stop(void);
+
+  /*
+    Evaluate the effects at 'now' milliseconds and call the output. Called by the timer,
+    or directly when driven from a thread or on a host.
+  */
+  void tick(uint32_t now);
+
+  /*
+    Output or feature report written by the host. Called by the joystick from the USB interrupt.
+
+    @returns false if the report is not a PID report.
+  */
+  bool receiveReport(const uint8_t *report, uint8_t length);
+
+  /*
+    Answer a GET_REPORT for feature report 'reportId', 'report' has room for REPORT_MAX_LENGTH bytes.
+
+    @returns length of the report, 0 if it is not a PID feature report.
+  */
+  uint8_t writeFeatureReport(uint8_t reportId, uint8_t *report) const;
+
+  JoystickCore &joystick(void) const { return this->_joystick; }
+
+  /*
+    State of the engine: latest forces, effects playing, actuators enabled, longest tick in
+    'JoystickTelemetry::ticks'.
+  */
+  const int16_t *forces(void) const { return this->_forces; }
+  uint8_t playingEffects(void) const;
+  bool actuatorsEnabled(void) const { return this->_enabled && !this->_paused; }
+  uint32_t tickTimeMax(void) const { return this->_tickTimeMax; }
+
+
+private:
+  struct Condition {
+    int16_t offset;       // Center point.
+    int16_t positive;     // Coefficient above and below the center.
+    int16_t negative;
+    uint16_t deadBand;
+  } ;
+
+  struct Effect {
+    uint8_t type;         // EFFECT_*, EFFECT_NONE when the block is free.
+    bool playing;
+    uint8_t axes;         // Bit 0 X, bit 1 Y, bit 2 use 'direction'.
+    uint8_t direction;    // 0 ... 255 = 0 ... 360 degrees, 0 pushes to +Y.
+    uint8_t gain;
+    uint8_t loops;        // 0 plays until stopped.
+    uint16_t duration;    // Milliseconds, 0xFFFF plays until stopped.
+    uint32_t startTime;
+    int16_t magnitude;    // Constant force and periodic.
+    int16_t offset;       // Periodic.
+    uint8_t phase;        // Periodic, 0 ... 255 = 0 ... 360 degrees.
+    uint16_t period;      // Periodic, milliseconds.
+    Condition conditions[ AXES ];
+  } ;
+
+  JoystickCore &_joystick;
+  mbed::Callback<void(const int16_t *forces)> _output;
+  mbed::Ticker _ticker;
+
+  Effect _effects[ MAX_EFFECTS ];
+  uint8_t _deviceGain = 255;
+  bool _enabled = true;
+  bool _paused = false;
+  uint32_t _pauseTime = 0;
+  uint32_t _lastTick = 0;
+
+  uint8_t _lastBlock = 0;           // Answer to the last Create New Effect.
+  uint8_t _lastLoadStatus = 0;
+
+  int16_t _forces[ AXES ];
+  int16_t _lastPosition[ AXES ];
+  uint32_t _tickTimeMax = 0;
+
+  void tickNow(void);
+  Effect *block(uint8_t index);
+  void stopAll(void);
+  void reset(void);
+
+  /*
+    Force of one effect along its direction (constant and periodic) or on 'axis' (conditions).
+  */
+  int32_t periodicForce(const Effect &effect, uint32_t elapsed) const;
+  int32_t conditionForce(const Effect &effect, uint8_t axis, int32_t position, int32_t velocity) const;
+
+  /*
+    Position of axis 0 = X or 1 = Y of the joystick in -FORCE_MAX ... FORCE_MAX.
+  */
+  int32_t position(uint8_t axis) const;
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKFORCE_H
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKLAYOUT_H
+#define USBJOYSTICKLAYOUT_H
+
+#include "PluggableUSBHID.h"
+
+namespace arduino {
+
+// Axis numbers used to index the per-axis tables. Same order as the fields in 'USBJoystick::_axis_'.
+enum {
+  X_AXIS,
+  Y_AXIS,
+  Z_AXIS,
+  RX_AXIS,
+  RY_AXIS,
+  RZ_AXIS,
+  THROTTLE_AXIS,
+  RUDDER_AXIS,
+  AXIS_COUNT
+} ;
+
+// Axis selection bits for the 'AxisMask' parameter of 'USBJoystickLayout'.
+enum {
+  AXIS_X = 0x01 << X_AXIS,
+  AXIS_Y = 0x01 << Y_AXIS,
+  AXIS_Z = 0x01 << Z_AXIS,
+  AXIS_RX = 0x01 << RX_AXIS,
+  AXIS_RY = 0x01 << RY_AXIS,
+  AXIS_RZ = 0x01 << RZ_AXIS,
+  AXIS_THROTTLE = 0x01 << THROTTLE_AXIS,
+  AXIS_RUDDER = 0x01 << RUDDER_AXIS,
+
+  AXIS_XYZ_ROTATIONS = AXIS_X | AXIS_Y | AXIS_Z | AXIS_RX | AXIS_RY | AXIS_RZ,
+  AXIS_ALL = AXIS_XYZ_ROTATIONS | AXIS_THROTTLE | AXIS_RUDDER
+} ;
+
+
+/*
+  Description of one report layout: what the report contains, the report descriptor for it and
+  the function which serialises the joystick state into it. Instances are generated at compile
+  time by 'USBJoystickLayout' and live in flash.
+*/
+struct JoystickLayout {
+  uint16_t buttons;           // Number of buttons in the report, multiple of 8.
+  uint8_t axisMask;           // AXIS_X | AXIS_Y ...
+  uint8_t axisBits;           // Resolution and size of one axis field in the report.
+  int16_t axisMinimum;        // Logical minimum and maximum of the axis fields.
+  int16_t axisMaximum;
+  uint8_t reportId;           // First report ID, the reports use 'reportCount' consecutive IDs.
+  uint8_t reportCount;
+  uint16_t buttonsPerReport;  // Buttons in one button report, 0 when the buttons and axes share one report.
+  uint8_t reportLength;       // Bytes in the longest report including the report ID.
+  const uint8_t *descriptor;
+  uint16_t descriptorLength;
+
+  /*
+    Write report 'index' (0 ... reportCount-1) from 'buttons' (button array, 8 buttons per byte) and
+    'axes' (indexed with X_AXIS etc.). With split reports the button reports come first, then the axis report.
+
+    @returns length of the written report.
+  */
+  uint8_t (*writeReport)(uint8_t *report, uint8_t index, const uint8_t *buttons, const int16_t *axes);
+} ;
+
+
+/*
+  Storage for a generated report descriptor. Plain array wrapped in a struct so it can be
+  returned from a constexpr function.
+*/
+template<uint16_t LENGTH>
+struct JoystickDescriptorData {
+  uint8_t bytes[LENGTH];
+} ;
+
+
+/*
+  Constexpr generator of the joystick report descriptor. Called once with 'data' set to null
+  to get the length, then again to fill the array.
+*/
+template<uint16_t BUTTONS, uint8_t AXIS_MASK, uint8_t BITS, uint16_t BUTTONS_PER_REPORT>
+struct JoystickDescriptorBuilder {
+
+  static const uint8_t REPORT_ID = 0x10;
+
+  // Axis data will be constrained to this symmetric range when sending it over the USB,
+  // for example -2047...2047 with 12 bits. -2^(BITS-1) is left out so the range has a center.
+  // The limits are written as signed items of the shortest size that holds them. Linux reads
+  // LOGICAL_MINIMUM/MAXIMUM as signed, so e.g. 32767 must not be written as 0xFFFF and
+  // 255 not as a single 0xFF byte, or the host sees an inverted or empty range.
+  static constexpr int16_t AXIS_MAXIMUM = static_cast<int16_t>((static_cast<int32_t>(1) << (BITS - 1)) - 1);
+  static constexpr int16_t AXIS_MINIMUM = -AXIS_MAXIMUM;
+
+  static constexpr uint8_t countAxes(uint8_t mask) {
+    uint8_t count = 0;
+    for (; mask != 0; mask >>= 1) count += mask & 0x01;
+    return count;
+  }
+
+  static constexpr uint8_t GENERIC_DESKTOP_AXES = countAxes(AXIS_MASK & AXIS_XYZ_ROTATIONS);
+  static constexpr uint8_t SIMULATION_AXES = countAxes(AXIS_MASK & (AXIS_THROTTLE | AXIS_RUDDER));
+
+  // Axis fields are packed back to back without byte alignment, the last byte is padded.
+  static constexpr uint16_t AXIS_DATA_BITS = (GENERIC_DESKTOP_AXES + SIMULATION_AXES) * BITS;
+  static constexpr uint8_t AXIS_PADDING_BITS = (8 - AXIS_DATA_BITS % 8) % 8;
+
+  static constexpr uint8_t AXIS_BYTES = (AXIS_DATA_BITS + AXIS_PADDING_BITS) / 8;
+
+  // With split reports every group of BUTTONS_PER_REPORT buttons and the axes have a report of their own.
+  static constexpr bool SPLIT = BUTTONS_PER_REPORT > 0;
+  static constexpr uint8_t BUTTON_REPORTS = SPLIT ? (BUTTONS + BUTTONS_PER_REPORT - 1) / BUTTONS_PER_REPORT : 0;
+  static constexpr uint8_t AXIS_REPORTS = (SPLIT && AXIS_BYTES > 0) ? 1 : 0;
+  static constexpr uint8_t REPORT_COUNT = SPLIT ? BUTTON_REPORTS + AXIS_REPORTS : 1;
+
+  static constexpr uint8_t REPORT_LENGTH = !SPLIT ? 1 + BUTTONS / 8 + AXIS_BYTES
+                                         : (BUTTONS_PER_REPORT / 8 > AXIS_BYTES) ? 1 + BUTTONS_PER_REPORT / 8 : 1 + AXIS_BYTES;
+
+
+  struct Writer {
+    uint8_t *data;
+    uint16_t length;
+
+    constexpr void byte(uint8_t value) {
+      if (this->data != nullptr) this->data[this->length] = value;
+      this->length++;
+    }
+
+    // Short item with 1 or 2 bytes of data, whichever is enough for 'value'.
+    // The item macros take the data size in bytes in the two lowest bits.
+    constexpr void item(uint8_t prefix, int32_t value, bool isSigned) {
+      bool oneByte = isSigned ? (value >= -128 && value <= 127) : (value >= 0 && value <= 255);
+      if (oneByte) {
+        this->byte(prefix | 1);
+        this->byte(static_cast<uint8_t>(value));
+      }
+      else {
+        this->byte(prefix | 2);
+        this->byte(static_cast<uint8_t>(value));
+        this->byte(static_cast<uint8_t>(value >> 8));
+      }
+    }
+  } ;
+
+  // Buttons 'first' ... 'first' + 'count' - 1 as one field.
+  static constexpr void buttons(Writer &w, uint16_t first, uint16_t count) {
+    w.item(COLLECTION(0), 0x00, false);         // Collection Physical
+    w.item(USAGE_PAGE(0), 0x09, false);         // Button page.
+    w.item(USAGE_MINIMUM(0), first + 1, false); // Min allowed UsageID
+    w.item(USAGE_MAXIMUM(0), first + count, false);   // Max allowed UsageID
+    w.item(LOGICAL_MINIMUM(0), 0, true);        // Min value 0 = button not pressed.
+    w.item(LOGICAL_MAXIMUM(0), 1, true);        // Max value 1 = button pressed.
+    w.item(REPORT_COUNT(0), count, false);      // One report per button...
+    w.item(REPORT_SIZE(0), 1, false);           // ...of 1 bit of data per report.
+    w.item(INPUT(0), 0x02, false);              // Data, Variable, Absolute
+    w.byte(END_COLLECTION(0));
+  }
+
+  static constexpr uint16_t build(uint8_t *data) {
+    Writer w = { data, 0 };
+
+    w.item(USAGE_PAGE(0), 0x01, false);           // Generic Desktop
+    w.item(USAGE(0), 0x04, false);                // Joystick
+    w.item(COLLECTION(0), 0x01, false);           // Collection Application
+
+    if (!SPLIT) {
+      w.item(REPORT_ID(0), REPORT_ID, false);
+      if (BUTTONS > 0) buttons(w, 0, BUTTONS);
+    }
+    else {
+      for (uint8_t i = 0; i < BUTTON_REPORTS; i++) {
+        uint16_t first = i * BUTTONS_PER_REPORT;
+        w.item(REPORT_ID(0), REPORT_ID + i, false);
+        buttons(w, first, (BUTTONS - first < BUTTONS_PER_REPORT) ? BUTTONS - first : BUTTONS_PER_REPORT);
+      }
+      if (AXIS_REPORTS > 0) w.item(REPORT_ID(0), REPORT_ID + BUTTON_REPORTS, false);
+    }
+
+    if (GENERIC_DESKTOP_AXES + SIMULATION_AXES > 0) {
+      w.item(USAGE_PAGE(0), 0x01, false);         // Generic Desktop
+      w.item(USAGE(0), 0x01, false);              // Pointer
+      w.item(COLLECTION(0), 0x00, false);         // Collection Physical
+      w.item(LOGICAL_MINIMUM(0), AXIS_MINIMUM, true);
+      w.item(LOGICAL_MAXIMUM(0), AXIS_MAXIMUM, true);
+      w.item(REPORT_SIZE(0), BITS, false);
+
+      if (GENERIC_DESKTOP_AXES > 0) {
+        w.item(USAGE_PAGE(0), 0x01, false);       // Generic Desktop
+        for (uint8_t i = X_AXIS; i <= RZ_AXIS; i++) {
+          if (AXIS_MASK & (0x01 << i)) w.item(USAGE(0), 0x30 + i, false);  // X, Y, Z, Rx, Ry, Rz
+        }
+        w.item(REPORT_COUNT(0), GENERIC_DESKTOP_AXES, false);
+        w.item(INPUT(0), 0x02, false);            // Data, variable, absolute.
+      }
+
+      if (SIMULATION_AXES > 0) {
+        w.item(USAGE_PAGE(0), 0x02, false);       // Simulation Controls
+        if (AXIS_MASK & AXIS_THROTTLE) w.item(USAGE(0), 0xBB, false);  // Throttle
+        if (AXIS_MASK & AXIS_RUDDER) w.item(USAGE(0), 0xBA, false);    // Rudder
+        w.item(REPORT_COUNT(0), SIMULATION_AXES, false);
+        w.item(INPUT(0), 0x02, false);            // Data, variable, absolute.
+      }
+
+      if (AXIS_PADDING_BITS > 0) {
+        w.item(REPORT_SIZE(0), AXIS_PADDING_BITS, false);
+        w.item(REPORT_COUNT(0), 1, false);
+        w.item(INPUT(0), 0x03, false);            // Constant padding to the byte boundary.
+      }
+
+      w.byte(END_COLLECTION(0));                  // End collection Physical.
+    }
+
+    w.byte(END_COLLECTION(0));                    // End collection Application
+    return w.length;
+  }
+
+  static constexpr uint16_t DESCRIPTOR_LENGTH = build(nullptr);
+
+  static constexpr JoystickDescriptorData<DESCRIPTOR_LENGTH> generate(void) {
+    JoystickDescriptorData<DESCRIPTOR_LENGTH> descriptor = {};
+    build(descriptor.bytes);
+    return descriptor;
+  }
+} ;
+
+
+/*
+  Report layout selected at compile time.
+
+    BUTTONS     Number of buttons, multiple of 8, at most 256.
+    AXIS_MASK   Axes included in the report, for example AXIS_X | AXIS_Y | AXIS_THROTTLE.
+    BITS        Axis resolution: 8, 10, 12 or 16 bits. The logical range is -(2^(BITS-1)-1)...2^(BITS-1)-1
+                and the fields are packed, so six 10-bit axes take 8 bytes instead of 12.
+    BUTTONS_PER_REPORT
+                0 puts the buttons and axes in one report. Otherwise the buttons are sent in reports of
+                this many buttons (multiple of 8) and the axes in a report of their own, each with its
+                own report ID, and 'update' sends only the reports whose contents changed. The host sees
+                the same buttons and axes either way. Dirty tracking works on groups of 32 buttons, so
+                multiples of 32 are the most efficient.
+
+  The report descriptor, report length and the report writer are all generated by the compiler,
+  so a layout with 8 buttons and two 8-bit axes has a 4-byte report and no code for the rest.
+  Pass 'USBJoystickLayout<...>::layout' to the 'USBJoystick' constructor. The defaults are 
+  64 buttons and six 12-bit axes, the same range the original 16-bit fields carried.
+*/
+template<uint16_t BUTTONS = 64, uint8_t AXIS_MASK = AXIS_XYZ_ROTATIONS, uint8_t BITS = 12, uint16_t BUTTONS_PER_REPORT = 0>
+struct USBJoystickLayout {
+  typedef JoystickDescriptorBuilder<BUTTONS, AXIS_MASK, BITS, BUTTONS_PER_REPORT> Builder;
+
+  // Buttons amount must be byte-aligned because I don't want to deal with padding-data in the HID-report :)
+  static_assert( BUTTONS % 8 == 0, "BUTTONS does not align to byte-length" );
+  static_assert( BUTTONS <= 256, "At most 256 buttons are supported" );
+  static_assert( BITS == 8 || BITS == 10 || BITS == 12 || BITS == 16, "Axis fields must be 8, 10, 12 or 16 bits" );
+  static_assert( BUTTONS > 0 || AXIS_MASK != 0, "Layout without buttons and axes" );
+  static_assert( Builder::REPORT_LENGTH <= MAX_HID_REPORT_SIZE, "Report does not fit in HID_REPORT" );
+  static_assert( BUTTONS_PER_REPORT % 8 == 0, "BUTTONS_PER_REPORT does not align to byte-length" );
+
+  static constexpr JoystickDescriptorData<Builder::DESCRIPTOR_LENGTH> DESCRIPTOR = Builder::generate();
+
+  static uint8_t writeReport(uint8_t *report, uint8_t index, const uint8_t *buttons, const int16_t *axes) {
+    uint8_t length = 0;
+
+    if (Builder::SPLIT) {
+      report[length++] = Builder::REPORT_ID + index;
+      if (index < Builder::BUTTON_REPORTS) {
+        uint8_t first = index * BUTTONS_PER_REPORT / 8;
+        uint8_t last = (first + BUTTONS_PER_REPORT / 8 < BUTTONS / 8) ? first + BUTTONS_PER_REPORT / 8 : BUTTONS / 8;
+        for (uint8_t i = first; i < last; i++) {
+          report[length++] = buttons[i];
+        }
+        return length;
+      }
+      return writeAxes(report, length, axes);
+    }
+
+    report[length++] = Builder::REPORT_ID;
+    for (uint8_t i = 0; i < BUTTONS / 8; i++) {
+      report[length++] = buttons[i];
+    }
+    return writeAxes(report, length, axes);
+  }
+
+  static uint8_t writeAxes(uint8_t *report, uint8_t length, const int16_t *axes) {
+    // Axes in X_AXIS ... RUDDER_AXIS order, which is also the order of the usages in the descriptor.
+    // HID packs the fields little-endian from the lowest bit up.
+    uint32_t bits = 0;
+    uint8_t bitCount = 0;
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      if ((AXIS_MASK & (0x01 << i)) == 0) continue;
+
+      bits |= (static_cast<uint32_t>(axes[i]) & ((static_cast<uint32_t>(1) << BITS) - 1)) << bitCount;
+      bitCount += BITS;
+      while (bitCount >= 8) {
+        report[length++] = static_cast<uint8_t>(bits);
+        bits >>= 8;
+        bitCount -= 8;
+      }
+    }
+    if (bitCount > 0) report[length++] = static_cast<uint8_t>(bits);  // Padding bits are zero.
+
+    return length;
+  }
+
+  static const JoystickLayout layout;
+} ;
+
+template<uint16_t BUTTONS, uint8_t AXIS_MASK, uint8_t BITS, uint16_t BUTTONS_PER_REPORT>
+constexpr JoystickDescriptorData<JoystickDescriptorBuilder<BUTTONS, AXIS_MASK, BITS, BUTTONS_PER_REPORT>::DESCRIPTOR_LENGTH>
+  USBJoystickLayout<BUTTONS, AXIS_MASK, BITS, BUTTONS_PER_REPORT>::DESCRIPTOR;
+
+template<uint16_t BUTTONS, uint8_t AXIS_MASK, uint8_t BITS, uint16_t BUTTONS_PER_REPORT>
+const JoystickLayout USBJoystickLayout<BUTTONS, AXIS_MASK, BITS, BUTTONS_PER_REPORT>::layout = {
+  BUTTONS,
+  AXIS_MASK,
+  BITS,
+  Builder::AXIS_MINIMUM,
+  Builder::AXIS_MAXIMUM,
+  Builder::REPORT_ID,
+  Builder::REPORT_COUNT,
+  BUTTONS_PER_REPORT,
+  Builder::REPORT_LENGTH,
+  USBJoystickLayout<BUTTONS, AXIS_MASK, BITS, BUTTONS_PER_REPORT>::DESCRIPTOR.bytes,
+  Builder::DESCRIPTOR_LENGTH,
+  &USBJoystickLayout<BUTTONS, AXIS_MASK, BITS, BUTTONS_PER_REPORT>::writeReport
+};
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKLAYOUT_H
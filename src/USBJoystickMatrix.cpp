@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBJoystickMatrix.h"
+
+using namespace arduino;
+
+
+JoystickMatrixGPIO::JoystickMatrixGPIO(const uint8_t *rowPins, uint8_t rows, const uint8_t *columnPins, uint8_t columns):
+  _rowPins(rowPins),
+  _columnPins(columnPins),
+  _rows(rows),
+  _columns(columns)
+{
+  if (this->_rows > MAX_ROWS) this->_rows = MAX_ROWS;
+  if (this->_columns > MAX_COLUMNS) this->_columns = MAX_COLUMNS;
+}
+
+JoystickMatrixGPIO::~JoystickMatrixGPIO(void)
+{
+  for (uint8_t i=0; i < this->_rows; i++) delete this->_rowLines[i];
+  for (uint8_t i=0; i < this->_columns; i++) delete this->_columnLines[i];
+}
+
+void JoystickMatrixGPIO::begin(void)
+{
+  // The rows start as inputs with a low level latched, 'selectRow' only turns the driver on.
+  for (uint8_t i=0; i < this->_rows; i++) {
+    if (this->_rowLines[i] == nullptr) {
+      this->_rowLines[i] = new mbed::DigitalInOut(digitalPinToPinName(this->_rowPins[i]), PIN_INPUT, PullNone, 0);
+    }
+  }
+  for (uint8_t i=0; i < this->_columns; i++) {
+    if (this->_columnLines[i] == nullptr) {
+      this->_columnLines[i] = new mbed::DigitalIn(digitalPinToPinName(this->_columnPins[i]), PullUp);
+    }
+  }
+}
+
+void JoystickMatrixGPIO::selectRow(uint8_t row)
+{
+  // Output low only while selected, so two closed switches in one column never short a low row to a high one.
+  if (row < this->_rows && this->_rowLines[row] != nullptr) this->_rowLines[row]->output();
+}
+
+void JoystickMatrixGPIO::releaseRow(uint8_t row)
+{
+  if (row < this->_rows && this->_rowLines[row] != nullptr) this->_rowLines[row]->input();
+}
+
+uint32_t JoystickMatrixGPIO::readColumns(void)
+{
+  uint32_t columns = 0;
+  for (uint8_t i=0; i < this->_columns; i++) {
+    if (this->_columnLines[i] != nullptr && this->_columnLines[i]->read() == 0) columns |= static_cast<uint32_t>(1) << i;
+  }
+  return columns;
+}
+
+
+
+JoystickButtonMatrix::JoystickButtonMatrix(JoystickCore &joystick, JoystickMatrixPins &pins, uint8_t rows, uint8_t columns,
+                                           uint16_t firstButton):
+  _joystick(joystick),
+  _pins(pins),
+  _rows( (rows < MAX_ROWS) ? rows : MAX_ROWS ),
+  _columns( (columns < MAX_COLUMNS) ? columns : MAX_COLUMNS ),
+  _firstButton(firstButton)
+{
+  if (firstButton % 8 != 0) this->_rows = 0;   // Rejected, see 'valid'.
+  this->_columnMask = (this->_columns < 32) ? (static_cast<uint32_t>(1) << this->_columns) - 1 : 0xFFFFFFFF;
+
+  for (uint8_t i=0; i < MAX_ROWS; i++) {
+    this->_raw[i] = 0;
+    this->_counter0[i] = 0xFFFFFFFF;   // Counters idle at 3, four differing readings roll them over.
+    this->_counter1[i] = 0xFFFFFFFF;
+    this->_debounced[i] = 0;
+  }
+}
+
+JoystickButtonMatrix::~JoystickButtonMatrix(void)
+{
+  this->stop();
+}
+
+
+void JoystickButtonMatrix::start(uint32_t rowInterval)
+{
+  this->_ticker.attach( mbed::callback(this, &JoystickButtonMatrix::scanRow), std::chrono::microseconds(rowInterval) );
+}
+
+void JoystickButtonMatrix::stop(void)
+{
+  this->_ticker.detach();
+  if (this->_rowSelected) {
+    this->_pins.releaseRow(this->_currentRow);
+    this->_rowSelected = false;
+  }
+}
+
+
+void JoystickButtonMatrix::scanRow(void)
+{
+  if (this->_rows == 0) return;
+
+  if (this->_rowSelected) {
+    uint8_t row = this->_currentRow;
+    uint32_t reading = this->_pins.readColumns() & this->_columnMask;
+    this->_pins.releaseRow(row);
+    this->sampleRow(row, reading);
+
+    this->_currentRow = (row + 1 < this->_rows) ? row + 1 : 0;
+    if (this->_currentRow == 0) {
+      this->_passes++;
+      if (this->_changed) this->publish();
+      this->_changed = false;
+    }
+  }
+
+  // Selected now, read on the next tick.
+  this->_pins.selectRow(this->_currentRow);
+  this->_rowSelected = true;
+}
+
+void JoystickButtonMatrix::scan(void)
+{
+  for (uint8_t i=0; i < this->_rows; i++) {
+    this->scanRow();
+  }
+}
+
+
+void JoystickButtonMatrix::sampleRow(uint8_t row, uint32_t reading)
+{
+  this->_raw[row] = reading;
+
+  // With two or more switches closed in this row, any other row closing two of the same columns
+  // may be a ghost of the rectangle. Ignore the reading until it's unambiguous.
+  if (this->ghostDetection && __builtin_popcount(reading) >= 2) {
+    for (uint8_t i=0; i < this->_rows; i++) {
+      if (i != row && __builtin_popcount(reading & this->_raw[i]) >= 2) {
+        this->_ghostedRows++;
+        reading = this->_debounced[row];
+        break;
+      }
+    }
+  }
+
+  // Vertical counter: each column counts down while the reading differs from the debounced state
+  // and is reset when it agrees. The state toggles when the counter rolls over.
+  uint32_t delta = this->_debounced[row] ^ reading;
+  this->_counter0[row] = ~(this->_counter0[row] & delta);
+  this->_counter1[row] = this->_counter0[row] ^ (this->_counter1[row] & delta);
+  delta &= this->_counter0[row] & this->_counter1[row];
+
+  if (delta != 0) {
+    this->_debounced[row] ^= delta;
+    this->_changed = true;
+  }
+}
+
+
+void JoystickButtonMatrix::publish(void)
+{
+  uint8_t bytes[ MAX_ROWS * MAX_COLUMNS / 8 ];
+  uint16_t bits = this->_rows * this->_columns;
+  uint16_t count = (bits + 7) / 8;
+
+  for (uint8_t i=0; i < count; i++) bytes[i] = 0;
+
+  uint16_t bit = 0;
+  for (uint8_t row=0; row < this->_rows; row++) {
+    uint32_t state = this->_debounced[row];
+    for (uint8_t column=0; column < this->_columns; column++, bit++) {
+      if (state & (static_cast<uint32_t>(1) << column)) bytes[bit / 8] |= 0x01 << (bit % 8);
+    }
+  }
+
+  // Clipped to the button array like 'setButtonBytes' does; a clipped last byte is a whole byte.
+  uint16_t arrayBytes = sizeof(this->_joystick.buttonState);
+  uint16_t firstByte = this->_firstButton / 8;
+  if (firstByte >= arrayBytes) return;
+  uint8_t lastByteMask = (bits % 8 != 0) ? (0x01 << (bits % 8)) - 1 : 0xFF;
+  if (count > arrayBytes - firstByte) {
+    count = arrayBytes - firstByte;
+    lastByteMask = 0xFF;
+  }
+  this->_joystick.setButtonBytes(firstByte, bytes, count, lastByteMask);
+}
+
+
+bool JoystickButtonMatrix::pressed(uint8_t row, uint8_t column) const
+{
+  if (row >= this->_rows || column >= this->_columns) return false;
+  return (this->_debounced[row] >> column) & 0x01;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKMATRIX_H
+#define USBJOYSTICKMATRIX_H
+
+#include <stdint.h>
+#include "mbed.h"
+#include "USBJoystickCore.h"
+
+namespace arduino {
+
+/*
+  Hardware access of a switch matrix. Implement this for other wiring, or for a simulated matrix
+  when running the scanner on a host.
+*/
+class JoystickMatrixPins {
+public:
+  static const uint8_t MAX_ROWS = 16;
+  static const uint8_t MAX_COLUMNS = 32;
+
+  virtual ~JoystickMatrixPins(void) { }
+
+  /*
+    Drive row 'row' active / inactive. Called from the scanner timer interrupt.
+  */
+  virtual void selectRow(uint8_t row) = 0;
+  virtual void releaseRow(uint8_t row) = 0;
+
+  /*
+    Read the columns of the selected row, bit n set when the switch in column n is closed.
+  */
+  virtual uint32_t readColumns(void) = 0;
+} ;
+
+
+/*
+  Rows and columns on GPIO pins. The selected row is driven low and the others are left floating,
+  the columns have pull-ups, so a closed switch reads low.
+
+  The pins are 'mbed::DigitalInOut' and 'mbed::DigitalIn' lines made by 'begin', so the scanner
+  interrupt only switches the direction of a row and reads the column registers; 'pinMode' and
+  'digitalRead' look the pin up each time and are not meant for an interrupt.
+*/
+class JoystickMatrixGPIO : public JoystickMatrixPins {
+public:
+  JoystickMatrixGPIO(const uint8_t *rowPins, uint8_t rows, const uint8_t *columnPins, uint8_t columns);
+  virtual ~JoystickMatrixGPIO(void);
+
+  JoystickMatrixGPIO(const JoystickMatrixGPIO &) = delete;
+  JoystickMatrixGPIO &operator=(const JoystickMatrixGPIO &) = delete;
+
+  /*
+    Configure the pins, call from 'setup' before the scanner starts.
+  */
+  void begin(void);
+
+  virtual void selectRow(uint8_t row);
+  virtual void releaseRow(uint8_t row);
+  virtual uint32_t readColumns(void);
+
+private:
+  const uint8_t *_rowPins;
+  const uint8_t *_columnPins;
+  uint8_t _rows;
+  uint8_t _columns;
+
+  // Null until 'begin'.
+  mbed::DigitalInOut *_rowLines[ MAX_ROWS ] = { };
+  mbed::DigitalIn *_columnLines[ MAX_COLUMNS ] = { };
+} ;
+
+
+/*
+  Scans a switch matrix from a timer interrupt and writes the debounced switches to the buttons of a joystick.
+
+  One row is handled per timer tick: the columns of the row selected on the previous tick are read
+  and the next row is selected, so the lines have a whole tick to settle. After each full pass over the
+  matrix the changed bytes of the button array are written with 'setButtonBytes'. Switch (row, column)
+  is button 'firstButton' + row * columns + column.
+
+  Each switch is debounced with a two-bit vertical counter: a new state is accepted after it has been
+  read four passes in a row. The counters of a row are two 32-bit words, one bit per column.
+
+  Without diodes three closed switches at the corners of a rectangle make the fourth one read closed too.
+  With 'ghostDetection' a row that shares two or more closed columns with another row keeps its previous
+  state until the ambiguity is gone. Turn it off for matrices with diodes to allow any combination.
+*/
+class JoystickButtonMatrix {
+public:
+  static const uint8_t MAX_ROWS = JoystickMatrixPins::MAX_ROWS;
+  static const uint8_t MAX_COLUMNS = JoystickMatrixPins::MAX_COLUMNS;
+
+  bool ghostDetection = true;
+
+  /*
+    The buttons are written a byte at a time, so 'firstButton' must be a multiple of 8. Any other
+    'firstButton' is rejected: 'valid' returns false, and the matrix scans and writes nothing.
+    Buttons past the end of the joystick's button array are dropped.
+  */
+  JoystickButtonMatrix(JoystickCore &joystick, JoystickMatrixPins &pins, uint8_t rows, uint8_t columns,
+                       uint16_t firstButton = 0);
+  ~JoystickButtonMatrix(void);
+
+  /*
+    Start or stop the timer. A full pass over the matrix takes 'rows' * 'rowInterval' microseconds
+    and a change is accepted after four passes.
+  */
+  void start(uint32_t rowInterval = 250);
+  void stop(void);
+
+  /*
+    One timer tick: read the selected row and select the next one. Called by the timer,
+    or directly when the matrix is scanned from the loop or on a host.
+  */
+  void scanRow(void);
+
+  /*
+    A full pass over the matrix, 'rows' calls to 'scanRow'.
+  */
+  void scan(void);
+
+  /*
+    False if the constructor rejected 'firstButton'.
+  */
+  bool valid(void) const { return this->_rows > 0; }
+
+  /*
+    Debounced state of switch ('row', 'column').
+  */
+  bool pressed(uint8_t row, uint8_t column) const;
+
+  /*
+    Full passes done and rows whose reading was ignored because of possible ghosting.
+  */
+  uint32_t passes(void) const { return this->_passes; }
+  uint32_t ghostedRows(void) const { return this->_ghostedRows; }
+
+
+private:
+  JoystickCore &_joystick;
+  JoystickMatrixPins &_pins;
+  uint8_t _rows;
+  uint8_t _columns;
+  uint16_t _firstButton;
+  uint32_t _columnMask;
+
+  uint8_t _currentRow = 0;
+  bool _rowSelected = false;
+  bool _changed = true;          // Debounced state changed during the current pass.
+
+  uint32_t _raw[ MAX_ROWS ];     // Latest reading of each row, for the ghost detection.
+  uint32_t _counter0[ MAX_ROWS ];   // Vertical counters, low and high bit.
+  uint32_t _counter1[ MAX_ROWS ];
+  uint32_t _debounced[ MAX_ROWS ];
+
+  uint32_t _passes = 0;
+  uint32_t _ghostedRows = 0;
+
+  mbed::Ticker _ticker;
+
+  /*
+    Debounce the reading of one row.
+  */
+  void sampleRow(uint8_t row, uint32_t reading);
+
+  /*
+    Pack the debounced matrix into bytes and write them to the joystick.
+  */
+  void publish(void);
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKMATRIX_H
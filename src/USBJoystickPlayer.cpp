@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickPlayer.h"
+
+using namespace arduino;
+
+
+static_assert( JoystickRecord::AXES == AXIS_COUNT, "Recording format and joystick disagree on the axis count" );
+
+
+JoystickPlayer::JoystickPlayer(JoystickCore &joystick, const uint8_t *data, uint32_t length):
+  _joystick(joystick),
+  _reader(data, length)
+{
+  this->_reader.rewind(this->_frame);
+}
+
+
+bool JoystickPlayer::start(uint32_t now)
+{
+  this->_playing = false;
+  if (!this->_reader.valid()) return false;
+  if (this->_reader.buttonBytes() != this->_joystick.layout().buttons / 8) return false;
+
+  this->_reader.rewind(this->_frame);
+  this->_startTime = now;
+  this->_framesPlayed = 0;
+  this->_frameReady = this->_reader.next(this->_frame);
+  this->_playing = this->_frameReady;
+  return this->_playing;
+}
+
+
+bool JoystickPlayer::poll(uint32_t now)
+{
+  if (!this->_playing) return false;
+
+  uint32_t elapsed = now - this->_startTime;
+  while (this->_frameReady) {
+    if (this->speed != 0 && static_cast<uint64_t>(this->_frame.time) * 100 / this->speed > elapsed) break;
+
+    this->apply();
+    this->_frameReady = this->_reader.next(this->_frame);
+    if (this->speed == 0) break;
+  }
+
+  this->_playing = this->_frameReady;
+  return this->_playing;
+}
+
+
+void JoystickPlayer::apply(void)
+{
+  JoystickCore::Batch batch(this->_joystick);
+
+  uint32_t changed = this->_frame.changedButtons;
+  while (changed != 0) {
+    uint8_t index = __builtin_ctz(changed);
+    this->_joystick.setButtonBytes(index, &this->_frame.buttons[index], 1);
+    changed &= changed - 1;
+  }
+  if (this->_frame.axisMask != 0) this->_joystick.setAxesMapped(this->_frame.axes, this->_frame.axisMask);
+
+  this->_framesPlayed++;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKPLAYER_H
+#define USBJOYSTICKPLAYER_H
+
+#include <stdint.h>
+#include "USBJoystickCore.h"
+#include "USBJoystickRecord.h"
+
+namespace arduino {
+
+/*
+  Replays a recording made with 'JoystickRecorder' through the setters of a joystick. Each frame is
+  applied as one batch, so it goes out as one report update, with the button bytes written by
+  'setButtonBytes' and the axes by 'setAxesMapped' (the recorded values are already mapped).
+
+  Call 'poll' often, from the loop or a thread. It applies every frame whose time has come, so a late
+  call catches up without changing the order of the frames.
+*/
+class JoystickPlayer {
+public:
+  // Playback speed in percent of the original: 100 is real time, 200 twice as fast.
+  // 0 applies one frame per 'poll' call, as fast as the caller polls.
+  uint16_t speed = 100;
+
+  JoystickPlayer(JoystickCore &joystick, const uint8_t *data, uint32_t length);
+
+  /*
+    Start from the first frame at time 'now' (microseconds).
+
+    @returns false if the recording is invalid or has a different button count than the joystick.
+  */
+  bool start(uint32_t now = micros());
+
+  /*
+    Apply the frames that are due at 'now'.
+
+    @returns false when the recording has ended.
+  */
+  bool poll(uint32_t now = micros());
+
+  bool playing(void) const { return this->_playing; }
+  uint32_t framesPlayed(void) const { return this->_framesPlayed; }
+
+
+private:
+  JoystickCore &_joystick;
+  JoystickRecordReader _reader;
+  JoystickRecord::Frame _frame;
+
+  uint32_t _startTime = 0;
+  uint32_t _framesPlayed = 0;
+  bool _playing = false;
+  bool _frameReady = false;   // '_frame' holds a decoded frame not applied yet.
+
+  void apply(void);
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKPLAYER_H
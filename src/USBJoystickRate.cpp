@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickRate.h"
+
+using namespace arduino;
+
+
+void JoystickRateGovernor::activity(uint32_t now)
+{
+  uint32_t gap = now - this->_lastActivity;
+  if (this->_seen && gap <= GAP_LIMIT) {
+    // Only gaps inside a burst of activity count, the first change after an idle period does not.
+    int32_t difference = static_cast<int32_t>(gap * 16) - static_cast<int32_t>(this->_averageGap);
+    this->_averageGap = static_cast<uint32_t>( static_cast<int32_t>(this->_averageGap) + difference / 8 );
+  }
+  this->_lastActivity = now;
+  this->_seen = true;
+}
+
+
+uint32_t JoystickRateGovernor::hold(void) const
+{
+  uint32_t learned = this->_averageGap * 2 / 16;
+  return (learned > this->holdTime) ? learned : this->holdTime;
+}
+
+
+uint32_t JoystickRateGovernor::interval(uint32_t now) const
+{
+  if (!this->_seen) return this->idleInterval;
+
+  // No hold time: idle right after each change, as in 'active'.
+  uint32_t hold = this->hold();
+  if (hold == 0) return this->idleInterval;
+  uint32_t idle = now - this->_lastActivity;
+  if (idle < hold) return this->activeInterval;
+
+  // Double the interval for every hold time spent idle.
+  uint32_t doublings = idle / hold;
+  uint32_t interval = (this->activeInterval > 0) ? this->activeInterval : 1;
+  while (doublings-- > 0 && interval < this->idleInterval) {
+    interval *= 2;
+  }
+  return (interval < this->idleInterval) ? interval : this->idleInterval;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKRATE_H
+#define USBJOYSTICKRATE_H
+
+#include <stdint.h>
+
+namespace arduino {
+
+/*
+  Report cadence that follows the input activity. Attach to the first joystick of a device with
+  'JoystickCore::setRateGovernor'.
+
+  While the inputs change every change is sent as soon as possible, so the host sees up to one report
+  per 'bInterval'. Once they stop the reports continue as keep-alives every 'activeInterval' for the
+  hold time, after which the keep-alive interval doubles every hold time up to 'idleInterval'. The first
+  change after that is sent right away and the interval drops back to 'activeInterval'. The report pump
+  sleeps for the current interval, so an idle device wakes up rarely.
+
+  The hold time is learned from the input: it is at least 'holdTime' and at least twice the average gap
+  between changes, so slowly moving controls (a knob turned in steps) don't fall back to idle between steps.
+  All times are in milliseconds.
+*/
+class JoystickRateGovernor {
+public:
+  uint32_t activeInterval = 1;     // Report interval while active, normally the 'bInterval' of the endpoint.
+  uint32_t idleInterval = 1000;    // Longest keep-alive interval when nothing changes.
+  uint32_t holdTime = 50;          // Minimum time to stay at 'activeInterval' after a change, 0 for none.
+
+  /*
+    Called by the joystick with a report carrying a change at time 'now'.
+  */
+  void activity(uint32_t now);
+
+  /*
+    Report interval at time 'now' following the rules above.
+  */
+  uint32_t interval(uint32_t now) const;
+
+  /*
+    Current hold time, and the average gap between changes in 1/16 milliseconds.
+  */
+  uint32_t hold(void) const;
+  uint32_t averageGap(void) const { return this->_averageGap; }
+
+  /*
+    True when the input has changed within the hold time.
+  */
+  bool active(uint32_t now) const { return this->_seen && now - this->_lastActivity < this->hold(); }
+
+
+private:
+  static const uint32_t GAP_LIMIT = 1000;   // Gaps longer than this are idle periods, not activity.
+
+  uint32_t _lastActivity = 0;
+  uint32_t _averageGap = 0;    // Exponential moving average, weight 1/8, fixed point x16.
+  bool _seen = false;
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKRATE_H
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include "USBJoystickRecord.h"
+
+using namespace arduino;
+
+
+static const uint8_t MAGIC[] = { 'J', 'R', 'e', 'c' };
+
+
+static uint8_t writeVarint(uint8_t *out, uint32_t value)
+{
+  uint8_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  out[length++] = static_cast<uint8_t>(value);
+  return length;
+}
+
+static bool readVarint(const uint8_t *data, uint32_t length, uint32_t &position, uint32_t &value)
+{
+  value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (position >= length) return false;
+    uint8_t byte = data[position++];
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+static inline uint32_t zigzag(int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+static inline int32_t unzigzag(uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 0x01); }
+
+
+
+JoystickRecorder::JoystickRecorder(uint8_t *buffer, uint32_t size):
+  _buffer(buffer),
+  _size(size)
+{
+
+}
+
+
+void JoystickRecorder::start(uint8_t buttonBytes)
+{
+  if (buttonBytes > JoystickRecord::BUTTON_BYTES) buttonBytes = JoystickRecord::BUTTON_BYTES;
+
+  this->_buttonBytes = buttonBytes;
+  this->_frames = 0;
+  this->_overflows = 0;
+  this->_length = 0;
+  this->_started = false;
+  this->_full = (this->_size < JoystickRecord::HEADER_LENGTH);
+  memset(this->_buttons, 0, sizeof(this->_buttons));
+  memset(this->_axes, 0, sizeof(this->_axes));
+  if (this->_full) return;
+
+  memcpy(this->_buffer, MAGIC, sizeof(MAGIC));
+  this->_buffer[4] = JoystickRecord::VERSION;
+  this->_buffer[5] = buttonBytes;
+  this->_buffer[6] = JoystickRecord::AXES;
+  this->_buffer[7] = 0;
+  this->_length = JoystickRecord::HEADER_LENGTH;
+}
+
+
+bool JoystickRecorder::record(uint32_t time, const uint8_t *buttons, const int16_t *axes)
+{
+  if (this->_length == 0 || this->_full) {
+    if (this->_full) this->_overflows++;
+    return false;
+  }
+
+  // Encode into a scratch frame first, the buffer only takes whole frames.
+  uint8_t frame[ JoystickRecord::FRAME_MAX_LENGTH ];
+  uint8_t length = writeVarint(frame, this->_started ? time - this->_lastTime : 0);
+
+  uint8_t axisMask = 0;
+  for (uint8_t i=0; i < JoystickRecord::AXES; i++) {
+    if (axes[i] != this->_axes[i]) axisMask |= 0x01 << i;
+  }
+  frame[length++] = axisMask;
+
+  uint8_t countIndex = length++;
+  uint8_t changedBytes = 0;
+  for (uint8_t i=0; i < this->_buttonBytes; i++) {
+    uint8_t changed = buttons[i] ^ this->_buttons[i];
+    if (changed == 0) continue;
+    frame[length++] = i;
+    frame[length++] = changed;
+    changedBytes++;
+  }
+  frame[countIndex] = changedBytes;
+
+  for (uint8_t i=0; i < JoystickRecord::AXES; i++) {
+    if (axisMask & (0x01 << i)) {
+      length += writeVarint(frame + length, zigzag( static_cast<int32_t>(axes[i]) - this->_axes[i] ));
+    }
+  }
+
+  if (this->_length + length > this->_size) {
+    this->_full = true;
+    this->_overflows++;
+    return false;
+  }
+
+  memcpy(this->_buffer + this->_length, frame, length);
+  this->_length += length;
+  memcpy(this->_buttons, buttons, this->_buttonBytes);
+  memcpy(this->_axes, axes, sizeof(this->_axes));
+  this->_lastTime = time;
+  this->_started = true;
+  this->_frames++;
+  return true;
+}
+
+
+
+JoystickRecordReader::JoystickRecordReader(const uint8_t *data, uint32_t length):
+  _data(data),
+  _length(length),
+  _position(JoystickRecord::HEADER_LENGTH)
+{
+  if (length < JoystickRecord::HEADER_LENGTH || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) return;
+  if (data[4] != JoystickRecord::VERSION || data[5] > JoystickRecord::BUTTON_BYTES || data[6] != JoystickRecord::AXES) return;
+
+  this->_buttonBytes = data[5];
+  this->_valid = true;
+}
+
+
+void JoystickRecordReader::rewind(JoystickRecord::Frame &frame)
+{
+  this->_position = JoystickRecord::HEADER_LENGTH;
+  memset(&frame, 0, sizeof(frame));
+}
+
+
+bool JoystickRecordReader::next(JoystickRecord::Frame &frame)
+{
+  if (!this->_valid) return false;
+
+  uint32_t position = this->_position;
+  uint32_t delta;
+  if (!readVarint(this->_data, this->_length, position, delta)) return false;
+  if (position + 2 > this->_length) return false;
+
+  uint8_t axisMask = this->_data[position++];
+  uint8_t changedBytes = this->_data[position++];
+  if (position + 2 * changedBytes > this->_length) return false;
+
+  // Validate the whole frame before touching 'frame', a truncated frame leaves it as it was.
+  uint32_t buttonsPosition = position;
+  for (uint8_t i=0; i < changedBytes; i++) {
+    if (this->_data[position] >= this->_buttonBytes) return false;
+    position += 2;
+  }
+  int32_t differences[ JoystickRecord::AXES ];
+  for (uint8_t i=0; i < JoystickRecord::AXES; i++) {
+    if ((axisMask & (0x01 << i)) == 0) continue;
+    uint32_t value;
+    if (!readVarint(this->_data, this->_length, position, value)) return false;
+    differences[i] = unzigzag(value);
+  }
+
+  frame.delta = delta;
+  frame.time += delta;
+  frame.axisMask = axisMask;
+  frame.changedButtons = 0;
+  for (uint8_t i=0; i < changedBytes; i++) {
+    uint8_t index = this->_data[buttonsPosition + 2 * i];
+    frame.buttons[index] ^= this->_data[buttonsPosition + 2 * i + 1];
+    frame.changedButtons |= static_cast<uint32_t>(1) << index;
+  }
+  for (uint8_t i=0; i < JoystickRecord::AXES; i++) {
+    if (axisMask & (0x01 << i)) frame.axes[i] = static_cast<int16_t>(frame.axes[i] + differences[i]);
+  }
+
+  this->_position = position;
+  return true;
+}
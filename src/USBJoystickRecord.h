@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKRECORD_H
+#define USBJOYSTICKRECORD_H
+
+#include <stdint.h>
+
+namespace arduino {
+
+/*
+  Compact recording of the reports a joystick sent. The format only depends on this header and
+  USBJoystickRecord.cpp, so a host-side program can include them to read recordings.
+
+  Every frame holds the changes against the previous frame, the first one against an all-zero state.
+  Multi-byte header fields are little-endian.
+
+    Header, HEADER_LENGTH bytes:
+      0   4  magic "JRec"
+      4   1  format version, 'VERSION'
+      5   1  button bytes in a frame state (buttons / 8)
+      6   1  axis count, 'AXES', in X, Y, Z, Rx, Ry, Rz, throttle, rudder order
+      7   1  reserved, 0
+
+    Frame:
+      varint  microseconds since the previous frame (since the start of the recording for the first one)
+      1       axis mask, bit n set when axis n changed
+      1       number of changed button bytes, n
+      n x 2   button byte index, XOR of the old and the new value
+      varint  zigzag-encoded difference of each changed axis, lowest axis number first
+
+  Varints are 7 bits per byte, least significant group first, high bit set on all but the last byte.
+  A frame where nothing changed is 3 bytes.
+*/
+struct JoystickRecord {
+  static const uint8_t VERSION = 1;
+  static const uint8_t HEADER_LENGTH = 8;
+  static const uint8_t AXES = 8;
+  static const uint8_t BUTTON_BYTES = 32;
+  static const uint8_t FRAME_MAX_LENGTH = 5 + 2 + 2 * BUTTON_BYTES + 3 * AXES;
+
+  /*
+    State after a frame. 'changedButtons' has bit n set when button byte n changed in this frame.
+  */
+  struct Frame {
+    uint32_t time;            // Microseconds since the start of the recording.
+    uint32_t delta;           // Microseconds since the previous frame.
+    uint8_t axisMask;
+    uint32_t changedButtons;
+    uint8_t buttons[ BUTTON_BYTES ];
+    int16_t axes[ AXES ];
+  } ;
+} ;
+
+
+/*
+  Appends frames to a caller-owned buffer, attach with 'JoystickCore::setRecorder'. The joystick
+  records every report it sent successfully, keep-alives included, after the send, so recording adds
+  a few comparisons and a memcpy to 'update' and nothing to the setters.
+
+  The buffer is filled from the start and never wraps: a frame that does not fit stops the recording,
+  so the buffer always holds a readable recording of the first frames. 'overflows' counts the frames
+  lost after that. Copy 'data' to flash or send it to the host to keep it.
+*/
+class JoystickRecorder {
+public:
+  JoystickRecorder(uint8_t *buffer, uint32_t size);
+
+  /*
+    Start a new recording for a joystick with 'buttonBytes' bytes of buttons.
+  */
+  void start(uint8_t buttonBytes);
+
+  /*
+    Record the state 'buttons' and 'axes' sent at 'time' microseconds (any free-running clock).
+    Called by the joystick with its send mutex held.
+
+    @returns false if the frame did not fit or no recording has been started.
+  */
+  bool record(uint32_t time, const uint8_t *buttons, const int16_t *axes);
+
+  const uint8_t *data(void) const { return this->_buffer; }
+  uint32_t length(void) const { return this->_length; }
+  uint32_t frames(void) const { return this->_frames; }
+  uint32_t overflows(void) const { return this->_overflows; }
+  bool full(void) const { return this->_full; }
+
+
+private:
+  uint8_t *_buffer;
+  uint32_t _size;
+  uint32_t _length = 0;
+  uint32_t _frames = 0;
+  uint32_t _overflows = 0;
+  uint32_t _lastTime = 0;
+  uint8_t _buttonBytes = 0;
+  bool _started = false;
+  bool _full = false;
+
+  uint8_t _buttons[ JoystickRecord::BUTTON_BYTES ];
+  int16_t _axes[ JoystickRecord::AXES ];
+} ;
+
+
+/*
+  Decodes a recording frame by frame.
+*/
+class JoystickRecordReader {
+public:
+  JoystickRecordReader(const uint8_t *data, uint32_t length);
+
+  /*
+    True if the header is valid.
+  */
+  bool valid(void) const { return this->_valid; }
+  uint8_t buttonBytes(void) const { return this->_buttonBytes; }
+
+  /*
+    Decode the next frame into 'frame', which must hold the previous frame (as left by the previous
+    call or by 'rewind').
+
+    @returns false at the end of the recording or if the frame is truncated.
+  */
+  bool next(JoystickRecord::Frame &frame);
+
+  /*
+    Go back to the first frame and clear 'frame' to the initial state.
+  */
+  void rewind(JoystickRecord::Frame &frame);
+
+
+private:
+  const uint8_t *_data;
+  uint32_t _length;
+  uint32_t _position;
+  uint8_t _buttonBytes = 0;
+  bool _valid = false;
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKRECORD_H
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickSequencer.h"
+#include "mbed_critical.h"
+
+using namespace arduino;
+
+
+JoystickSequencer::JoystickSequencer(JoystickCore &joystick):
+  _joystick(joystick)
+{
+  for (uint8_t i=0; i < MAX_SEQUENCES; i++) {
+    this->_slots[i].generation = 0;
+    this->_free[i] = MAX_SEQUENCES - 1 - i;
+  }
+}
+
+JoystickSequencer::~JoystickSequencer(void)
+{
+  this->stop();
+}
+
+
+uint16_t JoystickSequencer::play(const JoystickStep *steps, uint8_t count, uint16_t repeat, uint8_t bank)
+{
+  if (steps == nullptr || count == 0 || bank >= 4) return NONE;
+
+  uint64_t owned = 0;
+  for (uint8_t i=0; i < count; i++) owned |= steps[i].buttons;
+
+  core_util_critical_section_enter();
+  bool overlaps = false;
+  for (uint8_t i=0; i < this->_activeCount; i++) {
+    // A cancelled sequence releases its buttons before the others of the same tick set theirs.
+    const Slot &other = this->_slots[ this->_active[i] ];
+    if (other.bank == bank && !other.cancelled && (other.owned & owned) != 0) overlaps = true;
+  }
+  if (this->_freeCount == 0 || overlaps) {
+    core_util_critical_section_exit();
+    return NONE;
+  }
+  uint8_t slotNumber = this->_free[ --this->_freeCount ];
+  Slot &slot = this->_slots[slotNumber];
+  slot.steps = steps;
+  slot.owned = owned;
+  slot.remaining = 0;
+  slot.repeat = repeat;
+  slot.count = count;
+  slot.step = STARTING;
+  slot.bank = bank;
+  slot.cancelled = false;
+  slot.position = this->_activeCount;
+  this->_active[ this->_activeCount ] = slotNumber;
+  core_util_atomic_store_u8(&this->_activeCount, this->_activeCount + 1);
+  uint16_t handle = (slot.generation << 8) | slotNumber;
+  core_util_critical_section_exit();
+  return handle;
+}
+
+uint16_t JoystickSequencer::autofire(uint8_t buttonNumber, uint16_t onTicks, uint16_t offTicks)
+{
+  // The steps live in the slot. The slot is taken first, so fill them before the first tick can read them.
+  core_util_critical_section_enter();
+  uint16_t handle = NONE;
+  if (this->_freeCount > 0) {
+    Slot &slot = this->_slots[ this->_free[ this->_freeCount - 1 ] ];
+    uint64_t button = static_cast<uint64_t>(1) << (buttonNumber % 64);
+    slot.autofire[0] = { button, JoystickStep::NO_AXIS, 0, onTicks };
+    slot.autofire[1] = { 0, JoystickStep::NO_AXIS, 0, offTicks };
+    handle = this->play(slot.autofire, 2, 0, buttonNumber / 64);
+  }
+  core_util_critical_section_exit();
+  return handle;
+}
+
+
+uint8_t JoystickSequencer::find(uint16_t handle) const
+{
+  uint8_t slotNumber = handle & 0xFF;
+  if (slotNumber >= MAX_SEQUENCES) return MAX_SEQUENCES;
+
+  const Slot &slot = this->_slots[slotNumber];
+  if (slot.generation != (handle >> 8)) return MAX_SEQUENCES;
+  if (slot.position >= this->_activeCount || this->_active[slot.position] != slotNumber) return MAX_SEQUENCES;
+  return slotNumber;
+}
+
+void JoystickSequencer::cancel(uint16_t handle)
+{
+  core_util_critical_section_enter();
+  uint8_t slotNumber = this->find(handle);
+  if (slotNumber < MAX_SEQUENCES) this->_slots[slotNumber].cancelled = true;
+  core_util_critical_section_exit();
+}
+
+void JoystickSequencer::cancelAll(void)
+{
+  core_util_critical_section_enter();
+  for (uint8_t i=0; i < this->_activeCount; i++) this->_slots[ this->_active[i] ].cancelled = true;
+  core_util_critical_section_exit();
+}
+
+bool JoystickSequencer::playing(uint16_t handle) const
+{
+  core_util_critical_section_enter();
+  uint8_t slotNumber = this->find(handle);
+  bool result = (slotNumber < MAX_SEQUENCES) && !this->_slots[slotNumber].cancelled;
+  core_util_critical_section_exit();
+  return result;
+}
+
+void JoystickSequencer::remove(uint8_t slotNumber)
+{
+  // Swap the last active slot into the hole, the order of the sequences does not matter.
+  Slot &slot = this->_slots[slotNumber];
+  uint8_t last = this->_active[ this->_activeCount - 1 ];
+  this->_active[slot.position] = last;
+  this->_slots[last].position = slot.position;
+  core_util_atomic_store_u8(&this->_activeCount, this->_activeCount - 1);
+
+  slot.generation++;
+  this->_free[ this->_freeCount++ ] = slotNumber;
+}
+
+
+void JoystickSequencer::start(uint32_t tickInterval)
+{
+  this->_ticker.attach( mbed::callback(this, &JoystickSequencer::tick), std::chrono::microseconds(tickInterval) );
+}
+
+void JoystickSequencer::stop(void)
+{
+  this->_ticker.detach();
+}
+
+void JoystickSequencer::poll(uint32_t now)
+{
+  if (!this->_polling) {
+    this->_polling = true;
+    this->_lastPoll = now;
+  }
+
+  // All the ticks due go out as one report.
+  bool batch = false;
+  while (now - this->_lastPoll >= 1) {
+    this->_lastPoll++;
+    this->advance(batch);
+  }
+  if (batch) this->_joystick.commitBatch();
+}
+
+
+void JoystickSequencer::tick(void)
+{
+  bool batch = false;
+  this->advance(batch);
+  if (batch) this->_joystick.commitBatch();
+}
+
+void JoystickSequencer::advance(bool &batch)
+{
+  // Step changes are collected with the slots locked and applied after, the setters may send. Every
+  // slot gives at most one action: the releases of the sequences that end fill 'actions' from the
+  // start and are applied first, the steps fill it from the end.
+  Action actions[ MAX_SEQUENCES ];
+  uint8_t releaseCount = 0;
+  uint8_t stepStart = MAX_SEQUENCES;
+
+  core_util_critical_section_enter();
+  for (uint8_t i=0; i < this->_activeCount; ) {
+    uint8_t slotNumber = this->_active[i];
+    Slot &slot = this->_slots[slotNumber];
+
+    if (slot.cancelled) {
+      actions[ releaseCount++ ] = { slot.owned, 0, slot.bank, JoystickStep::NO_AXIS, 0 };
+      this->remove(slotNumber);   // Moves the last one to 'i'.
+      continue;
+    }
+
+    if (slot.step != STARTING && --slot.remaining > 0) {
+      i++;
+      continue;
+    }
+
+    if (slot.step == STARTING) {
+      slot.step = 0;
+    }
+    else if (++slot.step == slot.count) {
+      slot.step = 0;
+      if (slot.repeat > 0 && --slot.repeat == 0) {
+        actions[ releaseCount++ ] = { slot.owned, 0, slot.bank, JoystickStep::NO_AXIS, 0 };
+        this->remove(slotNumber);
+        continue;
+      }
+    }
+
+    const JoystickStep &step = slot.steps[slot.step];
+    actions[ --stepStart ] = { slot.owned, step.buttons, slot.bank, step.axis, step.value };
+    slot.remaining = (step.duration > 0) ? step.duration : 1;
+    i++;
+  }
+  core_util_critical_section_exit();
+
+  if (releaseCount == 0 && stepStart == MAX_SEQUENCES) return;
+
+  // From an ISR the setters don't send anyway and a batch can't be committed.
+  if (!batch && !core_util_is_isr_active()) {
+    this->_joystick.beginBatch();
+    batch = true;
+  }
+  for (uint8_t i=0; i < releaseCount; i++) this->apply(actions[i]);
+  for (uint8_t i=stepStart; i < MAX_SEQUENCES; i++) this->apply(actions[i]);
+}
+
+void JoystickSequencer::apply(const Action &action)
+{
+  if (action.mask != 0) this->_joystick.setButtonsMasked(action.mask, action.values, action.bank);
+  if (action.axis < AXIS_COUNT) this->_joystick.setAxisRaw(action.axis, action.value);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKSEQUENCER_H
+#define USBJOYSTICKSEQUENCER_H
+
+#include <stdint.h>
+#include "mbed.h"
+#include "USBJoystickCore.h"
+
+namespace arduino {
+
+/*
+  One step of a sequence. The buttons of the sequence that are set in 'buttons' are held for 'duration'
+  ticks, the others are released. 'axis' (X_AXIS etc.) is set to raw value 'value' when the step starts,
+  NO_AXIS leaves the axes alone.
+*/
+struct JoystickStep {
+  static const uint8_t NO_AXIS = 0xFF;
+
+  uint64_t buttons;     // Bit n is button 'bank' * 64 + n, see 'JoystickSequencer::play'.
+  uint8_t axis;
+  int16_t value;
+  uint16_t duration;    // Ticks, at least 1.
+} ;
+
+
+/*
+  Plays button and axis sequences on a joystick from a timer, for autofire and macros, so the timing
+  does not depend on the loop and no thread sleeps. A sequence is a table of steps, usually 'const':
+
+    const JoystickStep combo[] = {
+      { 0x01, JoystickStep::NO_AXIS, 0, 30 },   // Button 0 for 30 ms,
+      { 0x03, JoystickStep::NO_AXIS, 0, 30 },   // buttons 0 and 1,
+      { 0x00, X_AXIS, 511, 50 },                // nothing pressed, X to the right.
+    };
+    sequencer.play(combo, 3);
+
+  Up to MAX_SEQUENCES play at the same time from a static pool. Each tick visits only the playing
+  sequences, and only those whose step ends do any work. A sequence owns the buttons used by any of its
+  steps and releases them when it ends. No two playing sequences own the same button: 'play' refuses
+  one that would, until the other one has ended or been cancelled.
+
+  'start' runs the ticks from a timer, a tick is then 'tickInterval' microseconds. From the timer
+  interrupt the setters do not send; run the report pump ('USBJoystick::startPump') or call 'update'.
+  Without the timer call 'poll' from the loop or a thread: it runs one tick per elapsed millisecond and
+  sends all the changes of the ticks it ran as one report, so steps that began and ended between two
+  polls never reach the host.
+*/
+class JoystickSequencer {
+public:
+  static const uint8_t MAX_SEQUENCES = 16;
+  static const uint16_t NONE = 0xFFFF;   // Not a sequence handle.
+
+  JoystickSequencer(JoystickCore &joystick);
+  ~JoystickSequencer(void);
+
+  JoystickSequencer(const JoystickSequencer &) = delete;
+  JoystickSequencer &operator=(const JoystickSequencer &) = delete;
+
+  /*
+    Play 'count' steps from 'steps', 'repeat' times (0 until cancelled). The buttons are in bank
+    'bank' (0-3), as in 'setButtonsMasked'. 'steps' must stay valid while the sequence plays.
+    It starts on the next tick.
+
+    @returns handle for 'cancel' and 'playing', NONE if all the sequences are in use or a playing
+             sequence uses any of the buttons.
+  */
+  uint16_t play(const JoystickStep *steps, uint8_t count, uint16_t repeat = 1, uint8_t bank = 0);
+
+  /*
+    Autofire: press 'buttonNumber' for 'onTicks' and release it for 'offTicks' until cancelled.
+  */
+  uint16_t autofire(uint8_t buttonNumber, uint16_t onTicks, uint16_t offTicks);
+
+  /*
+    Stop a sequence and release its buttons on the next tick.
+  */
+  void cancel(uint16_t handle);
+  void cancelAll(void);
+
+  bool playing(uint16_t handle) const;
+  uint8_t playingCount(void) const { return core_util_atomic_load_u8(&this->_activeCount); }
+
+  /*
+    Start or stop the timer.
+  */
+  void start(uint32_t tickInterval = 1000);
+  void stop(void);
+
+  /*
+    Advance the playing sequences by one tick. Called by the timer, or directly.
+  */
+  void tick(void);
+
+  /*
+    Run the ticks due at 'now' in milliseconds, for use without the timer.
+  */
+  void poll(uint32_t now = millis());
+
+
+private:
+  struct Slot {
+    const JoystickStep *steps;
+    uint64_t owned;           // Buttons used by any of the steps.
+    uint16_t remaining;       // Ticks left of the current step.
+    uint16_t repeat;          // Rounds left, 0 forever.
+    uint8_t count;
+    uint8_t step;             // Current step, STARTING before the first tick.
+    uint8_t bank;
+    uint8_t generation;       // High byte of the handle, changes every time the slot is reused.
+    uint8_t position;         // Index in '_active'.
+    bool cancelled;
+    JoystickStep autofire[2];
+  } ;
+
+  // Setter calls collected by a tick, applied after it.
+  struct Action {
+    uint64_t mask;
+    uint64_t values;
+    uint8_t bank;
+    uint8_t axis;
+    int16_t value;
+  } ;
+
+  static const uint8_t STARTING = 0xFF;
+
+  JoystickCore &_joystick;
+
+  Slot _slots[ MAX_SEQUENCES ];
+  uint8_t _active[ MAX_SEQUENCES ];   // Slots playing, in '_active[0 ... _activeCount-1]'.
+  volatile uint8_t _activeCount = 0;
+  uint8_t _free[ MAX_SEQUENCES ];     // Stack of free slots.
+  uint8_t _freeCount = MAX_SEQUENCES;
+
+  uint32_t _lastPoll = 0;
+  bool _polling = false;
+  mbed::Ticker _ticker;
+
+  /*
+    Slot of a playing sequence, MAX_SEQUENCES if 'handle' is not playing.
+  */
+  uint8_t find(uint16_t handle) const;
+  void remove(uint8_t slotNumber);
+
+  /*
+    One tick. The setters run in a batch opened on the first change unless in an ISR, 'batch' tells
+    if it is open.
+  */
+  void advance(bool &batch);
+  void apply(const Action &action);
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKSEQUENCER_H
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBJoystickTelemetry.h"
+
+using namespace arduino;
+
+
+const uint8_t JoystickTelemetry::DESCRIPTOR[] = {
+  USAGE_PAGE(2), 0x00, 0xFF,        // Vendor defined
+  USAGE(1), 0x01,
+  COLLECTION(1), 0x01,              // Application
+    REPORT_ID(1), REPORT_ID,
+    USAGE(1), 0x01,
+    LOGICAL_MINIMUM(1), 0x00,
+    LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+    REPORT_SIZE(1), 0x08,
+    REPORT_COUNT(1), REPORT_LENGTH - 1,
+    FEATURE(1), 0x02,               // Data, Variable, Absolute
+  END_COLLECTION(0)
+};
+
+static_assert( sizeof(JoystickTelemetry::DESCRIPTOR) == JoystickTelemetry::DESCRIPTOR_LENGTH, "DESCRIPTOR_LENGTH does not match DESCRIPTOR" );
+
+
+static void writeU16(uint8_t *report, uint32_t value)
+{
+  if (value > 0xFFFF) value = 0xFFFF;
+  report[0] = value;
+  report[1] = value >> 8;
+}
+
+static void writeU32(uint8_t *report, uint32_t value)
+{
+  report[0] = value;
+  report[1] = value >> 8;
+  report[2] = value >> 16;
+  report[3] = value >> 24;
+}
+
+
+JoystickTelemetry::JoystickTelemetry(void)
+{
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  // Start the cycle counter, harmless if it is already running.
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+  uint32_t perMicrosecond = ticksPerSecond() / 1000000;
+  this->_ticksPerMicrosecond = (perMicrosecond > 0) ? perMicrosecond : 1;
+  this->reset();
+}
+
+uint32_t JoystickTelemetry::ticksPerSecond(void)
+{
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  return SystemCoreClock;
+#else
+  return 1000000;
+#endif
+}
+
+void JoystickTelemetry::reset(void)
+{
+  this->_reportsSent = 0;
+  this->_reportsFailed = 0;
+  this->_reportsDropped = 0;
+  core_util_atomic_store_u32(&this->_updatesSkipped, 0);
+
+  this->_updateCount = 0;
+  this->_latencyMin = UINT32_MAX;
+  this->_latencyMax = 0;
+  this->_latencyTotal = 0;
+  this->_mutexWaitTotal = 0;
+  this->_mutexWaitMax = 0;
+  for (uint8_t i=0; i < HISTOGRAM_BUCKETS; i++) this->_histogram[i] = 0;
+
+  this->_rateWindowStart = millis();
+  this->_rateWindowSent = 0;
+  this->_reportRate = 0;
+}
+
+
+void JoystickTelemetry::recordSend(bool success, bool blocking)
+{
+  if (success) this->_reportsSent++;
+  else if (blocking) this->_reportsFailed++;
+  else this->_reportsDropped++;
+}
+
+void JoystickTelemetry::recordUpdate(uint32_t start, uint32_t locked, uint32_t end)
+{
+  // Unsigned differences are correct across the counter wrap-around.
+  uint32_t latency = end - start;
+  uint32_t wait = locked - start;
+
+  this->_updateCount++;
+  this->_latencyTotal += latency;
+  if (latency < this->_latencyMin) this->_latencyMin = latency;
+  if (latency > this->_latencyMax) this->_latencyMax = latency;
+
+  this->_mutexWaitTotal += wait;
+  if (wait > this->_mutexWaitMax) this->_mutexWaitMax = wait;
+
+  uint32_t microseconds = latency / this->_ticksPerMicrosecond;
+  uint8_t bucket = (microseconds > 1) ? 31 - __builtin_clz(microseconds) : 0;
+  if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+  this->_histogram[bucket]++;
+
+  uint32_t now = millis();
+  uint32_t elapsed = now - this->_rateWindowStart;
+  if (elapsed >= 1000) {
+    this->_reportRate = static_cast<uint64_t>(this->_reportsSent - this->_rateWindowSent) * 1000 / elapsed;
+    this->_rateWindowStart = now;
+    this->_rateWindowSent = this->_reportsSent;
+  }
+}
+
+
+uint32_t JoystickTelemetry::reportRate(void) const
+{
+  // Every send ends in 'recordUpdate', which closes the window once it is a second long. A window
+  // still open after a second therefore got all its reports in its first second, and one open for
+  // two seconds had a whole second without any.
+  uint32_t elapsed = millis() - this->_rateWindowStart;
+  if (elapsed < 1000) return this->_reportRate;
+  if (elapsed < 2000) return this->_reportsSent - this->_rateWindowSent;
+  return 0;
+}
+
+
+uint8_t JoystickTelemetry::writeReport(uint8_t *report) const
+{
+  uint32_t updates = this->_updateCount;
+
+  report[0] = REPORT_ID;
+  report[1] = VERSION;
+  writeU32(report + 2, this->_reportsSent);
+  writeU32(report + 6, this->_reportsFailed);
+  writeU32(report + 10, this->_reportsDropped);
+  writeU32(report + 14, this->updatesSkipped());
+  writeU32(report + 18, updates);
+  writeU32(report + 22, (updates > 0) ? this->_latencyMin : 0);
+  writeU32(report + 26, (updates > 0) ? static_cast<uint32_t>(this->_latencyTotal / updates) : 0);
+  writeU32(report + 30, this->_latencyMax);
+  writeU32(report + 34, static_cast<uint32_t>(this->_mutexWaitTotal / this->_ticksPerMicrosecond));
+  writeU32(report + 38, this->_mutexWaitMax);
+  writeU16(report + 42, this->reportRate());
+  writeU32(report + 44, ticksPerSecond());
+  for (uint8_t i=0; i < HISTOGRAM_BUCKETS; i++) {
+    writeU16(report + 48 + 2 * i, this->_histogram[i]);
+  }
+  return REPORT_LENGTH;
+}
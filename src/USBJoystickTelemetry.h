@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKTELEMETRY_H
+#define USBJOYSTICKTELEMETRY_H
+
+#include <stdint.h>
+#include "PluggableUSBHID.h"
+#include "mbed_atomic.h"
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#include "cmsis.h"
+#endif
+
+namespace arduino {
+
+/*
+  Counters and timings of the report sending, kept by the first joystick of a device.
+
+  Times are taken from the DWT cycle counter on Cortex-M3/M4/M7 (a single register read) and from
+  'micros' elsewhere. Only the 'update' calls that send something are timed, the skip path only
+  increments a counter.
+
+  The host reads everything as a vendor-defined feature report with report ID 'REPORT_ID'. All fields
+  are little-endian:
+
+    offset  size  field
+         0     1  report ID
+         1     1  format version, 'VERSION'
+         2     4  reports sent
+         6     4  reports failed, blocking send returned false
+        10     4  reports dropped, non-blocking send returned false (endpoint busy)
+        14     4  'update' calls skipped, nothing to send
+        18     4  timed 'update' calls
+        22     4  'update' latency minimum, ticks
+        26     4  'update' latency average, ticks
+        30     4  'update' latency maximum, ticks
+        34     4  time blocked on the send mutex, total, microseconds
+        38     4  time blocked on the send mutex, maximum, ticks
+        42     2  reports sent per second, measured over the last full second, 0 once idle for a second
+        44     4  tick frequency, Hz
+        48    32  'update' latency histogram, 16 x uint16, saturating. Bucket n counts latencies of
+                  [2^n, 2^(n+1)) microseconds, bucket 0 also counts the ones below 1 microsecond.
+*/
+class JoystickTelemetry {
+public:
+  static const uint8_t REPORT_ID = 0xF0;
+  static const uint8_t VERSION = 1;
+  static const uint8_t HISTOGRAM_BUCKETS = 16;
+  static const uint8_t REPORT_LENGTH = 48 + 2 * HISTOGRAM_BUCKETS;   // Including the report ID.
+
+  // Vendor-defined top-level collection with one feature report. Appended to the report descriptor of the device.
+  static const uint8_t DESCRIPTOR[];
+  static const uint8_t DESCRIPTOR_LENGTH = 23;
+
+  JoystickTelemetry(void);
+
+  /*
+    Current time in ticks and the tick frequency.
+  */
+  static inline uint32_t ticks(void) {
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    return DWT->CYCCNT;
+#else
+    return micros();
+#endif
+  }
+  static uint32_t ticksPerSecond(void);
+
+  /*
+    Recording, called by the sending joystick. 'recordSkip' may be called from any thread,
+    the others with the send mutex held.
+  */
+  void recordSkip(void) { core_util_atomic_incr_u32(&this->_updatesSkipped, 1); }
+  void recordSend(bool success, bool blocking);
+  void recordUpdate(uint32_t start, uint32_t locked, uint32_t end);
+
+  /*
+    Forget everything.
+  */
+  void reset(void);
+
+  uint32_t reportsSent(void) const { return this->_reportsSent; }
+  uint32_t reportsFailed(void) const { return this->_reportsFailed; }
+  uint32_t reportsDropped(void) const { return this->_reportsDropped; }
+  uint32_t updatesSkipped(void) const { return core_util_atomic_load_u32(&this->_updatesSkipped); }
+
+  /*
+    Reports sent per second over the last full second, 0 once a full second has gone by without one.
+  */
+  uint32_t reportRate(void) const;
+
+  /*
+    Serialise into the feature report described above. 'report' must have room for REPORT_LENGTH bytes.
+    Only reads, so it can be called from the USB interrupt; the fields are copied one by one and may
+    come from different 'update' calls.
+
+    @returns length of the report.
+  */
+  uint8_t writeReport(uint8_t *report) const;
+
+
+private:
+  uint32_t _reportsSent = 0;
+  uint32_t _reportsFailed = 0;
+  uint32_t _reportsDropped = 0;
+  volatile uint32_t _updatesSkipped = 0;
+
+  uint32_t _updateCount = 0;
+  uint32_t _latencyMin = UINT32_MAX;
+  uint32_t _latencyMax = 0;
+  uint64_t _latencyTotal = 0;
+
+  uint64_t _mutexWaitTotal = 0;
+  uint32_t _mutexWaitMax = 0;
+
+  uint32_t _histogram[ HISTOGRAM_BUCKETS ];
+
+  uint32_t _rateWindowStart = 0;   // 'millis' when the current rate window started.
+  uint32_t _rateWindowSent = 0;    // '_reportsSent' at that time.
+  uint32_t _reportRate = 0;        // Of the window before the current one.
+
+  uint32_t _ticksPerMicrosecond;
+} ;
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKTELEMETRY_H
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "USBJoystickTransport.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <linux/uhid.h>
+#endif
+
+using namespace arduino;
+
+
+JoystickDevice::JoystickDevice(const JoystickLayout &layout, JoystickTransport &transport):
+  JoystickCore(layout),
+  _transport(transport)
+{
+
+}
+
+JoystickDevice::JoystickDevice(const JoystickLayout &layout, JoystickCore *const *joysticks, uint8_t count,
+                               JoystickTransport &transport):
+  JoystickCore(layout),
+  _transport(transport)
+{
+  for (uint8_t i=0; i < count; i++) {
+    this->addJoystick( *joysticks[i] );
+  }
+}
+
+bool JoystickDevice::sendReport(HID_REPORT *report, bool blocking)
+{
+  return this->_transport.sendHidReport(report, blocking);
+}
+
+
+#if defined(__linux__)
+JoystickPipeTransport::JoystickPipeTransport(int output, int input):
+  _output(output),
+  _input(input)
+{
+
+}
+
+bool JoystickPipeTransport::begin(JoystickDevice &device)
+{
+  this->_device = &device;
+  if (this->_input >= 0) fcntl(this->_input, F_SETFL, fcntl(this->_input, F_GETFL) | O_NONBLOCK);   // For 'poll'.
+  return this->_output >= 0;
+}
+
+// Wait until 'fd' takes more data, or only check it with 'timeout' 0.
+static bool waitWritable(int fd, int timeout)
+{
+  struct pollfd writable = { fd, POLLOUT, 0 };
+  int ready;
+  do {
+    ready = ::poll(&writable, 1, timeout);
+  } while (ready < 0 && errno == EINTR);
+  return ready > 0 && (writable.revents & POLLOUT) != 0;
+}
+
+bool JoystickPipeTransport::sendReport(const uint8_t *report, uint8_t length, bool blocking)
+{
+  // A pipe with room for PIPE_BUF bytes signals POLLOUT and takes a frame of at most 256 bytes whole.
+  if (!blocking && !waitWritable(this->_output, 0)) return false;
+
+  struct iovec frame[2] = {
+    { &length, 1 },
+    { const_cast<uint8_t *>(report), length }
+  };
+  struct iovec *rest = frame;
+  int restCount = 2;
+
+  // Once the length byte is out the reader expects the rest, so a frame is never abandoned halfway.
+  while (restCount > 0) {
+    ssize_t written = writev(this->_output, rest, restCount);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitWritable(this->_output, -1)) continue;
+      return false;
+    }
+    while (restCount > 0 && static_cast<size_t>(written) >= rest->iov_len) {
+      written -= rest->iov_len;
+      rest++;
+      restCount--;
+    }
+    if (restCount > 0) {
+      rest->iov_base = static_cast<uint8_t *>(rest->iov_base) + written;
+      rest->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+void JoystickPipeTransport::poll(void)
+{
+  if (this->_input < 0) return;
+
+  while (true) {
+    // The length byte first, then the rest of the frame.
+    uint16_t wanted = (this->_frameFill == 0) ? 1 : 1 + this->_frame[0];
+    ssize_t got = read(this->_input, this->_frame + this->_frameFill, wanted - this->_frameFill);
+    if (got <= 0) return;
+    this->_frameFill += got;
+
+    if (this->_frameFill == 1 && this->_frame[0] == 0) {
+      this->_frameFill = 0;   // Empty frame.
+    }
+    else if (this->_frameFill > 1 && this->_frameFill == 1 + this->_frame[0]) {
+      if (this->_device != nullptr) this->_device->hostReport(this->_frame + 1, this->_frame[0]);
+      this->_frameFill = 0;
+    }
+  }
+}
+
+
+// Header of the UHID_INPUT2 event, the report follows right after it.
+struct __attribute__((packed)) UhidInput {
+  uint32_t type;
+  uint16_t size;
+  uint8_t data[ MAX_HID_REPORT_SIZE ];
+} ;
+
+static bool writeEvent(int fd, const void *event, size_t length)
+{
+  ssize_t written;
+  do {
+    written = write(fd, event, length);
+  } while (written < 0 && errno == EINTR);
+  return written == static_cast<ssize_t>(length);
+}
+
+// Host reports longer than 255 bytes are not ours, 'receiveReport' rejects them by their report ID.
+static uint8_t clampLength(uint16_t length)
+{
+  return (length > 0xFF) ? 0xFF : length;
+}
+
+JoystickUhidTransport::JoystickUhidTransport(const char *name, uint16_t vendorId, uint16_t productId, const char *path):
+  _name(name),
+  _vendorId(vendorId),
+  _productId(productId),
+  _path(path)
+{
+
+}
+
+JoystickUhidTransport::~JoystickUhidTransport(void)
+{
+  if (this->_fd < 0) return;
+
+  struct uhid_event event;
+  memset(&event, 0, sizeof(event));
+  event.type = UHID_DESTROY;
+  writeEvent(this->_fd, &event, sizeof(event));
+  close(this->_fd);
+}
+
+bool JoystickUhidTransport::begin(JoystickDevice &device)
+{
+  if (this->_fd >= 0) return false;
+
+  this->_fd = open(this->_path, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+  if (this->_fd < 0) return false;
+  this->_device = &device;
+
+  struct uhid_event event;
+  memset(&event, 0, sizeof(event));
+  event.type = UHID_CREATE2;
+  strncpy(reinterpret_cast<char *>(event.u.create2.name), this->_name, sizeof(event.u.create2.name) - 1);
+  event.u.create2.rd_size = device.reportDescriptor(event.u.create2.rd_data, sizeof(event.u.create2.rd_data));
+  event.u.create2.bus = BUS_USB;
+  event.u.create2.vendor = this->_vendorId;
+  event.u.create2.product = this->_productId;
+
+  if (event.u.create2.rd_size == 0 || !writeEvent(this->_fd, &event, sizeof(event))) {
+    close(this->_fd);
+    this->_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+bool JoystickUhidTransport::sendReport(const uint8_t *report, uint8_t length, bool /* blocking */)
+{
+  // The kernel queues the event at once or fails it, there is nothing to wait for.
+  if (this->_fd < 0 || length > MAX_HID_REPORT_SIZE) return false;
+
+  // The kernel fills the rest of a short event with zeros.
+  UhidInput event;
+  event.type = UHID_INPUT2;
+  event.size = length;
+  memcpy(event.data, report, length);
+  return writeEvent(this->_fd, &event, offsetof(UhidInput, data) + length);
+}
+
+void JoystickUhidTransport::poll(void)
+{
+  if (this->_fd < 0) return;
+
+  struct uhid_event event;
+  while (read(this->_fd, &event, sizeof(event)) > 0) {
+    switch (event.type) {
+      case UHID_START:
+      case UHID_OPEN:
+        this->_started = true;
+        break;
+
+      case UHID_STOP:
+        this->_started = false;
+        break;
+
+      case UHID_OUTPUT:
+        this->_device->hostReport(event.u.output.data, clampLength(event.u.output.size));
+        break;
+
+      case UHID_SET_REPORT: {
+        bool taken = this->_device->hostReport(event.u.set_report.data, clampLength(event.u.set_report.size));
+        uint32_t id = event.u.set_report.id;
+        memset(&event, 0, sizeof(event));
+        event.type = UHID_SET_REPORT_REPLY;
+        event.u.set_report_reply.id = id;
+        event.u.set_report_reply.err = taken ? 0 : EIO;
+        writeEvent(this->_fd, &event, sizeof(event));
+        break;
+      }
+
+      case UHID_GET_REPORT: {
+        uint32_t id = event.u.get_report.id;
+        uint8_t reportId = event.u.get_report.rnum;
+        bool feature = (event.u.get_report.rtype == UHID_FEATURE_REPORT);
+        memset(&event, 0, sizeof(event));
+        event.type = UHID_GET_REPORT_REPLY;
+        event.u.get_report_reply.id = id;
+        uint8_t length = feature ? this->_device->featureReport(reportId, event.u.get_report_reply.data) : 0;
+        event.u.get_report_reply.size = length;
+        event.u.get_report_reply.err = (length > 0) ? 0 : EIO;
+        writeEvent(this->_fd, &event, sizeof(event));
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+}
+#endif
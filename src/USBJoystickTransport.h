@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2022, Jaakko Koivisto.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef USBJOYSTICKTRANSPORT_H
+#define USBJOYSTICKTRANSPORT_H
+
+#include <stdint.h>
+#include "USBJoystickCore.h"
+
+namespace arduino {
+
+class JoystickDevice;
+
+/*
+  Link that carries the reports of a 'JoystickDevice' to the host.
+
+  'sendReport' gets the report as the joystick built it, report ID first, and must be done with the
+  buffer when it returns; nothing is copied on the way from the joystick to the transport. Output and
+  feature reports from the host go back with 'JoystickDevice::hostReport' and 'featureReport'.
+
+  'JoystickUSBTransport' is the USB backend, 'USBJoystick' pairs it with the joystick state.
+*/
+class JoystickTransport {
+public:
+  virtual ~JoystickTransport(void) { }
+
+  /*
+    Called by 'JoystickDevice::begin' once the joysticks are attached, the report descriptor is final then.
+
+    @returns false if the link could not be opened.
+  */
+  virtual bool begin(JoystickDevice & /* device */) { return true; }
+
+  /*
+    Send one input report of 'length' bytes. With 'blocking' wait until the link takes it, otherwise
+    fail if it is busy.
+
+    @returns true if the report was sent or queued.
+  */
+  virtual bool sendReport(const uint8_t *report, uint8_t length, bool blocking) = 0;
+
+  /*
+    'sendReport' for the 'HID_REPORT' the joystick builds the report in. The default passes its data to
+    'sendReport', a link sending 'HID_REPORT's overrides this to skip the copy.
+  */
+  virtual bool sendHidReport(HID_REPORT *report, bool blocking) { return this->sendReport(report->data, report->length, blocking); }
+
+  /*
+    True when the host is listening.
+  */
+  virtual bool ready(void) const { return true; }
+} ;
+
+
+/*
+  Joysticks sending through a 'JoystickTransport'. Same setters, filters, events and telemetry as
+  'USBJoystick', and 'update' or 'autoSend' send the reports, for example
+
+    JoystickPipeTransport pipe( STDOUT_FILENO );
+    JoystickDevice joystick( USBJoystickLayout<>::layout, pipe );
+    joystick.begin();
+*/
+class JoystickDevice : public JoystickCore {
+public:
+  static const uint8_t FEATURE_REPORT_LENGTH = FEATURE_REPORT_MAX_LENGTH;   // Buffer size of 'featureReport'.
+
+  /*
+    'joysticks' are 'count' more logical joysticks attached with 'addJoystick', see 'JoystickCore'.
+  */
+  JoystickDevice(const JoystickLayout &layout, JoystickTransport &transport);
+  JoystickDevice(const JoystickLayout &layout, JoystickCore *const *joysticks, uint8_t count,
+                 JoystickTransport &transport);
+
+  /*
+    Open the transport. Attach all the joysticks first.
+  */
+  bool begin(void) { return this->_transport.begin(*this); }
+
+  bool ready(void) const { return this->_transport.ready(); }
+
+  JoystickTransport &transport(void) const { return this->_transport; }
+
+  /*
+    For the transports: the report descriptor of the device, an output or feature report written by
+    the host, and the answer to a feature report request.
+  */
+  uint16_t reportDescriptor(uint8_t *buffer, uint16_t size) const { return this->writeReportDescriptor(buffer, size); }
+  bool hostReport(const uint8_t *report, uint8_t length) { return this->receiveReport(report, length); }
+  uint8_t featureReport(uint8_t reportId, uint8_t *report) const { return this->writeFeatureReport(reportId, report); }
+
+  /*
+    For the transports: the link finished the previous report and takes the next one. May be called
+    from an ISR. The default does nothing, 'USBJoystick' wakes up its report pump.
+  */
+  virtual void transportReady(void) { }
+
+
+protected:
+  virtual bool sendReport(HID_REPORT *report, bool blocking);
+
+
+private:
+  JoystickTransport &_transport;
+} ;
+
+
+#if defined(__linux__)
+/*
+  Reports as frames on file descriptors: a length byte followed by the report. Works with pipes,
+  sockets and FIFOs, for running the joysticks on a Linux host and measuring them end to end.
+
+  Each report goes out with 'writev' from the joystick's buffer. A frame is always written whole: a
+  non-blocking send fails if 'output' has no room for it, otherwise the send waits for the reader and
+  finishes the frame even if the descriptor is O_NONBLOCK or the write is cut short. Frames read from
+  'input' by 'poll' go to the device as host reports.
+*/
+class JoystickPipeTransport : public JoystickTransport {
+public:
+  JoystickPipeTransport(int output, int input = -1);
+
+  virtual bool begin(JoystickDevice &device);
+  virtual bool sendReport(const uint8_t *report, uint8_t length, bool blocking);
+
+  /*
+    Read the frames waiting on 'input'. Call from the loop or when the descriptor is readable.
+  */
+  void poll(void);
+
+
+private:
+  int _output;
+  int _input;
+  JoystickDevice *_device = nullptr;
+
+  uint8_t _frame[ 1 + 255 ];    // Frame being read.
+  uint16_t _frameFill = 0;
+} ;
+
+
+/*
+  Virtual HID device of the Linux kernel through '/dev/uhid', so the joysticks show up to the
+  applications of the host like a USB joystick (needs write access to '/dev/uhid').
+
+  The kernel takes one event per 'write', so each report is copied once into the event header.
+  'poll' answers the kernel: output and feature reports written by applications, feature report
+  requests, and the start and stop of the device.
+*/
+class JoystickUhidTransport : public JoystickTransport {
+public:
+  JoystickUhidTransport(const char *name = "USBJoystick", uint16_t vendorId = 0x1235, uint16_t productId = 0x0050,
+                        const char *path = "/dev/uhid");
+  virtual ~JoystickUhidTransport(void);
+
+  virtual bool begin(JoystickDevice &device);
+  virtual bool sendReport(const uint8_t *report, uint8_t length, bool blocking);
+  virtual bool ready(void) const { return this->_started; }
+
+  /*
+    Handle the events from the kernel. Call from the loop or when 'fd' is readable.
+  */
+  void poll(void);
+
+  int fd(void) const { return this->_fd; }
+
+
+private:
+  const char *_name;
+  uint16_t _vendorId;
+  uint16_t _productId;
+  const char *_path;
+
+  int _fd = -1;
+  bool _started = false;
+  JoystickDevice *_device = nullptr;
+} ;
+#endif
+
+
+} // End of 'namespace arduino'.
+
+
+#endif // USBJOYSTICKTRANSPORT_H